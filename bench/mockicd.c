@@ -0,0 +1,1143 @@
+/* Mock OpenCL platform, for benchmarking clinfo itself (make bench):
+ * an ICD that is found through the ICD loader like any real one, exposing
+ * a configurable number of platforms and devices, each of which can be
+ * partitioned into any number of sub-devices, and answering each query
+ * after a configurable latency.
+ *
+ * The configuration is taken from the environment:
+ *   MOCKICD_PLATFORMS    number of platforms (default 1)
+ *   MOCKICD_DEVICES      number of devices per platform (default 2)
+ *   MOCKICD_SUB_DEVICES  number of sub-devices obtained when partitioning
+ *                        each device by affinity domain (default 0, no partitioning)
+ *   MOCKICD_LATENCY_US   time taken by each query, in microseconds (default 0)
+ *
+ * Only the entry points used by clinfo are implemented, with just enough
+ * behavior for its queries, probes and benchmarks to succeed: buffers live
+ * in host memory, and commands complete as soon as they are enqueued, with
+ * event timestamps simulating their execution on the device. All the other
+ * entries of the dispatch table return CL_INVALID_OPERATION.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/* the same headers and extension defines as clinfo itself */
+#include "../src/ext.h"
+
+/* The ICD dispatch table: the first member of each object points to it,
+ * and the loader forwards each call through the entry at the same index
+ * as in struct _cl_icd_dispatch (see CL/cl_icd.h) */
+typedef void (*mock_fn)(void);
+
+enum dispatch_index {
+	DISPATCH_GET_PLATFORM_IDS = 0,
+	DISPATCH_GET_PLATFORM_INFO = 1,
+	DISPATCH_GET_DEVICE_IDS = 2,
+	DISPATCH_GET_DEVICE_INFO = 3,
+	DISPATCH_CREATE_CONTEXT = 4,
+	DISPATCH_CREATE_CONTEXT_FROM_TYPE = 5,
+	DISPATCH_RETAIN_CONTEXT = 6,
+	DISPATCH_RELEASE_CONTEXT = 7,
+	DISPATCH_GET_CONTEXT_INFO = 8,
+	DISPATCH_CREATE_COMMAND_QUEUE = 9,
+	DISPATCH_RETAIN_COMMAND_QUEUE = 10,
+	DISPATCH_RELEASE_COMMAND_QUEUE = 11,
+	DISPATCH_CREATE_BUFFER = 14,
+	DISPATCH_RETAIN_MEM_OBJECT = 17,
+	DISPATCH_RELEASE_MEM_OBJECT = 18,
+	DISPATCH_CREATE_PROGRAM_WITH_SOURCE = 26,
+	DISPATCH_CREATE_PROGRAM_WITH_BINARY = 27,
+	DISPATCH_RETAIN_PROGRAM = 28,
+	DISPATCH_RELEASE_PROGRAM = 29,
+	DISPATCH_BUILD_PROGRAM = 30,
+	DISPATCH_GET_PROGRAM_INFO = 32,
+	DISPATCH_GET_PROGRAM_BUILD_INFO = 33,
+	DISPATCH_CREATE_KERNEL = 34,
+	DISPATCH_RETAIN_KERNEL = 36,
+	DISPATCH_RELEASE_KERNEL = 37,
+	DISPATCH_SET_KERNEL_ARG = 38,
+	DISPATCH_GET_KERNEL_WORK_GROUP_INFO = 40,
+	DISPATCH_WAIT_FOR_EVENTS = 41,
+	DISPATCH_RETAIN_EVENT = 43,
+	DISPATCH_RELEASE_EVENT = 44,
+	DISPATCH_GET_EVENT_PROFILING_INFO = 45,
+	DISPATCH_FLUSH = 46,
+	DISPATCH_FINISH = 47,
+	DISPATCH_ENQUEUE_READ_BUFFER = 48,
+	DISPATCH_ENQUEUE_WRITE_BUFFER = 49,
+	DISPATCH_ENQUEUE_MAP_BUFFER = 56,
+	DISPATCH_ENQUEUE_UNMAP_MEM_OBJECT = 58,
+	DISPATCH_ENQUEUE_NDRANGE_KERNEL = 59,
+	DISPATCH_GET_EXTENSION_FUNCTION_ADDRESS = 65,
+	DISPATCH_CREATE_SUB_DEVICES = 93,
+	DISPATCH_RETAIN_DEVICE = 94,
+	DISPATCH_RELEASE_DEVICE = 95,
+	DISPATCH_COMPILE_PROGRAM = 98,
+	DISPATCH_LINK_PROGRAM = 99,
+	DISPATCH_GET_EXTENSION_FUNCTION_ADDRESS_FOR_PLATFORM = 107,
+	DISPATCH_SIZE = 192
+};
+
+static mock_fn dispatch[DISPATCH_SIZE];
+
+enum obj_kind {
+	OBJ_PLATFORM,
+	OBJ_DEVICE,
+	OBJ_CONTEXT,
+	OBJ_QUEUE,
+	OBJ_PROGRAM,
+	OBJ_KERNEL,
+	OBJ_MEM,
+	OBJ_EVENT
+};
+
+struct obj {
+	const mock_fn *dispatch;
+	enum obj_kind kind;
+	cl_uint p; /* platform index */
+	cl_uint d; /* device index in the platform */
+	cl_uint s; /* sub-device index, if parent is not NULL */
+	struct obj *parent;
+	/* devices of a context */
+	cl_device_id *devs;
+	cl_uint ndevs;
+	/* contents of a buffer */
+	unsigned char *mem;
+	size_t mem_sz;
+	/* CL_PROFILING_COMMAND_{QUEUED,SUBMIT,START,END} of an event */
+	cl_ulong profiling[4];
+};
+
+static cl_uint num_platforms = 1, num_devices = 2, num_sub_devices = 0;
+static long latency_us = 0;
+
+static struct obj *platforms;
+static struct obj *devices; /* num_devices per platform */
+static struct obj *sub_devices; /* num_sub_devices per device */
+
+static const char device_extensions[] =
+	"cl_khr_icd cl_khr_fp64 cl_khr_fp16 cl_khr_byte_addressable_store "
+	"cl_khr_global_int32_base_atomics cl_khr_global_int32_extended_atomics "
+	"cl_khr_local_int32_base_atomics cl_khr_local_int32_extended_atomics "
+	"cl_khr_int64_base_atomics cl_khr_int64_extended_atomics "
+	"cl_khr_3d_image_writes cl_khr_subgroups cl_khr_create_command_queue";
+
+static void wait_latency(void)
+{
+	struct timespec ts;
+	if (!latency_us)
+		return;
+	ts.tv_sec = latency_us/1000000;
+	ts.tv_nsec = (latency_us % 1000000)*1000;
+	nanosleep(&ts, NULL);
+}
+
+static cl_uint env_uint(const char *name, cl_uint def)
+{
+	const char *val = getenv(name);
+	return val && *val ? (cl_uint)strtoul(val, NULL, 0) : def;
+}
+
+static struct obj *new_obj(enum obj_kind kind)
+{
+	struct obj *o = calloc(1, sizeof(*o));
+	if (o) {
+		o->dispatch = dispatch;
+		o->kind = kind;
+	}
+	return o;
+}
+
+static cl_int release_obj(struct obj *o)
+{
+	if (o) {
+		free(o->devs);
+		free(o->mem);
+		free(o);
+	}
+	return CL_SUCCESS;
+}
+
+/* Store a property value of len bytes, following the clGet*Info conventions */
+static cl_int ret_value(const void *data, size_t len, size_t sz, void *val, size_t *ret_sz)
+{
+	if (ret_sz)
+		*ret_sz = len;
+	if (val) {
+		if (sz < len)
+			return CL_INVALID_VALUE;
+		memcpy(val, data, len);
+	}
+	return CL_SUCCESS;
+}
+
+#define RET_VALUE(data, len) return ret_value(data, len, sz, val, ret_sz)
+#define RET_STRING(str) RET_VALUE(str, strlen(str) + 1)
+#define RET_TYPED(type, v) do { \
+	const type _v = (v); \
+	RET_VALUE(&_v, sizeof(_v)); \
+} while (0)
+
+/* Platforms */
+
+static cl_int CL_API_CALL
+mock_GetPlatformIDs(cl_uint num_entries, cl_platform_id *plat, cl_uint *num_plat)
+{
+	cl_uint i;
+	if (!plat && !num_plat)
+		return CL_INVALID_VALUE;
+	if (num_plat)
+		*num_plat = num_platforms;
+	for (i = 0; plat && i < num_entries && i < num_platforms; ++i)
+		plat[i] = (cl_platform_id)(platforms + i);
+	return CL_SUCCESS;
+}
+
+static cl_int CL_API_CALL
+mock_GetPlatformInfo(cl_platform_id plat, cl_platform_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	const struct obj *o = (const struct obj *)plat;
+	char buf[64];
+
+	wait_latency();
+	if (!o)
+		o = platforms;
+
+	switch (param) {
+	case CL_PLATFORM_PROFILE:
+		RET_STRING("FULL_PROFILE");
+	case CL_PLATFORM_VERSION:
+		RET_STRING("OpenCL 1.2 mockicd");
+	case CL_PLATFORM_NAME:
+		snprintf(buf, sizeof(buf), "Mock Platform %u", o->p);
+		RET_STRING(buf);
+	case CL_PLATFORM_VENDOR:
+		RET_STRING("clinfo");
+	case CL_PLATFORM_EXTENSIONS:
+		RET_STRING("cl_khr_icd");
+	case CL_PLATFORM_ICD_SUFFIX_KHR:
+		snprintf(buf, sizeof(buf), "MOCK%u", o->p);
+		RET_STRING(buf);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+/* Devices */
+
+static cl_device_type device_type(const struct obj *dev)
+{
+	return (dev->d % 2) ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU;
+}
+
+static cl_uint device_compute_units(const struct obj *dev)
+{
+	if (dev->parent)
+		return 1;
+	return num_sub_devices ? num_sub_devices : 8;
+}
+
+static cl_int CL_API_CALL
+mock_GetDeviceIDs(cl_platform_id plat, cl_device_type type, cl_uint num_entries,
+	cl_device_id *dev, cl_uint *num_dev)
+{
+	const struct obj *o = (const struct obj *)plat;
+	cl_uint i, n = 0;
+
+	wait_latency();
+	if (!o)
+		o = platforms;
+	if (!dev && !num_dev)
+		return CL_INVALID_VALUE;
+
+	for (i = 0; i < num_devices; ++i) {
+		struct obj *d = devices + o->p*num_devices + i;
+		if (type == CL_DEVICE_TYPE_DEFAULT ? i > 0 : !(type & device_type(d)))
+			continue;
+		if (dev && n < num_entries)
+			dev[n] = (cl_device_id)d;
+		++n;
+	}
+	if (num_dev)
+		*num_dev = n;
+	return n ? CL_SUCCESS : CL_DEVICE_NOT_FOUND;
+}
+
+static cl_int CL_API_CALL
+mock_GetDeviceInfo(cl_device_id device, cl_device_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	const struct obj *o = (const struct obj *)device;
+	char buf[64];
+
+	wait_latency();
+
+	switch (param) {
+	case CL_DEVICE_NAME:
+		if (o->parent)
+			snprintf(buf, sizeof(buf), "Mock Device %u.%u.%u", o->p, o->d, o->s);
+		else
+			snprintf(buf, sizeof(buf), "Mock Device %u.%u", o->p, o->d);
+		RET_STRING(buf);
+	case CL_DEVICE_VENDOR:
+		RET_STRING("clinfo");
+	case CL_DRIVER_VERSION:
+		RET_STRING("1.0");
+	case CL_DEVICE_PROFILE:
+		RET_STRING("FULL_PROFILE");
+	case CL_DEVICE_VERSION:
+		RET_STRING("OpenCL 1.2 mockicd");
+	case CL_DEVICE_OPENCL_C_VERSION:
+		RET_STRING("OpenCL C 1.2 mockicd");
+	case CL_DEVICE_EXTENSIONS:
+		RET_STRING(device_extensions);
+	case CL_DEVICE_BUILT_IN_KERNELS:
+		RET_STRING("");
+	case CL_DEVICE_TYPE:
+		RET_TYPED(cl_device_type, device_type(o));
+	case CL_DEVICE_PLATFORM:
+		RET_TYPED(cl_platform_id, (cl_platform_id)(platforms + o->p));
+	case CL_DEVICE_VENDOR_ID:
+		RET_TYPED(cl_uint, 0xc11f0);
+	case CL_DEVICE_MAX_COMPUTE_UNITS:
+		RET_TYPED(cl_uint, device_compute_units(o));
+	case CL_DEVICE_MAX_CLOCK_FREQUENCY:
+		RET_TYPED(cl_uint, 1000);
+	case CL_DEVICE_ADDRESS_BITS:
+		RET_TYPED(cl_uint, 64);
+	case CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS:
+		RET_TYPED(cl_uint, 3);
+	case CL_DEVICE_MAX_WORK_ITEM_SIZES: {
+		const size_t wis[3] = { 256, 256, 64 };
+		RET_VALUE(wis, sizeof(wis));
+	}
+	case CL_DEVICE_MAX_WORK_GROUP_SIZE:
+		RET_TYPED(size_t, 256);
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_CHAR:
+		RET_TYPED(cl_uint, 4);
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_SHORT:
+		RET_TYPED(cl_uint, 2);
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_INT:
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_LONG:
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT:
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE:
+	case CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF:
+	case CL_DEVICE_NATIVE_VECTOR_WIDTH_HALF:
+		RET_TYPED(cl_uint, 1);
+	case CL_DEVICE_SINGLE_FP_CONFIG:
+	case CL_DEVICE_DOUBLE_FP_CONFIG:
+	case CL_DEVICE_HALF_FP_CONFIG:
+		RET_TYPED(cl_device_fp_config,
+			CL_FP_DENORM | CL_FP_INF_NAN | CL_FP_ROUND_TO_NEAREST | CL_FP_FMA);
+	case CL_DEVICE_ENDIAN_LITTLE:
+	case CL_DEVICE_AVAILABLE:
+	case CL_DEVICE_COMPILER_AVAILABLE:
+	case CL_DEVICE_LINKER_AVAILABLE:
+	case CL_DEVICE_PREFERRED_INTEROP_USER_SYNC:
+		RET_TYPED(cl_bool, CL_TRUE);
+	case CL_DEVICE_IMAGE_SUPPORT:
+	case CL_DEVICE_ERROR_CORRECTION_SUPPORT:
+		RET_TYPED(cl_bool, CL_FALSE);
+	case CL_DEVICE_HOST_UNIFIED_MEMORY:
+		RET_TYPED(cl_bool, device_type(o) == CL_DEVICE_TYPE_CPU);
+	case CL_DEVICE_GLOBAL_MEM_SIZE:
+		RET_TYPED(cl_ulong, (cl_ulong)256 << 20);
+	case CL_DEVICE_MAX_MEM_ALLOC_SIZE:
+		RET_TYPED(cl_ulong, (cl_ulong)64 << 20);
+	case CL_DEVICE_GLOBAL_MEM_CACHE_TYPE:
+		RET_TYPED(cl_device_mem_cache_type, CL_READ_WRITE_CACHE);
+	case CL_DEVICE_GLOBAL_MEM_CACHE_SIZE:
+		RET_TYPED(cl_ulong, 1 << 20);
+	case CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE:
+		RET_TYPED(cl_uint, 64);
+	case CL_DEVICE_LOCAL_MEM_TYPE:
+		RET_TYPED(cl_device_local_mem_type, CL_LOCAL);
+	case CL_DEVICE_LOCAL_MEM_SIZE:
+	case CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE:
+		RET_TYPED(cl_ulong, 65536);
+	case CL_DEVICE_MAX_CONSTANT_ARGS:
+		RET_TYPED(cl_uint, 8);
+	case CL_DEVICE_MEM_BASE_ADDR_ALIGN:
+		RET_TYPED(cl_uint, 1024);
+	case CL_DEVICE_MIN_DATA_TYPE_ALIGN_SIZE:
+		RET_TYPED(cl_uint, 128);
+	case CL_DEVICE_MAX_PARAMETER_SIZE:
+		RET_TYPED(size_t, 1024);
+	case CL_DEVICE_PRINTF_BUFFER_SIZE:
+		RET_TYPED(size_t, 1 << 20);
+	case CL_DEVICE_PROFILING_TIMER_RESOLUTION:
+		RET_TYPED(size_t, 1);
+	case CL_DEVICE_EXECUTION_CAPABILITIES:
+		RET_TYPED(cl_device_exec_capabilities, CL_EXEC_KERNEL);
+	case CL_DEVICE_QUEUE_PROPERTIES:
+		RET_TYPED(cl_command_queue_properties,
+			CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE);
+	case CL_DEVICE_REFERENCE_COUNT:
+		RET_TYPED(cl_uint, 1);
+	case CL_DEVICE_PARENT_DEVICE:
+		RET_TYPED(cl_device_id, (cl_device_id)o->parent);
+	case CL_DEVICE_PARTITION_MAX_SUB_DEVICES:
+		RET_TYPED(cl_uint, o->parent ? 0 : num_sub_devices);
+	case CL_DEVICE_PARTITION_PROPERTIES: {
+		/* a single 0 if the device can't be partitioned */
+		const cl_device_partition_property props[] = {
+			CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, 0
+		};
+		RET_VALUE(props + (o->parent || !num_sub_devices), sizeof(*props));
+	}
+	case CL_DEVICE_PARTITION_AFFINITY_DOMAIN:
+		RET_TYPED(cl_device_affinity_domain,
+			o->parent || !num_sub_devices ? 0 : CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+	case CL_DEVICE_PARTITION_TYPE: {
+		const cl_device_partition_property props[] = {
+			CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0
+		};
+		if (!o->parent)
+			RET_VALUE(props, 0);
+		RET_VALUE(props, sizeof(props));
+	}
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+static cl_int CL_API_CALL
+mock_CreateSubDevices(cl_device_id device, const cl_device_partition_property *props,
+	cl_uint num_entries, cl_device_id *out, cl_uint *num_out)
+{
+	const struct obj *o = (const struct obj *)device;
+	const struct obj *sub;
+	cl_uint i;
+
+	wait_latency();
+	if (o->parent || !num_sub_devices || !props ||
+		props[0] != CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN)
+		return CL_INVALID_VALUE;
+	if (props[1] != CL_DEVICE_AFFINITY_DOMAIN_NUMA &&
+		props[1] != CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE)
+		return CL_INVALID_VALUE;
+	if (out && num_entries < num_sub_devices)
+		return CL_INVALID_VALUE;
+
+	sub = sub_devices + (o->p*num_devices + o->d)*num_sub_devices;
+	for (i = 0; out && i < num_sub_devices; ++i)
+		out[i] = (cl_device_id)(sub + i);
+	if (num_out)
+		*num_out = num_sub_devices;
+	return CL_SUCCESS;
+}
+
+/* The devices are never actually released */
+static cl_int CL_API_CALL
+mock_RetainDevice(cl_device_id device)
+{
+	(void)device;
+	return CL_SUCCESS;
+}
+
+/* Contexts */
+
+static cl_context CL_API_CALL
+mock_CreateContext(const cl_context_properties *props, cl_uint ndevs, const cl_device_id *devs,
+	void (CL_CALLBACK *notify)(const char *, const void *, size_t, void *),
+	void *user_data, cl_int *err)
+{
+	struct obj *ctx = NULL;
+	cl_int ret = CL_SUCCESS;
+
+	(void)props;
+	(void)notify;
+	(void)user_data;
+	wait_latency();
+
+	if (!ndevs || !devs)
+		ret = CL_INVALID_VALUE;
+	if (!ret) {
+		ctx = new_obj(OBJ_CONTEXT);
+		if (ctx)
+			ctx->devs = malloc(ndevs*sizeof(*devs));
+		if (!ctx || !ctx->devs) {
+			release_obj(ctx);
+			ctx = NULL;
+			ret = CL_OUT_OF_HOST_MEMORY;
+		}
+	}
+	if (!ret) {
+		memcpy(ctx->devs, devs, ndevs*sizeof(*devs));
+		ctx->ndevs = ndevs;
+	}
+	if (err)
+		*err = ret;
+	return (cl_context)ctx;
+}
+
+static cl_context CL_API_CALL
+mock_CreateContextFromType(const cl_context_properties *props, cl_device_type type,
+	void (CL_CALLBACK *notify)(const char *, const void *, size_t, void *),
+	void *user_data, cl_int *err)
+{
+	cl_platform_id plat = NULL;
+	cl_device_id *devs = NULL;
+	cl_context ctx = NULL;
+	cl_uint ndevs = 0;
+	cl_int ret;
+
+	for (; props && *props; props += 2)
+		if (*props == CL_CONTEXT_PLATFORM)
+			plat = (cl_platform_id)props[1];
+	if (!plat) {
+		if (err)
+			*err = CL_INVALID_PLATFORM;
+		return NULL;
+	}
+
+	ret = mock_GetDeviceIDs(plat, type, 0, NULL, &ndevs);
+	if (!ret) {
+		devs = malloc(ndevs*sizeof(*devs));
+		ret = devs ? mock_GetDeviceIDs(plat, type, ndevs, devs, NULL) : CL_OUT_OF_HOST_MEMORY;
+	}
+	if (!ret)
+		ctx = mock_CreateContext(NULL, ndevs, devs, notify, user_data, &ret);
+	free(devs);
+	if (err)
+		*err = ret;
+	return ctx;
+}
+
+static cl_int CL_API_CALL
+mock_RetainObj(void *o)
+{
+	(void)o;
+	return CL_SUCCESS;
+}
+
+static cl_int CL_API_CALL
+mock_ReleaseObj(void *o)
+{
+	return release_obj(o);
+}
+
+static cl_int CL_API_CALL
+mock_GetContextInfo(cl_context context, cl_context_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	const struct obj *o = (const struct obj *)context;
+
+	wait_latency();
+	switch (param) {
+	case CL_CONTEXT_NUM_DEVICES:
+		RET_TYPED(cl_uint, o->ndevs);
+	case CL_CONTEXT_DEVICES:
+		RET_VALUE(o->devs, o->ndevs*sizeof(*o->devs));
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+/* Command queues, programs and kernels: even though nothing is ever executed,
+ * clinfo needs them for some of its checks and probes */
+
+static cl_command_queue CL_API_CALL
+mock_CreateCommandQueue(cl_context context, cl_device_id device,
+	cl_command_queue_properties props, cl_int *err)
+{
+	struct obj *q;
+
+	(void)context;
+	(void)device;
+	(void)props;
+	wait_latency();
+	q = new_obj(OBJ_QUEUE);
+	if (err)
+		*err = q ? CL_SUCCESS : CL_OUT_OF_HOST_MEMORY;
+	return (cl_command_queue)q;
+}
+
+static cl_program CL_API_CALL
+mock_CreateProgramWithSource(cl_context context, cl_uint count, const char **strings,
+	const size_t *lengths, cl_int *err)
+{
+	struct obj *prg;
+
+	(void)context;
+	(void)count;
+	(void)strings;
+	(void)lengths;
+	wait_latency();
+	prg = new_obj(OBJ_PROGRAM);
+	if (err)
+		*err = prg ? CL_SUCCESS : CL_OUT_OF_HOST_MEMORY;
+	return (cl_program)prg;
+}
+
+/* The binary of every program, for every device (see mock_GetProgramInfo) */
+static const unsigned char program_binary[] = "mockicd program binary";
+
+/* Only the binaries produced by this platform are accepted */
+static cl_program CL_API_CALL
+mock_CreateProgramWithBinary(cl_context context, cl_uint ndevs, const cl_device_id *devs,
+	const size_t *lengths, const unsigned char **binaries, cl_int *status, cl_int *err)
+{
+	struct obj *prg = NULL;
+	cl_int ret = CL_SUCCESS;
+	cl_uint i;
+
+	(void)context;
+	wait_latency();
+	if (!ndevs || !devs || !lengths || !binaries)
+		ret = CL_INVALID_VALUE;
+	for (i = 0; !ret && i < ndevs; ++i) {
+		const cl_bool valid = binaries[i] && lengths[i] == sizeof(program_binary) &&
+			!memcmp(binaries[i], program_binary, sizeof(program_binary));
+		if (status)
+			status[i] = valid ? CL_SUCCESS : CL_INVALID_BINARY;
+		if (!valid)
+			ret = CL_INVALID_BINARY;
+	}
+	if (!ret) {
+		prg = new_obj(OBJ_PROGRAM);
+		if (!prg)
+			ret = CL_OUT_OF_HOST_MEMORY;
+	}
+	if (err)
+		*err = ret;
+	return (cl_program)prg;
+}
+
+static cl_int CL_API_CALL
+mock_BuildProgram(cl_program program, cl_uint ndevs, const cl_device_id *devs,
+	const char *options, void (CL_CALLBACK *notify)(cl_program, void *), void *user_data)
+{
+	(void)program;
+	(void)ndevs;
+	(void)devs;
+	(void)options;
+	(void)notify;
+	(void)user_data;
+	wait_latency();
+	return CL_SUCCESS;
+}
+
+static cl_int CL_API_CALL
+mock_CompileProgram(cl_program program, cl_uint ndevs, const cl_device_id *devs,
+	const char *options, cl_uint num_headers, const cl_program *headers, const char **header_names,
+	void (CL_CALLBACK *notify)(cl_program, void *), void *user_data)
+{
+	(void)num_headers;
+	(void)headers;
+	(void)header_names;
+	return mock_BuildProgram(program, ndevs, devs, options, notify, user_data);
+}
+
+static cl_program CL_API_CALL
+mock_LinkProgram(cl_context context, cl_uint ndevs, const cl_device_id *devs,
+	const char *options, cl_uint num_programs, const cl_program *programs,
+	void (CL_CALLBACK *notify)(cl_program, void *), void *user_data, cl_int *err)
+{
+	struct obj *prg = NULL;
+	cl_int ret = CL_SUCCESS;
+
+	(void)context;
+	(void)ndevs;
+	(void)devs;
+	(void)options;
+	(void)notify;
+	(void)user_data;
+	wait_latency();
+	if (!num_programs || !programs)
+		ret = CL_INVALID_VALUE;
+	if (!ret) {
+		prg = new_obj(OBJ_PROGRAM);
+		if (!prg)
+			ret = CL_OUT_OF_HOST_MEMORY;
+	}
+	if (err)
+		*err = ret;
+	return (cl_program)prg;
+}
+
+static cl_int CL_API_CALL
+mock_GetProgramInfo(cl_program program, cl_program_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	size_t i;
+
+	(void)program;
+	wait_latency();
+	switch (param) {
+	case CL_PROGRAM_BINARY_SIZES:
+		/* the same binary for each of the sz/sizeof(size_t) devices */
+		for (i = 0; val && i < sz/sizeof(size_t); ++i)
+			((size_t *)val)[i] = sizeof(program_binary);
+		if (ret_sz)
+			*ret_sz = sz;
+		return CL_SUCCESS;
+	case CL_PROGRAM_BINARIES:
+		/* the caller allocates the binaries, and can skip devices by passing NULL */
+		for (i = 0; val && i < sz/sizeof(unsigned char *); ++i) {
+			unsigned char *bin = ((unsigned char **)val)[i];
+			if (bin)
+				memcpy(bin, program_binary, sizeof(program_binary));
+		}
+		if (ret_sz)
+			*ret_sz = sz;
+		return CL_SUCCESS;
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+static cl_int CL_API_CALL
+mock_GetProgramBuildInfo(cl_program program, cl_device_id device, cl_program_build_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	(void)program;
+	(void)device;
+	switch (param) {
+	case CL_PROGRAM_BUILD_STATUS:
+		RET_TYPED(cl_build_status, CL_BUILD_SUCCESS);
+	case CL_PROGRAM_BUILD_LOG:
+	case CL_PROGRAM_BUILD_OPTIONS:
+		RET_STRING("");
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+static cl_kernel CL_API_CALL
+mock_CreateKernel(cl_program program, const char *name, cl_int *err)
+{
+	struct obj *krn;
+
+	(void)program;
+	(void)name;
+	wait_latency();
+	krn = new_obj(OBJ_KERNEL);
+	if (err)
+		*err = krn ? CL_SUCCESS : CL_OUT_OF_HOST_MEMORY;
+	return (cl_kernel)krn;
+}
+
+static cl_int CL_API_CALL
+mock_GetKernelWorkGroupInfo(cl_kernel kernel, cl_device_id device, cl_kernel_work_group_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	const struct obj *o = (const struct obj *)device;
+
+	(void)kernel;
+	wait_latency();
+	switch (param) {
+	case CL_KERNEL_WORK_GROUP_SIZE:
+		RET_TYPED(size_t, 256);
+	case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE:
+		RET_TYPED(size_t, device_type(o) == CL_DEVICE_TYPE_GPU ? 32 : 1);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+static cl_int CL_API_CALL
+mock_SetKernelArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+{
+	(void)kernel;
+	(void)index;
+	(void)size;
+	(void)value;
+	return CL_SUCCESS;
+}
+
+/* Buffers: plain host memory, which the commands below access directly */
+
+static cl_mem CL_API_CALL
+mock_CreateBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *err)
+{
+	const cl_bool uses_host_ptr = !!(flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR));
+	struct obj *buf = NULL;
+	cl_int ret = CL_SUCCESS;
+
+	(void)context;
+	wait_latency();
+	if (!size)
+		ret = CL_INVALID_BUFFER_SIZE;
+	else if ((host_ptr != NULL) != uses_host_ptr)
+		ret = CL_INVALID_HOST_PTR;
+	if (!ret) {
+		buf = new_obj(OBJ_MEM);
+		if (buf)
+			buf->mem = calloc(1, size);
+		if (!buf || !buf->mem) {
+			release_obj(buf);
+			buf = NULL;
+			ret = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+		}
+	}
+	if (!ret) {
+		buf->mem_sz = size;
+		/* nothing runs concurrently with the host, so CL_MEM_USE_HOST_PTR
+		 * can be a copy too */
+		if (host_ptr)
+			memcpy(buf->mem, host_ptr, size);
+	}
+	if (err)
+		*err = ret;
+	return (cl_mem)buf;
+}
+
+/* Check that [offset, offset + size) is within the buffer */
+static cl_int buffer_range(const struct obj *buf, size_t offset, size_t size)
+{
+	if (!buf || buf->kind != OBJ_MEM)
+		return CL_INVALID_MEM_OBJECT;
+	if (!size || offset > buf->mem_sz || size > buf->mem_sz - offset)
+		return CL_INVALID_VALUE;
+	return CL_SUCCESS;
+}
+
+/* Events: commands complete as soon as they are enqueued, and their events
+ * report the time the device would have taken to execute them */
+
+/* simulated device speed: a nanosecond for each work-item,
+ * and for each BYTES_PER_NS bytes transferred */
+#define BYTES_PER_NS 16
+
+static cl_ulong now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (cl_ulong)ts.tv_sec*1000000000UL + (cl_ulong)ts.tv_nsec;
+}
+
+/* The event, if requested, of a command just enqueued taking ns nanoseconds */
+static cl_int new_event(cl_event *event, cl_ulong ns)
+{
+	struct obj *ev;
+
+	if (!event)
+		return CL_SUCCESS;
+	ev = new_obj(OBJ_EVENT);
+	if (!ev)
+		return CL_OUT_OF_HOST_MEMORY;
+	ev->profiling[0] = ev->profiling[1] = ev->profiling[2] = now_ns();
+	ev->profiling[3] = ev->profiling[2] + (ns ? ns : 1);
+	*event = (cl_event)ev;
+	return CL_SUCCESS;
+}
+
+static cl_int CL_API_CALL
+mock_WaitForEvents(cl_uint num_events, const cl_event *events)
+{
+	wait_latency();
+	return num_events && events ? CL_SUCCESS : CL_INVALID_VALUE;
+}
+
+static cl_int CL_API_CALL
+mock_GetEventProfilingInfo(cl_event event, cl_profiling_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	const struct obj *o = (const struct obj *)event;
+
+	wait_latency();
+	switch (param) {
+	case CL_PROFILING_COMMAND_QUEUED:
+	case CL_PROFILING_COMMAND_SUBMIT:
+	case CL_PROFILING_COMMAND_START:
+	case CL_PROFILING_COMMAND_END:
+		RET_TYPED(cl_ulong, o->profiling[param - CL_PROFILING_COMMAND_QUEUED]);
+	default:
+		return CL_INVALID_VALUE;
+	}
+}
+
+/* Commands: the wait lists can be ignored, since all the commands
+ * have already completed */
+
+static cl_int CL_API_CALL
+mock_Finish(cl_command_queue queue)
+{
+	(void)queue;
+	wait_latency();
+	return CL_SUCCESS;
+}
+
+static cl_int CL_API_CALL
+mock_EnqueueReadBuffer(cl_command_queue queue, cl_mem buffer, cl_bool blocking,
+	size_t offset, size_t size, void *ptr,
+	cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const struct obj *buf = (const struct obj *)buffer;
+	cl_int err;
+
+	(void)queue;
+	(void)blocking;
+	(void)num_events;
+	(void)wait_list;
+	wait_latency();
+	err = buffer_range(buf, offset, size);
+	if (!err && !ptr)
+		err = CL_INVALID_VALUE;
+	if (err)
+		return err;
+	memcpy(ptr, buf->mem + offset, size);
+	return new_event(event, size/BYTES_PER_NS);
+}
+
+static cl_int CL_API_CALL
+mock_EnqueueWriteBuffer(cl_command_queue queue, cl_mem buffer, cl_bool blocking,
+	size_t offset, size_t size, const void *ptr,
+	cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	struct obj *buf = (struct obj *)buffer;
+	cl_int err;
+
+	(void)queue;
+	(void)blocking;
+	(void)num_events;
+	(void)wait_list;
+	wait_latency();
+	err = buffer_range(buf, offset, size);
+	if (!err && !ptr)
+		err = CL_INVALID_VALUE;
+	if (err)
+		return err;
+	memcpy(buf->mem + offset, ptr, size);
+	return new_event(event, size/BYTES_PER_NS);
+}
+
+/* Mapping a buffer gives direct access to its contents */
+static void *CL_API_CALL
+mock_EnqueueMapBuffer(cl_command_queue queue, cl_mem buffer, cl_bool blocking,
+	cl_map_flags flags, size_t offset, size_t size,
+	cl_uint num_events, const cl_event *wait_list, cl_event *event, cl_int *err)
+{
+	struct obj *buf = (struct obj *)buffer;
+	cl_int ret;
+
+	(void)queue;
+	(void)blocking;
+	(void)flags;
+	(void)num_events;
+	(void)wait_list;
+	wait_latency();
+	ret = buffer_range(buf, offset, size);
+	if (!ret)
+		ret = new_event(event, 0);
+	if (err)
+		*err = ret;
+	return ret ? NULL : buf->mem + offset;
+}
+
+static cl_int CL_API_CALL
+mock_EnqueueUnmapMemObject(cl_command_queue queue, cl_mem memobj, void *ptr,
+	cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const struct obj *buf = (const struct obj *)memobj;
+
+	(void)queue;
+	(void)num_events;
+	(void)wait_list;
+	wait_latency();
+	if (!buf || buf->kind != OBJ_MEM)
+		return CL_INVALID_MEM_OBJECT;
+	if ((unsigned char *)ptr < buf->mem || (unsigned char *)ptr >= buf->mem + buf->mem_sz)
+		return CL_INVALID_VALUE;
+	return new_event(event, 0);
+}
+
+static cl_int CL_API_CALL
+mock_EnqueueNDRangeKernel(cl_command_queue queue, cl_kernel kernel, cl_uint dims,
+	const size_t *gwo, const size_t *gws, const size_t *lws,
+	cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	cl_ulong items = 1;
+	cl_uint i;
+
+	(void)queue;
+	(void)kernel;
+	(void)gwo;
+	(void)num_events;
+	(void)wait_list;
+	wait_latency();
+	if (dims < 1 || dims > 3 || !gws)
+		return CL_INVALID_WORK_DIMENSION;
+	for (i = 0; i < dims; ++i) {
+		if (!gws[i] || (lws && (!lws[i] || gws[i] % lws[i])))
+			return CL_INVALID_WORK_GROUP_SIZE;
+		items *= gws[i];
+	}
+	return new_event(event, items);
+}
+
+/* Entries not otherwise implemented; all of the ones clinfo may reach return
+ * a status, so that this is never mistaken for an object */
+static cl_int CL_API_CALL
+mock_Unsupported(void)
+{
+	return CL_INVALID_OPERATION;
+}
+
+/* Extensions: only the ICD entry point itself is provided */
+
+cl_int CL_API_CALL
+clIcdGetPlatformIDsKHR(cl_uint num_entries, cl_platform_id *plat, cl_uint *num_plat);
+
+static void *CL_API_CALL
+mock_GetExtensionFunctionAddress(const char *name)
+{
+	/* see oclIcdProps in clinfo.c for why we go through a pointer-to-pointer */
+	cl_int (CL_API_CALL *fn)(cl_uint, cl_platform_id *, cl_uint *) = clIcdGetPlatformIDsKHR;
+	void *ptr = NULL;
+	if (name && !strcmp(name, "clIcdGetPlatformIDsKHR"))
+		memcpy(&ptr, &fn, sizeof(ptr));
+	return ptr;
+}
+
+static void *CL_API_CALL
+mock_GetExtensionFunctionAddressForPlatform(cl_platform_id plat, const char *name)
+{
+	(void)plat;
+	return mock_GetExtensionFunctionAddress(name);
+}
+
+/* Setup */
+
+#define SET_DISPATCH(index, fn) dispatch[DISPATCH_##index] = (mock_fn)(fn)
+
+static cl_int init(void)
+{
+	const char *latency = getenv("MOCKICD_LATENCY_US");
+	cl_uint i, j, k;
+	size_t n;
+
+	if (platforms)
+		return CL_SUCCESS;
+
+	num_platforms = env_uint("MOCKICD_PLATFORMS", num_platforms);
+	num_devices = env_uint("MOCKICD_DEVICES", num_devices);
+	num_sub_devices = env_uint("MOCKICD_SUB_DEVICES", num_sub_devices);
+	if (latency && *latency)
+		latency_us = strtol(latency, NULL, 0);
+
+	/* the loader calls through the table without checking for NULL entries */
+	for (n = 0; n < DISPATCH_SIZE; ++n)
+		dispatch[n] = (mock_fn)mock_Unsupported;
+	SET_DISPATCH(GET_PLATFORM_IDS, mock_GetPlatformIDs);
+	SET_DISPATCH(GET_PLATFORM_INFO, mock_GetPlatformInfo);
+	SET_DISPATCH(GET_DEVICE_IDS, mock_GetDeviceIDs);
+	SET_DISPATCH(GET_DEVICE_INFO, mock_GetDeviceInfo);
+	SET_DISPATCH(CREATE_CONTEXT, mock_CreateContext);
+	SET_DISPATCH(CREATE_CONTEXT_FROM_TYPE, mock_CreateContextFromType);
+	SET_DISPATCH(RETAIN_CONTEXT, mock_RetainObj);
+	SET_DISPATCH(RELEASE_CONTEXT, mock_ReleaseObj);
+	SET_DISPATCH(GET_CONTEXT_INFO, mock_GetContextInfo);
+	SET_DISPATCH(CREATE_COMMAND_QUEUE, mock_CreateCommandQueue);
+	SET_DISPATCH(RETAIN_COMMAND_QUEUE, mock_RetainObj);
+	SET_DISPATCH(RELEASE_COMMAND_QUEUE, mock_ReleaseObj);
+	SET_DISPATCH(CREATE_BUFFER, mock_CreateBuffer);
+	SET_DISPATCH(RETAIN_MEM_OBJECT, mock_RetainObj);
+	SET_DISPATCH(RELEASE_MEM_OBJECT, mock_ReleaseObj);
+	SET_DISPATCH(CREATE_PROGRAM_WITH_SOURCE, mock_CreateProgramWithSource);
+	SET_DISPATCH(CREATE_PROGRAM_WITH_BINARY, mock_CreateProgramWithBinary);
+	SET_DISPATCH(RETAIN_PROGRAM, mock_RetainObj);
+	SET_DISPATCH(RELEASE_PROGRAM, mock_ReleaseObj);
+	SET_DISPATCH(BUILD_PROGRAM, mock_BuildProgram);
+	SET_DISPATCH(COMPILE_PROGRAM, mock_CompileProgram);
+	SET_DISPATCH(LINK_PROGRAM, mock_LinkProgram);
+	SET_DISPATCH(GET_PROGRAM_INFO, mock_GetProgramInfo);
+	SET_DISPATCH(GET_PROGRAM_BUILD_INFO, mock_GetProgramBuildInfo);
+	SET_DISPATCH(CREATE_KERNEL, mock_CreateKernel);
+	SET_DISPATCH(RETAIN_KERNEL, mock_RetainObj);
+	SET_DISPATCH(RELEASE_KERNEL, mock_ReleaseObj);
+	SET_DISPATCH(SET_KERNEL_ARG, mock_SetKernelArg);
+	SET_DISPATCH(GET_KERNEL_WORK_GROUP_INFO, mock_GetKernelWorkGroupInfo);
+	SET_DISPATCH(WAIT_FOR_EVENTS, mock_WaitForEvents);
+	SET_DISPATCH(RETAIN_EVENT, mock_RetainObj);
+	SET_DISPATCH(RELEASE_EVENT, mock_ReleaseObj);
+	SET_DISPATCH(GET_EVENT_PROFILING_INFO, mock_GetEventProfilingInfo);
+	SET_DISPATCH(FLUSH, mock_Finish);
+	SET_DISPATCH(FINISH, mock_Finish);
+	SET_DISPATCH(ENQUEUE_READ_BUFFER, mock_EnqueueReadBuffer);
+	SET_DISPATCH(ENQUEUE_WRITE_BUFFER, mock_EnqueueWriteBuffer);
+	SET_DISPATCH(ENQUEUE_MAP_BUFFER, mock_EnqueueMapBuffer);
+	SET_DISPATCH(ENQUEUE_UNMAP_MEM_OBJECT, mock_EnqueueUnmapMemObject);
+	SET_DISPATCH(ENQUEUE_NDRANGE_KERNEL, mock_EnqueueNDRangeKernel);
+	SET_DISPATCH(GET_EXTENSION_FUNCTION_ADDRESS, mock_GetExtensionFunctionAddress);
+	SET_DISPATCH(CREATE_SUB_DEVICES, mock_CreateSubDevices);
+	SET_DISPATCH(RETAIN_DEVICE, mock_RetainDevice);
+	SET_DISPATCH(RELEASE_DEVICE, mock_RetainDevice);
+	SET_DISPATCH(GET_EXTENSION_FUNCTION_ADDRESS_FOR_PLATFORM,
+		mock_GetExtensionFunctionAddressForPlatform);
+
+	platforms = calloc(num_platforms ? num_platforms : 1, sizeof(*platforms));
+	devices = calloc(num_platforms*num_devices + 1, sizeof(*devices));
+	sub_devices = calloc(num_platforms*num_devices*num_sub_devices + 1, sizeof(*sub_devices));
+	if (!platforms || !devices || !sub_devices) {
+		free(platforms);
+		free(devices);
+		free(sub_devices);
+		platforms = devices = sub_devices = NULL;
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+
+	for (i = 0; i < num_platforms; ++i) {
+		struct obj *p = platforms + i;
+		p->dispatch = dispatch;
+		p->kind = OBJ_PLATFORM;
+		p->p = i;
+		for (j = 0; j < num_devices; ++j) {
+			struct obj *d = devices + i*num_devices + j;
+			d->dispatch = dispatch;
+			d->kind = OBJ_DEVICE;
+			d->p = i;
+			d->d = j;
+			for (k = 0; k < num_sub_devices; ++k) {
+				struct obj *s = sub_devices + (i*num_devices + j)*num_sub_devices + k;
+				*s = *d;
+				s->s = k;
+				s->parent = d;
+			}
+		}
+	}
+	return CL_SUCCESS;
+}
+
+/* Entry points exported to the ICD loader */
+
+CL_API_ENTRY cl_int CL_API_CALL
+clIcdGetPlatformIDsKHR(cl_uint num_entries, cl_platform_id *plat, cl_uint *num_plat)
+{
+	const cl_int err = init();
+	if (err)
+		return err;
+	if (!num_platforms) {
+		if (num_plat)
+			*num_plat = 0;
+		return CL_PLATFORM_NOT_FOUND_KHR;
+	}
+	return mock_GetPlatformIDs(num_entries, plat, num_plat);
+}
+
+CL_API_ENTRY void * CL_API_CALL
+clGetExtensionFunctionAddress(const char *name)
+{
+	return mock_GetExtensionFunctionAddress(name);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformInfo(cl_platform_id plat, cl_platform_info param,
+	size_t sz, void *val, size_t *ret_sz)
+{
+	if (init())
+		return CL_OUT_OF_HOST_MEMORY;
+	return mock_GetPlatformInfo(plat, param, sz, val, ret_sz);
+}
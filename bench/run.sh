@@ -0,0 +1,79 @@
+#!/bin/sh
+# Time the whole clinfo pipeline in each of the output modes, and with all
+# the --bench benchmarks, against the mock platform of mockicd.c, found
+# through the ICD loader.
+# Normally run via `make bench`.
+#
+# Usage: run.sh path/to/clinfo path/to/libmockicd.so
+#
+# The mock platform is configured by the MOCKICD_* environment variables
+# (see mockicd.c); BENCH_RUNS is the number of runs for each mode (default 5),
+# and BENCH_FLAGS are additional flags passed to clinfo (e.g. -j 4).
+
+set -e
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 clinfo libmockicd.so" >&2
+	exit 1
+fi
+
+clinfo="$1"
+mockicd="$(cd "$(dirname "$2")" && pwd)/$(basename "$2")"
+runs="${BENCH_RUNS:-5}"
+flags="${BENCH_FLAGS:-}"
+
+# show the sub-devices too, if the devices can be partitioned
+case "${MOCKICD_SUB_DEVICES:-0}" in
+	0) ;;
+	*) flags="$flags --sub-devices" ;;
+esac
+
+# the loader only picks up the mock platform
+vendors="${TMPDIR:-/tmp}/clinfo-bench.$$"
+trap 'rm -rf "$vendors"' EXIT INT TERM
+mkdir -p "$vendors"
+echo "$mockicd" > "$vendors/mockicd.icd"
+OCL_ICD_VENDORS="$vendors"
+export OCL_ICD_VENDORS
+
+# don't load the probe results from a previous run
+CLINFO_CACHE_DIR=
+export CLINFO_CACHE_DIR
+
+# current time in milliseconds; date +%N is not POSIX, so fall back
+# to whole seconds if it isn't supported
+now_ms() {
+	t="$(date +%s%N)"
+	case "$t" in
+	*N) echo $(( $(date +%s) * 1000 )) ;;
+	*) echo $(( t / 1000000 )) ;;
+	esac
+}
+
+printf '%s platform(s), %s device(s) each, %s sub-device(s) each, %s us latency, %s run(s)\n' \
+	"${MOCKICD_PLATFORMS:-1}" "${MOCKICD_DEVICES:-2}" "${MOCKICD_SUB_DEVICES:-0}" \
+	"${MOCKICD_LATENCY_US:-0}" "$runs"
+printf '%-8s %12s %12s\n' mode "total (ms)" "run (ms)"
+
+for mode in human raw json list bench; do
+	case $mode in
+	human) mflags= ;;
+	raw) mflags=--raw ;;
+	json) mflags=--json ;;
+	list) mflags=--list ;;
+	bench) mflags="--bench bandwidth,transfer,launch,p2p,svm,compile,flops,cache" ;;
+	esac
+
+	start=$(now_ms)
+	i=0
+	while [ $i -lt "$runs" ]; do
+		if ! "$clinfo" $flags $mflags > /dev/null 2>&1; then
+			echo "$clinfo $flags $mflags failed" >&2
+			exit 1
+		fi
+		i=$((i + 1))
+	done
+	end=$(now_ms)
+
+	printf '%-8s %12s %12s\n' $mode $((end - start)) $(( (end - start) / runs ))
+done
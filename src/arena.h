@@ -0,0 +1,143 @@
+/* Scratch memory arena: allocations are carved out of large blocks and
+ * are never freed individually; instead, the whole arena is reset when none
+ * of the data is needed anymore, keeping the blocks around for reuse.
+ *
+ * Since devices may be processed concurrently, each thread has its own
+ * scratch arena, which is reset between devices.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "threads.h"
+
+/* alignment of the allocations, good enough for any property value */
+#define ARENA_ALIGN 16
+/* minimum size of each block */
+#define ARENA_BLOCK_SZ 65536
+
+#define ARENA_ROUND(sz) (((sz) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena_block {
+	struct arena_block *next;
+	size_t sz; /* usable size, following the (aligned) header */
+	size_t used;
+};
+
+#define ARENA_BLOCK_DATA(block) ((char *)(block) + ARENA_ROUND(sizeof(struct arena_block)))
+
+struct arena {
+	struct arena_block *first;
+	struct arena_block *cur; /* the block allocations are currently taken from */
+	void *last; /* the last allocation, which can be grown in place */
+};
+
+/* Allocate sz bytes (not cleared) from the arena */
+static inline void *arena_alloc_raw(struct arena *arena, size_t sz, const char *what)
+{
+	struct arena_block *block = arena->cur;
+	void *ret;
+
+	sz = ARENA_ROUND(sz ? sz : 1);
+
+	/* blocks past the current one are unused since the last reset */
+	while (block && block->used + sz > block->sz) {
+		block = block->next;
+		if (block) block->used = 0;
+	}
+
+	if (!block) {
+		const size_t bsz = sz > ARENA_BLOCK_SZ ? sz : ARENA_BLOCK_SZ;
+		block = malloc(ARENA_ROUND(sizeof(*block)) + bsz);
+		CHECK_MEM(block, what);
+		block->sz = bsz;
+		block->used = 0;
+		/* link after the current block, so that it is reused after a reset */
+		if (arena->cur) {
+			block->next = arena->cur->next;
+			arena->cur->next = block;
+		} else {
+			block->next = arena->first;
+			arena->first = block;
+		}
+	}
+
+	arena->cur = block;
+	ret = ARENA_BLOCK_DATA(block) + block->used;
+	block->used += sz;
+	arena->last = ret;
+	return ret;
+}
+
+/* Allocate num elements of size sz from the arena, cleared as by calloc */
+static inline void *arena_alloc(struct arena *arena, size_t num, size_t sz, const char *what)
+{
+	void *ret = arena_alloc_raw(arena, num*sz, what);
+	memset(ret, 0, num*sz);
+	return ret;
+}
+
+/* Grow an allocation of the arena from oldsz to nusz bytes: this is done in place
+ * for the last allocation, if there is room for it; otherwise the data is copied
+ * into a new allocation, and the old one is only reclaimed on reset
+ */
+static inline void *arena_realloc(struct arena *arena, void *ptr, size_t oldsz, size_t nusz,
+	const char *what)
+{
+	struct arena_block *block = arena->cur;
+	void *ret;
+
+	if (!ptr)
+		return arena_alloc_raw(arena, nusz, what);
+	if (nusz <= oldsz)
+		return ptr;
+
+	if (ptr == arena->last) {
+		const size_t ofs = (size_t)((char *)ptr - ARENA_BLOCK_DATA(block));
+		if (ofs + ARENA_ROUND(nusz) <= block->sz) {
+			block->used = ofs + ARENA_ROUND(nusz);
+			return ptr;
+		}
+	}
+
+	ret = arena_alloc_raw(arena, nusz, what);
+	memcpy(ret, ptr, oldsz);
+	return ret;
+}
+
+/* Release all the allocations at once, keeping the blocks */
+static inline void arena_reset(struct arena *arena)
+{
+	arena->cur = arena->first;
+	if (arena->cur)
+		arena->cur->used = 0;
+	arena->last = NULL;
+}
+
+/* Release the blocks too */
+static inline void arena_free(struct arena *arena)
+{
+	struct arena_block *block = arena->first;
+	while (block) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->first = arena->cur = NULL;
+	arena->last = NULL;
+}
+
+#define ARENA_ALLOC(arena, var, num, what) do { \
+	var = arena_alloc(arena, num, sizeof(*(var)), what); \
+} while (0)
+
+/* The per-thread scratch arena */
+THREAD_LOCAL struct arena scratch;
+
+#define SCRATCH_ALLOC(var, num, what) ARENA_ALLOC(&scratch, var, num, what)
+
+#endif
@@ -0,0 +1,1496 @@
+/* Micro-benchmarks (--bench): rather than reporting what the devices
+ * advertise, measure what they actually achieve. Each benchmark only
+ * collects its results: showing them is up to the caller.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+# include <sched.h>
+#endif
+
+#include "ext.h"
+#include "error.h"
+#include "memory.h"
+#include "strbuf.h"
+#include "timings.h"
+
+/* Benchmark kinds, as a bitmask of the ones requested */
+enum bench_kind {
+	BENCH_BANDWIDTH = 1 << 0,
+	BENCH_TRANSFER = 1 << 1,
+	BENCH_LAUNCH = 1 << 2,
+	BENCH_P2P = 1 << 3,
+	BENCH_SVM = 1 << 4,
+	BENCH_COMPILE = 1 << 5,
+	BENCH_FLOPS = 1 << 6,
+	BENCH_CACHE = 1 << 7,
+};
+
+/* Benchmarks that involve all the devices of a platform, rather than a single one */
+#define BENCH_PLATFORM_KINDS (BENCH_P2P)
+
+static const struct bench_name {
+	enum bench_kind kind;
+	const char *name;
+} bench_names[] = {
+	{ BENCH_BANDWIDTH, "bandwidth" },
+	{ BENCH_TRANSFER, "transfer" },
+	{ BENCH_LAUNCH, "launch" },
+	{ BENCH_P2P, "p2p" },
+	{ BENCH_SVM, "svm" },
+	{ BENCH_COMPILE, "compile" },
+	{ BENCH_FLOPS, "flops" },
+	{ BENCH_CACHE, "cache" },
+};
+
+/* Number of timed runs for each measurement (after a warm-up run);
+ * the best one is reported */
+#define BENCH_REPEAT 5
+
+/* clCreateCommandQueueWithProperties, looked up at runtime since the OpenCL library
+ * might not provide it */
+typedef cl_command_queue (CL_API_CALL *bench_create_queue_fn)(cl_context, cl_device_id,
+	const cl_queue_properties *, cl_int *);
+
+/* OpenCL objects shared by the benchmarks run on a device */
+struct bench_env {
+	cl_platform_id plat;
+	cl_device_id dev;
+	cl_context ctx;
+	cl_command_queue queue;
+	/* NULL if not available, or if the platform is older than OpenCL 2.0 */
+	bench_create_queue_fn create_queue;
+	/* set when something fails in setting up or running a benchmark */
+	struct _strbuf err_str;
+};
+
+/* Create a queue on the device of env with the given properties, with
+ * clCreateCommandQueueWithProperties where possible, since clCreateCommandQueue
+ * is deprecated since OpenCL 2.0 */
+cl_command_queue bench_queue(struct bench_env *env, cl_command_queue_properties props, cl_int *err)
+{
+	if (env->create_queue) {
+		const cl_queue_properties qprops[] = { CL_QUEUE_PROPERTIES, props, 0 };
+		return env->create_queue(env->ctx, env->dev, qprops, err);
+	}
+	return clCreateCommandQueue(env->ctx, env->dev, props, err);
+}
+
+/* create_queue is clCreateCommandQueueWithProperties, or NULL if the OpenCL
+ * library does not provide it */
+cl_int bench_env_init(struct bench_env *env, cl_platform_id plat, cl_device_id dev,
+	bench_create_queue_fn create_queue)
+{
+	cl_context_properties ctxpft[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)plat,
+		0, 0 };
+	char version[64] = "";
+	int major = 0;
+	cl_int err;
+
+	env->plat = plat;
+	env->dev = dev;
+	env->queue = NULL;
+	init_strbuf(&env->err_str, "benchmark error");
+
+	/* the platform must support it too, not just the ICD loader */
+	clGetPlatformInfo(plat, CL_PLATFORM_VERSION, sizeof(version) - 1, version, NULL);
+	if (sscanf(version, "OpenCL %d.", &major) != 1 || major < 2)
+		create_queue = NULL;
+	env->create_queue = create_queue;
+
+	env->ctx = clCreateContext(ctxpft, 1, &dev, NULL, NULL, &err);
+	if (REPORT_ERROR(&env->err_str, err, "create context"))
+		return err;
+	env->queue = bench_queue(env, CL_QUEUE_PROFILING_ENABLE, &err);
+	REPORT_ERROR(&env->err_str, err, "create command queue");
+	return err;
+}
+
+void bench_env_release(struct bench_env *env)
+{
+	if (env->queue)
+		clReleaseCommandQueue(env->queue);
+	if (env->ctx)
+		clReleaseContext(env->ctx);
+	free_strbuf(&env->err_str);
+}
+
+/* Device-side duration of the command associated with ev, in nanoseconds;
+ * the event is released */
+cl_int bench_event_ns(cl_event ev, cl_ulong *ns)
+{
+	cl_ulong start = 0, end = 0;
+	cl_int err = clWaitForEvents(1, &ev);
+	if (!err)
+		err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+	if (!err)
+		err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+	clReleaseEvent(ev);
+	*ns = end > start ? end - start : 1;
+	return err;
+}
+
+/* Build a program for the benchmark device from the given sources */
+cl_program bench_build(struct bench_env *env, const char * const *src, cl_uint nsrc,
+	const char *opts, cl_int *err)
+{
+	cl_program prg = clCreateProgramWithSource(env->ctx, nsrc, (const char **)src, NULL, err);
+	if (REPORT_ERROR(&env->err_str, *err, "create program"))
+		return NULL;
+	*err = clBuildProgram(prg, 1, &env->dev, opts, NULL, NULL);
+	if (REPORT_ERROR(&env->err_str, *err, "build program")) {
+		clReleaseProgram(prg);
+		return NULL;
+	}
+	return prg;
+}
+
+/* Create a buffer of the given size, zeroed so that the contents do not
+ * trigger slow paths such as denormals */
+cl_mem bench_buffer(struct bench_env *env, size_t sz, cl_int *err)
+{
+	cl_mem buf = clCreateBuffer(env->ctx, CL_MEM_READ_WRITE, sz, NULL, err);
+	void *ptr;
+	if (REPORT_ERROR(&env->err_str, *err, "create buffer"))
+		return NULL;
+	ptr = clEnqueueMapBuffer(env->queue, buf, CL_TRUE, CL_MAP_WRITE, 0, sz, 0, NULL, NULL, err);
+	if (!REPORT_ERROR(&env->err_str, *err, "map buffer")) {
+		memset(ptr, 0, sz);
+		*err = clEnqueueUnmapMemObject(env->queue, buf, ptr, 0, NULL, NULL);
+		if (!REPORT_ERROR(&env->err_str, *err, "unmap buffer"))
+			*err = clFinish(env->queue);
+	}
+	if (*err) {
+		clReleaseMemObject(buf);
+		buf = NULL;
+	}
+	return buf;
+}
+
+/* Global memory bandwidth, measured with the sum kernels of the work-group
+ * size probe program, for each vector width from 1 to 16.
+ * Each work-item reads two floatN and writes one. */
+
+#define BENCH_BW_WIDTHS 5
+/* upper limit to the size of each of the three buffers, to keep the run time reasonable */
+#define BENCH_BW_MAX_BUF ((cl_ulong)256 << 20)
+
+struct bench_bandwidth {
+	size_t buf_sz;
+	cl_uint preferred_width;
+	cl_uint native_width;
+	cl_int err[BENCH_BW_WIDTHS];
+	double gbps[BENCH_BW_WIDTHS];
+};
+
+cl_int bench_bandwidth(struct bench_env *env, const char * const *src, cl_uint nsrc,
+	struct bench_bandwidth *res)
+{
+	cl_ulong max_alloc = 0, global_mem = 0, sz;
+	cl_mem buf[3] = { NULL, NULL, NULL };
+	cl_program prg = NULL;
+	cl_int err;
+	cl_uint w, b;
+
+	memset(res, 0, sizeof(*res));
+	clGetDeviceInfo(env->dev, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT,
+		sizeof(res->preferred_width), &res->preferred_width, NULL);
+	clGetDeviceInfo(env->dev, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT,
+		sizeof(res->native_width), &res->native_width, NULL);
+
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_MAX_MEM_ALLOC_SIZE")) return err;
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_GLOBAL_MEM_SIZE")) return err;
+
+	/* three buffers must fit, with some room to spare */
+	sz = max_alloc;
+	if (sz > global_mem/4)
+		sz = global_mem/4;
+	if (sz > BENCH_BW_MAX_BUF)
+		sz = BENCH_BW_MAX_BUF;
+	/* whole float16s */
+	sz -= sz % (16*sizeof(cl_float));
+	res->buf_sz = (size_t)sz;
+	if (!sz) {
+		err = CL_INVALID_BUFFER_SIZE;
+		REPORT_ERROR(&env->err_str, err, "buffer size");
+		return err;
+	}
+
+	prg = bench_build(env, src, nsrc, NULL, &err);
+	if (err) goto out;
+
+	for (b = 0; b < 3; ++b) {
+		buf[b] = bench_buffer(env, res->buf_sz, &err);
+		if (err) goto out;
+	}
+
+	for (w = 0; w < BENCH_BW_WIDTHS; ++w) {
+		const cl_uint width = 1U << w;
+		const size_t gws = res->buf_sz/(width*sizeof(cl_float));
+		cl_ulong best = 0;
+		cl_kernel krn;
+		char name[8] = "sum";
+		int run;
+
+		if (width > 1)
+			snprintf(name, sizeof(name), "sum%u", width);
+		krn = clCreateKernel(prg, name, &err);
+		if (err) {
+			res->err[w] = err;
+			continue;
+		}
+		for (b = 0; b < 3 && !err; ++b)
+			err = clSetKernelArg(krn, b, sizeof(cl_mem), buf + b);
+
+		/* run 0 is the warm-up */
+		for (run = 0; run <= BENCH_REPEAT && !err; ++run) {
+			cl_event ev = NULL;
+			cl_ulong ns;
+			err = clEnqueueNDRangeKernel(env->queue, krn, 1, NULL, &gws, NULL, 0, NULL, &ev);
+			if (err) break;
+			err = bench_event_ns(ev, &ns);
+			if (run > 0 && (!best || ns < best))
+				best = ns;
+		}
+		clReleaseKernel(krn);
+
+		res->err[w] = err;
+		if (!err)
+			res->gbps[w] = 3.0*res->buf_sz/best;
+		err = CL_SUCCESS;
+	}
+
+out:
+	for (b = 0; b < 3; ++b)
+		if (buf[b])
+			clReleaseMemObject(buf[b]);
+	if (prg)
+		clReleaseProgram(prg);
+	return err;
+}
+
+/* NUMA support for the transfer benchmark: the host memory is placed
+ * on a given node by running the benchmark on the CPUs of that node, so that
+ * it gets allocated there on first touch. Only supported on Linux.
+ */
+
+struct bench_numa {
+	cl_bool bound;
+#ifdef __linux__
+	cpu_set_t saved;
+#endif
+};
+
+/* Number of NUMA nodes, 0 if unknown */
+int bench_numa_nodes(void)
+{
+	int nodes = 0;
+#ifdef __linux__
+	char path[64];
+	for (;;) {
+		FILE *f;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes);
+		f = fopen(path, "r");
+		if (!f)
+			break;
+		fclose(f);
+		++nodes;
+	}
+#endif
+	return nodes;
+}
+
+/* NUMA node of the device at the given PCI address, -1 if unknown */
+int bench_pci_numa_node(const cl_device_pci_bus_info_khr *pci)
+{
+	int node = -1;
+#ifdef __linux__
+	char path[96];
+	FILE *f;
+	snprintf(path, sizeof(path), "/sys/bus/pci/devices/%04x:%02x:%02x.%u/numa_node",
+		pci->pci_domain, pci->pci_bus, pci->pci_device, pci->pci_function);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%d", &node) != 1)
+			node = -1;
+		fclose(f);
+	}
+#else
+	(void)pci;
+#endif
+	return node;
+}
+
+/* Restrict the calling thread to the CPUs of the given node;
+ * returns CL_FALSE if this is not possible */
+cl_bool bench_numa_bind(struct bench_numa *numa, int node)
+{
+	numa->bound = CL_FALSE;
+#ifdef __linux__
+	{
+		char path[64];
+		cpu_set_t set;
+		unsigned first, last;
+		FILE *f;
+		int n;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		f = fopen(path, "r");
+		if (!f)
+			return CL_FALSE;
+		/* the format is a comma-separated list of ranges, e.g. 0-3,8-11 */
+		CPU_ZERO(&set);
+		while ((n = fscanf(f, "%u-%u", &first, &last)) >= 1) {
+			if (n == 1)
+				last = first;
+			for (; first <= last && first < CPU_SETSIZE; ++first)
+				CPU_SET(first, &set);
+			if (fgetc(f) != ',')
+				break;
+		}
+		fclose(f);
+
+		if (!CPU_COUNT(&set) || sched_getaffinity(0, sizeof(numa->saved), &numa->saved))
+			return CL_FALSE;
+		numa->bound = !sched_setaffinity(0, sizeof(set), &set);
+	}
+#else
+	(void)node;
+#endif
+	return numa->bound;
+}
+
+void bench_numa_unbind(struct bench_numa *numa)
+{
+#ifdef __linux__
+	if (numa->bound)
+		sched_setaffinity(0, sizeof(numa->saved), &numa->saved);
+#endif
+	numa->bound = CL_FALSE;
+}
+
+/* Host/device transfer throughput, with pageable (plain malloc) host memory,
+ * and with pinned host memory (a mapped CL_MEM_ALLOC_HOST_PTR buffer),
+ * for transfer sizes from 4KiB to 1GiB (as long as the device allows it).
+ * Transfers are blocking and timed on the host, so that the latency of
+ * the small ones is included. */
+
+enum bench_xfer_kind {
+	BENCH_XFER_WRITE_PAGEABLE,
+	BENCH_XFER_READ_PAGEABLE,
+	BENCH_XFER_WRITE_PINNED,
+	BENCH_XFER_READ_PINNED,
+	BENCH_XFER_KINDS
+};
+
+#define BENCH_XFER_SIZES 10
+/* sizes grow by a factor of 4 */
+#define BENCH_XFER_MIN_SZ ((size_t)4 << 10)
+
+struct bench_transfer {
+	cl_uint num_sizes; /* number of sizes that could be tested */
+	size_t size[BENCH_XFER_SIZES];
+	cl_int err[BENCH_XFER_KINDS];
+	double gbps[BENCH_XFER_KINDS][BENCH_XFER_SIZES];
+	double us[BENCH_XFER_KINDS][BENCH_XFER_SIZES]; /* time of a single transfer */
+};
+
+cl_int bench_transfer(struct bench_env *env, struct bench_transfer *res)
+{
+	cl_ulong max_alloc = 0;
+	size_t max_sz;
+	cl_mem dev_buf = NULL, pinned_buf = NULL;
+	char *pageable = NULL, *pinned = NULL;
+	cl_int err;
+	cl_uint i, k;
+
+	memset(res, 0, sizeof(*res));
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_MAX_MEM_ALLOC_SIZE")) return err;
+
+	for (i = 0; i < BENCH_XFER_SIZES; ++i) {
+		const size_t sz = BENCH_XFER_MIN_SZ << (2*i);
+		if (sz > max_alloc)
+			break;
+		res->size[i] = sz;
+	}
+	res->num_sizes = i;
+	if (!i) {
+		err = CL_INVALID_BUFFER_SIZE;
+		REPORT_ERROR(&env->err_str, err, "buffer size");
+		return err;
+	}
+	max_sz = res->size[i - 1];
+
+	dev_buf = clCreateBuffer(env->ctx, CL_MEM_READ_WRITE, max_sz, NULL, &err);
+	if (REPORT_ERROR(&env->err_str, err, "create device buffer")) goto out;
+	pinned_buf = clCreateBuffer(env->ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, max_sz, NULL, &err);
+	if (REPORT_ERROR(&env->err_str, err, "create pinned buffer")) goto out;
+	pinned = clEnqueueMapBuffer(env->queue, pinned_buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+		0, max_sz, 0, NULL, NULL, &err);
+	if (REPORT_ERROR(&env->err_str, err, "map pinned buffer")) goto out;
+	pageable = malloc(max_sz);
+	if (!pageable) {
+		err = CL_OUT_OF_HOST_MEMORY;
+		REPORT_ERROR(&env->err_str, err, "allocate pageable memory");
+		goto out;
+	}
+	/* first touch */
+	memset(pageable, 0, max_sz);
+	memset(pinned, 0, max_sz);
+
+	for (k = 0; k < BENCH_XFER_KINDS; ++k) {
+		const cl_bool write = (k == BENCH_XFER_WRITE_PAGEABLE || k == BENCH_XFER_WRITE_PINNED);
+		char *host = (k < BENCH_XFER_WRITE_PINNED ? pageable : pinned);
+		for (i = 0; i < res->num_sizes && !res->err[k]; ++i) {
+			const size_t sz = res->size[i];
+			/* fewer runs for the larger transfers */
+			const int runs = sz > ((size_t)16 << 20) ? 2 : BENCH_REPEAT;
+			cl_ulong best = 0;
+			int run;
+			/* run 0 is the warm-up */
+			for (run = 0; run <= runs; ++run) {
+				const cl_ulong start = timer_ns();
+				cl_ulong ns;
+				if (write)
+					err = clEnqueueWriteBuffer(env->queue, dev_buf, CL_TRUE, 0, sz, host, 0, NULL, NULL);
+				else
+					err = clEnqueueReadBuffer(env->queue, dev_buf, CL_TRUE, 0, sz, host, 0, NULL, NULL);
+				ns = timer_ns() - start;
+				if (err)
+					break;
+				if (run > 0 && (!best || ns < best))
+					best = ns;
+			}
+			res->err[k] = err;
+			if (!err) {
+				if (!best)
+					best = 1;
+				res->gbps[k][i] = (double)sz/best;
+				res->us[k][i] = best/1.0e3;
+			}
+		}
+	}
+	err = CL_SUCCESS;
+
+out:
+	free(pageable);
+	if (pinned)
+		clEnqueueUnmapMemObject(env->queue, pinned_buf, pinned, 0, NULL, NULL);
+	if (env->queue)
+		clFinish(env->queue);
+	if (pinned_buf)
+		clReleaseMemObject(pinned_buf);
+	if (dev_buf)
+		clReleaseMemObject(dev_buf);
+	return err;
+}
+
+/* Kernel launch latency and throughput, measured with an empty kernel
+ * on a given queue (created with profiling enabled) */
+
+static const char bench_empty_src[] = "kernel void empty(void) { }\n";
+
+/* number of launches timed one by one for the latency */
+#define BENCH_LAUNCH_RUNS 100
+/* number of launches enqueued back to back for the throughput */
+#define BENCH_LAUNCH_BATCH 1000
+
+struct bench_launch {
+	/* from enqueue to completion of a single launch, as reported by the profiling events */
+	double latency_us; /* median */
+	double min_latency_us;
+	/* from enqueue to the return of clFinish, as seen by the host (median) */
+	double host_latency_us;
+	/* sustained launches per second */
+	double launches_per_s;
+};
+
+int bench_ulong_cmp(const void *a, const void *b)
+{
+	const cl_ulong va = *(const cl_ulong *)a;
+	const cl_ulong vb = *(const cl_ulong *)b;
+	return (va > vb) - (va < vb);
+}
+
+cl_int bench_launch(struct bench_env *env, cl_command_queue queue, cl_kernel krn,
+	struct bench_launch *res)
+{
+	const size_t gws = 1;
+	cl_ulong dev_ns[BENCH_LAUNCH_RUNS], host_ns[BENCH_LAUNCH_RUNS];
+	cl_ulong start;
+	cl_int err;
+	int run;
+
+	memset(res, 0, sizeof(*res));
+
+	/* warm-up */
+	err = clEnqueueNDRangeKernel(queue, krn, 1, NULL, &gws, NULL, 0, NULL, NULL);
+	if (!err)
+		err = clFinish(queue);
+	if (REPORT_ERROR(&env->err_str, err, "warm-up launch"))
+		return err;
+
+	for (run = 0; run < BENCH_LAUNCH_RUNS; ++run) {
+		cl_ulong queued = 0, end = 0;
+		cl_event ev = NULL;
+		start = timer_ns();
+		err = clEnqueueNDRangeKernel(queue, krn, 1, NULL, &gws, NULL, 0, NULL, &ev);
+		if (REPORT_ERROR(&env->err_str, err, "launch"))
+			return err;
+		err = clFinish(queue);
+		host_ns[run] = timer_ns() - start;
+		if (!err)
+			err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, NULL);
+		if (!err)
+			err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+		clReleaseEvent(ev);
+		if (REPORT_ERROR(&env->err_str, err, "get launch profiling info"))
+			return err;
+		dev_ns[run] = end > queued ? end - queued : 0;
+	}
+	qsort(dev_ns, BENCH_LAUNCH_RUNS, sizeof(*dev_ns), bench_ulong_cmp);
+	qsort(host_ns, BENCH_LAUNCH_RUNS, sizeof(*host_ns), bench_ulong_cmp);
+	res->latency_us = dev_ns[BENCH_LAUNCH_RUNS/2]/1.0e3;
+	res->min_latency_us = dev_ns[0]/1.0e3;
+	res->host_latency_us = host_ns[BENCH_LAUNCH_RUNS/2]/1.0e3;
+
+	start = timer_ns();
+	for (run = 0; run < BENCH_LAUNCH_BATCH && !err; ++run)
+		err = clEnqueueNDRangeKernel(queue, krn, 1, NULL, &gws, NULL, 0, NULL, NULL);
+	if (!err)
+		err = clFinish(queue);
+	if (REPORT_ERROR(&env->err_str, err, "launch batch"))
+		return err;
+	res->launches_per_s = BENCH_LAUNCH_BATCH*1.0e9/(timer_ns() - start);
+	return CL_SUCCESS;
+}
+
+
+/* Copies between the devices of a platform: directly, for devices supporting
+ * cl_amd_copy_buffer_p2p, or staged through host memory. Each device has its own
+ * context, as required by clEnqueueCopyBufferP2PAMD */
+
+typedef void *(CL_API_CALL *bench_get_ext_fn)(cl_platform_id, const char *);
+typedef cl_int (CL_API_CALL *bench_copy_p2p_fn)(cl_command_queue, cl_mem, cl_mem,
+	size_t, size_t, size_t, cl_uint, const cl_event *, cl_event *);
+
+/* size of the copies timed for the bandwidth and for the latency */
+#define BENCH_P2P_SZ ((size_t)64 << 20)
+#define BENCH_P2P_LAT_SZ ((size_t)4)
+
+enum bench_p2p_kind {
+	BENCH_P2P_DIRECT,
+	BENCH_P2P_HOST,
+	BENCH_P2P_KINDS
+};
+
+struct bench_p2p {
+	cl_int err;
+	double gbps;
+	double latency_us;
+};
+
+/* Check if src can copy directly to dst */
+cl_bool bench_p2p_peer(cl_device_id src, cl_device_id dst)
+{
+	cl_device_id *peers = NULL;
+	cl_uint num_peers = 0, i;
+	cl_bool found = CL_FALSE;
+	cl_int err;
+
+	err = clGetDeviceInfo(src, CL_DEVICE_NUM_P2P_DEVICES_AMD, sizeof(num_peers), &num_peers, NULL);
+	if (err || !num_peers)
+		return CL_FALSE;
+	ALLOC(peers, num_peers, "P2P devices");
+	/* the number of peers cannot be queried with CL_DEVICE_P2P_DEVICES_AMD, see device_info_p2p_dev_list */
+	err = clGetDeviceInfo(src, CL_DEVICE_P2P_DEVICES_AMD, num_peers*sizeof(*peers), peers, NULL);
+	for (i = 0; i < num_peers && !err && !found; ++i)
+		found = (peers[i] == dst);
+	free(peers);
+	return found;
+}
+
+/* Time the copy of sz bytes from src_buf (on src) to dst_buf (on dst), best of BENCH_REPEAT:
+ * with copy_p2p if not NULL, otherwise with a blocking read into host, followed by
+ * a blocking write from it */
+cl_int bench_p2p_time(const struct bench_env *src, const struct bench_env *dst,
+	cl_mem src_buf, cl_mem dst_buf, size_t sz, bench_copy_p2p_fn copy_p2p,
+	void *host, cl_ulong *best)
+{
+	cl_int err = CL_SUCCESS;
+	int run;
+
+	*best = 0;
+	/* run 0 is the warm-up */
+	for (run = 0; run <= BENCH_REPEAT && !err; ++run) {
+		const cl_ulong start = timer_ns();
+		cl_ulong ns;
+		if (copy_p2p) {
+			err = copy_p2p(src->queue, src_buf, dst_buf, 0, 0, sz, 0, NULL, NULL);
+			if (!err)
+				err = clFinish(src->queue);
+		} else {
+			err = clEnqueueReadBuffer(src->queue, src_buf, CL_TRUE, 0, sz, host, 0, NULL, NULL);
+			if (!err)
+				err = clEnqueueWriteBuffer(dst->queue, dst_buf, CL_TRUE, 0, sz, host, 0, NULL, NULL);
+		}
+		ns = timer_ns() - start;
+		if (!err && run > 0 && (!*best || ns < *best))
+			*best = ns;
+	}
+	if (!err && !*best)
+		*best = 1;
+	return err;
+}
+
+void bench_p2p_pair(const struct bench_env *src, const struct bench_env *dst,
+	cl_mem src_buf, cl_mem dst_buf, size_t sz, bench_copy_p2p_fn copy_p2p,
+	void *host, struct bench_p2p *res)
+{
+	cl_ulong ns = 0;
+
+	memset(res, 0, sizeof(*res));
+	res->err = bench_p2p_time(src, dst, src_buf, dst_buf, sz, copy_p2p, host, &ns);
+	if (res->err)
+		return;
+	res->gbps = (double)sz/ns;
+	res->err = bench_p2p_time(src, dst, src_buf, dst_buf, BENCH_P2P_LAT_SZ, copy_p2p, host, &ns);
+	if (res->err)
+		return;
+	res->latency_us = ns/1.0e3;
+}
+
+
+/* Shared virtual memory and Intel unified shared memory: allocation and release
+ * latency, cost of the first access from the host and from the device, and
+ * bandwidth of the device accesses, for each kind of memory supported */
+
+/* The SVM (OpenCL 2.0) and USM (cl_intel_unified_shared_memory) entry points,
+ * looked up at runtime; NULL if not available */
+struct bench_mem_api {
+	void *(CL_API_CALL *svm_alloc)(cl_context, cl_bitfield, size_t, cl_uint);
+	void (CL_API_CALL *svm_free)(cl_context, void *);
+	cl_int (CL_API_CALL *svm_map)(cl_command_queue, cl_bool, cl_map_flags, void *, size_t,
+		cl_uint, const cl_event *, cl_event *);
+	cl_int (CL_API_CALL *svm_unmap)(cl_command_queue, void *, cl_uint, const cl_event *, cl_event *);
+	cl_int (CL_API_CALL *set_arg_svm)(cl_kernel, cl_uint, const void *);
+	void *(CL_API_CALL *usm_host_alloc)(cl_context, const cl_ulong *, size_t, cl_uint, cl_int *);
+	void *(CL_API_CALL *usm_device_alloc)(cl_context, cl_device_id, const cl_ulong *, size_t, cl_uint, cl_int *);
+	void *(CL_API_CALL *usm_shared_alloc)(cl_context, cl_device_id, const cl_ulong *, size_t, cl_uint, cl_int *);
+	cl_int (CL_API_CALL *usm_free)(cl_context, void *);
+	cl_int (CL_API_CALL *set_arg_usm)(cl_kernel, cl_uint, const void *);
+};
+
+enum bench_mem_kind {
+	BENCH_MEM_SVM_COARSE,
+	BENCH_MEM_SVM_FINE,
+	BENCH_MEM_SVM_SYSTEM,
+	BENCH_MEM_USM_HOST,
+	BENCH_MEM_USM_DEVICE,
+	BENCH_MEM_USM_SHARED,
+	BENCH_MEM_KINDS
+};
+
+/* consecutive kinds are SVM first, USM afterwards */
+#define BENCH_MEM_IS_USM(kind) ((kind) >= BENCH_MEM_USM_HOST)
+
+static const char bench_touch_src[] =
+	"kernel void touch(global uint4 *p) { const size_t i = get_global_id(0); p[i] += (uint4)(1); }\n";
+
+/* size of the allocations */
+#define BENCH_MEM_SZ ((size_t)64 << 20)
+
+struct bench_mem {
+	size_t size;
+	double alloc_us; /* best allocation time */
+	double free_us; /* best release time */
+	double host_touch_us; /* first host write to a new allocation (not for USM device memory) */
+	double first_touch_us; /* first kernel access to a new allocation */
+	double gbps; /* kernel read-write bandwidth, after the first access */
+};
+
+void *bench_mem_alloc(const struct bench_env *env, const struct bench_mem_api *api,
+	enum bench_mem_kind kind, size_t sz, cl_int *err)
+{
+	void *ptr = NULL;
+	*err = CL_SUCCESS;
+	switch (kind) {
+	case BENCH_MEM_SVM_COARSE:
+		ptr = api->svm_alloc(env->ctx, CL_MEM_READ_WRITE, sz, 0);
+		break;
+	case BENCH_MEM_SVM_FINE:
+		ptr = api->svm_alloc(env->ctx, CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER, sz, 0);
+		break;
+	case BENCH_MEM_SVM_SYSTEM:
+		ptr = malloc(sz);
+		break;
+	case BENCH_MEM_USM_HOST:
+		ptr = api->usm_host_alloc(env->ctx, NULL, sz, 0, err);
+		break;
+	case BENCH_MEM_USM_DEVICE:
+		ptr = api->usm_device_alloc(env->ctx, env->dev, NULL, sz, 0, err);
+		break;
+	case BENCH_MEM_USM_SHARED:
+		ptr = api->usm_shared_alloc(env->ctx, env->dev, NULL, sz, 0, err);
+		break;
+	default:
+		break;
+	}
+	if (!ptr && !*err)
+		*err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+	return ptr;
+}
+
+void bench_mem_free(const struct bench_env *env, const struct bench_mem_api *api,
+	enum bench_mem_kind kind, void *ptr)
+{
+	if (kind == BENCH_MEM_SVM_SYSTEM)
+		free(ptr);
+	else if (BENCH_MEM_IS_USM(kind))
+		api->usm_free(env->ctx, ptr);
+	else
+		api->svm_free(env->ctx, ptr);
+}
+
+/* write to the whole allocation from the host; coarse-grained buffers must be mapped */
+cl_int bench_mem_host_touch(const struct bench_env *env, const struct bench_mem_api *api,
+	enum bench_mem_kind kind, void *ptr, size_t sz)
+{
+	cl_int err = CL_SUCCESS;
+	if (kind == BENCH_MEM_SVM_COARSE) {
+		err = api->svm_map(env->queue, CL_TRUE, CL_MAP_WRITE, ptr, sz, 0, NULL, NULL);
+		if (err)
+			return err;
+	}
+	memset(ptr, 1, sz);
+	if (kind == BENCH_MEM_SVM_COARSE) {
+		err = api->svm_unmap(env->queue, ptr, 0, NULL, NULL);
+		if (!err)
+			err = clFinish(env->queue);
+	}
+	return err;
+}
+
+/* Measure the given kind of memory with the touch kernel krn */
+cl_int bench_mem(struct bench_env *env, const struct bench_mem_api *api,
+	enum bench_mem_kind kind, cl_kernel krn, struct bench_mem *res)
+{
+	cl_ulong max_alloc = 0, best_alloc = 0, best_free = 0, best = 0;
+	size_t gws;
+	void *ptr = NULL;
+	cl_int err;
+	int run;
+
+	memset(res, 0, sizeof(*res));
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_MAX_MEM_ALLOC_SIZE")) return err;
+	res->size = BENCH_MEM_SZ;
+	while (res->size > max_alloc)
+		res->size /= 2;
+	gws = res->size/16;
+
+	/* allocation and release latency; run 0 is the warm-up */
+	for (run = 0; run <= BENCH_REPEAT; ++run) {
+		cl_ulong start = timer_ns(), ns;
+		ptr = bench_mem_alloc(env, api, kind, res->size, &err);
+		ns = timer_ns() - start;
+		if (REPORT_ERROR(&env->err_str, err, "allocate memory"))
+			return err;
+		if (run > 0 && (!best_alloc || ns < best_alloc))
+			best_alloc = ns;
+		start = timer_ns();
+		bench_mem_free(env, api, kind, ptr);
+		ns = timer_ns() - start;
+		if (run > 0 && (!best_free || ns < best_free))
+			best_free = ns;
+	}
+	res->alloc_us = best_alloc/1.0e3;
+	res->free_us = best_free/1.0e3;
+
+	/* first touch on a new allocation, from the host and then from the device */
+	ptr = bench_mem_alloc(env, api, kind, res->size, &err);
+	if (REPORT_ERROR(&env->err_str, err, "allocate memory"))
+		return err;
+	if (kind != BENCH_MEM_USM_DEVICE) {
+		const cl_ulong start = timer_ns();
+		err = bench_mem_host_touch(env, api, kind, ptr, res->size);
+		res->host_touch_us = (timer_ns() - start)/1.0e3;
+		if (REPORT_ERROR(&env->err_str, err, "host access"))
+			goto out;
+	}
+	err = (BENCH_MEM_IS_USM(kind) ? api->set_arg_usm : api->set_arg_svm)(krn, 0, ptr);
+	if (REPORT_ERROR(&env->err_str, err, "set kernel argument"))
+		goto out;
+	for (run = 0; run <= BENCH_REPEAT; ++run) {
+		cl_event ev = NULL;
+		cl_ulong ns = 0;
+		err = clEnqueueNDRangeKernel(env->queue, krn, 1, NULL, &gws, NULL, 0, NULL, &ev);
+		if (REPORT_ERROR(&env->err_str, err, "launch kernel"))
+			goto out;
+		err = bench_event_ns(ev, &ns);
+		if (REPORT_ERROR(&env->err_str, err, "get kernel profiling info"))
+			goto out;
+		if (run == 0)
+			res->first_touch_us = ns/1.0e3;
+		else if (!best || ns < best)
+			best = ns;
+	}
+	/* each element is read and written */
+	res->gbps = 2.0*res->size/best;
+
+out:
+	clFinish(env->queue);
+	bench_mem_free(env, api, kind, ptr);
+	return err;
+}
+
+
+/* Program build times: from source (with a source the driver has never seen,
+ * and then again with the same source, to check if the driver caches the builds),
+ * with separate compilation and linking, and from a binary or IL */
+
+/* The OpenCL 1.2 and 2.1 entry points, looked up at runtime; NULL if not available */
+struct bench_compile_api {
+	cl_int (CL_API_CALL *compile)(cl_program, cl_uint, const cl_device_id *, const char *,
+		cl_uint, const cl_program *, const char **, void (CL_CALLBACK *)(cl_program, void *), void *);
+	cl_program (CL_API_CALL *link)(cl_context, cl_uint, const cl_device_id *, const char *,
+		cl_uint, const cl_program *, void (CL_CALLBACK *)(cl_program, void *), void *, cl_int *);
+	cl_program (CL_API_CALL *create_with_il)(cl_context, const void *, size_t, cl_int *);
+};
+
+/* SPIR-V module with an empty kernel, for the IL build: there is no way to get
+ * the IL for the probe source from the platform. The addressing model (word 10,
+ * the first operand of OpMemoryModel) must match the device address bits */
+static const cl_uint bench_empty_spirv[] = {
+	0x07230203, 0x00010000, 0, 5, 0, /* magic, version 1.0, generator, bound, schema */
+	0x00020011, 4, /* OpCapability Addresses */
+	0x00020011, 6, /* OpCapability Kernel */
+	0x0003000e, 2, 2, /* OpMemoryModel Physical64 OpenCL */
+	0x0005000f, 6, 3, 0x74706d65, 0x00000079, /* OpEntryPoint Kernel %3 "empty" */
+	0x00020013, 1, /* %1 = OpTypeVoid */
+	0x00030021, 2, 1, /* %2 = OpTypeFunction %1 */
+	0x00050036, 1, 3, 0, 2, /* %3 = OpFunction %1 None %2 */
+	0x000200f8, 4, /* %4 = OpLabel */
+	0x000100fd, /* OpReturn */
+	0x00010038, /* OpFunctionEnd */
+};
+#define BENCH_SPIRV_ADDRESSING_WORD 10
+#define BENCH_SPIRV_HEADER_WORDS 5
+#define BENCH_SPIRV_OP_MEMORY_MODEL 14
+
+/* Check that the word at index addr of the module is the addressing model operand
+ * of its OpMemoryModel, walking the instructions by their word counts */
+cl_bool bench_spirv_is_addressing_word(const cl_uint *words, size_t num_words, size_t addr)
+{
+	size_t i = BENCH_SPIRV_HEADER_WORDS;
+	while (i < num_words) {
+		const cl_uint count = words[i] >> 16, opcode = words[i] & 0xffff;
+		if (opcode == BENCH_SPIRV_OP_MEMORY_MODEL)
+			return count == 3 && i + 1 == addr;
+		if (!count)
+			break;
+		i += count;
+	}
+	return CL_FALSE;
+}
+
+struct bench_compile {
+	double build_ms; /* clCreateProgramWithSource + clBuildProgram, new source */
+	double rebuild_ms; /* the same, with the same source again */
+	double compile_ms; /* clCreateProgramWithSource + clCompileProgram, new source */
+	double link_ms; /* clLinkProgram of the compiled program */
+	double binary_ms; /* clCreateProgramWithBinary + clBuildProgram, binary of the first build */
+	double il_ms; /* clCreateProgramWithIL + clBuildProgram, empty kernel */
+	size_t binary_size;
+	cl_bool has_compile; /* compile_ms and link_ms are set */
+	cl_bool has_il; /* il_ms is set */
+};
+
+/* Prepend to src a comment line making it unique, so that the driver cannot
+ * have it in its cache; tag holds the comment. The array should be freed by the caller */
+const char **bench_unique_src(char *tag, size_t tag_sz, const char *what,
+	const char * const *src, cl_uint nsrc)
+{
+	const char **usrc = NULL;
+	snprintf(tag, tag_sz, "/* clinfo %s benchmark %lu %" PRIu64 " */\n",
+		what, (unsigned long)time(NULL), timer_ns());
+	ALLOC(usrc, nsrc + 1, "benchmark source");
+	usrc[0] = tag;
+	memcpy(usrc + 1, src, nsrc*sizeof(*src));
+	return usrc;
+}
+
+cl_int bench_compile(struct bench_env *env, const struct bench_compile_api *api,
+	const char * const *src, cl_uint nsrc, cl_bool use_il, struct bench_compile *res)
+{
+	cl_program prg = NULL, prg2 = NULL;
+	unsigned char *binary = NULL;
+	const char **usrc;
+	char tag[96];
+	cl_ulong start;
+	cl_int err, status;
+
+	memset(res, 0, sizeof(*res));
+
+	/* build from a new source, and then once more from the same source */
+	usrc = bench_unique_src(tag, sizeof(tag), "build", src, nsrc);
+	start = timer_ns();
+	prg = bench_build(env, usrc, nsrc + 1, NULL, &err);
+	res->build_ms = (timer_ns() - start)/1.0e6;
+	if (!err) {
+		start = timer_ns();
+		prg2 = bench_build(env, usrc, nsrc + 1, NULL, &err);
+		res->rebuild_ms = (timer_ns() - start)/1.0e6;
+	}
+	free(usrc);
+	if (err)
+		goto out;
+	clReleaseProgram(prg2);
+	prg2 = NULL;
+
+	/* separate compilation and linking */
+	if (api->compile && api->link) {
+		cl_program linked;
+		usrc = bench_unique_src(tag, sizeof(tag), "compile", src, nsrc);
+		start = timer_ns();
+		prg2 = clCreateProgramWithSource(env->ctx, nsrc + 1, usrc, NULL, &err);
+		free(usrc);
+		if (REPORT_ERROR(&env->err_str, err, "create program"))
+			goto out;
+		err = api->compile(prg2, 1, &env->dev, NULL, 0, NULL, NULL, NULL, NULL);
+		res->compile_ms = (timer_ns() - start)/1.0e6;
+		if (REPORT_ERROR(&env->err_str, err, "compile program"))
+			goto out;
+		start = timer_ns();
+		linked = api->link(env->ctx, 1, &env->dev, NULL, 1, &prg2, NULL, NULL, &err);
+		res->link_ms = (timer_ns() - start)/1.0e6;
+		if (REPORT_ERROR(&env->err_str, err, "link program"))
+			goto out;
+		clReleaseProgram(linked);
+		clReleaseProgram(prg2);
+		prg2 = NULL;
+		res->has_compile = CL_TRUE;
+	}
+
+	/* reload from the binary of the first build */
+	err = clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, sizeof(res->binary_size), &res->binary_size, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_PROGRAM_BINARY_SIZES"))
+		goto out;
+	if (!res->binary_size) {
+		err = CL_INVALID_PROGRAM_EXECUTABLE;
+		REPORT_ERROR(&env->err_str, err, "get program binary");
+		goto out;
+	}
+	ALLOC(binary, res->binary_size, "program binary");
+	err = clGetProgramInfo(prg, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_PROGRAM_BINARIES"))
+		goto out;
+	start = timer_ns();
+	prg2 = clCreateProgramWithBinary(env->ctx, 1, &env->dev, &res->binary_size,
+		(const unsigned char **)&binary, &status, &err);
+	if (!err)
+		err = status;
+	if (REPORT_ERROR(&env->err_str, err, "create program from binary"))
+		goto out;
+	err = clBuildProgram(prg2, 1, &env->dev, NULL, NULL, NULL);
+	res->binary_ms = (timer_ns() - start)/1.0e6;
+	if (REPORT_ERROR(&env->err_str, err, "build program from binary"))
+		goto out;
+	clReleaseProgram(prg2);
+	prg2 = NULL;
+
+	/* build from IL */
+	if (use_il && api->create_with_il) {
+		cl_uint spirv[sizeof(bench_empty_spirv)/sizeof(*bench_empty_spirv)];
+		cl_uint addr_bits = 0;
+		memcpy(spirv, bench_empty_spirv, sizeof(spirv));
+		if (!bench_spirv_is_addressing_word(spirv, sizeof(spirv)/sizeof(*spirv), BENCH_SPIRV_ADDRESSING_WORD)) {
+			err = CL_INVALID_VALUE;
+			REPORT_ERROR(&env->err_str, err, "find the SPIR-V addressing model");
+			goto out;
+		}
+		clGetDeviceInfo(env->dev, CL_DEVICE_ADDRESS_BITS, sizeof(addr_bits), &addr_bits, NULL);
+		if (addr_bits == 32)
+			spirv[BENCH_SPIRV_ADDRESSING_WORD] = 1; /* Physical32 */
+		start = timer_ns();
+		prg2 = api->create_with_il(env->ctx, spirv, sizeof(spirv), &err);
+		if (REPORT_ERROR(&env->err_str, err, "create program from IL"))
+			goto out;
+		err = clBuildProgram(prg2, 1, &env->dev, NULL, NULL, NULL);
+		res->il_ms = (timer_ns() - start)/1.0e6;
+		if (REPORT_ERROR(&env->err_str, err, "build program from IL"))
+			goto out;
+		res->has_il = CL_TRUE;
+	}
+
+out:
+	free(binary);
+	if (prg2)
+		clReleaseProgram(prg2);
+	if (prg)
+		clReleaseProgram(prg);
+	return err;
+}
+
+/* Peak floating-point throughput, measured with kernels running independent
+ * chains of multiply-adds on registers, for half, float and double, at the
+ * native vector width of the device for each type. The kernels use mad()
+ * rather than fma(), since it maps to the fastest multiply-add the hardware has,
+ * while fma() must be correctly rounded and may be emulated. */
+
+enum bench_fp_type {
+	BENCH_FP_HALF,
+	BENCH_FP_FLOAT,
+	BENCH_FP_DOUBLE,
+	BENCH_FP_TYPES
+};
+
+static const struct bench_fp_info {
+	const char *type;
+	size_t size;
+	const char *ext; /* extension to enable in the kernel, NULL if none */
+	cl_device_info native_width;
+} bench_fp_info[BENCH_FP_TYPES] = {
+	{ "half", 2, "cl_khr_fp16", CL_DEVICE_NATIVE_VECTOR_WIDTH_HALF },
+	{ "float", 4, NULL, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT },
+	{ "double", 8, "cl_khr_fp64", CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE },
+};
+
+/* multiply-adds per vector lane in each iteration of the kernel loop */
+#define BENCH_FLOPS_MADS 32
+/* the number of iterations is scaled up until a run takes at least this long (in ns),
+ * so that the launch overhead is negligible */
+#define BENCH_FLOPS_MIN_NS 20000000U
+#define BENCH_FLOPS_MAX_ITERS (1U << 20)
+/* upper limit to the size of the output buffer */
+#define BENCH_FLOPS_MAX_BUF ((size_t)64 << 20)
+
+/* The values converge to n/(1 - m) = 1, so there are no overflows or denormals;
+ * m and n are kernel arguments, so the chains cannot be folded */
+static const char bench_flops_src[] =
+	"#define STEP a = mad(a, m, n); b = mad(b, m, n); c = mad(c, m, n); d = mad(d, m, n);\n"
+	"#define STEP4 STEP STEP STEP STEP\n"
+	"kernel void flops(global VT *out, float fm, float fn, int iters)\n"
+	"{\n"
+	"	const VT m = (VT)((T)fm), n = (VT)((T)fn);\n"
+	"	VT a = (VT)((T)(get_local_id(0) & 7)), b = a + (T)1, c = a + (T)2, d = a + (T)3;\n"
+	"	for (int i = 0; i < iters; ++i) { STEP4 STEP4 }\n"
+	"	out[get_global_id(0)] = a + b + c + d;\n"
+	"}\n";
+
+struct bench_flops {
+	size_t gws;
+	cl_bool supported[BENCH_FP_TYPES];
+	cl_uint width[BENCH_FP_TYPES]; /* vector width of the kernel */
+	cl_int err[BENCH_FP_TYPES];
+	char err_str[BENCH_FP_TYPES][256]; /* error message of each type that failed */
+	double gflops[BENCH_FP_TYPES];
+};
+
+/* Run the kernel for one type; the result goes in res->gflops[t] */
+cl_int bench_flops_type(struct bench_env *env, enum bench_fp_type t, struct bench_flops *res)
+{
+	const struct bench_fp_info *info = bench_fp_info + t;
+	char defs[160];
+	const char *src[2] = { defs, bench_flops_src };
+	cl_program prg = NULL;
+	cl_kernel krn = NULL;
+	cl_mem buf = NULL;
+	cl_uint width = 0;
+	cl_int err, iters = 16;
+	cl_ulong best = 0, ns = 0;
+	const cl_float fm = 0.5f, fn = 0.5f;
+	int run;
+
+	/* only powers of two are valid vector widths */
+	clGetDeviceInfo(env->dev, info->native_width, sizeof(width), &width, NULL);
+	res->width[t] = 1;
+	while (res->width[t] < width && res->width[t] < 16)
+		res->width[t] *= 2;
+
+	if (res->width[t] > 1)
+		snprintf(defs, sizeof(defs), "%s%s%s#define T %s\n#define VT %s%u\n",
+			info->ext ? "#pragma OPENCL EXTENSION " : "", info->ext ? info->ext : "",
+			info->ext ? " : enable\n" : "", info->type, info->type, res->width[t]);
+	else
+		snprintf(defs, sizeof(defs), "%s%s%s#define T %s\n#define VT %s\n",
+			info->ext ? "#pragma OPENCL EXTENSION " : "", info->ext ? info->ext : "",
+			info->ext ? " : enable\n" : "", info->type, info->type);
+
+	prg = bench_build(env, src, 2, NULL, &err);
+	if (err) goto out;
+	krn = clCreateKernel(prg, "flops", &err);
+	if (REPORT_ERROR(&env->err_str, err, "create kernel")) goto out;
+	buf = bench_buffer(env, res->gws*res->width[t]*info->size, &err);
+	if (err) goto out;
+
+	err = clSetKernelArg(krn, 0, sizeof(buf), &buf);
+	if (!err) err = clSetKernelArg(krn, 1, sizeof(fm), &fm);
+	if (!err) err = clSetKernelArg(krn, 2, sizeof(fn), &fn);
+	if (REPORT_ERROR(&env->err_str, err, "set kernel arguments")) goto out;
+
+	/* run 0 is the warm-up, and the calibration: the following runs
+	 * use a number of iterations scaled to take at least BENCH_FLOPS_MIN_NS */
+	for (run = 0; run <= BENCH_REPEAT; ++run) {
+		cl_event ev = NULL;
+		err = clSetKernelArg(krn, 3, sizeof(iters), &iters);
+		if (!err)
+			err = clEnqueueNDRangeKernel(env->queue, krn, 1, NULL, &res->gws, NULL, 0, NULL, &ev);
+		if (!err)
+			err = bench_event_ns(ev, &ns);
+		if (REPORT_ERROR(&env->err_str, err, "run kernel")) goto out;
+		if (run == 0) {
+			while (ns < BENCH_FLOPS_MIN_NS && (cl_uint)iters < BENCH_FLOPS_MAX_ITERS) {
+				iters *= 2;
+				ns *= 2;
+			}
+			continue;
+		}
+		if (!best || ns < best)
+			best = ns;
+	}
+	res->gflops[t] = 2.0*BENCH_FLOPS_MADS*iters*res->width[t]*res->gws/best;
+
+out:
+	if (buf)
+		clReleaseMemObject(buf);
+	if (krn)
+		clReleaseKernel(krn);
+	if (prg)
+		clReleaseProgram(prg);
+	return err;
+}
+
+/* Measure the throughput for each of the types marked as supported */
+void bench_flops(struct bench_env *env, const cl_bool *supported, struct bench_flops *res)
+{
+	cl_uint cus = 1;
+	size_t wgs = 1;
+	cl_uint t;
+
+	memset(res, 0, sizeof(*res));
+	clGetDeviceInfo(env->dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cus), &cus, NULL);
+	clGetDeviceInfo(env->dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(wgs), &wgs, NULL);
+	/* enough work-items to fill the device several times over */
+	res->gws = (size_t)(cus ? cus : 1)*(wgs ? wgs : 1)*8;
+	/* the largest vector is a double16 */
+	if (res->gws > BENCH_FLOPS_MAX_BUF/(16*sizeof(cl_double)))
+		res->gws = BENCH_FLOPS_MAX_BUF/(16*sizeof(cl_double));
+
+	for (t = 0; t < BENCH_FP_TYPES; ++t) {
+		res->supported[t] = supported[t];
+		if (!supported[t])
+			continue;
+		res->err[t] = bench_flops_type(env, (enum bench_fp_type)t, res);
+		/* env->err_str only holds the last error, keep the message of each type */
+		if (res->err[t]) {
+			snprintf(res->err_str[t], sizeof(res->err_str[t]), "%s", env->err_str.buf);
+			reset_strbuf(&env->err_str);
+		}
+	}
+}
+
+/* Memory hierarchy: the latency of a single work-item chasing pointers through
+ * working sets of increasing size shows the actual cache levels, as steps in
+ * the latency; the local memory bandwidth, read with increasing strides between
+ * the work-items, shows the bank conflicts. */
+
+/* working sets from 1KiB to 128MiB, doubling each time */
+#define BENCH_CHASE_MIN_SZ ((size_t)1 << 10)
+#define BENCH_CHASE_SIZES 18
+#define BENCH_CHASE_HOPS (1 << 16)
+/* latency increase between consecutive working sets marking the end of a cache level */
+#define BENCH_CHASE_STEP 1.3
+/* node stride if the device doesn't report a cacheline size */
+#define BENCH_CHASE_LINE 64
+
+/* The hops are unrolled, so that the loop overhead is hidden in the load latency;
+ * the final pointer is stored, so that the chain cannot be optimized out */
+static const char bench_chase_src[] =
+	"#define HOP p = next[p];\n"
+	"kernel void chase(global const uint *next, global uint *out, int hops)\n"
+	"{\n"
+	"	uint p = 0;\n"
+	"	for (int i = 0; i < hops; i += 8) { HOP HOP HOP HOP HOP HOP HOP HOP }\n"
+	"	out[0] = p;\n"
+	"}\n";
+
+struct bench_cache_level {
+	size_t size; /* largest working set fitting in the level */
+	double latency_ns;
+};
+
+struct bench_cache_latency {
+	size_t line; /* distance between the nodes of the chain */
+	cl_uint num_sizes;
+	size_t size[BENCH_CHASE_SIZES];
+	double latency_ns[BENCH_CHASE_SIZES];
+	cl_uint num_levels;
+	struct bench_cache_level level[BENCH_CHASE_SIZES];
+};
+
+/* Find the cache levels from the latency curve: each level ends at a jump in
+ * the latency, and the consecutive jumps of a gradual rise to the next plateau
+ * are merged; the latency of a level is the one at the start of its plateau */
+void bench_cache_levels(struct bench_cache_latency *res)
+{
+	cl_uint i, start = 0;
+	cl_bool rising = CL_FALSE;
+
+	res->num_levels = 0;
+	for (i = 1; i < res->num_sizes; ++i) {
+		const cl_bool jump = res->latency_ns[i] > BENCH_CHASE_STEP*res->latency_ns[i - 1];
+		if (jump && !rising) {
+			struct bench_cache_level *lvl = res->level + res->num_levels++;
+			lvl->size = res->size[i - 1];
+			lvl->latency_ns = res->latency_ns[start];
+		} else if (!jump && rising) {
+			start = i - 1;
+		}
+		rising = jump;
+	}
+}
+
+/* Fill next (of sz bytes) with a single random cycle through nodes line bytes apart,
+ * using Sattolo's algorithm, so that the hardware prefetchers cannot anticipate
+ * the loads; a fixed seed keeps the runs comparable */
+void bench_chase_init(cl_uint *next, size_t sz, size_t line)
+{
+	const size_t step = line/sizeof(*next), nodes = sz/line;
+	cl_uint *order;
+	cl_uint seed = 2463534242U;
+	size_t i;
+
+	ALLOC(order, nodes, "pointer chase");
+	for (i = 0; i < nodes; ++i)
+		order[i] = (cl_uint)(i*step);
+	for (i = nodes - 1; i > 0; --i) {
+		size_t j;
+		cl_uint tmp;
+		/* xorshift32 */
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		j = seed % i;
+		tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+	}
+	memset(next, 0, sz);
+	for (i = 0; i < nodes; ++i)
+		next[order[i]] = order[(i + 1) % nodes];
+	free(order);
+}
+
+/* Latency for each working-set size, up to the smallest of 128MiB,
+ * the largest allocation and a quarter of the global memory */
+cl_int bench_cache_latency(struct bench_env *env, struct bench_cache_latency *res)
+{
+	const char *src[1] = { bench_chase_src };
+	const size_t one = 1;
+	const cl_int hops = BENCH_CHASE_HOPS;
+	cl_program prg = NULL;
+	cl_kernel krn = NULL;
+	cl_mem out = NULL;
+	cl_uint *host = NULL;
+	cl_ulong max_alloc = 0, global_mem = 0, max_sz;
+	cl_uint line = 0;
+	cl_int err;
+	size_t sz;
+
+	memset(res, 0, sizeof(*res));
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_MAX_MEM_ALLOC_SIZE")) return err;
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_GLOBAL_MEM_SIZE")) return err;
+	clGetDeviceInfo(env->dev, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, sizeof(line), &line, NULL);
+	/* the nodes must be aligned cl_uints */
+	res->line = line >= sizeof(cl_uint) && !(line & (line - 1)) ? line : BENCH_CHASE_LINE;
+
+	max_sz = BENCH_CHASE_MIN_SZ << (BENCH_CHASE_SIZES - 1);
+	if (max_sz > max_alloc)
+		max_sz = max_alloc;
+	if (max_sz > global_mem/4)
+		max_sz = global_mem/4;
+
+	prg = bench_build(env, src, 1, NULL, &err);
+	if (err) goto out;
+	krn = clCreateKernel(prg, "chase", &err);
+	if (REPORT_ERROR(&env->err_str, err, "create kernel")) goto out;
+	out = bench_buffer(env, sizeof(cl_uint), &err);
+	if (err) goto out;
+	err = clSetKernelArg(krn, 1, sizeof(out), &out);
+	if (!err) err = clSetKernelArg(krn, 2, sizeof(hops), &hops);
+	if (REPORT_ERROR(&env->err_str, err, "set kernel arguments")) goto out;
+
+	ALLOC(host, max_sz/sizeof(*host), "pointer chase");
+
+	for (sz = BENCH_CHASE_MIN_SZ; sz <= max_sz && sz >= 2*res->line; sz *= 2) {
+		cl_mem buf;
+		cl_ulong best = 0, ns = 0;
+		int run;
+
+		bench_chase_init(host, sz, res->line);
+		buf = clCreateBuffer(env->ctx, CL_MEM_READ_ONLY, sz, NULL, &err);
+		if (REPORT_ERROR(&env->err_str, err, "create buffer")) goto out;
+		err = clEnqueueWriteBuffer(env->queue, buf, CL_TRUE, 0, sz, host, 0, NULL, NULL);
+		if (!REPORT_ERROR(&env->err_str, err, "write buffer")) {
+			err = clSetKernelArg(krn, 0, sizeof(buf), &buf);
+			REPORT_ERROR(&env->err_str, err, "set kernel arguments");
+		}
+		/* run 0 is the warm-up, which also brings the working set into the caches */
+		for (run = 0; !err && run <= BENCH_REPEAT; ++run) {
+			cl_event ev = NULL;
+			err = clEnqueueNDRangeKernel(env->queue, krn, 1, NULL, &one, &one, 0, NULL, &ev);
+			if (!err)
+				err = bench_event_ns(ev, &ns);
+			if (REPORT_ERROR(&env->err_str, err, "run kernel")) break;
+			if (run > 0 && (!best || ns < best))
+				best = ns;
+		}
+		clReleaseMemObject(buf);
+		if (err) goto out;
+
+		res->size[res->num_sizes] = sz;
+		res->latency_ns[res->num_sizes] = (double)best/hops;
+		++res->num_sizes;
+	}
+	bench_cache_levels(res);
+
+out:
+	free(host);
+	if (out)
+		clReleaseMemObject(out);
+	if (krn)
+		clReleaseKernel(krn);
+	if (prg)
+		clReleaseProgram(prg);
+	return err;
+}
+
+/* Local memory bandwidth: each work-item of a work-group reads, from a local
+ * buffer of 32 floats per work-item, the consecutive elements starting at
+ * lid*stride. With a stride of 1 the work-items access consecutive banks;
+ * larger strides map more of them to the same bank, serializing the accesses. */
+
+/* strides from 1 to 32, doubling each time */
+#define BENCH_LMEM_STRIDES 6
+#define BENCH_LMEM_PER_ITEM 32
+#define BENCH_LMEM_MAX_WG 256
+/* reads per work-item, in each iteration of the kernel loop */
+#define BENCH_LMEM_READS 8
+
+static const char bench_lmem_src[] =
+	"#define READ acc += buf[idx & mask]; ++idx;\n"
+	"kernel void lmem(global float *out, local float *buf, int stride, int iters)\n"
+	"{\n"
+	"	const int lid = get_local_id(0), n = get_local_size(0);\n"
+	"	const int mask = n*32 - 1;\n"
+	"	int idx = lid*stride;\n"
+	"	float acc = 0;\n"
+	"	for (int i = lid; i <= mask; i += n) buf[i] = i;\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (int i = 0; i < iters; ++i) { READ READ READ READ READ READ READ READ }\n"
+	"	out[get_global_id(0)] = acc;\n"
+	"}\n";
+
+struct bench_local_bandwidth {
+	size_t lws, gws;
+	cl_int err[BENCH_LMEM_STRIDES];
+	double gbps[BENCH_LMEM_STRIDES];
+};
+
+cl_int bench_local_bandwidth(struct bench_env *env, struct bench_local_bandwidth *res)
+{
+	const char *src[1] = { bench_lmem_src };
+	cl_program prg = NULL;
+	cl_kernel krn = NULL;
+	cl_mem out = NULL;
+	cl_ulong local_mem = 0;
+	cl_uint cus = 1;
+	size_t wgs = 1, lmem_sz;
+	cl_int err;
+	cl_uint s;
+
+	memset(res, 0, sizeof(*res));
+	err = clGetDeviceInfo(env->dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_DEVICE_LOCAL_MEM_SIZE")) return err;
+	clGetDeviceInfo(env->dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cus), &cus, NULL);
+
+	prg = bench_build(env, src, 1, NULL, &err);
+	if (err) goto out;
+	krn = clCreateKernel(prg, "lmem", &err);
+	if (REPORT_ERROR(&env->err_str, err, "create kernel")) goto out;
+	err = clGetKernelWorkGroupInfo(krn, env->dev, CL_KERNEL_WORK_GROUP_SIZE, sizeof(wgs), &wgs, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "get CL_KERNEL_WORK_GROUP_SIZE")) goto out;
+
+	/* the masking in the kernel needs a power of two */
+	res->lws = 1;
+	while (2*res->lws <= wgs && 2*res->lws <= BENCH_LMEM_MAX_WG &&
+		2*res->lws*BENCH_LMEM_PER_ITEM*sizeof(cl_float) <= local_mem)
+		res->lws *= 2;
+	lmem_sz = res->lws*BENCH_LMEM_PER_ITEM*sizeof(cl_float);
+	if (lmem_sz > local_mem) {
+		err = CL_OUT_OF_RESOURCES;
+		REPORT_ERROR(&env->err_str, err, "fit the local buffer");
+		goto out;
+	}
+	/* a few work-groups for each compute unit */
+	res->gws = res->lws*(cus ? cus : 1)*4;
+
+	out = bench_buffer(env, res->gws*sizeof(cl_float), &err);
+	if (err) goto out;
+	err = clSetKernelArg(krn, 0, sizeof(out), &out);
+	if (!err) err = clSetKernelArg(krn, 1, lmem_sz, NULL);
+	if (REPORT_ERROR(&env->err_str, err, "set kernel arguments")) goto out;
+
+	for (s = 0; s < BENCH_LMEM_STRIDES; ++s) {
+		const cl_int stride = 1 << s;
+		cl_int iters = 16;
+		cl_ulong best = 0, ns = 0;
+		int run;
+
+		err = clSetKernelArg(krn, 2, sizeof(stride), &stride);
+		/* run 0 is the warm-up, and the calibration, as in bench_flops_type */
+		for (run = 0; !err && run <= BENCH_REPEAT; ++run) {
+			cl_event ev = NULL;
+			err = clSetKernelArg(krn, 3, sizeof(iters), &iters);
+			if (!err)
+				err = clEnqueueNDRangeKernel(env->queue, krn, 1, NULL, &res->gws, &res->lws, 0, NULL, &ev);
+			if (!err)
+				err = bench_event_ns(ev, &ns);
+			if (err) break;
+			if (run == 0) {
+				while (ns < BENCH_FLOPS_MIN_NS && (cl_uint)iters < BENCH_FLOPS_MAX_ITERS) {
+					iters *= 2;
+					ns *= 2;
+				}
+				continue;
+			}
+			if (!best || ns < best)
+				best = ns;
+		}
+		res->err[s] = err;
+		if (!err)
+			res->gbps[s] = (double)BENCH_LMEM_READS*sizeof(cl_float)*iters*res->gws/best;
+	}
+	err = CL_SUCCESS;
+
+out:
+	if (out)
+		clReleaseMemObject(out);
+	if (krn)
+		clReleaseKernel(krn);
+	if (prg)
+		clReleaseProgram(prg);
+	return err;
+}
+
+#endif
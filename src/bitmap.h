@@ -0,0 +1,55 @@
+/* Bitmaps that grow as bits are set, e.g. for the selected devices
+ * of each platform: testing a bit is then constant-time, regardless
+ * of how many bits were set
+ */
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <string.h>
+
+#include "ext.h"
+#include "memory.h"
+
+#define BITMAP_WORD_BITS 64
+
+struct bitmap {
+	cl_ulong *word;
+	size_t num_words;
+	size_t count; /* number of bits set */
+};
+
+static inline cl_bool bitmap_test(const struct bitmap *bm, size_t bit)
+{
+	const size_t w = bit/BITMAP_WORD_BITS;
+	return w < bm->num_words && (bm->word[w] >> (bit % BITMAP_WORD_BITS) & 1);
+}
+
+static inline void bitmap_set(struct bitmap *bm, size_t bit)
+{
+	const size_t w = bit/BITMAP_WORD_BITS;
+	const cl_ulong mask = (cl_ulong)1 << (bit % BITMAP_WORD_BITS);
+
+	if (w >= bm->num_words) {
+		size_t num_words = bm->num_words ? 2*bm->num_words : 1;
+		while (num_words <= w)
+			num_words *= 2;
+		REALLOC(bm->word, num_words, "bitmap");
+		memset(bm->word + bm->num_words, 0, (num_words - bm->num_words)*sizeof(*bm->word));
+		bm->num_words = num_words;
+	}
+	if (!(bm->word[w] & mask)) {
+		bm->word[w] |= mask;
+		++bm->count;
+	}
+}
+
+static inline void bitmap_free(struct bitmap *bm)
+{
+	free(bm->word);
+	bm->word = NULL;
+	bm->num_words = 0;
+	bm->count = 0;
+}
+
+#endif
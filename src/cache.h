@@ -0,0 +1,194 @@
+/* On-disk cache support: data produced by previous runs (such as
+ * compiled program binaries) is stored in files named after a hash
+ * of a key that identifies what the data depends on (platform, driver, etc).
+ * The key itself is stored at the beginning of the file, so that
+ * hash collisions and stale files are detected on load.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _MSC_VER
+# include <direct.h>
+# include <process.h>
+# define make_dir(path) _mkdir(path)
+# define get_pid() _getpid()
+#else
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# define make_dir(path) mkdir(path, 0755)
+# define get_pid() getpid()
+#endif
+
+#include "ext.h"
+#include "memory.h"
+#include "strbuf.h"
+
+/* cache file format version, bump when changing the layout */
+#define CACHE_MAGIC "clinfo-cache-1"
+
+/* 64-bit FNV-1a hash */
+static inline cl_ulong cache_hash(const char *data, size_t len)
+{
+	cl_ulong hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* Find the directory to use for the cache, which is off unless asked for:
+ * CLINFO_CACHE_DIR if set (an empty value disables the cache), or else,
+ * if requested, a clinfo subdirectory of the standard per-user cache location.
+ * Returns NULL if the cache is disabled or no directory could be found.
+ * The returned string should be freed by the caller.
+ */
+char *cache_dir_default(cl_bool requested)
+{
+	const char *env = getenv("CLINFO_CACHE_DIR");
+	const char *base = NULL;
+	const char *sub = NULL;
+	char *dir = NULL;
+	size_t len;
+
+	if (env) {
+		if (!*env)
+			return NULL;
+		len = strlen(env);
+		ALLOC(dir, len + 1, "cache dir");
+		memcpy(dir, env, len + 1);
+		return dir;
+	}
+	if (!requested)
+		return NULL;
+
+#ifdef _WIN32
+	base = getenv("LOCALAPPDATA");
+	sub = "\\clinfo";
+#else
+	base = getenv("XDG_CACHE_HOME");
+	sub = "/clinfo";
+	if (!base || !*base) {
+		base = getenv("HOME");
+		sub = "/.cache/clinfo";
+	}
+#endif
+	if (!base || !*base)
+		return NULL;
+
+	len = strlen(base) + strlen(sub);
+	ALLOC(dir, len + 1, "cache dir");
+	snprintf(dir, len + 1, "%s%s", base, sub);
+	return dir;
+}
+
+/* Create the cache directory and its parents if they don't exist;
+ * returns non-zero on success */
+int cache_make_dir(const char *dir)
+{
+	size_t len = strlen(dir);
+	char *path;
+	int ok;
+
+	ALLOC(path, len + 1, "cache dir path");
+	memcpy(path, dir, len + 1);
+	for (size_t i = 1; i < len; ++i) {
+		if (path[i] != '/' && path[i] != '\\')
+			continue;
+		path[i] = '\0';
+		make_dir(path);
+		path[i] = dir[i];
+	}
+	ok = !make_dir(path) || errno == EEXIST;
+	free(path);
+	return ok;
+}
+
+/* Set str to the path of the cache file for the given kind of data and key */
+void cache_path(struct _strbuf *str, const char *dir, const char *kind, const char *key)
+{
+	reset_strbuf(str);
+	strbuf_append(__func__, str, "%s/%s-%016" PRIx64 ".bin",
+		dir, kind, cache_hash(key, strlen(key)));
+}
+
+/* Load the data stored for key at path. Returns the data (to be freed by the caller)
+ * and its size in *size, or NULL if there is no valid data for the key
+ */
+void *cache_load(const char *path, const char *key, size_t *size)
+{
+	const size_t magic_len = sizeof(CACHE_MAGIC);
+	const size_t key_len = strlen(key) + 1;
+	FILE *f = fopen(path, "rb");
+	char *data = NULL;
+	long fsize;
+
+	*size = 0;
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) || (fsize = ftell(f)) < 0 ||
+		(size_t)fsize <= magic_len + key_len || fseek(f, 0, SEEK_SET))
+		goto out;
+
+	ALLOC(data, fsize, "cache data");
+	if (fread(data, 1, fsize, f) != (size_t)fsize ||
+		memcmp(data, CACHE_MAGIC, magic_len) ||
+		memcmp(data + magic_len, key, key_len)) {
+		free(data);
+		data = NULL;
+		goto out;
+	}
+
+	/* move the payload to the beginning */
+	*size = fsize - magic_len - key_len;
+	memmove(data, data + magic_len + key_len, *size);
+out:
+	fclose(f);
+	return data;
+}
+
+/* Store the data for key at path, creating dir if necessary. Failures are silently
+ * ignored, since the cache is not essential. The file is written under a temporary
+ * name and then moved in place, so that concurrent runs never see partial data.
+ */
+void cache_store(const char *dir, const char *path, const char *key, const void *data, size_t size)
+{
+	struct _strbuf tmp;
+	FILE *f;
+	int ok;
+
+	if (!cache_make_dir(dir))
+		return;
+
+	init_strbuf(&tmp, __func__);
+	/* the temporary name must be unique across processes and threads */
+	strbuf_append(__func__, &tmp, "%s.%lu.%p.tmp", path, (unsigned long)get_pid(), (void*)&tmp);
+	f = fopen(tmp.buf, "wb");
+	if (!f) {
+		free_strbuf(&tmp);
+		return;
+	}
+	ok = fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC), f) == sizeof(CACHE_MAGIC);
+	ok = ok && fwrite(key, 1, strlen(key) + 1, f) == strlen(key) + 1;
+	ok = ok && fwrite(data, 1, size, f) == size;
+	ok = !fclose(f) && ok;
+	if (ok) {
+#ifdef _WIN32
+		remove(path); /* rename does not overwrite existing files on Windows */
+#endif
+		ok = !rename(tmp.buf, path);
+	}
+	if (!ok)
+		remove(tmp.buf);
+	free_strbuf(&tmp);
+}
+
+#endif
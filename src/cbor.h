@@ -0,0 +1,96 @@
+/* Minimal CBOR (RFC 8949) encoder, for the binary output mode:
+ * only definite-length items are produced, appended to a strbuf
+ */
+
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <string.h>
+
+#include "ext.h"
+#include "strbuf.h"
+
+/* major types */
+enum cbor_major {
+	CBOR_UINT = 0,
+	CBOR_NINT = 1,
+	CBOR_BYTES = 2,
+	CBOR_TEXT = 3,
+	CBOR_ARRAY = 4,
+	CBOR_MAP = 5,
+	CBOR_SIMPLE = 7
+};
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+
+/* append raw data */
+static inline void cbor_put(struct _strbuf *str, const void *data, size_t len)
+{
+	strbuf_append_str_len("CBOR", str, (const char *)data, len);
+}
+
+/* initial byte(s) of an item: the major type and the argument,
+ * in the shortest form that can hold it */
+static inline void cbor_head(struct _strbuf *str, enum cbor_major major, cl_ulong arg)
+{
+	unsigned char head[9];
+	size_t len, i;
+
+	if (arg < 24) {
+		head[0] = (unsigned char)(major << 5 | arg);
+		len = 1;
+	} else {
+		const unsigned bytes = arg <= 0xff ? 1 : arg <= 0xffff ? 2 : arg <= 0xffffffffU ? 4 : 8;
+		const unsigned info = bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27;
+		head[0] = (unsigned char)(major << 5 | info);
+		/* big-endian argument */
+		for (i = 0; i < bytes; ++i)
+			head[1 + i] = (unsigned char)(arg >> 8*(bytes - 1 - i));
+		len = 1 + bytes;
+	}
+	cbor_put(str, head, len);
+}
+
+static inline void cbor_uint(struct _strbuf *str, cl_ulong val)
+{
+	cbor_head(str, CBOR_UINT, val);
+}
+
+static inline void cbor_int(struct _strbuf *str, cl_long val)
+{
+	if (val < 0)
+		cbor_head(str, CBOR_NINT, (cl_ulong)(-(val + 1)));
+	else
+		cbor_head(str, CBOR_UINT, (cl_ulong)val);
+}
+
+static inline void cbor_bool(struct _strbuf *str, cl_bool val)
+{
+	cbor_head(str, CBOR_SIMPLE, val ? CBOR_TRUE : CBOR_FALSE);
+}
+
+static inline void cbor_null(struct _strbuf *str)
+{
+	cbor_head(str, CBOR_SIMPLE, CBOR_NULL);
+}
+
+static inline void cbor_text(struct _strbuf *str, const char *text)
+{
+	const size_t len = strlen(text);
+	cbor_head(str, CBOR_TEXT, len);
+	cbor_put(str, text, len);
+}
+
+static inline void cbor_array(struct _strbuf *str, size_t count)
+{
+	cbor_head(str, CBOR_ARRAY, count);
+}
+
+static inline void cbor_map(struct _strbuf *str, size_t count)
+{
+	cbor_head(str, CBOR_MAP, count);
+}
+
+#endif
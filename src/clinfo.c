@@ -2,8 +2,23 @@
  * on all available OpenCL platforms present in the system
  */
 
+/* CPU affinity control, for the NUMA placement of the transfer benchmark buffers */
+#if defined __linux__ && !defined _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+/* Low-level output, to write out the output document with a single call */
+#ifdef _MSC_VER
+# include <io.h>
+# include <fcntl.h>
+#else
+# include <unistd.h>
+#endif
 
 /* We will want to check for symbols in the OpenCL library.
  * On Windows, we must get the module handle for it, on Unix-like
@@ -41,6 +56,14 @@
 #include "info_loc.h"
 #include "info_ret.h"
 #include "opt_out.h"
+#include "threads.h"
+#include "cache.h"
+#include "timings.h"
+#include "bench.h"
+#include "libclinfo.h"
+#include "cbor.h"
+#include "extset.h"
+#include "json.h"
 
 #define ARRAY_SIZE(ar) (sizeof(ar)/sizeof(*ar))
 
@@ -173,8 +196,9 @@ struct icdl_data {
 };
 
 /* line prefix, used to identify the platform/device for each
- * device property in RAW output mode */
-char *line_pfx;
+ * device property in RAW output mode; per-thread, since
+ * devices may be processed concurrently */
+THREAD_LOCAL char *line_pfx;
 int line_pfx_len;
 
 #define CHECK_SIZE(ret, loc, val, cmd, ...) do { \
@@ -583,6 +607,10 @@ static const char* sources[] = {
 	"KRN()\n/* KRN(2)\nKRN(4)\nKRN(8)\nKRN(16) */\n",
 };
 
+/* replacement for the last line of sources[], enabling all the vector widths
+ * for the bandwidth benchmark */
+static const char bench_all_widths[] = "KRN()\nKRN(2)\nKRN(4)\nKRN(8)\nKRN(16)\n";
+
 const char *num_devs_header(const struct opt_out *output, cl_bool these_are_offline)
 {
 	return output->mode == CLINFO_HUMAN ?
@@ -723,7 +751,7 @@ static const char times_str[] = "x";
 static const char comma_str[] = ", ";
 static const char vbar_str[] = " | ";
 
-const char *cur_sfx = empty_str;
+THREAD_LOCAL const char *cur_sfx = empty_str;
 
 /* parse a CL_DEVICE_VERSION or CL_PLATFORM_VERSION info to determine the OpenCL version.
  * Returns an unsigned integer in the form major*10 + minor
@@ -853,12 +881,118 @@ void strbuf_ext_semaphore_handle(const char *what, struct _strbuf *str, const cl
 }
 
 
+/* Output sink: if set, output is accumulated in this buffer instead
+ * of being written to stdout. In the main thread this is the output document
+ * (out_doc), which is only written out by out_flush(); the threads
+ * gathering the properties of devices processed concurrently use their own
+ * buffer, so that the output can then be emitted in order.
+ */
+THREAD_LOCAL struct _strbuf *out_buf;
+
+struct _strbuf out_doc;
+
+/* Keep the output document buffered, even at exit: in diff mode it is
+ * compared with the baseline, and replaced by the report of the differences */
+cl_bool out_held;
+
+/* Write the buffered output document to stdout, with as few system calls
+ * as possible (normally a single one) */
+void out_flush(void)
+{
+	const char *buf = out_doc.buf;
+	size_t left = out_doc.end;
+
+	if (!left || out_held)
+		return;
+
+	/* anything written with stdio must come first */
+	fflush(stdout);
+	while (left > 0) {
+#ifdef _MSC_VER
+		const int chunk = left > INT_MAX ? INT_MAX : (int)left;
+		const int written = _write(_fileno(stdout), buf, chunk);
+#else
+		const ssize_t written = write(STDOUT_FILENO, buf, left);
+		if (written < 0 && errno == EINTR)
+			continue;
+#endif
+		if (written <= 0)
+			break;
+		buf += written;
+		left -= written;
+	}
+	reset_strbuf(&out_doc);
+}
+
+/* Write out the output document at a platform or device boundary, or before
+ * something likely to crash a buggy driver, so that what was gathered so far
+ * is not lost; only the thread writing to the output document may do it */
+void out_checkpoint(void)
+{
+	if (out_buf != &out_doc)
+		return;
+	out_flush();
+	fflush(stderr);
+}
+
+static inline
+void out_printf(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	if (out_buf) {
+		size_t room = out_buf->sz - out_buf->end;
+		size_t written;
+		va_list aq;
+		va_copy(aq, ap);
+		written = vsnprintf(out_buf->buf + out_buf->end, room, fmt, aq);
+		va_end(aq);
+		if (written >= room) {
+			realloc_strbuf(out_buf, 2*(out_buf->end + written + 1), "output");
+			written = vsnprintf(out_buf->buf + out_buf->end,
+				out_buf->sz - out_buf->end, fmt, ap);
+		}
+		out_buf->end += written;
+	} else {
+		vprintf(fmt, ap);
+	}
+	va_end(ap);
+}
+
+/* like fwrite(str, 1, len, stdout) */
+static inline
+void out_str_len(const char *str, size_t len)
+{
+	if (out_buf) {
+		/* grow geometrically, since the output is built in many small pieces */
+		if (out_buf->end + len >= out_buf->sz)
+			realloc_strbuf(out_buf, 2*(out_buf->end + len + 1), "output");
+		strbuf_append_str_len("output", out_buf, str, len);
+	} else {
+		fwrite(str, 1, len, stdout);
+	}
+}
+
+/* like fputs(str, stdout) */
+static inline
+void out_str(const char *str)
+{
+	out_str_len(str, strlen(str));
+}
+
+/* like putchar(c) */
+static inline
+void out_char(char c)
+{
+	out_str_len(&c, 1);
+}
+
 /* print strbuf, prefixed by pname, skipping leading whitespace if skip is nonzero,
  * affixing cur_sfx */
 static inline
 void show_strbuf(const struct _strbuf *strbuf, const char *pname, int skip, cl_int err)
 {
-	printf("%s" I1_STR "%s%s\n",
+	out_printf("%s" I1_STR "%s%s\n",
 		line_pfx, pname,
 		(skip ? skip_leading_ws(strbuf->buf) : strbuf->buf),
 		err ? empty_str : cur_sfx);
@@ -869,14 +1003,20 @@ void show_strbuf(const struct _strbuf *strbuf, const char *pname, int skip, cl_i
 static inline
 void json_stringify(const char *str)
 {
-	putchar('"');
-	while (*str) {
-		if (*str == '\\' || *str == '"')
-			putchar('\\');
-		putchar(*str);
+	out_char('"');
+	for (;;) {
+		/* copy runs of characters that need no escaping in one go */
+		const size_t run = strcspn(str, "\\\"");
+		if (run)
+			out_str_len(str, run);
+		str += run;
+		if (!*str)
+			break;
+		out_char('\\');
+		out_char(*str);
 		++str;
 	}
-	putchar('"');
+	out_char('"');
 }
 
 /* print JSON version of strbuf, prefixed by pname, skipping leading whitespace if skip is nonzero,
@@ -885,11 +1025,11 @@ void json_stringify(const char *str)
 static inline
 void json_strbuf(const struct _strbuf *strbuf, const char *pname, cl_uint n, cl_bool is_string)
 {
-	printf("%s\"%s\" : ", (n > 0 ? comma_str : spc_str), pname);
+	out_printf("%s\"%s\" : ", (n > 0 ? comma_str : spc_str), pname);
 	if (is_string)
 		json_stringify(strbuf->buf);
 	else
-		fputs(strbuf->buf, stdout);
+		out_str(strbuf->buf);
 }
 
 void
@@ -1122,26 +1262,46 @@ struct platform_info_traits pinfo_traits[] = {
 
 };
 
-/* Collect (and optionally show) information on a specific platform,
- * initializing relevant arrays and optionally showing the collected
- * information
- */
+/* Platform properties that are needed even when they are not shown,
+ * since their post-processing fills in the platform data and checks
+ * (see gatherPlatformData); the others are only queried to be shown */
+static cl_bool
+platform_info_needed(cl_platform_info param)
+{
+	switch (param) {
+	case CL_PLATFORM_NAME:
+	case CL_PLATFORM_VERSION:
+	case CL_PLATFORM_EXTENSIONS:
+	case CL_PLATFORM_ICD_SUFFIX_KHR:
+		return CL_TRUE;
+	default:
+		return CL_FALSE;
+	}
+}
+
+/* Gather the information about platform plat (number p), storing it into pdata
+ * and pinfo_checks */
 void
-gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out *output)
+gatherPlatformData(cl_platform_id plat, cl_uint p, struct platform_data *pdata,
+	struct platform_info_checks *pinfo_checks, cl_device_id **devs,
+	const struct opt_out *output)
 {
 	size_t len = 0;
 	cl_uint n = 0; /* number of platform properties shown, for JSON */
 
-	struct platform_data *pdata = plist->pdata + p;
-	struct platform_info_checks *pinfo_checks = plist->platform_checks + p;
 	struct platform_info_ret ret;
 	struct info_loc loc;
 
+	const cl_ulong phase_start = timing_start(output);
+	cl_ulong start;
+
 	pinfo_checks->plat_version = 10;
+	set_timing_ctx(p, -1, CL_FALSE);
 
 	INIT_RET(ret, "platform");
-	reset_loc(&loc, __func__);
-	loc.plat = plist->platform[p];
+	/* report errors under the public entry point, also when gathering in a job */
+	reset_loc(&loc, "gatherPlatformInfo");
+	loc.plat = plat;
 
 	for (loc.line = 0; loc.line < ARRAY_SIZE(pinfo_traits); ++loc.line) {
 		const struct platform_info_traits *traits = pinfo_traits + loc.line;
@@ -1155,6 +1315,12 @@ gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out
 		if (output->cond == COND_PROP_CHECK && !checked)
 			continue;
 
+		/* when the platform properties are not being shown (e.g. only some devices
+		 * were selected, or we are just listing), skip the ones we don't need */
+		requested = is_requested_prop(output, traits->sname);
+		if (!output->detailed && !requested && !platform_info_needed(traits->param))
+			continue;
+
 		loc.sname = traits->sname;
 		loc.pname = (output->mode == CLINFO_HUMAN ?
 			traits->pname : traits->sname);
@@ -1165,7 +1331,9 @@ gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out
 		reset_strbuf(&ret.str);
 		reset_strbuf(&ret.err_str);
 		ret.needs_escaping = CL_FALSE;
+		start = timing_start(output);
 		traits->show_func(&ret, &loc, pinfo_checks, output);
+		timing_stop(output, TIMING_PROP, loc.sname, start);
 
 		/* The property is skipped if this was a conditional property,
 		 * unsatisfied, there was an error retrieving it and cond_prop_mode is not
@@ -1177,7 +1345,6 @@ gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out
 		/* The property gets printed if we are not just listing,
 		 * or if the user requested a property and this one matches.
 		 * Otherwise, we're just gathering information */
-		requested = is_requested_prop(output, loc.sname);
 		if (output->detailed || requested) {
 			if (output->json) {
 				json_strbuf(RET_BUF(ret), loc.pname, n++, ret.err || ret.needs_escaping);
@@ -1207,14 +1374,18 @@ gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out
 			/* compute numeric value for OpenCL version */
 			pinfo_checks->plat_version = getOpenCLVersion(ret.str.buf + 7);
 			break;
-		case CL_PLATFORM_EXTENSIONS:
-			pinfo_checks->has_khr_icd = !!strstr(ret.str.buf, "cl_khr_icd");
-			pinfo_checks->has_amd_object_metadata = !!strstr(ret.str.buf, "cl_amd_object_metadata");
-			pinfo_checks->has_external_memory = !!strstr(ret.str.buf, "cl_khr_external_memory");
-			pinfo_checks->has_semaphore = !!strstr(ret.str.buf, "cl_khr_semaphore");
-			pinfo_checks->has_external_semaphore = !!strstr(ret.str.buf, "cl_khr_external_semaphore");
-			pdata->has_amd_offline = !!strstr(ret.str.buf, "cl_amd_offline_devices");
+		case CL_PLATFORM_EXTENSIONS: {
+			struct ext_set set;
+			ext_set_init(&set, ret.str.buf, NULL);
+			pinfo_checks->has_khr_icd = ext_set_has(&set, "cl_khr_icd");
+			pinfo_checks->has_amd_object_metadata = ext_set_has(&set, "cl_amd_object_metadata");
+			pinfo_checks->has_external_memory = ext_set_has(&set, "cl_khr_external_memory");
+			pinfo_checks->has_semaphore = ext_set_has(&set, "cl_khr_semaphore");
+			pinfo_checks->has_external_semaphore = ext_set_has(&set, "cl_khr_external_semaphore");
+			pdata->has_amd_offline = ext_set_has(&set, "cl_amd_offline_devices");
+			ext_set_free(&set);
 			break;
+		}
 		case CL_PLATFORM_ICD_SUFFIX_KHR:
 			/* Store ICD suffix for future reference */
 			len = strlen(ret.str.buf);
@@ -1230,9 +1401,6 @@ gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out
 
 	}
 
-	if (pinfo_checks->plat_version > plist->max_plat_version)
-		plist->max_plat_version = pinfo_checks->plat_version;
-
 	/* if no CL_PLATFORM_ICD_SUFFIX_KHR, use P### as short/symbolic name */
 	if (!pdata->sname) {
 #define SNAME_MAX 32
@@ -1240,29 +1408,159 @@ gatherPlatformInfo(struct platform_list *plist, cl_uint p, const struct opt_out
 		snprintf(pdata->sname, SNAME_MAX, "P%" PRIu32 "", p);
 	}
 
-	len = strlen(pdata->sname);
-	if (len > plist->max_sname_len)
-		plist->max_sname_len = len;
-
+	*devs = NULL;
 	ret.err = clGetDeviceIDs(loc.plat, CL_DEVICE_TYPE_ALL, 0, NULL, &pdata->ndevs);
 	if (ret.err == CL_DEVICE_NOT_FOUND)
 		pdata->ndevs = 0;
 	else
 		CHECK_ERROR(ret.err, "number of devices");
-	plist->ndevs_total += pdata->ndevs;
-	plist->dev_offset[p] = p ? plist->dev_offset[p-1] + (pdata-1)->ndevs : 0;
-	plist_devs_reserve(plist, plist->ndevs_total);
 
 	if (pdata->ndevs > 0) {
+		ALLOC(*devs, pdata->ndevs, "platform devices");
 		ret.err = clGetDeviceIDs(loc.plat, CL_DEVICE_TYPE_ALL,
-			pdata->ndevs,
-			plist->all_devs + plist->dev_offset[p], NULL);
+			pdata->ndevs, *devs, NULL);
 	}
 
+	timing_stop(output, TIMING_PHASE, "gatherPlatformInfo", phase_start);
+	set_timing_ctx(-1, -1, CL_FALSE);
+
+	UNINIT_RET(ret);
+}
+
+/* Collect (and optionally show) information on a specific platform,
+ * initializing its platform data and checks and optionally showing the collected
+ * information. Only the data specific to this platform is touched, so that
+ * multiple platforms can be processed concurrently; the list of devices is returned
+ * in devs, and is merged into the global data by mergePlatformInfo().
+ */
+void
+gatherPlatformInfo(struct platform_list *plist, cl_uint p, cl_device_id **devs,
+	const struct opt_out *output)
+{
+	gatherPlatformData(plist->platform[p], p, plist->pdata + p,
+		plist->platform_checks + p, devs, output);
+}
+
+/* Merge the information gathered for platform p into the global platform list data,
+ * taking ownership of the platform devices list devs.
+ * Must be called in platform order.
+ */
+void
+mergePlatformInfo(struct platform_list *plist, cl_uint p, cl_device_id *devs)
+{
+	const struct platform_data *pdata = plist->pdata + p;
+	const struct platform_info_checks *pinfo_checks = plist->platform_checks + p;
+	size_t len;
+
+	if (pinfo_checks->plat_version > plist->max_plat_version)
+		plist->max_plat_version = pinfo_checks->plat_version;
+
+	len = strlen(pdata->sname);
+	if (len > plist->max_sname_len)
+		plist->max_sname_len = len;
+
+	plist->ndevs_total += pdata->ndevs;
+	plist->dev_offset[p] = p ? plist->dev_offset[p-1] + (pdata-1)->ndevs : 0;
+	plist_devs_reserve(plist, plist->ndevs_total);
+
+	if (pdata->ndevs > 0)
+		memcpy(plist->all_devs + plist->dev_offset[p], devs, pdata->ndevs*sizeof(*devs));
+	free(devs);
+
 	if (pdata->ndevs > plist->max_devs)
 		plist->max_devs = pdata->ndevs;
+}
 
-	UNINIT_RET(ret);
+/* A platform whose information is gathered by a worker thread */
+struct platform_job {
+	struct platform_list *plist;
+	cl_uint p;
+	cl_bool selected;
+	cl_bool timed_out; /* see --timeout: the job data must be left alone */
+	const struct opt_out *output;
+	char *line_pfx;
+	cl_device_id *devs;
+	/* the platform data is gathered here, and moved to the platform list when merging,
+	 * so that jobs that timed out don't touch the platform list */
+	struct platform_data pdata;
+	struct platform_info_checks pinfo_checks;
+	struct _strbuf out;
+};
+
+/* Set when some job was abandoned after exceeding the --timeout deadline: the shared
+ * data it may still be using must then not be released */
+cl_bool abandoned_jobs;
+
+/* describe a timeout, in the same form as the errors */
+void report_timeout(struct _strbuf *str, const char *what, const struct opt_out *output)
+{
+	reset_strbuf(str);
+	strbuf_append(__func__, str, "<%s: timed out after %" PRIu64 "ms>", what, output->timeout_ms);
+}
+
+/* Run the jobs, with the --timeout deadline if one was given, setting the timed_out
+ * field (at offset timed_out_ofs) of the jobs that did not complete in time
+ */
+void run_jobs_timeout(job_func func, void *jobs, size_t job_sz, size_t num_jobs,
+	size_t timed_out_ofs, const struct opt_out *output)
+{
+	unsigned char *timed_out;
+	size_t j;
+
+	if (!output->timeout_ms) {
+		run_jobs(func, jobs, job_sz, num_jobs, output->jobs);
+		return;
+	}
+
+	ALLOC(timed_out, num_jobs, "timed out jobs");
+	if (run_jobs_deadline(func, jobs, job_sz, num_jobs, output->jobs, output->timeout_ms, timed_out))
+		abandoned_jobs = CL_TRUE;
+	for (j = 0; j < num_jobs; ++j)
+		*(cl_bool *)((char *)jobs + j*job_sz + timed_out_ofs) = timed_out[j];
+	free(timed_out);
+}
+
+void platformJob(void *arg)
+{
+	struct platform_job *job = arg;
+	char *saved_pfx = line_pfx;
+	struct _strbuf *saved_buf = out_buf;
+
+	if (!job->selected)
+		return;
+
+	line_pfx = job->line_pfx;
+	out_buf = &job->out;
+	gatherPlatformData(job->plist->platform[job->p], job->p, &job->pdata,
+		&job->pinfo_checks, &job->devs, job->output);
+	line_pfx = saved_pfx;
+	out_buf = saved_buf;
+}
+
+/* Gather the information about all selected platforms concurrently, each
+ * with its own output buffer; the caller is responsible for printing the buffers
+ * and merging the platform data in order
+ */
+struct platform_job *
+gatherPlatformsConcurrently(struct platform_list *plist, cl_uint num_platforms,
+	const struct opt_out *output)
+{
+	struct platform_job *job;
+	cl_uint p;
+
+	ALLOC(job, num_platforms, "platform jobs");
+	for (p = 0; p < num_platforms; ++p) {
+		job[p].plist = plist;
+		job[p].p = p;
+		job[p].selected = is_selected_platform(output, p);
+		job[p].output = output;
+		job[p].line_pfx = line_pfx;
+		if (job[p].selected)
+			init_strbuf(&job[p].out, "platform output");
+	}
+	run_jobs_timeout(platformJob, job, sizeof(*job), num_platforms,
+		offsetof(struct platform_job, timed_out), output);
+	return job;
 }
 
 /*
@@ -1526,17 +1824,17 @@ cl_bool dev_has_p2p_devs(const struct device_info_checks *chk)
 
 void identify_device_extensions(const char *extensions, struct device_info_checks *chk)
 {
-#define _HAS_EXT(ext) (strstr(extensions, ext))
 #define CPY_EXT(what, ext) do { \
-	strncpy(chk->has_##what, has+1, sizeof(ext)); \
-	chk->has_##what[sizeof(ext)-1] = '\0'; \
+	memcpy(chk->has_##what, ext, sizeof(ext)); \
 } while (0)
 #define CHECK_EXT(what, ext) do { \
-	has = _HAS_EXT(" " #ext " "); \
-	if (has) CPY_EXT(what, #ext); \
+	if (ext_set_has_len(&set, #ext, sizeof(#ext) - 1)) CPY_EXT(what, #ext); \
 } while(0)
 
-	char *has;
+	struct ext_set set;
+	/* the callers reset the scratch arena for each device */
+	ext_set_init(&set, extensions, &scratch);
+
 	CHECK_EXT(half, cl_khr_fp16);
 	CHECK_EXT(spir, cl_khr_spir);
 	CHECK_EXT(double, cl_khr_fp64);
@@ -1581,6 +1879,7 @@ void identify_device_extensions(const char *extensions, struct device_info_check
 	CHECK_EXT(extended_versioning, cl_khr_extended_versioning);
 	CHECK_EXT(cxx_for_opencl, cl_ext_cxx_for_opencl);
 	CHECK_EXT(device_uuid, cl_khr_device_uuid);
+	ext_set_free(&set);
 }
 
 
@@ -1594,21 +1893,41 @@ void identify_device_extensions(const char *extensions, struct device_info_check
 		loc, "get %s"); \
 	CHECK_SIZE(ret, loc, val, clGetDeviceInfo, (loc)->dev, (loc)->param.dev);
 
+/* The values are allocated in the scratch arena (see arena.h), and must not be freed */
 #define _GET_VAL_VALUES(ret, loc) \
-	REALLOC(val, numval, loc->sname); \
+	SCRATCH_ALLOC(val, numval, loc->sname); \
 	ret->err = REPORT_ERROR_LOC(ret, \
 		clGetDeviceInfo(loc->dev, loc->param.dev, szval, val, NULL), \
 		loc, "get %s"); \
-	if (ret->err) { free(val); val = NULL; } \
-
-#define _GET_VAL_ARRAY(ret, loc) \
-	ret->err = REPORT_ERROR_LOC(ret, \
-		clGetDeviceInfo(loc->dev, loc->param.dev, 0, NULL, &szval), \
-		loc, "get number of %s"); \
-	numval = szval/sizeof(*val); \
-	if (!ret->err && numval > 0) { \
-		_GET_VAL_VALUES(ret, loc) \
-	}
+	if (ret->err) val = NULL; \
+
+/* Initial buffer size for array properties with no size hint */
+#define DEFAULT_ARRAY_SZ 256
+
+/* Fetch an array property, trying first with a buffer sized after the
+ * size hint for the property, and only querying the actual size
+ * if that's not enough */
+#define _GET_VAL_ARRAY(ret, loc) { \
+	size_t *hint = loc_size_hint(loc); \
+	numval = ((*hint ? *hint : DEFAULT_ARRAY_SZ) + sizeof(*val) - 1)/sizeof(*val); \
+	SCRATCH_ALLOC(val, numval, loc->sname); \
+	szval = 0; \
+	ret->err = clGetDeviceInfo(loc->dev, loc->param.dev, numval*sizeof(*val), val, &szval); \
+	if (ret->err != CL_SUCCESS || szval > numval*sizeof(*val)) { \
+		val = NULL; \
+		ret->err = REPORT_ERROR_LOC(ret, \
+			clGetDeviceInfo(loc->dev, loc->param.dev, 0, NULL, &szval), \
+			loc, "get number of %s"); \
+		numval = szval/sizeof(*val); \
+		if (!ret->err && numval > 0) { \
+			_GET_VAL_VALUES(ret, loc) \
+		} \
+	} else { \
+		numval = szval/sizeof(*val); \
+		if (!numval) val = NULL; \
+	} \
+	if (!ret->err) *hint = szval; \
+}
 
 #define GET_VAL(ret, loc, field) do { \
 	_GET_VAL(ret, (loc), ret->value.field) \
@@ -1729,7 +2048,6 @@ device_info_ext_version(struct device_info_ret *ret,
 	if (!ret->err) {
 		strbuf_name_version(loc->pname, &ret->str, val, numval, output);
 	}
-	free(val);
 }
 
 void
@@ -1743,7 +2061,6 @@ device_info_ext_mem(struct device_info_ret *ret,
 	if (!ret->err) {
 		strbuf_ext_mem(loc->pname, &ret->str, val, numval, output);
 	}
-	free(val);
 }
 
 void
@@ -1757,7 +2074,6 @@ device_info_semaphore_types(struct device_info_ret *ret,
 	if (!ret->err) {
 		strbuf_semaphore_type(loc->pname, &ret->str, val, numval, output);
 	}
-	free(val);
 }
 
 void
@@ -1771,7 +2087,6 @@ device_info_ext_semaphore_handles(struct device_info_ret *ret,
 	if (!ret->err) {
 		strbuf_ext_semaphore_handle(loc->pname, &ret->str, val, numval, output);
 	}
-	free(val);
 }
 
 void strbuf_mem(const char *what, struct _strbuf *str, cl_ulong val)
@@ -1890,7 +2205,6 @@ device_info_intptr(struct device_info_ret *ret,
 			strbuf_append_str_len(loc->pname, &ret->str, " ]", 2);
 		// TODO: ret->value.??? = val;
 	}
-	free(val);
 }
 
 void
@@ -1914,7 +2228,6 @@ device_info_szptr_sep(struct device_info_ret *ret, const char *human_sep,
 			strbuf_append_str_len(loc->pname, &ret->str, " ]", 2);
 		// TODO: ret->value.??? = val;
 	}
-	free(val);
 }
 
 
@@ -1934,9 +2247,277 @@ device_info_szptr_comma(struct device_info_ret *ret,
 	device_info_szptr_sep(ret, comma_str, loc, chk, output);
 }
 
+/* The program used to probe the preferred work-group size multiple is built
+ * once per platform, for all of its devices at once, and kept around for the
+ * whole run. If the on-disk cache is enabled, the compiled binaries are also
+ * stored there, so that later runs with the same platform and driver can skip
+ * the compilation altogether.
+ */
+#define MAX_WG_KERNELS 5
+struct wg_probe {
+	cl_platform_id plat;
+	cl_context ctx;
+	cl_program prg;
+	cl_kernel krn[MAX_WG_KERNELS];
+	cl_uint num_krn; /* kernels created, in krn */
+	cl_int err; /* CL_SUCCESS if the program could be built for all devices */
+	cl_bool built; /* set (with wg_probe_built signaled) once the fields above are final */
+};
+
+/* probes requested so far, protected by wg_probe_lock; each probe is built
+ * without the lock held, by the first thread requesting it, while the others
+ * wait on wg_probe_built */
+struct wg_probe **wg_probe_cache;
+cl_uint wg_probe_count;
+thread_mutex wg_probe_lock;
+thread_cond wg_probe_built;
+
+/* Set key to the string identifying the probe program binary for dev in the on-disk cache */
+cl_int
+wg_probe_key(struct _strbuf *key, cl_platform_id plat, cl_device_id dev)
+{
+	struct _strbuf str;
+	cl_int err = CL_SUCCESS;
+	size_t i;
+
+	init_strbuf(&str, "probe key");
+	reset_strbuf(key);
+	do {
+		GET_STRING(&str, err, clGetPlatformInfo, CL_PLATFORM_NAME, "CL_PLATFORM_NAME", plat);
+		if (err) break;
+		strbuf_append(__func__, key, "%s\n", str.buf);
+		GET_STRING(&str, err, clGetPlatformInfo, CL_PLATFORM_VERSION, "CL_PLATFORM_VERSION", plat);
+		if (err) break;
+		strbuf_append(__func__, key, "%s\n", str.buf);
+		GET_STRING(&str, err, clGetDeviceInfo, CL_DEVICE_NAME, "CL_DEVICE_NAME", dev);
+		if (err) break;
+		strbuf_append(__func__, key, "%s\n", str.buf);
+		GET_STRING(&str, err, clGetDeviceInfo, CL_DRIVER_VERSION, "CL_DRIVER_VERSION", dev);
+		if (err) break;
+		strbuf_append(__func__, key, "%s\n", str.buf);
+	} while (0);
+	/* the binary obviously also depends on the source */
+	for (i = 0; !err && i < ARRAY_SIZE(sources); ++i)
+		strbuf_append_str(__func__, key, sources[i]);
+	free_strbuf(&str);
+	return err;
+}
+
+/* Try creating the probe program from the binaries in the on-disk cache */
+cl_program
+wg_probe_load(cl_context ctx, cl_platform_id plat, const cl_device_id *dev, cl_uint ndevs,
+	const char *cache_dir)
+{
+	struct _strbuf key, path;
+	size_t *size;
+	unsigned char **bin;
+	cl_program prg = NULL;
+	cl_int err = CL_SUCCESS;
+	cl_uint d;
+
+	init_strbuf(&key, "probe key");
+	init_strbuf(&path, "probe cache path");
+	ALLOC(size, ndevs, "probe binary sizes");
+	ALLOC(bin, ndevs, "probe binaries");
+
+	for (d = 0; d < ndevs; ++d) {
+		if (wg_probe_key(&key, plat, dev[d]) != CL_SUCCESS)
+			break;
+		cache_path(&path, cache_dir, "wgprobe", key.buf);
+		bin[d] = cache_load(path.buf, key.buf, size + d);
+		if (!bin[d])
+			break;
+	}
+
+	if (d == ndevs) {
+		prg = clCreateProgramWithBinary(ctx, ndevs, dev, size,
+			(const unsigned char **)bin, NULL, &err);
+		if (!err)
+			err = clBuildProgram(prg, ndevs, dev, NULL, NULL, NULL);
+		if (err && prg) {
+			clReleaseProgram(prg);
+			prg = NULL;
+		}
+	}
+
+	for (d = 0; d < ndevs; ++d)
+		free(bin[d]);
+	free(bin);
+	free(size);
+	free_strbuf(&path);
+	free_strbuf(&key);
+	return prg;
+}
+
+/* Store the binaries of the probe program in the on-disk cache */
+void
+wg_probe_store(cl_program prg, cl_platform_id plat, const cl_device_id *dev, cl_uint ndevs,
+	const char *cache_dir)
+{
+	struct _strbuf key, path;
+	size_t *size;
+	unsigned char **bin;
+	cl_int err;
+	cl_uint d;
+
+	ALLOC(size, ndevs, "probe binary sizes");
+	ALLOC(bin, ndevs, "probe binaries");
+	err = clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, ndevs*sizeof(*size), size, NULL);
+	for (d = 0; !err && d < ndevs; ++d)
+		ALLOC(bin[d], size[d] + 1, "probe binary");
+	if (!err)
+		err = clGetProgramInfo(prg, CL_PROGRAM_BINARIES, ndevs*sizeof(*bin), bin, NULL);
+
+	init_strbuf(&key, "probe key");
+	init_strbuf(&path, "probe cache path");
+	for (d = 0; !err && d < ndevs; ++d) {
+		if (!size[d] || wg_probe_key(&key, plat, dev[d]) != CL_SUCCESS)
+			continue;
+		cache_path(&path, cache_dir, "wgprobe", key.buf);
+		cache_store(cache_dir, path.buf, key.buf, bin[d], size[d]);
+	}
+	free_strbuf(&path);
+	free_strbuf(&key);
+
+	for (d = 0; d < ndevs; ++d)
+		free(bin[d]);
+	free(bin);
+	free(size);
+}
+
+/* Build the probe program for all the devices of the given platform;
+ * when only some devices were selected, don't pay for the compilation on the others,
+ * and build it just for the device that needs it (other selected devices of the same
+ * platform will fall back to their own probe)
+ */
+void
+wg_probe_build(struct wg_probe *probe, cl_device_id requester, size_t num_krn,
+	const struct opt_out *output)
+{
+	struct _strbuf name;
+	cl_context_properties ctxpft[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)probe->plat,
+		0, 0 };
+	cl_device_id *dev = NULL;
+	cl_uint ndevs = 0;
+
+	if (output->num_selected_devices) {
+		ndevs = 1;
+		ALLOC(dev, ndevs, "probe devices");
+		dev[0] = requester;
+	} else {
+		probe->err = clGetDeviceIDs(probe->plat, CL_DEVICE_TYPE_ALL, 0, NULL, &ndevs);
+		if (probe->err)
+			return;
+		ALLOC(dev, ndevs, "probe devices");
+		probe->err = clGetDeviceIDs(probe->plat, CL_DEVICE_TYPE_ALL, ndevs, dev, NULL);
+	}
+	if (!probe->err)
+		probe->ctx = clCreateContext(ctxpft, ndevs, dev, NULL, NULL, &probe->err);
+	if (!probe->err && output->cache_dir)
+		probe->prg = wg_probe_load(probe->ctx, probe->plat, dev, ndevs, output->cache_dir);
+	if (!probe->err && !probe->prg) {
+		probe->prg = clCreateProgramWithSource(probe->ctx, ARRAY_SIZE(sources), sources, NULL, &probe->err);
+		if (!probe->err)
+			probe->err = clBuildProgram(probe->prg, ndevs, dev, NULL, NULL, NULL);
+		if (!probe->err && output->cache_dir)
+			wg_probe_store(probe->prg, probe->plat, dev, ndevs, output->cache_dir);
+	}
+	free(dev);
+
+	init_strbuf(&name, "probe kernel name");
+	while (!probe->err && probe->num_krn < num_krn) {
+		reset_strbuf(&name);
+		strbuf_append(__func__, &name, "sum%u", 1<<probe->num_krn);
+		if (probe->num_krn == 0)
+			name.buf[3] = 0; // scalar kernel is called 'sum'
+		probe->krn[probe->num_krn] = clCreateKernel(probe->prg, name.buf, &probe->err);
+		if (!probe->err)
+			++probe->num_krn;
+	}
+	free_strbuf(&name);
+}
+
+/* Get the preferred work-group size multiples for the device from the shared probe
+ * of its platform. Returns CL_SUCCESS on success; on failure, the caller should
+ * fall back to a device-specific probe, which will also take care of error reporting
+ */
+cl_int
+getWGsizesShared(const struct info_loc *loc, size_t *wgm, size_t wgm_sz,
+	const struct opt_out *output)
+{
+	struct wg_probe *probe = NULL;
+	cl_int err = CL_SUCCESS;
+	cl_uint i;
+
+	if (wgm_sz > MAX_WG_KERNELS)
+		return CL_INVALID_VALUE;
+
+	mutex_lock(&wg_probe_lock);
+	for (i = 0; i < wg_probe_count; ++i) {
+		if (wg_probe_cache[i]->plat == loc->plat) {
+			probe = wg_probe_cache[i];
+			break;
+		}
+	}
+	if (probe) {
+		while (!probe->built)
+			cond_wait(&wg_probe_built, &wg_probe_lock);
+		mutex_unlock(&wg_probe_lock);
+	} else {
+		REALLOC(wg_probe_cache, wg_probe_count + 1, "work-group size probes");
+		ALLOC(probe, 1, "work-group size probe");
+		memset(probe, 0, sizeof(*probe));
+		probe->plat = loc->plat;
+		wg_probe_cache[wg_probe_count++] = probe;
+		mutex_unlock(&wg_probe_lock);
+
+		/* nobody else touches the probe until it's marked as built */
+		wg_probe_build(probe, loc->dev, wgm_sz, output);
+
+		mutex_lock(&wg_probe_lock);
+		probe->built = CL_TRUE;
+		cond_broadcast(&wg_probe_built);
+		mutex_unlock(&wg_probe_lock);
+	}
+
+	/* the probe is never modified after being built, so it can be queried unlocked */
+	err = probe->err;
+	if (!err && wgm_sz > probe->num_krn)
+		err = CL_INVALID_VALUE; /* built for fewer vector widths */
+	for (i = 0; !err && i < wgm_sz; ++i) {
+		/* this fails with CL_INVALID_DEVICE for devices not in a platform device list,
+		 * such as the AMD offline devices */
+		err = clGetKernelWorkGroupInfo(probe->krn[i], loc->dev, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(*wgm), wgm + i, NULL);
+	}
+	return err;
+}
+
+void
+release_wg_probes(void)
+{
+	mutex_lock(&wg_probe_lock);
+	for (cl_uint i = 0; i < wg_probe_count; ++i) {
+		struct wg_probe *probe = wg_probe_cache[i];
+		/* leave alone the probes still being built by a thread that timed out */
+		if (!probe->built)
+			continue;
+		for (cl_uint k = 0; k < probe->num_krn; ++k)
+			clReleaseKernel(probe->krn[k]);
+		if (probe->prg) clReleaseProgram(probe->prg);
+		if (probe->ctx) clReleaseContext(probe->ctx);
+		free(probe);
+	}
+	free(wg_probe_cache);
+	wg_probe_cache = NULL;
+	wg_probe_count = 0;
+	mutex_unlock(&wg_probe_lock);
+}
+
 void
 getWGsizes(struct device_info_ret *ret, const struct info_loc *loc, size_t *wgm, size_t wgm_sz,
-	const struct opt_out* UNUSED(output))
+	const struct opt_out *output)
 {
 	cl_int log_err;
 
@@ -1948,6 +2529,11 @@ getWGsizes(struct device_info_ret *ret, const struct info_loc *loc, size_t *wgm,
 	cl_program prg = NULL;
 	cl_kernel krn = NULL;
 
+	ret->err = getWGsizesShared(loc, wgm, wgm_sz, output);
+	if (ret->err == CL_SUCCESS)
+		return;
+
+	/* fall back to building the probe for this device alone */
 	ret->err = CL_SUCCESS;
 
 	ctx = clCreateContext(ctxpft, 1, &loc->dev, NULL, NULL, &ret->err);
@@ -1964,7 +2550,7 @@ getWGsizes(struct device_info_ret *ret, const struct info_loc *loc, size_t *wgm,
 		GET_STRING(&logbuf, ret->err,
 			clGetProgramBuildInfo, CL_PROGRAM_BUILD_LOG, "CL_PROGRAM_BUILD_LOG", prg, loc->dev);
 		if (ret->err == CL_SUCCESS) {
-			fflush(stdout);
+			out_flush();
 			fflush(stderr);
 			fputs("=== CL_PROGRAM_BUILD_LOG ===\n", stderr);
 			fputs(logbuf.buf, stderr);
@@ -2010,8 +2596,10 @@ device_info_wg(struct device_info_ret *ret,
 	 */
 #define NUM_KERNELS 1
 	size_t wgm[NUM_KERNELS] = {0};
+	const cl_ulong start = timing_start(output);
 
 	getWGsizes(ret, loc, wgm, NUM_KERNELS, output);
+	timing_stop(output, TIMING_PHASE, "getWGsizes", start);
 	if (!ret->err) {
 		strbuf_append("get WG sizes", &ret->str, "%" PRIuS, wgm[0]);
 	}
@@ -2573,7 +3161,6 @@ device_info_partition_types(struct device_info_ret *ret,
 			strbuf_append_str_len(loc->pname, &ret->str, " ]", 2);
 		// TODO ret->value.??? = val
 	}
-	free(val);
 }
 
 void
@@ -2621,7 +3208,6 @@ device_info_partition_types_ext(struct device_info_ret *ret,
 			strbuf_append_str_len(loc->pname, &ret->str, " ]", 2);
 		// TODO ret->value.??? = val
 	}
-	free(val);
 }
 
 
@@ -2687,7 +3273,6 @@ device_info_partition_affinities_ext(struct device_info_ret *ret,
 			strbuf_append_str_len(loc->pname, &ret->str, " ]", 2);
 		// TODO: ret->value.??? = val
 	}
-	free(val);
 }
 
 /* Preferred / native vector widths */
@@ -2928,7 +3513,6 @@ device_info_qfamily_prop(struct device_info_ret *ret,
 		strbuf_intel_queue_family(loc->pname, &ret->str, val, numval, output);
 		// TODO: ret->value.??? = val;
 	}
-	free(val);
 }
 
 
@@ -3082,7 +3666,6 @@ device_info_p2p_dev_list(struct device_info_ret *ret,
 		strbuf_append_str_len(loc->pname, &ret->str, " ]", 2);
 		// TODO: ret->value.??? = val;
 	}
-	free(val);
 }
 
 void
@@ -3137,7 +3720,6 @@ device_info_interop_list(struct device_info_ret *ret,
 	}
 	// TODO JSONify
 	ret->needs_escaping = CL_TRUE;
-	free(val);
 }
 
 void device_info_uuid(struct device_info_ret *ret,
@@ -3509,41 +4091,370 @@ struct device_info_traits dinfo_traits[] = {
 	{ CLINFO_BOTH, DINFO(CL_DEVICE_AVC_ME_SUPPORTS_PREEMPTION_INTEL, INDENT INDENT "Supports preemption", bool), dev_has_intel_AVC_ME },
 };
 
-/* Process all the device info in the traits, except if param_whitelist is not NULL,
- * in which case only those in the whitelist will be processed.
- * If present, the whitelist should be sorted in the order of appearance of the parameters
- * in the traits table, and terminated by the value CL_FALSE
+/* Device properties whose values are recorded in the device_info_checks
+ * (see the post-processing in printDeviceInfo), and are needed by the
+ * conditions and show functions of the other properties.
+ * Terminated by CL_FALSE.
  */
+static const cl_device_info dev_checks_info[] = {
+	CL_DEVICE_VERSION,
+	CL_DEVICE_EXTENSIONS,
+	CL_DEVICE_TYPE,
+	CL_DEVICE_GLOBAL_MEM_CACHE_TYPE,
+	CL_DEVICE_LOCAL_MEM_TYPE,
+	CL_DEVICE_IMAGE_SUPPORT,
+	CL_DEVICE_COMPILER_AVAILABLE,
+	CL_DEVICE_NUM_P2P_DEVICES_AMD,
+	CL_DEVICE_SCHEDULING_CONTROLS_CAPABILITIES_ARM,
+	CL_FALSE
+};
 
-void
-printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
-	const cl_device_info *param_whitelist, /* list of device info to process, or NULL */
-	const struct opt_out *output)
+/* Resolve the selected properties against the device info traits,
+ * so that printDeviceInfo only queries the properties that will be shown,
+ * and the ones they depend on
+ */
+void planDeviceInfo(struct opt_out *output)
 {
-	char *extensions = NULL;
-	size_t ext_len = 0;
-	char *versioned_extensions = NULL;
+	size_t i;
+	const cl_device_info *dep;
 
-	/* pointers to the traits for CL_DEVICE_EXTENSIONS and CL_DEVICE_EXTENSIONS_WITH_VERSION */
-	const struct device_info_traits *extensions_traits = NULL;
-	const struct device_info_traits *versioned_extensions_traits = NULL;
+	if (!output->num_selected_props)
+		return;
 
-	struct device_info_checks chk;
-	struct device_info_ret ret;
-	struct info_loc loc;
+	ALLOC(output->dev_prop_plan, ARRAY_SIZE(dinfo_traits), "device property plan");
+	for (i = 0; i < ARRAY_SIZE(dinfo_traits); ++i) {
+		const struct device_info_traits *traits = dinfo_traits + i;
+		if (traits->param == CL_FALSE)
+			output->dev_prop_plan[i] = PROP_SKIP;
+		else if (is_selected_prop(output, traits->sname))
+			output->dev_prop_plan[i] = PROP_SELECTED;
+		else {
+			output->dev_prop_plan[i] = PROP_SKIP;
+			for (dep = dev_checks_info; *dep != CL_FALSE; ++dep) {
+				if (traits->param == *dep) {
+					output->dev_prop_plan[i] = PROP_DEPENDENCY;
+					break;
+				}
+			}
+		}
+	}
+}
 
-	cl_uint n = 0; /* number of device properties shown, for JSON */
+/* Device properties that can change while the device is in use,
+ * and must therefore never be answered from a snapshot.
+ * Terminated by CL_FALSE.
+ */
+static const cl_device_info dev_dynamic_info[] = {
+	CL_DEVICE_AVAILABLE,
+	CL_DEVICE_GLOBAL_FREE_MEMORY_AMD,
+	CL_DEVICE_PROFILING_TIMER_OFFSET_AMD,
+	CL_DEVICE_CORE_TEMPERATURE_ALTERA,
+	CL_FALSE
+};
 
-	memset(&chk, 0, sizeof(chk));
-	chk.pinfo_checks = plist->platform_checks + p;
-	chk.dev_version = 10;
+cl_bool is_dynamic_dev_info(cl_device_info param)
+{
+	const cl_device_info *dyn;
+	for (dyn = dev_dynamic_info; *dyn != CL_FALSE; ++dyn)
+		if (*dyn == param) return CL_TRUE;
+	return CL_FALSE;
+}
+
+/* Snapshot of the device properties gathered in a previous run,
+ * stored in the on-disk cache. For each entry of the device info traits
+ * we keep the complete device_info_ret (minus the auxiliary data),
+ * so that printDeviceInfo can use it as if it had just been fetched.
+ */
+struct dev_snapshot_rec {
+	cl_bool present;
+	cl_int err;
+	cl_bool needs_escaping;
+	char *str;
+	char *err_str;
+	size_t str_len;
+	size_t err_len;
+	unsigned char value[sizeof(((struct device_info_ret*)NULL)->value)];
+};
+
+struct dev_snapshot {
+	struct _strbuf key;
+	struct _strbuf path;
+	cl_bool changed; /* new records were added since it was loaded */
+	struct dev_snapshot_rec *rec; /* one per device info trait */
+};
+
+/* Compute the key identifying the snapshot for a device:
+ * what the device (and its driver) is, and the output format, since the
+ * snapshot holds the string representations of the values
+ */
+void
+dev_snapshot_key(struct _strbuf *key, const struct platform_list *plist, cl_uint p,
+	cl_device_id dev, const struct opt_out *output)
+{
+	cl_platform_id pid = plist->platform[p];
+	const cl_device_id *devs = get_platform_devs(plist, p);
+	struct _strbuf str;
+	cl_device_pci_bus_info_khr pci;
+	cl_uchar uuid[CL_UUID_SIZE_KHR];
+	cl_int err;
+	cl_uint d;
+
+	init_strbuf(&str, "snapshot key");
+	reset_strbuf(key);
+	strbuf_append(__func__, key, "%" PRIuS "/%" PRIuS "\n%d%d%d%d[%s]\n",
+		ARRAY_SIZE(dinfo_traits), sizeof(struct dev_snapshot_rec),
+		output->mode, output->json, output->cond, output->check_size, line_pfx);
+
+#define SNAPSHOT_KEY_STRING(cmd, param, ...) do { \
+	GET_STRING(&str, err, cmd, param, #param, __VA_ARGS__); \
+	strbuf_append(__func__, key, "%s\n", err ? "" : str.buf); \
+} while (0)
+	SNAPSHOT_KEY_STRING(clGetPlatformInfo, CL_PLATFORM_NAME, pid);
+	SNAPSHOT_KEY_STRING(clGetPlatformInfo, CL_PLATFORM_VERSION, pid);
+	SNAPSHOT_KEY_STRING(clGetDeviceInfo, CL_DEVICE_NAME, dev);
+	SNAPSHOT_KEY_STRING(clGetDeviceInfo, CL_DEVICE_VERSION, dev);
+	SNAPSHOT_KEY_STRING(clGetDeviceInfo, CL_DRIVER_VERSION, dev);
+#undef SNAPSHOT_KEY_STRING
+
+	/* identify the device by its PCI bus information if possible, by its
+	 * UUID otherwise, and by its position in the platform as a last resort */
+	if (clGetDeviceInfo(dev, CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(pci), &pci, NULL) == CL_SUCCESS) {
+		strbuf_append(__func__, key, "%04x:%02x:%02x.%u\n",
+			pci.pci_domain, pci.pci_bus, pci.pci_device, pci.pci_function);
+	} else if (clGetDeviceInfo(dev, CL_DEVICE_UUID_KHR, sizeof(uuid), uuid, NULL) == CL_SUCCESS) {
+		for (d = 0; d < CL_UUID_SIZE_KHR; ++d)
+			strbuf_append(__func__, key, "%02x", uuid[d]);
+		strbuf_append_str(__func__, key, "\n");
+	} else {
+		for (d = 0; d < plist->pdata[p].ndevs; ++d)
+			if (devs[d] == dev) break;
+		strbuf_append(__func__, key, "%" PRIu32 ":%" PRIu32 "\n", p, d);
+	}
+	free_strbuf(&str);
+}
+
+/* Read a field of the given size from the snapshot data, advancing the cursor */
+static inline int
+snapshot_read(void *dst, size_t sz, const char **cursor, const char *end)
+{
+	if ((size_t)(end - *cursor) < sz)
+		return 0;
+	memcpy(dst, *cursor, sz);
+	*cursor += sz;
+	return 1;
+}
+
+/* Read a string of the given length from the snapshot data, advancing the cursor */
+static inline char *
+snapshot_read_str(size_t len, const char **cursor, const char *end)
+{
+	char *ret;
+	if ((size_t)(end - *cursor) < len)
+		return NULL;
+	ALLOC(ret, len + 1, "snapshot string");
+	memcpy(ret, *cursor, len);
+	*cursor += len;
+	return ret;
+}
+
+void
+dev_snapshot_load(struct dev_snapshot *snap, const struct platform_list *plist, cl_uint p,
+	cl_device_id dev, const struct opt_out *output)
+{
+	size_t size = 0;
+	char *data;
+	const char *cursor, *end;
+	cl_uint line;
+
+	init_strbuf(&snap->key, "snapshot key");
+	init_strbuf(&snap->path, "snapshot path");
+	ALLOC(snap->rec, ARRAY_SIZE(dinfo_traits), "snapshot records");
+	snap->changed = CL_FALSE;
+
+	dev_snapshot_key(&snap->key, plist, p, dev, output);
+	cache_path(&snap->path, output->cache_dir, "snapshot", snap->key.buf);
+	data = cache_load(snap->path.buf, snap->key.buf, &size);
+	if (!data)
+		return;
+
+	cursor = data;
+	end = data + size;
+	while (snapshot_read(&line, sizeof(line), &cursor, end)) {
+		struct dev_snapshot_rec *rec;
+		if (line >= ARRAY_SIZE(dinfo_traits))
+			break;
+		rec = snap->rec + line;
+		if (!snapshot_read(&rec->err, sizeof(rec->err), &cursor, end) ||
+			!snapshot_read(&rec->needs_escaping, sizeof(rec->needs_escaping), &cursor, end) ||
+			!snapshot_read(rec->value, sizeof(rec->value), &cursor, end) ||
+			!snapshot_read(&rec->str_len, sizeof(rec->str_len), &cursor, end) ||
+			!(rec->str = snapshot_read_str(rec->str_len, &cursor, end)) ||
+			!snapshot_read(&rec->err_len, sizeof(rec->err_len), &cursor, end) ||
+			!(rec->err_str = snapshot_read_str(rec->err_len, &cursor, end)))
+			break;
+		rec->present = CL_TRUE;
+	}
+	free(data);
+}
+
+void
+dev_snapshot_save(struct dev_snapshot *snap, const struct opt_out *output)
+{
+	struct _strbuf data;
+	cl_uint line;
+
+	init_strbuf(&data, "snapshot data");
+	for (line = 0; line < ARRAY_SIZE(dinfo_traits); ++line) {
+		const struct dev_snapshot_rec *rec = snap->rec + line;
+		if (!rec->present)
+			continue;
+		strbuf_append_str_len(__func__, &data, (const char *)&line, sizeof(line));
+		strbuf_append_str_len(__func__, &data, (const char *)&rec->err, sizeof(rec->err));
+		strbuf_append_str_len(__func__, &data, (const char *)&rec->needs_escaping, sizeof(rec->needs_escaping));
+		strbuf_append_str_len(__func__, &data, (const char *)rec->value, sizeof(rec->value));
+		strbuf_append_str_len(__func__, &data, (const char *)&rec->str_len, sizeof(rec->str_len));
+		strbuf_append_str_len(__func__, &data, rec->str, rec->str_len);
+		strbuf_append_str_len(__func__, &data, (const char *)&rec->err_len, sizeof(rec->err_len));
+		strbuf_append_str_len(__func__, &data, rec->err_str, rec->err_len);
+	}
+	cache_store(output->cache_dir, snap->path.buf, snap->key.buf, data.buf, data.end);
+	free_strbuf(&data);
+}
+
+void
+dev_snapshot_free(struct dev_snapshot *snap)
+{
+	cl_uint line;
+	for (line = 0; line < ARRAY_SIZE(dinfo_traits); ++line) {
+		free(snap->rec[line].str);
+		free(snap->rec[line].err_str);
+	}
+	free(snap->rec);
+	free_strbuf(&snap->path);
+	free_strbuf(&snap->key);
+}
+
+/* Restore ret from the snapshot record */
+void
+dev_snapshot_get(const struct dev_snapshot_rec *rec, struct device_info_ret *ret)
+{
+	ret->err = rec->err;
+	ret->needs_escaping = rec->needs_escaping;
+	memcpy(&ret->value, rec->value, sizeof(rec->value));
+	reset_strbuf(&ret->str);
+	strbuf_append_str_len(__func__, &ret->str, rec->str, rec->str_len);
+	reset_strbuf(&ret->err_str);
+	strbuf_append_str_len(__func__, &ret->err_str, rec->err_str, rec->err_len);
+}
+
+/* Record ret in the snapshot */
+void
+dev_snapshot_put(struct dev_snapshot *snap, cl_uint line, const struct device_info_ret *ret)
+{
+	struct dev_snapshot_rec *rec = snap->rec + line;
+	rec->present = CL_TRUE;
+	rec->err = ret->err;
+	rec->needs_escaping = ret->needs_escaping;
+	memcpy(rec->value, &ret->value, sizeof(rec->value));
+	rec->str_len = strlen(ret->str.buf);
+	ALLOC(rec->str, rec->str_len + 1, "snapshot string");
+	memcpy(rec->str, ret->str.buf, rec->str_len);
+	rec->err_len = strlen(ret->err_str.buf);
+	ALLOC(rec->err_str, rec->err_len + 1, "snapshot error string");
+	memcpy(rec->err_str, ret->err_str.buf, rec->err_len);
+	snap->changed = CL_TRUE;
+}
+
+/* Update the device checks from the (successfully retrieved) value of param;
+ * extensions is the space-padded extensions string.
+ * NOTE: keep dev_checks_info in sync with the properties handled here
+ */
+void
+updateDeviceChecks(cl_device_info param, const struct device_info_ret *ret,
+	const char *extensions, struct device_info_checks *chk)
+{
+	switch (param) {
+	case CL_DEVICE_VERSION:
+		/* compute numeric value for OpenCL version */
+		chk->dev_version = getOpenCLVersion(ret->str.buf + 7);
+		break;
+	case CL_DEVICE_EXTENSIONS:
+		identify_device_extensions(extensions, chk);
+		break;
+	case CL_DEVICE_TYPE:
+		chk->devtype = ret->value.devtype;
+		break;
+	case CL_DEVICE_GLOBAL_MEM_CACHE_TYPE:
+		chk->cachetype = ret->value.cachetype;
+		break;
+	case CL_DEVICE_LOCAL_MEM_TYPE:
+		chk->lmemtype = ret->value.lmemtype;
+		break;
+	case CL_DEVICE_IMAGE_SUPPORT:
+		chk->image_support = ret->value.b;
+		break;
+	case CL_DEVICE_COMPILER_AVAILABLE:
+		chk->compiler_available = ret->value.b;
+		break;
+	case CL_DEVICE_NUM_P2P_DEVICES_AMD:
+		chk->p2p_num_devs = ret->value.u32;
+		break;
+	case CL_DEVICE_SCHEDULING_CONTROLS_CAPABILITIES_ARM:
+		chk->arm_register_alloc_support = !!(ret->value.sched_controls & CL_DEVICE_SCHEDULING_REGISTER_ALLOCATION_ARM);
+		// TODO warp count support should check for extension version >= 0.4
+		chk->arm_warp_count_support = !!(ret->value.sched_controls);
+		break;
+	default:
+		/* do nothing */
+		break;
+	}
+}
+
+/* Process all the device info in the traits, except if param_whitelist is not NULL,
+ * in which case only those in the whitelist will be processed.
+ * If present, the whitelist should be sorted in the order of appearance of the parameters
+ * in the traits table, and terminated by the value CL_FALSE
+ */
+
+void
+printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
+	const cl_device_info *param_whitelist, /* list of device info to process, or NULL */
+	const struct opt_out *output)
+{
+	char *extensions = NULL;
+	size_t ext_len = 0;
+	char *versioned_extensions = NULL;
+
+	/* pointers to the traits for CL_DEVICE_EXTENSIONS and CL_DEVICE_EXTENSIONS_WITH_VERSION */
+	const struct device_info_traits *extensions_traits = NULL;
+	const struct device_info_traits *versioned_extensions_traits = NULL;
+
+	struct device_info_checks chk;
+	struct device_info_ret ret;
+	struct info_loc loc;
+
+	cl_uint n = 0; /* number of device properties shown, for JSON */
+	cl_ulong start;
 
-	INIT_RET(ret, "device");
+	struct dev_snapshot snap;
+	/* the NULL platform is not a stable identity, and some queries behave differently on it */
+	const cl_bool use_snapshot = output->snapshot && output->cache_dir && plist->platform[p];
+
+	memset(&chk, 0, sizeof(chk));
+	chk.pinfo_checks = plist->platform_checks + p;
+	chk.dev_version = 10;
+
+	/* nothing from the previous device is needed anymore */
+	arena_reset(&scratch);
+	INIT_RET_SCRATCH(ret, "device");
 
 	reset_loc(&loc, __func__);
 	loc.plat = plist->platform[p];
 	loc.dev = dev;
 
+	if (use_snapshot)
+		dev_snapshot_load(&snap, plist, p, dev, output);
+
 	for (loc.line = 0; loc.line < ARRAY_SIZE(dinfo_traits); ++loc.line) {
 
 		const struct device_info_traits *traits = dinfo_traits + loc.line;
@@ -3577,6 +4488,11 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 		if (output->cond == COND_PROP_CHECK && !checked)
 			continue;
 
+		/* skip if the user requested specific properties, and neither this one
+		 * nor any of those depending on it was selected */
+		if (output->dev_prop_plan && output->dev_prop_plan[loc.line] == PROP_SKIP)
+			continue;
+
 		cur_sfx = (output->mode == CLINFO_HUMAN && traits->sfx) ? traits->sfx : empty_str;
 
 		reset_strbuf(&ret.str);
@@ -3590,10 +4506,21 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 			continue;
 		}
 
-		traits->show_func(&ret, &loc, &chk, output);
+		if (output->flush)
+			out_checkpoint();
+		start = timing_start(output);
+		if (!use_snapshot || is_dynamic_dev_info(traits->param)) {
+			traits->show_func(&ret, &loc, &chk, output);
+		} else if (snap.rec[loc.line].present) {
+			dev_snapshot_get(snap.rec + loc.line, &ret);
+		} else {
+			traits->show_func(&ret, &loc, &chk, output);
+			dev_snapshot_put(&snap, loc.line, &ret);
+		}
+		timing_stop(output, TIMING_PROP, loc.sname, start);
 
 		/* Do not print this property if the user requested one and this does not match */
-		requested = is_selected_prop(output, loc.sname);
+		requested = !output->dev_prop_plan || output->dev_prop_plan[loc.line] == PROP_SELECTED;
 		if (traits->param == CL_DEVICE_EXTENSIONS) {
 			/* make a backup of the extensions string, regardless of
 			 * errors and requested, because we need the information
@@ -3605,7 +4532,7 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 			 * without erroneously matching substrings by simply padding the extension name
 			 * with spaces.
 			 */
-			ALLOC(extensions, ext_len+3, "extensions");
+			SCRATCH_ALLOC(extensions, ext_len+3, "extensions");
 			memcpy(extensions + 1, msg, ext_len);
 			extensions[0] = ' ';
 			extensions[ext_len+1] = ' ';
@@ -3615,11 +4542,11 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 				continue;
 			/* This will be displayed at the end, after we display the output of CL_DEVICE_EXTENSIONS */
 			const char *msg = RET_BUF(ret)->buf;
-			const size_t len = RET_BUF(ret)->sz;
+			const size_t len = RET_BUF(ret)->end + 1;
 			if (!requested)
 				continue;
 			versioned_extensions_traits = traits;
-			ALLOC(versioned_extensions, len, "versioned extensions");
+			SCRATCH_ALLOC(versioned_extensions, len, "versioned extensions");
 			memcpy(versioned_extensions, msg, len);
 		} else if (requested) {
 			if (ret.err) {
@@ -3640,7 +4567,7 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 			if (output->brief && output->json)
 				json_stringify(RET_BUF(ret)->buf);
 			else if (output->brief)
-				printf("%s%s\n", line_pfx, RET_BUF(ret)->buf);
+				out_printf("%s%s\n", line_pfx, RET_BUF(ret)->buf);
 			else if (output->json)
 				json_strbuf(RET_BUF(ret), loc.pname, n++, ret.err || ret.needs_escaping);
 			else
@@ -3650,45 +4577,9 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 		if (ret.err)
 			continue;
 
-		switch (traits->param) {
-		case CL_DEVICE_VERSION:
-			/* compute numeric value for OpenCL version */
-			chk.dev_version = getOpenCLVersion(ret.str.buf + 7);
-			break;
-		case CL_DEVICE_EXTENSIONS:
-			identify_device_extensions(extensions, &chk);
-			if (!requested) {
-				free(extensions);
-				extensions = NULL;
-			}
-			break;
-		case CL_DEVICE_TYPE:
-			chk.devtype = ret.value.devtype;
-			break;
-		case CL_DEVICE_GLOBAL_MEM_CACHE_TYPE:
-			chk.cachetype = ret.value.cachetype;
-			break;
-		case CL_DEVICE_LOCAL_MEM_TYPE:
-			chk.lmemtype = ret.value.lmemtype;
-			break;
-		case CL_DEVICE_IMAGE_SUPPORT:
-			chk.image_support = ret.value.b;
-			break;
-		case CL_DEVICE_COMPILER_AVAILABLE:
-			chk.compiler_available = ret.value.b;
-			break;
-		case CL_DEVICE_NUM_P2P_DEVICES_AMD:
-			chk.p2p_num_devs = ret.value.u32;
-			break;
-		case CL_DEVICE_SCHEDULING_CONTROLS_CAPABILITIES_ARM:
-			chk.arm_register_alloc_support = !!(ret.value.sched_controls & CL_DEVICE_SCHEDULING_REGISTER_ALLOCATION_ARM);
-			// TODO warp count support should check for extension version >= 0.4
-			chk.arm_warp_count_support = !!(ret.value.sched_controls);
-			break;
-		default:
-			/* do nothing */
-			break;
-		}
+		updateDeviceChecks(traits->param, &ret, extensions, &chk);
+		if (traits->param == CL_DEVICE_EXTENSIONS && !requested)
+			extensions = NULL;
 	}
 
 	// and finally the extensions, if we retrieved them
@@ -3696,34 +4587,38 @@ printDeviceInfo(cl_device_id dev, const struct platform_list *plist, cl_uint p,
 		// undo the padding
 		extensions[ext_len + 1] = '\0';
 		if (output->json) {
-			printf("%s\"%s\" : ", (n > 0 ? comma_str : spc_str),
+			out_printf("%s\"%s\" : ", (n > 0 ? comma_str : spc_str),
 				(output->mode == CLINFO_HUMAN ?
 				 extensions_traits->pname : extensions_traits->sname));
 			json_stringify(extensions + 1);
 			++n;
 		} else
-			printf("%s" I1_STR "%s\n", line_pfx, (output->mode == CLINFO_HUMAN ?
+			out_printf("%s" I1_STR "%s\n", line_pfx, (output->mode == CLINFO_HUMAN ?
 					extensions_traits->pname : extensions_traits->sname),
 				extensions + 1);
 	}
 	if (versioned_extensions) {
 		if (output->json) {
-			printf("%s\"%s\" : ", (n > 0 ? comma_str : spc_str),
+			out_printf("%s\"%s\" : ", (n > 0 ? comma_str : spc_str),
 				(output->mode == CLINFO_HUMAN ?
 				 versioned_extensions_traits->pname : versioned_extensions_traits->sname));
-			fputs(versioned_extensions, stdout);
+			out_str(versioned_extensions);
 			++n;
 		} else {
-			printf("%s" I1_STR "%s\n", line_pfx, (output->mode == CLINFO_HUMAN ?
+			out_printf("%s" I1_STR "%s\n", line_pfx, (output->mode == CLINFO_HUMAN ?
 					versioned_extensions_traits->pname :
 					versioned_extensions_traits->sname),
 				versioned_extensions);
 		}
 	}
-	free(extensions);
-	free(versioned_extensions);
 	extensions = NULL;
 	UNINIT_RET(ret);
+
+	if (use_snapshot) {
+		if (snap.changed)
+			dev_snapshot_save(&snap, output);
+		dev_snapshot_free(&snap);
+	}
 }
 
 /* list of allowed properties for AMD offline devices */
@@ -3819,9 +4714,319 @@ void printPlatformName(const struct platform_list *plist, cl_uint p, struct _str
 	reset_strbuf(str);
 
 	if (output->brief)
-		printf("%s%s\n", line_pfx, pdata->pname);
+		out_printf("%s%s\n", line_pfx, pdata->pname);
 	else
-		printf("%s" I1_STR "%s\n", line_pfx, title, pdata->pname);
+		out_printf("%s" I1_STR "%s\n", line_pfx, title, pdata->pname);
+}
+
+/* set the line prefix for device d of platform p */
+void setDeviceLinePrefix(const struct platform_list *plist, cl_uint p, cl_uint d, cl_uint ndevs,
+	struct _strbuf *str, const struct opt_out *output, cl_bool these_are_offline)
+{
+	const struct platform_data *pdata = plist->pdata + p;
+	if (output->brief) {
+		const cl_bool last_device = (d == ndevs - 1 &&
+			output->mode != CLINFO_RAW &&
+			(!output->offline ||
+			 !pdata->has_amd_offline ||
+			 these_are_offline));
+		if (output->json) { /* nothing to do */ }
+		else if (output->mode == CLINFO_RAW)
+			sprintf(line_pfx, "%" PRIu32 "%c%" PRIu32 ": ",
+				p,
+				these_are_offline ? '*' : '.',
+				d);
+		else
+			sprintf(line_pfx, " +-- %sDevice #%" PRIu32 ": ",
+				these_are_offline ? "Offline " : "",
+				d);
+		if (last_device)
+			line_pfx[1] = '`';
+	} else if (line_pfx_len > 0) {
+		cl_int sd = (these_are_offline ? -1 : 1)*(cl_int)d;
+		strbuf_append(__func__, str, "[%s/%" PRId32 "]", pdata->sname, sd);
+		sprintf(line_pfx, "%*s", -line_pfx_len, str->buf);
+		reset_strbuf(str);
+	}
+}
+
+/* Properties shown for the sub-devices, in the order of dinfo_traits */
+static const cl_device_info sub_device_info_whitelist[] = {
+	CL_DEVICE_NAME,
+	CL_DEVICE_TYPE,
+	CL_DEVICE_MAX_COMPUTE_UNITS,
+	CL_DEVICE_GLOBAL_MEM_SIZE,
+	CL_DEVICE_GLOBAL_MEM_CACHE_TYPE,
+	CL_DEVICE_GLOBAL_MEM_CACHE_SIZE,
+	CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE,
+	CL_DEVICE_LOCAL_MEM_TYPE,
+	CL_DEVICE_LOCAL_MEM_SIZE,
+	CL_FALSE
+};
+
+/* clCreateSubDevices and clReleaseDevice, looked up at runtime since the OpenCL library
+ * might predate them */
+typedef cl_int (CL_API_CALL *create_sub_devices_fn)(cl_device_id, const cl_device_partition_property *,
+	cl_uint, cl_device_id *, cl_uint *);
+typedef cl_int (CL_API_CALL *release_device_fn)(cl_device_id);
+
+/* Partitions tried for the sub-devices: equally in halves, by counts as one compute unit
+ * and the rest, and by each supported affinity domain */
+#define MAX_SUB_PARTITIONS (2 + 6)
+struct sub_partition {
+	cl_device_partition_property props[5];
+};
+
+cl_uint getSubPartitions(cl_device_id dev, struct sub_partition *part)
+{
+	cl_device_partition_property types[8];
+	cl_device_affinity_domain domains = 0;
+	size_t sz = 0, i;
+	cl_uint cu = 0, n = 0, k;
+
+	if (clGetDeviceInfo(dev, CL_DEVICE_PARTITION_PROPERTIES, sizeof(types), types, &sz) != CL_SUCCESS)
+		return 0;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu), &cu, NULL);
+	clGetDeviceInfo(dev, CL_DEVICE_PARTITION_AFFINITY_DOMAIN, sizeof(domains), &domains, NULL);
+
+	memset(part, 0, MAX_SUB_PARTITIONS*sizeof(*part));
+	for (i = 0; i < sz/sizeof(*types); ++i) {
+		switch (types[i]) {
+		case CL_DEVICE_PARTITION_EQUALLY:
+			if (cu < 2) break;
+			part[n].props[0] = CL_DEVICE_PARTITION_EQUALLY;
+			part[n].props[1] = cu/2;
+			++n;
+			break;
+		case CL_DEVICE_PARTITION_BY_COUNTS:
+			if (cu < 2) break;
+			part[n].props[0] = CL_DEVICE_PARTITION_BY_COUNTS;
+			part[n].props[1] = 1;
+			part[n].props[2] = cu - 1;
+			part[n].props[3] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+			++n;
+			break;
+		case CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN:
+			for (k = 0; k < affinity_domain_count; ++k) {
+				if (!(domains & (1 << k))) continue;
+				part[n].props[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+				part[n].props[1] = (cl_device_partition_property)(1 << k);
+				++n;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return n;
+}
+
+/* describe the partition, e.g. "equally (4 compute units)" or "CL_DEVICE_PARTITION_EQUALLY 4" */
+void describeSubPartition(const struct sub_partition *part, struct _strbuf *str,
+	const struct opt_out *output)
+{
+	const cl_bool human = (output->mode == CLINFO_HUMAN);
+	int k;
+	reset_strbuf(str);
+	switch (part->props[0]) {
+	case CL_DEVICE_PARTITION_EQUALLY:
+		strbuf_append(__func__, str, human ? "equally (%" PRIuPTR " compute units)" :
+			"CL_DEVICE_PARTITION_EQUALLY %" PRIuPTR, (uintptr_t)part->props[1]);
+		break;
+	case CL_DEVICE_PARTITION_BY_COUNTS:
+		strbuf_append(__func__, str, human ? "by counts (%" PRIuPTR ", %" PRIuPTR ")" :
+			"CL_DEVICE_PARTITION_BY_COUNTS %" PRIuPTR " %" PRIuPTR,
+			(uintptr_t)part->props[1], (uintptr_t)part->props[2]);
+		break;
+	case CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN:
+		for (k = 0; !(part->props[1] & (1 << k)); ++k)
+			;
+		strbuf_append(__func__, str, human ? "by affinity domain (%s)" :
+			"CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN %s",
+			(human ? affinity_domain_str : affinity_domain_raw_str)[k]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Partition the device in all the supported ways, and show the main properties
+ * of the resulting sub-devices */
+void printSubDevices(cl_device_id dev, const struct platform_list *plist, cl_uint p,
+	const struct opt_out *output)
+{
+	struct sub_partition part[MAX_SUB_PARTITIONS];
+	struct opt_out sub_output;
+	struct _strbuf str, err_str;
+	char *saved_pfx = line_pfx;
+	char pfx[64], sub_pfx[96];
+	cl_uint num_parts, k;
+	size_t pfx_len;
+
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	void *ptrHack = dlsym(DL_MODULE, "clCreateSubDevices");
+	const create_sub_devices_fn create_sub_devices = *(create_sub_devices_fn*)(&ptrHack);
+	ptrHack = dlsym(DL_MODULE, "clReleaseDevice");
+	const release_device_fn release_device = *(release_device_fn*)(&ptrHack);
+
+	if (!create_sub_devices || !release_device)
+		return;
+	num_parts = getSubPartitions(dev, part);
+	if (!num_parts)
+		return;
+
+	/* the snapshot of the parent device would be used for its sub-devices */
+	sub_output = *output;
+	sub_output.snapshot = CL_FALSE;
+
+	/* RAW prefix of the parent, without padding and closing bracket */
+	snprintf(pfx, sizeof(pfx), "%s", line_pfx);
+	pfx_len = strlen(pfx);
+	while (pfx_len > 0 && (pfx[pfx_len - 1] == ' ' || pfx[pfx_len - 1] == ']'))
+		pfx[--pfx_len] = '\0';
+
+	init_strbuf(&str, "sub-device partition");
+	init_strbuf(&err_str, "sub-device error");
+	if (output->json)
+		out_str(", \"sub_devices\" : [");
+
+	for (k = 0; k < num_parts; ++k) {
+		cl_device_id *sub = NULL;
+		cl_uint num_sub = 0, s;
+		cl_int err;
+
+		describeSubPartition(part + k, &str, output);
+		err = create_sub_devices(dev, part[k].props, 0, NULL, &num_sub);
+		if (!err && num_sub) {
+			ALLOC(sub, num_sub, "sub-devices");
+			err = create_sub_devices(dev, part[k].props, num_sub, sub, NULL);
+		}
+		REPORT_ERROR(&err_str, err, "create sub-devices");
+
+		if (output->json) {
+			out_printf("%s{ \"CL_DEVICE_PARTITION_TYPE\" : ", (k > 0 ? comma_str : spc_str));
+			json_stringify(str.buf);
+			if (err) {
+				out_str(", \"error\" : ");
+				json_stringify(err_str.buf);
+			} else {
+				out_str(", \"devices\" : [");
+			}
+		} else {
+			if (output->mode == CLINFO_RAW)
+				snprintf(sub_pfx, sizeof(sub_pfx), "%s.%" PRIu32 "]", pfx, k);
+			else
+				sub_pfx[0] = '\0';
+			line_pfx = sub_pfx;
+			show_strbuf(&str, (output->mode == CLINFO_HUMAN ? "Sub-device partition" : "CL_DEVICE_PARTITION_TYPE"), 0, CL_SUCCESS);
+			if (err) {
+				show_strbuf(&err_str, (output->mode == CLINFO_HUMAN ? "Number of sub-devices" : "#SUBDEVICES"), 0, err);
+			} else {
+				reset_strbuf(&str);
+				strbuf_append(__func__, &str, "%" PRIu32, num_sub);
+				show_strbuf(&str, (output->mode == CLINFO_HUMAN ? "Number of sub-devices" : "#SUBDEVICES"), 0, CL_SUCCESS);
+			}
+		}
+
+		for (s = 0; !err && s < num_sub; ++s) {
+			if (output->json) {
+				out_printf("%s{", (s > 0 ? comma_str : spc_str));
+			} else if (output->mode == CLINFO_RAW) {
+				snprintf(sub_pfx, sizeof(sub_pfx), "%s.%" PRIu32 ".%" PRIu32 "]  ", pfx, k, s);
+			} else {
+				out_printf("    Sub-device #%" PRIu32 "\n", s);
+				snprintf(sub_pfx, sizeof(sub_pfx), "    ");
+			}
+			line_pfx = sub_pfx;
+			printDeviceInfo(sub[s], plist, p, sub_device_info_whitelist, &sub_output);
+			if (output->json)
+				out_str(" }");
+		}
+		line_pfx = saved_pfx;
+
+		if (output->json)
+			out_str(err ? " }" : " ] }");
+
+		for (s = 0; sub && s < num_sub; ++s)
+			release_device(sub[s]);
+		free(sub);
+	}
+
+	if (output->json)
+		out_str(" ]");
+	free_strbuf(&err_str);
+	free_strbuf(&str);
+}
+
+/* A device whose properties are collected by a worker thread */
+struct device_job {
+	cl_device_id dev;
+	const struct platform_list *plist;
+	cl_uint p;
+	cl_uint d;
+	cl_bool offline;
+	cl_bool timed_out; /* see --timeout: the job data must be left alone */
+	const cl_device_info *param_whitelist;
+	const struct opt_out *output;
+	char *line_pfx;
+	struct _strbuf out;
+};
+
+void deviceJob(void *arg)
+{
+	struct device_job *job = arg;
+	char *saved_pfx = line_pfx;
+	struct _strbuf *saved_buf = out_buf;
+
+	/* not selected */
+	if (!job->dev)
+		return;
+
+	line_pfx = job->line_pfx;
+	out_buf = &job->out;
+	set_timing_ctx(job->p, job->d, job->offline);
+	printDeviceInfo(job->dev, job->plist, job->p, job->param_whitelist, job->output);
+	if (job->output->sub_devices && !job->output->brief && !job->offline)
+		printSubDevices(job->dev, job->plist, job->p, job->output);
+	set_timing_ctx(-1, -1, CL_FALSE);
+	/* this may be a worker thread, which exits once the jobs are done */
+	arena_free(&scratch);
+	line_pfx = saved_pfx;
+	out_buf = saved_buf;
+}
+
+/* Collect the properties of all the selected devices concurrently,
+ * each in its own buffer, so that they can be printed in order later */
+struct device_job *
+gatherDevicesConcurrently(const struct platform_list *plist, cl_uint p,
+	const cl_device_id *device, cl_uint ndevs, const cl_device_info *param_whitelist,
+	struct _strbuf *str, const struct opt_out *output, cl_bool these_are_offline)
+{
+	struct device_job *job;
+	cl_uint d;
+
+	ALLOC(job, ndevs, "device jobs");
+	for (d = 0; d < ndevs; ++d) {
+		job[d].dev = device[d];
+		job[d].plist = plist;
+		job[d].p = p;
+		job[d].d = d;
+		job[d].offline = these_are_offline;
+		job[d].param_whitelist = param_whitelist;
+		job[d].output = output;
+		if (!is_selected_device(output, p, d)) {
+			job[d].dev = NULL;
+			continue;
+		}
+		init_strbuf(&job[d].out, "device output");
+		setDeviceLinePrefix(plist, p, d, ndevs, str, output, these_are_offline);
+		ALLOC(job[d].line_pfx, strlen(line_pfx) + 1, "device line prefix");
+		strcpy(job[d].line_pfx, line_pfx);
+	}
+
+	run_jobs_timeout(deviceJob, job, sizeof(*job), ndevs,
+		offsetof(struct device_job, timed_out), output);
+	return job;
 }
 
 void printPlatformDevices(const struct platform_list *plist, cl_uint p,
@@ -3831,62 +5036,80 @@ void printPlatformDevices(const struct platform_list *plist, cl_uint p,
 	const struct platform_data *pdata = plist->pdata + p;
 	const cl_device_info *param_whitelist = output->brief ? list_info_whitelist :
 		these_are_offline ? amd_offline_info_whitelist : NULL;
+	struct device_job *job = NULL;
 	cl_uint d;
 
 	if (output->json)
-		printf("%s\"%s\" : [", (these_are_offline ? comma_str : spc_str),
+		out_printf("%s\"%s\" : [", (these_are_offline ? comma_str : spc_str),
 			(these_are_offline ? "offline" : "online"));
 	else if (output->detailed)
-		printf("%s" I0_STR "%" PRIu32 "\n",
+		out_printf("%s" I0_STR "%" PRIu32 "\n",
 			line_pfx,
 			num_devs_header(output, these_are_offline),
 			ndevs);
 
+	if ((output->jobs > 1 && ndevs > 1) || (output->timeout_ms && ndevs > 0))
+		job = gatherDevicesConcurrently(plist, p, device, ndevs, param_whitelist,
+			str, output, these_are_offline);
+
 	for (d = 0; d < ndevs; ++d) {
 		const cl_device_id dev = device[d];
 		if (!is_selected_device(output, p, d)) continue;
-		if (output->brief) {
-			const cl_bool last_device = (d == ndevs - 1 &&
-				output->mode != CLINFO_RAW &&
-				(!output->offline ||
-				 !pdata->has_amd_offline ||
-				 these_are_offline));
-			if (output->json) { /* nothing to do */ }
-			else if (output->mode == CLINFO_RAW)
-				sprintf(line_pfx, "%" PRIu32 "%c%" PRIu32 ": ",
-					p,
-					these_are_offline ? '*' : '.',
-					d);
-			else
-				sprintf(line_pfx, " +-- %sDevice #%" PRIu32 ": ",
-					these_are_offline ? "Offline " : "",
-					d);
-			if (last_device)
-				line_pfx[1] = '`';
-		} else if (line_pfx_len > 0) {
-			cl_int sd = (these_are_offline ? -1 : 1)*(cl_int)d;
-			strbuf_append(__func__, str, "[%s/%" PRId32 "]", pdata->sname, sd);
-			sprintf(line_pfx, "%*s", -line_pfx_len, str->buf);
-			reset_strbuf(str);
-		}
 
 		if (output->json)
-			printf("%s%s",	(d > 0 ? comma_str : spc_str),
+			out_printf("%s%s",	(d > 0 ? comma_str : spc_str),
 				(output->brief ? "" : "{"));
 
-		printDeviceInfo(dev, plist, p, param_whitelist, output);
+		if (job && job[d].timed_out) {
+			/* not in str, which is shared with the caller */
+			struct _strbuf msg;
+			init_strbuf(&msg, "device timeout");
+			report_timeout(&msg, "printDeviceInfo", output);
+			if (output->json && output->brief)
+				json_stringify(msg.buf);
+			else if (output->json)
+				out_printf(" \"error\" : \"%s\"", msg.buf);
+			else if (output->brief)
+				out_printf("%s%s\n", job[d].line_pfx, msg.buf);
+			else
+				out_printf("%s" I1_STR "%s\n", job[d].line_pfx,
+					(output->mode == CLINFO_HUMAN ? "Device Name" : "CL_DEVICE_NAME"), msg.buf);
+			free_strbuf(&msg);
+		} else if (job) {
+			out_str(job[d].out.buf);
+		} else {
+			setDeviceLinePrefix(plist, p, d, ndevs, str, output, these_are_offline);
+			set_timing_ctx(p, d, these_are_offline);
+			printDeviceInfo(dev, plist, p, param_whitelist, output);
+			if (output->sub_devices && !output->brief && !these_are_offline)
+				printSubDevices(dev, plist, p, output);
+			set_timing_ctx(-1, -1, CL_FALSE);
+		}
 
 		if (output->json) {
-			if (!output->brief) printf(" }");
+			if (!output->brief) out_printf(" }");
 		} else if (output->detailed && d < pdata[p].ndevs - 1)
-			puts("");
+			out_char('\n');
 
 
-		fflush(stdout);
-		fflush(stderr);
+		out_checkpoint();
 	}
 	if (output->json)
-		fputs(" ]", stdout);
+		out_str(" ]");
+
+	if (job) {
+		cl_bool any_timed_out = CL_FALSE;
+		for (d = 0; d < ndevs; ++d) {
+			if (job[d].timed_out) {
+				any_timed_out = CL_TRUE;
+				continue;
+			}
+			free(job[d].line_pfx);
+			free_strbuf(&job[d].out);
+		}
+		if (!any_timed_out)
+			free(job);
+	}
 }
 
 
@@ -3917,7 +5140,7 @@ void showDevices(const struct platform_list *plist, const struct opt_out *output
 
 	if (str.buf[0]) {
 		line_pfx_len = (int)(strlen(str.buf) + 1);
-		REALLOC(line_pfx, line_pfx_len, "line prefix");
+		REALLOC(line_pfx, line_pfx_len + 1, "line prefix");
 		reset_strbuf(&str);
 	}
 
@@ -3927,7 +5150,7 @@ void showDevices(const struct platform_list *plist, const struct opt_out *output
 
 		/* Open the JSON devices list for this platform */
 		if (output->json)
-			printf("%s{", p > 0 ? comma_str : spc_str);
+			out_printf("%s{", p > 0 ? comma_str : spc_str);
 		/* skip platform header if only printing specfic properties, */
 		else if (!output->num_selected_props)
 			printPlatformName(plist, p, &str, output);
@@ -3939,14 +5162,19 @@ void showDevices(const struct platform_list *plist, const struct opt_out *output
 		if (output->offline && pdata[p].has_amd_offline) {
 			struct device_info_ret ret;
 			cl_device_id *devs = NULL;
+			cl_ulong start;
 
 			INIT_RET(ret, "offline device");
 			if (output->detailed)
-				puts("");
+				out_char('\n');
 
+			start = timing_start(output);
+			set_timing_ctx(p, -1, CL_FALSE);
 			devs = fetchOfflineDevicesAMD(plist, p, &ret);
+			timing_stop(output, TIMING_PHASE, "fetchOfflineDevicesAMD", start);
+			set_timing_ctx(-1, -1, CL_FALSE);
 			if (ret.err) {
-				puts(ret.err_str.buf);
+				out_printf("%s\n", ret.err_str.buf);
 			} else {
 				printPlatformDevices(plist, p, devs, ret.value.u32,
 					&str, output, CL_TRUE);
@@ -3958,39 +5186,322 @@ void showDevices(const struct platform_list *plist, const struct opt_out *output
 
 		/* Close JSON object for this platform */
 		if (output->json)
-			fputs(" }", stdout);
+			out_str(" }");
 		else if (output->detailed)
-			puts("");
+			out_char('\n');
 	}
 	free_strbuf(&str);
 }
 
-/* check the behavior of clGetPlatformInfo() when given a NULL platform ID */
-void checkNullGetPlatformName(const struct opt_out *output)
+/* Gather the device properties the conditions of the device info traits depend on */
+void
+gatherDeviceChecks(cl_device_id dev, const struct platform_list *plist, cl_uint p,
+	struct device_info_checks *chk, const struct opt_out *output)
 {
 	struct device_info_ret ret;
 	struct info_loc loc;
+	const cl_device_info *dep;
+	char *extensions = NULL;
 
-	INIT_RET(ret, "null ctx");
+	memset(chk, 0, sizeof(*chk));
+	chk->pinfo_checks = plist->platform_checks + p;
+	chk->dev_version = 10;
+
+	arena_reset(&scratch);
+	INIT_RET_SCRATCH(ret, "device checks");
 	reset_loc(&loc, __func__);
-	RESET_LOC_PARAM(loc, plat, CL_PLATFORM_NAME);
+	loc.plat = plist->platform[p];
+	loc.dev = dev;
 
-	ret.err = clGetPlatformInfo(NULL, CL_PLATFORM_NAME, ret.str.sz, ret.str.buf, NULL);
-	if (ret.err == CL_INVALID_PLATFORM) {
-		strbuf_append(__func__, &ret.err_str, no_plat(output));
-	} else {
-		loc.line = __LINE__ + 1;
-		REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s");
+	for (loc.line = 0; loc.line < ARRAY_SIZE(dinfo_traits); ++loc.line) {
+		const struct device_info_traits *traits = dinfo_traits + loc.line;
+
+		if (traits->param == CL_FALSE || !(output->mode & traits->output_mode))
+			continue;
+		for (dep = dev_checks_info; *dep != CL_FALSE && *dep != traits->param; ++dep)
+			;
+		if (*dep == CL_FALSE)
+			continue;
+		if (traits->check_func && !traits->check_func(chk))
+			continue;
+
+		loc.sname = traits->sname;
+		loc.pname = (output->mode == CLINFO_HUMAN ? traits->pname : traits->sname);
+		loc.param.dev = traits->param;
+
+		reset_strbuf(&ret.str);
+		reset_strbuf(&ret.err_str);
+		traits->show_func(&ret, &loc, chk, output);
+		if (ret.err)
+			continue;
+
+		if (traits->param == CL_DEVICE_EXTENSIONS) {
+			/* padded with spaces, as expected by identify_device_extensions */
+			const size_t len = strlen(ret.str.buf);
+			SCRATCH_ALLOC(extensions, len + 3, "extensions");
+			extensions[0] = ' ';
+			memcpy(extensions + 1, ret.str.buf, len);
+			extensions[len + 1] = ' ';
+			extensions[len + 2] = '\0';
+		}
+		updateDeviceChecks(traits->param, &ret, extensions, chk);
 	}
-	printf(I1_STR "%s\n",
-		"clGetPlatformInfo(NULL, CL_PLATFORM_NAME, ...)", RET_BUF(ret)->buf);
 	UNINIT_RET(ret);
 }
 
-/* check the behavior of clGetDeviceIDs() when given a NULL platform ID;
- * return the index of the default platform in our array of platform IDs,
- * or num_platforms (which is an invalid platform index) in case of errors
- * or no platform or device found.
+/* A dynamic device property tracked in watch mode */
+struct watch_rec {
+	cl_uint p;
+	cl_uint d;
+	cl_device_id dev;
+	const struct device_info_checks *chk;
+	const struct device_info_traits *traits;
+	/* last value (or error) shown, NULL before the first poll */
+	char *last;
+	cl_int last_err;
+};
+
+/* Gather the information of the selected platforms, without showing it,
+ * for the modes that only keep polling the devices (watch, metrics) */
+void gatherPlatformsQuietly(struct platform_list *plist, cl_uint num_platforms,
+	const struct opt_out *output)
+{
+	struct opt_out quiet = *output;
+	cl_uint p;
+
+	quiet.detailed = CL_FALSE;
+	quiet.brief = CL_FALSE;
+	quiet.num_selected_props = 0;
+	for (p = 0; p < num_platforms; ++p) {
+		cl_device_id *devs = NULL;
+		if (!is_selected_platform(output, p)) {
+			if (p) {
+				plist->dev_offset[p] = plist->dev_offset[p-1] + plist->pdata[p-1].ndevs;
+				plist->pdata[p].ndevs = 0;
+			}
+			continue;
+		}
+		gatherPlatformInfo(plist, p, &devs, &quiet);
+		mergePlatformInfo(plist, p, devs);
+	}
+}
+
+/* Watch mode: after gathering the platform information once, poll the dynamic properties
+ * of the selected devices every output->watch_interval seconds, and write out a line for
+ * each value that changed (starting with the initial values). Runs until interrupted.
+ */
+void watchDevices(struct platform_list *plist, cl_uint num_platforms, const struct opt_out *output)
+{
+	struct device_info_checks *chk = NULL;
+	struct watch_rec *rec = NULL;
+	size_t num_recs = 0, alloc_recs = 0, r;
+	struct device_info_ret ret;
+	struct info_loc loc;
+	cl_ulong start, next;
+	const cl_ulong interval = (cl_ulong)(output->watch_interval*1.0e9);
+	cl_uint p, d, dev_idx;
+
+	gatherPlatformsQuietly(plist, num_platforms, output);
+
+	/* find the dynamic properties supported by each selected device */
+	ALLOC(chk, plist->ndevs_total ? plist->ndevs_total : 1, "watch device checks");
+	for (p = 0, dev_idx = 0; p < num_platforms; ++p) {
+		if (!is_selected_platform(output, p))
+			continue;
+		for (d = 0; d < plist->pdata[p].ndevs; ++d, ++dev_idx) {
+			const cl_device_id dev = get_platform_dev(plist, p, d);
+			if (!is_selected_device(output, p, d))
+				continue;
+			gatherDeviceChecks(dev, plist, p, chk + dev_idx, output);
+			for (loc.line = 0; loc.line < ARRAY_SIZE(dinfo_traits); ++loc.line) {
+				const struct device_info_traits *traits = dinfo_traits + loc.line;
+				if (traits->param == CL_FALSE || !(output->mode & traits->output_mode) ||
+					!is_dynamic_dev_info(traits->param) ||
+					(output->dev_prop_plan && output->dev_prop_plan[loc.line] != PROP_SELECTED) ||
+					(traits->check_func && !traits->check_func(chk + dev_idx)))
+					continue;
+				if (num_recs == alloc_recs) {
+					alloc_recs = alloc_recs ? 2*alloc_recs : 16;
+					REALLOC(rec, alloc_recs, "watched properties");
+				}
+				rec[num_recs].p = p;
+				rec[num_recs].d = d;
+				rec[num_recs].dev = dev;
+				rec[num_recs].chk = chk + dev_idx;
+				rec[num_recs].traits = traits;
+				rec[num_recs].last = NULL;
+				rec[num_recs].last_err = CL_SUCCESS;
+				++num_recs;
+			}
+		}
+	}
+
+	if (!num_recs) {
+		fprintf(stderr, "no dynamic properties to watch on the selected devices\n");
+		exit(1);
+	}
+
+	INIT_RET(ret, "watch");
+	reset_loc(&loc, __func__);
+	start = next = timer_ns();
+	for (;;) {
+		const double elapsed = (timer_ns() - start)*1.0e-9;
+		/* the array values of the previous poll */
+		arena_reset(&scratch);
+		for (r = 0; r < num_recs; ++r) {
+			struct watch_rec *wr = rec + r;
+			const struct device_info_traits *traits = wr->traits;
+			const struct _strbuf *buf;
+
+			loc.line = traits - dinfo_traits;
+			loc.plat = plist->platform[wr->p];
+			loc.dev = wr->dev;
+			loc.sname = traits->sname;
+			loc.pname = (output->mode == CLINFO_HUMAN ? traits->pname : traits->sname);
+			loc.param.dev = traits->param;
+			cur_sfx = (output->mode == CLINFO_HUMAN && traits->sfx) ? traits->sfx : empty_str;
+
+			reset_strbuf(&ret.str);
+			reset_strbuf(&ret.err_str);
+			ret.needs_escaping = CL_FALSE;
+			traits->show_func(&ret, &loc, wr->chk, output);
+
+			buf = RET_BUF(ret);
+			if (wr->last && wr->last_err == ret.err && !strcmp(wr->last, buf->buf))
+				continue;
+
+			if (output->json) {
+				out_printf("{ \"time\" : %.3f, \"platform\" : %" PRIu32 ", \"device\" : %" PRIu32,
+					elapsed, wr->p, wr->d);
+				json_strbuf(buf, loc.pname, 1, ret.err || ret.needs_escaping);
+				out_str(" }\n");
+			} else {
+				out_printf(output->mode == CLINFO_HUMAN ?
+					"%10.3fs  [%s/%" PRIu32 "]  %s  %s%s\n" :
+					"%.3f [%s/%" PRIu32 "] %s %s%s\n",
+					elapsed, plist->pdata[wr->p].sname, wr->d, loc.pname,
+					skip_leading_ws(buf->buf), ret.err ? empty_str : cur_sfx);
+			}
+
+			free(wr->last);
+			ALLOC(wr->last, strlen(buf->buf) + 1, "watched value");
+			memcpy(wr->last, buf->buf, strlen(buf->buf) + 1);
+			wr->last_err = ret.err;
+		}
+		out_flush();
+
+		timer_wait_next(&next, interval);
+	}
+}
+
+/* Get the extensions of the device into str, as a space-separated list,
+ * from CL_DEVICE_EXTENSIONS_WITH_VERSION if CL_DEVICE_EXTENSIONS is not available
+ */
+cl_int fetchDeviceExtensions(cl_device_id dev, struct _strbuf *str)
+{
+	cl_name_version *ext = NULL;
+	size_t sz = 0, i;
+	cl_int err;
+
+	GET_STRING(str, err, clGetDeviceInfo, CL_DEVICE_EXTENSIONS, "CL_DEVICE_EXTENSIONS", dev);
+	if (err == CL_SUCCESS)
+		return err;
+
+	err = clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS_WITH_VERSION, 0, NULL, &sz);
+	if (err != CL_SUCCESS)
+		return err;
+	reset_strbuf(str);
+	if (!sz)
+		return CL_SUCCESS;
+	SCRATCH_ALLOC(ext, sz/sizeof(*ext) + 1, "versioned extensions");
+	err = clGetDeviceInfo(dev, CL_DEVICE_EXTENSIONS_WITH_VERSION, sz, ext, NULL);
+	if (err != CL_SUCCESS)
+		return err;
+	for (i = 0; i < sz/sizeof(*ext); ++i)
+		strbuf_append(__func__, str, "%s%.*s", (i > 0 ? " " : ""),
+			CL_NAME_VERSION_MAX_NAME_SIZE, ext[i].name);
+	return CL_SUCCESS;
+}
+
+/* Check if the selected devices support all the extensions in the comma-separated
+ * output->has_ext list, without querying anything but the device extensions.
+ * Returns the exit status: 0 if at least one of the selected devices supports
+ * all of them, 1 otherwise (including when the extensions cannot be retrieved)
+ */
+int checkDeviceExtensions(const struct platform_list *plist, const struct opt_out *output)
+{
+	struct _strbuf str;
+	cl_device_id *dev = NULL;
+	cl_uint p, d, ndevs;
+	cl_int err;
+	int status = 1;
+
+	init_strbuf(&str, "device extensions");
+	for (p = 0; p < plist->num_platforms && status; ++p) {
+		if (!is_selected_platform(output, p))
+			continue;
+		err = clGetDeviceIDs(plist->platform[p], CL_DEVICE_TYPE_ALL, 0, NULL, &ndevs);
+		if (err != CL_SUCCESS || !ndevs)
+			continue;
+		REALLOC(dev, ndevs, "devices");
+		err = clGetDeviceIDs(plist->platform[p], CL_DEVICE_TYPE_ALL, ndevs, dev, NULL);
+		if (err != CL_SUCCESS)
+			continue;
+
+		for (d = 0; d < ndevs && status; ++d) {
+			struct ext_set set;
+			const char *name = output->has_ext;
+
+			if (!is_selected_device(output, p, d))
+				continue;
+			arena_reset(&scratch);
+			if (fetchDeviceExtensions(dev[d], &str) != CL_SUCCESS)
+				continue;
+			ext_set_init(&set, str.buf, &scratch);
+			while (*name) {
+				const size_t len = strcspn(name, ",");
+				if (len && !ext_set_has_len(&set, name, len))
+					break;
+				name += len;
+				if (*name == ',')
+					++name;
+			}
+			ext_set_free(&set);
+			if (!*name)
+				status = 0;
+		}
+	}
+	free(dev);
+	free_strbuf(&str);
+	return status;
+}
+
+/* check the behavior of clGetPlatformInfo() when given a NULL platform ID */
+void checkNullGetPlatformName(const struct opt_out *output)
+{
+	struct device_info_ret ret;
+	struct info_loc loc;
+
+	INIT_RET(ret, "null ctx");
+	reset_loc(&loc, __func__);
+	RESET_LOC_PARAM(loc, plat, CL_PLATFORM_NAME);
+
+	ret.err = clGetPlatformInfo(NULL, CL_PLATFORM_NAME, ret.str.sz, ret.str.buf, NULL);
+	if (ret.err == CL_INVALID_PLATFORM) {
+		strbuf_append(__func__, &ret.err_str, no_plat(output));
+	} else {
+		loc.line = __LINE__ + 1;
+		REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s");
+	}
+	out_printf(I1_STR "%s\n",
+		"clGetPlatformInfo(NULL, CL_PLATFORM_NAME, ...)", RET_BUF(ret)->buf);
+	UNINIT_RET(ret);
+}
+
+/* check the behavior of clGetDeviceIDs() when given a NULL platform ID;
+ * return the index of the default platform in our array of platform IDs,
+ * or num_platforms (which is an invalid platform index) in case of errors
+ * or no platform or device found.
  */
 cl_uint checkNullGetDevices(const struct platform_list *plist, const struct opt_out *output)
 {
@@ -4095,7 +5606,7 @@ cl_uint checkNullGetDevices(const struct platform_list *plist, const struct opt_
 			strbuf_append(__func__, &ret.err_str, "<error: platform %p not found>", (void*)plat);
 		}
 	}
-	printf(I1_STR "%s\n",
+	out_printf(I1_STR "%s\n",
 		"clGetDeviceIDs(NULL, CL_DEVICE_TYPE_ALL, ...)", RET_BUF(ret)->buf);
 
 	UNINIT_RET(ret);
@@ -4124,14 +5635,14 @@ void checkNullCtx(struct device_info_ret *ret,
 	}
 }
 
-/* check behavior of clCreateContextFromType() with NULL cl_context_properties */
-void checkNullCtxFromType(const struct platform_list *plist, const struct opt_out *output)
+/* check behavior of clCreateContextFromType() with NULL cl_context_properties,
+ * for the device type devtype[t] */
+void checkNullCtxFromType(const struct platform_list *plist, size_t t, const struct opt_out *output)
 {
 	const cl_uint num_platforms = plist->num_platforms;
 	const struct platform_data *pdata = plist->pdata;
 	const cl_platform_id *platform = plist->platform;
 
-	size_t t; /* type iterator */
 	size_t i; /* generic iterator */
 	char def[1024];
 	cl_context ctx = NULL;
@@ -4158,105 +5669,101 @@ void checkNullCtxFromType(const struct platform_list *plist, const struct opt_ou
 
 	ALLOC(devs, ndevs, "context devices");
 
-	for (t = 1; t < devtype_count; ++t) { /* we skip 0 */
-		loc.sname = device_type_raw_str[t];
+	loc.sname = device_type_raw_str[t];
 
-		strbuf_append(__func__, &ret.str, "clCreateContextFromType(NULL, %s)", loc.sname);
-		sprintf(def, I1_STR, ret.str.buf);
-		reset_strbuf(&ret.str);
+	strbuf_append(__func__, &ret.str, "clCreateContextFromType(NULL, %s)", loc.sname);
+	sprintf(def, I1_STR, ret.str.buf);
+	reset_strbuf(&ret.str);
 
-		loc.line = __LINE__+1;
-		ctx = clCreateContextFromType(NULL, devtype[t], NULL, NULL, &ret.err);
-
-		switch (ret.err) {
-		case CL_INVALID_PLATFORM:
-			strbuf_append_str(__func__, &ret.err_str, no_plat(output)); break;
-		case CL_DEVICE_NOT_FOUND:
-			strbuf_append_str(__func__, &ret.err_str, no_dev_found(output)); break;
-		case CL_INVALID_DEVICE_TYPE: /* e.g. _CUSTOM device on 1.1 platform */
-			strbuf_append_str(__func__, &ret.err_str, invalid_dev_type(output)); break;
-		case CL_INVALID_VALUE: /* This is what apple returns for the case above */
-			strbuf_append_str(__func__, &ret.err_str, invalid_dev_type(output)); break;
-		case CL_DEVICE_NOT_AVAILABLE:
-			strbuf_append_str(__func__, &ret.err_str, no_dev_avail(output)); break;
-		default:
-			if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "create context from type %s")) break;
+	loc.line = __LINE__+1;
+	ctx = clCreateContextFromType(NULL, devtype[t], NULL, NULL, &ret.err);
 
-			/* get the devices */
-			loc.sname = "CL_CONTEXT_DEVICES";
-			loc.line = __LINE__+2;
+	switch (ret.err) {
+	case CL_INVALID_PLATFORM:
+		strbuf_append_str(__func__, &ret.err_str, no_plat(output)); break;
+	case CL_DEVICE_NOT_FOUND:
+		strbuf_append_str(__func__, &ret.err_str, no_dev_found(output)); break;
+	case CL_INVALID_DEVICE_TYPE: /* e.g. _CUSTOM device on 1.1 platform */
+		strbuf_append_str(__func__, &ret.err_str, invalid_dev_type(output)); break;
+	case CL_INVALID_VALUE: /* This is what apple returns for the case above */
+		strbuf_append_str(__func__, &ret.err_str, invalid_dev_type(output)); break;
+	case CL_DEVICE_NOT_AVAILABLE:
+		strbuf_append_str(__func__, &ret.err_str, no_dev_avail(output)); break;
+	default:
+		if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "create context from type %s")) break;
 
-			ret.err = clGetContextInfo(ctx, CL_CONTEXT_DEVICES, 0, NULL, &szval);
-			if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s size")) break;
-			if (szval > cursz) {
-				REALLOC(devs, szval, "context devices");
-				cursz = szval;
-			}
+		/* get the devices */
+		loc.sname = "CL_CONTEXT_DEVICES";
+		loc.line = __LINE__+2;
 
-			loc.line = __LINE__+1;
-			ret.err = clGetContextInfo(ctx, CL_CONTEXT_DEVICES, cursz, devs, NULL);
-			if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s")) break;
-			ndevs = szval/sizeof(cl_device_id);
-			if (ndevs < 1) {
-				ret.err = CL_DEVICE_NOT_FOUND;
-				strbuf_append_str(__func__, &ret.err_str, "<error: context created with no devices>");
-			}
+		ret.err = clGetContextInfo(ctx, CL_CONTEXT_DEVICES, 0, NULL, &szval);
+		if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s size")) break;
+		if (szval > cursz) {
+			REALLOC(devs, szval, "context devices");
+			cursz = szval;
+		}
 
-			/* get the platform from the first device */
-			RESET_LOC_PARAM(loc, dev, CL_DEVICE_PLATFORM);
-			loc.line = __LINE__+1;
-			ret.err = clGetDeviceInfo(*devs, CL_DEVICE_PLATFORM, sizeof(plat), &plat, NULL);
-			if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s")) break;
-			loc.plat = plat;
+		loc.line = __LINE__+1;
+		ret.err = clGetContextInfo(ctx, CL_CONTEXT_DEVICES, cursz, devs, NULL);
+		if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s")) break;
+		ndevs = szval/sizeof(cl_device_id);
+		if (ndevs < 1) {
+			ret.err = CL_DEVICE_NOT_FOUND;
+			strbuf_append_str(__func__, &ret.err_str, "<error: context created with no devices>");
+		}
 
-			for (i = 0; i < num_platforms; ++i) {
-				if (platform[i] == plat)
-					break;
-			}
-			if (i == num_platforms) {
-				ret.err = CL_INVALID_PLATFORM;
-				strbuf_append(__func__, &ret.err_str, "<error: platform %p not found>", (void*)plat);
+		/* get the platform from the first device */
+		RESET_LOC_PARAM(loc, dev, CL_DEVICE_PLATFORM);
+		loc.line = __LINE__+1;
+		ret.err = clGetDeviceInfo(*devs, CL_DEVICE_PLATFORM, sizeof(plat), &plat, NULL);
+		if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s")) break;
+		loc.plat = plat;
+
+		for (i = 0; i < num_platforms; ++i) {
+			if (platform[i] == plat)
 				break;
-			} else {
-				strbuf_append(__func__, &ret.str, "%s (%" PRIuS ")",
-					(output->mode == CLINFO_HUMAN ? "Success" : "CL_SUCCESS"),
-					ndevs);
-				strbuf_append(__func__, &ret.str, "\n" I2_STR "%s",
-					platname_prop, pdata[i].pname);
-			}
-			for (i = 0; i < ndevs; ++i) {
-				size_t szname = 0;
-				/* for each device, show the device name */
-				/* TODO some other unique ID too, e.g. PCI address, if available? */
-
-				strbuf_append(__func__, &ret.str, "\n" I2_STR, devname_prop);
-
-				RESET_LOC_PARAM(loc, dev, CL_DEVICE_NAME);
-				loc.dev = devs[i];
-				loc.line = __LINE__+1;
-				ret.err = clGetDeviceInfo(devs[i], CL_DEVICE_NAME, ret.str.sz - ret.str.end, ret.str.buf + ret.str.end, &szname);
-				if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s")) break;
-				ret.str.end += szname - 1;
-			}
-			if (i != ndevs)
-				break; /* had an error earlier, bail */
 		}
+		if (i == num_platforms) {
+			ret.err = CL_INVALID_PLATFORM;
+			strbuf_append(__func__, &ret.err_str, "<error: platform %p not found>", (void*)plat);
+			break;
+		} else {
+			strbuf_append(__func__, &ret.str, "%s (%" PRIuS ")",
+				(output->mode == CLINFO_HUMAN ? "Success" : "CL_SUCCESS"),
+				ndevs);
+			strbuf_append(__func__, &ret.str, "\n" I2_STR "%s",
+				platname_prop, pdata[i].pname);
+		}
+		for (i = 0; i < ndevs; ++i) {
+			size_t szname = 0;
+			/* for each device, show the device name */
+			/* TODO some other unique ID too, e.g. PCI address, if available? */
 
-		if (ctx) {
-			clReleaseContext(ctx);
-			ctx = NULL;
+			strbuf_append(__func__, &ret.str, "\n" I2_STR, devname_prop);
+
+			RESET_LOC_PARAM(loc, dev, CL_DEVICE_NAME);
+			loc.dev = devs[i];
+			loc.line = __LINE__+1;
+			ret.err = clGetDeviceInfo(devs[i], CL_DEVICE_NAME, ret.str.sz - ret.str.end, ret.str.buf + ret.str.end, &szname);
+			if (REPORT_ERROR_LOC(&ret, ret.err, &loc, "get %s")) break;
+			ret.str.end += szname - 1;
 		}
-		printf("%s%s\n", def, RET_BUF(ret)->buf);
-		reset_strbuf(&ret.str);
-		reset_strbuf(&ret.err_str);
+		if (i != ndevs)
+			break; /* had an error earlier, bail */
+	}
+
+	if (ctx) {
+		clReleaseContext(ctx);
+		ctx = NULL;
 	}
+	out_printf("%s%s\n", def, RET_BUF(ret)->buf);
 	free(devs);
 	UNINIT_RET(ret);
 }
 
-/* check the behavior of NULL platform in clGetDeviceIDs (see checkNullGetDevices)
- * and in clCreateContext() */
-void checkNullBehavior(const struct platform_list *plist, const struct opt_out *output)
+/* check the behavior of NULL platform in clGetPlatformInfo(), in clGetDeviceIDs
+ * (see checkNullGetDevices) and in clCreateContext() */
+void checkNullGetDevicesCtx(const struct platform_list *plist, const struct opt_out *output)
 {
 	const cl_uint num_platforms = plist->num_platforms;
 	const struct platform_data *pdata = plist->pdata;
@@ -4264,13 +5771,17 @@ void checkNullBehavior(const struct platform_list *plist, const struct opt_out *
 	cl_uint p = 0;
 	struct device_info_ret ret;
 
-	INIT_RET(ret, "null behavior");
+	cl_ulong start;
 
-	printf("NULL platform behavior\n");
+	INIT_RET(ret, "null behavior");
 
+	start = timing_start(output);
 	checkNullGetPlatformName(output);
+	timing_stop(output, TIMING_PHASE, "checkNullGetPlatformName", start);
 
+	start = timing_start(output);
 	p = checkNullGetDevices(plist, output);
+	timing_stop(output, TIMING_PHASE, "checkNullGetDevices", start);
 
 	/* If there's a default platform, and it has devices, try
 	 * creating a context with its first device and see if it works */
@@ -4283,14 +5794,16 @@ void checkNullBehavior(const struct platform_list *plist, const struct opt_out *
 		strbuf_append(__func__, &ret.err_str, no_dev_found(output));
 	} else {
 		if (p < num_platforms) {
+			start = timing_start(output);
 			checkNullCtx(&ret, plist, p, "default", output);
+			timing_stop(output, TIMING_PHASE, "checkNullCtx", start);
 		} else {
 			/* this shouldn't happen, but still ... */
 			ret.err = CL_OUT_OF_HOST_MEMORY;
 			strbuf_append_str(__func__, &ret.err_str, "<error: overflow in default platform scan>");
 		}
 	}
-	printf(I1_STR "%s\n", "clCreateContext(NULL, ...) [default]", RET_BUF(ret)->buf);
+	out_printf(I1_STR "%s\n", "clCreateContext(NULL, ...) [default]", RET_BUF(ret)->buf);
 
 	/* Look for a device from a non-default platform, if there are any */
 	if (p == num_platforms || num_platforms > 1) {
@@ -4301,16 +5814,16 @@ void checkNullBehavior(const struct platform_list *plist, const struct opt_out *
 			p2++;
 		}
 		if (p2 < num_platforms) {
+			start = timing_start(output);
 			checkNullCtx(&ret, plist, p2, "non-default", output);
+			timing_stop(output, TIMING_PHASE, "checkNullCtx", start);
 		} else {
 			ret.err = CL_DEVICE_NOT_FOUND;
 			strbuf_append(__func__, &ret.err_str, "<error: no devices in non-default plaforms>");
 		}
-		printf(I1_STR "%s\n", "clCreateContext(NULL, ...) [other]", RET_BUF(ret)->buf);
+		out_printf(I1_STR "%s\n", "clCreateContext(NULL, ...) [other]", RET_BUF(ret)->buf);
 	}
 
-	checkNullCtxFromType(plist, output);
-
 	UNINIT_RET(ret);
 }
 
@@ -4377,6 +5890,182 @@ struct icdl_info_traits linfo_traits[] = {
 #pragma GCC diagnostic ignored "-Wstrict-aliasing"
 #endif
 
+/* The NULL platform checks, as independent jobs: the clGetDeviceIDs and
+ * clCreateContext checks (type 0), and the clCreateContextFromType check
+ * for each device type (devtype[type]), since each context creation can be slow
+ */
+struct null_behavior_job {
+	const struct platform_list *plist;
+	const struct opt_out *output;
+	size_t type;
+	char *line_pfx;
+	cl_bool timed_out;
+	struct _strbuf out;
+};
+
+void nullBehaviorJob(void *arg)
+{
+	struct null_behavior_job *job = arg;
+	char *saved_pfx = line_pfx;
+	struct _strbuf *saved_buf = out_buf;
+	cl_ulong start;
+
+	line_pfx = job->line_pfx;
+	out_buf = &job->out;
+	if (job->type == 0) {
+		checkNullGetDevicesCtx(job->plist, job->output);
+	} else {
+		start = timing_start(job->output);
+		checkNullCtxFromType(job->plist, job->type, job->output);
+		timing_stop(job->output, TIMING_PHASE, "checkNullCtxFromType", start);
+	}
+	line_pfx = saved_pfx;
+	out_buf = saved_buf;
+}
+
+/* Key for the cached results of the NULL platform checks: they only depend
+ * on the ICD loader (and its configuration), on the platforms and on their devices,
+ * and are rendered according to the output mode */
+void null_behavior_key(struct _strbuf *key, const struct platform_list *plist,
+	const struct opt_out *output)
+{
+	/* the loader settings that change which platforms are found, and in which order */
+	static const char * const loader_env[] = {
+		"OCL_ICD_VENDORS", "OCL_ICD_FILENAMES",
+		"OCL_ICD_DEFAULT_PLATFORM", "OCL_ICD_PLATFORM_SORT"
+	};
+	struct _strbuf str;
+	icdl_info_fn_ptr icdl_info;
+	void *ptrHack;
+	cl_int err;
+	cl_uint p, d;
+	size_t i;
+
+	init_strbuf(&str, "NULL platform checks key");
+	reset_strbuf(key);
+	strbuf_append(__func__, key, "%d[%s]\n", output->mode, line_pfx);
+
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	ptrHack = clGetExtensionFunctionAddress("clGetICDLoaderInfoOCLICD");
+	icdl_info = *(icdl_info_fn_ptr*)(&ptrHack);
+	if (icdl_info) {
+		char buf[256];
+		for (i = 0; i < ARRAY_SIZE(linfo_traits); ++i) {
+			if (icdl_info(linfo_traits[i].param, sizeof(buf), buf, NULL) != CL_SUCCESS)
+				buf[0] = '\0';
+			buf[sizeof(buf) - 1] = '\0';
+			strbuf_append(__func__, key, "%s\n", buf);
+		}
+	}
+	for (i = 0; i < ARRAY_SIZE(loader_env); ++i) {
+		const char *val = getenv(loader_env[i]);
+		strbuf_append(__func__, key, "%s=%s\n", loader_env[i], val ? val : "");
+	}
+
+	for (p = 0; p < plist->num_platforms; ++p) {
+		const struct platform_data *pdata = plist->pdata + p;
+		const cl_device_id *devs = get_platform_devs(plist, p);
+		strbuf_append(__func__, key, "%s\n%s\n", pdata->sname, pdata->pname);
+		GET_STRING(&str, err, clGetPlatformInfo, CL_PLATFORM_VERSION, "CL_PLATFORM_VERSION",
+			plist->platform[p]);
+		strbuf_append(__func__, key, "%s\n%" PRIu32 "\n", err ? "" : str.buf, pdata->ndevs);
+		for (d = 0; d < pdata->ndevs; ++d) {
+			GET_STRING(&str, err, clGetDeviceInfo, CL_DEVICE_NAME, "CL_DEVICE_NAME", devs[d]);
+			strbuf_append(__func__, key, "%s\n", err ? "" : str.buf);
+			GET_STRING(&str, err, clGetDeviceInfo, CL_DRIVER_VERSION, "CL_DRIVER_VERSION", devs[d]);
+			strbuf_append(__func__, key, "%s\n", err ? "" : str.buf);
+		}
+	}
+	free_strbuf(&str);
+}
+
+/* Show the behavior of the NULL platform. The checks are run concurrently
+ * (with -j), each with the --timeout deadline if any, since on broken ICDs
+ * even the context creation may hang. With --snapshot, the results
+ * are stored in the on-disk cache, and reused as long as the ICD loader,
+ * the platforms and their devices do not change.
+ */
+void checkNullBehavior(const struct platform_list *plist, const struct opt_out *output)
+{
+	const cl_bool use_cache = output->snapshot && output->cache_dir;
+	struct null_behavior_job *job;
+	struct _strbuf res, key, path;
+	cl_bool timed_out = CL_FALSE;
+	size_t j;
+
+	init_strbuf(&res, "NULL platform checks");
+	if (use_cache) {
+		size_t size;
+		char *data;
+
+		init_strbuf(&key, "NULL platform checks key");
+		init_strbuf(&path, "NULL platform checks path");
+		null_behavior_key(&key, plist, output);
+		cache_path(&path, output->cache_dir, "null", key.buf);
+		data = cache_load(path.buf, key.buf, &size);
+		if (data) {
+			out_str_len(data, size);
+			free(data);
+			free_strbuf(&key);
+			free_strbuf(&path);
+			free_strbuf(&res);
+			return;
+		}
+	}
+
+	/* one job for the clGetDeviceIDs and clCreateContext checks, and one
+	 * for each device type except 0 */
+	ALLOC(job, devtype_count, "NULL platform checks jobs");
+	for (j = 0; j < devtype_count; ++j) {
+		job[j].plist = plist;
+		job[j].output = output;
+		job[j].type = j;
+		ALLOC(job[j].line_pfx, strlen(line_pfx) + 1, "line prefix");
+		strcpy(job[j].line_pfx, line_pfx);
+		job[j].timed_out = CL_FALSE;
+		init_strbuf(&job[j].out, "NULL platform checks output");
+	}
+	run_jobs_timeout(nullBehaviorJob, job, sizeof(*job), devtype_count,
+		offsetof(struct null_behavior_job, timed_out), output);
+
+	strbuf_append_str(__func__, &res, "NULL platform behavior\n");
+	for (j = 0; j < devtype_count; ++j) {
+		if (job[j].timed_out) {
+			struct _strbuf str;
+			init_strbuf(&str, "NULL platform checks timeout");
+			report_timeout(&str, "checkNullBehavior", output);
+			if (j == 0)
+				strbuf_append(__func__, &res, I1_STR "%s\n", "Checks", str.buf);
+			else
+				strbuf_append(__func__, &res, I1_STR "%s\n",
+					device_type_raw_str[j], str.buf);
+			free_strbuf(&str);
+			timed_out = CL_TRUE;
+		} else {
+			strbuf_append_str_len(__func__, &res, job[j].out.buf, job[j].out.end);
+		}
+	}
+	out_str_len(res.buf, res.end);
+
+	/* results from timed out checks are not worth keeping */
+	if (use_cache) {
+		if (!timed_out)
+			cache_store(output->cache_dir, path.buf, key.buf, res.buf, res.end);
+		free_strbuf(&key);
+		free_strbuf(&path);
+	}
+	free_strbuf(&res);
+
+	/* the timed out jobs are abandoned, and may still be using their data */
+	if (timed_out)
+		return;
+	for (j = 0; j < devtype_count; ++j) {
+		free_strbuf(&job[j].out);
+		free(job[j].line_pfx);
+	}
+	free(job);
+}
+
 struct icdl_data oclIcdProps(const struct platform_list *plist, const struct opt_out *output)
 {
 	const cl_uint max_plat_version = plist->max_plat_version;
@@ -4427,13 +6116,13 @@ struct icdl_data oclIcdProps(const struct platform_list *plist, const struct opt
 
 		/* TODO think of a sensible header in CLINFO_RAW */
 		if (output->mode != CLINFO_RAW)
-			puts("\nICD loader properties");
+			out_str("\nICD loader properties\n");
 
 		if (output->json) {
-			fputs(", \"icd_loader\" : {", stdout);
+			out_str(", \"icd_loader\" : {");
 		} else if (output->mode == CLINFO_RAW) {
 			line_pfx_len = (int)(strlen(oclicdl_pfx) + 5);
-			REALLOC(line_pfx, line_pfx_len, "line prefix OCL ICD");
+			REALLOC(line_pfx, line_pfx_len + 1, "line prefix OCL ICD");
 			strbuf_append(loc.pname, &ret.str, "[%s/*]", oclicdl_pfx);
 			sprintf(line_pfx, "%*s", -line_pfx_len, ret.str.buf);
 			reset_strbuf(&ret.str);
@@ -4468,7 +6157,7 @@ struct icdl_data oclIcdProps(const struct platform_list *plist, const struct opt
 		}
 
 		if (output->json)
-			printf("%s\"_detected_version\" : \"%" PRIu32 ".%" PRIu32 "\" }",
+			out_printf("%s\"_detected_version\" : \"%" PRIu32 ".%" PRIu32 "\" }",
 				(n > 0 ? comma_str : spc_str),
 				SPLIT_CL_VERSION(icdl.detected_version));
 		UNINIT_RET(ret);
@@ -4485,7 +6174,7 @@ struct icdl_data oclIcdProps(const struct platform_list *plist, const struct opt
 		if (icdl.reported_version &&
 			icdl.reported_version <= clinfo_highest_known_version &&
 			icdl.reported_version != icdl.detected_version) {
-			printf(	"\tNOTE:\tyour OpenCL library declares to support OpenCL %" PRIu32 ".%" PRIu32 ",\n"
+			out_printf(	"\tNOTE:\tyour OpenCL library declares to support OpenCL %" PRIu32 ".%" PRIu32 ",\n"
 				"\t\tbut it seems to support up to OpenCL %" PRIu32 ".%" PRIu32 " %s.\n",
 				SPLIT_CL_VERSION(icdl.reported_version),
 				SPLIT_CL_VERSION(icdl.detected_version),
@@ -4494,7 +6183,7 @@ struct icdl_data oclIcdProps(const struct platform_list *plist, const struct opt
 		}
 
 		if (max_version_check < max_plat_version) {
-			printf(	"\tNOTE:\tyour OpenCL library only supports OpenCL %" PRIu32 ".%" PRIu32 ",\n"
+			out_printf(	"\tNOTE:\tyour OpenCL library only supports OpenCL %" PRIu32 ".%" PRIu32 ",\n"
 				"\t\tbut some installed platforms support OpenCL %" PRIu32 ".%" PRIu32 ".\n"
 				"\t\tPrograms using %" PRIu32 ".%" PRIu32 " features may crash\n"
 				"\t\tor behave unexpectedly\n",
@@ -4506,87 +6195,1382 @@ struct icdl_data oclIcdProps(const struct platform_list *plist, const struct opt
 	return icdl;
 }
 
+/* clCreateCommandQueueWithProperties, if the OpenCL library provides it */
+bench_create_queue_fn bench_create_queue_func(void)
+{
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	void *ptrHack = dlsym(DL_MODULE, "clCreateCommandQueueWithProperties");
+	return *(bench_create_queue_fn*)(&ptrHack);
+}
+
 #if defined __GNUC__ && ((__GNUC__*10 + __GNUC_MINOR__) < 46)
 #pragma GCC diagnostic warning "-Wstrict-aliasing"
 #endif
 
-void version(void)
+/* Output of the benchmark results: for each device, a group of values
+ * for each benchmark (possibly with nested groups), shown as an indented section
+ * in HUMAN mode, as properties named group.key in RAW mode, and as nested objects
+ * in JSON mode
+ */
+#define BENCH_OUT_DEPTH 4
+struct bench_out {
+	const struct opt_out *output;
+	char pfx[64]; /* line prefix in RAW mode */
+	cl_uint depth; /* number of open groups */
+	const char *group[BENCH_OUT_DEPTH]; /* keys of the open groups */
+	cl_uint n[BENCH_OUT_DEPTH + 1]; /* number of values in each open JSON object, n[0] is the device */
+};
+
+void bench_group_begin(struct bench_out *bo, const char *hname, const char *key)
 {
-	puts("clinfo version 3.0.23.01.25");
+	/* each benchmark opens a top-level group before running */
+	if (!bo->depth)
+		out_checkpoint();
+	if (bo->output->json)
+		out_printf("%s\"%s\" : {", (bo->n[bo->depth]++ > 0 ? comma_str : spc_str), key);
+	else if (bo->output->mode == CLINFO_HUMAN)
+		out_printf("%*s%s\n", 2*(bo->depth + 1), "", hname);
+	bo->group[bo->depth++] = key;
+	bo->n[bo->depth] = 0;
 }
 
-void add_selected_device(struct opt_out *output, cl_uint p, cl_uint d)
+void bench_group_end(struct bench_out *bo)
 {
-	if (output->num_selected_devices == MAX_SELECTED_DEVICES) {
-		fprintf(stderr, "too many device specifications (max: %u)\n", MAX_SELECTED_DEVICES);
-		exit(1);
-	}
-	cl_uint2 *dst = output->selected_devices + output->num_selected_devices++;
-	dst->s[0] = p;
-	dst->s[1] = d;
+	if (bo->output->json)
+		out_str(" }");
+	--bo->depth;
 }
 
-void parse_device_spec(const char *str, struct opt_out *output)
+/* show a value of the current group; the (human-readable) suffix sfx
+ * is only used in HUMAN mode, value must be valid JSON */
+void bench_value(struct bench_out *bo, const char *hname, const char *key,
+	const char *sfx, const char *fmt, ...)
 {
-	int p, d, n;
-	if (!str) {
-		fprintf(stderr, "please specify a device in the form P:D where P is the platform number and D the device number\n");
-		exit(1);
-	}
-	n = sscanf(str, "%d:%d", &p, &d);
-	if (n != 2 || p < 0 || d < 0) {
-		fprintf(stderr, "invalid device specification '%s'\n", str);
-		exit(1);
+	const int indent = 2*(bo->depth + 1);
+	char value[256];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(value, sizeof(value), fmt, ap);
+	va_end(ap);
+
+	if (bo->output->json) {
+		out_printf("%s\"%s\" : %s", (bo->n[bo->depth]++ > 0 ? comma_str : spc_str), key, value);
+	} else if (bo->output->mode == CLINFO_HUMAN) {
+		out_printf("%*s%-*s  %s%s\n", indent, "", 48 - indent, hname, value, sfx ? sfx : empty_str);
+	} else {
+		char name[128] = "";
+		size_t len = 0;
+		cl_uint i;
+		for (i = 0; i < bo->depth; ++i)
+			len += snprintf(name + len, sizeof(name) - len, "%s.", bo->group[i]);
+		snprintf(name + len, sizeof(name) - len, "%s", key);
+		out_printf("%s" I1_STR "%s\n", bo->pfx, name, value);
 	}
-	add_selected_device(output, p, d);
 }
 
-void free_output(struct opt_out * UNUSED(output))
+/* show a string value (such as an error message) of the current group */
+void bench_string(struct bench_out *bo, const char *hname, const char *key, const char *str)
 {
-	/* nothing to do until we implement proper memory management
-	 * for selected_devices and selected_props
-	 */
+	if (bo->output->json) {
+		out_printf("%s\"%s\" : ", (bo->n[bo->depth]++ > 0 ? comma_str : spc_str), key);
+		json_stringify(str);
+	} else {
+		bench_value(bo, hname, key, NULL, "%s", str);
+	}
 }
 
-void add_selected_prop(struct opt_out *output, const char* prop)
+/* show an n-by-n matrix of values of the current group, indexed by source and
+ * destination; the entries with valid[i*n + j] unset are shown as missing,
+ * labels are the (device) indices shown for the rows and columns */
+void bench_matrix(struct bench_out *bo, const char *hname, const char *key,
+	cl_uint n, const cl_uint *labels, const double *val, const cl_bool *valid, const char *fmt)
 {
-	if (output->num_selected_props == MAX_SELECTED_PROPS) {
-		fprintf(stderr, "too many properties specifications (max: %u)\n", MAX_SELECTED_PROPS);
-		exit(1);
+	const int indent = 2*(bo->depth + 1);
+	char value[32];
+	cl_uint i, j;
+
+	if (bo->output->json) {
+		out_printf("%s\"%s\" : [", (bo->n[bo->depth]++ > 0 ? comma_str : spc_str), key);
+		for (i = 0; i < n; ++i) {
+			out_str(i > 0 ? ", [" : " [");
+			for (j = 0; j < n; ++j) {
+				if (valid[i*n + j])
+					snprintf(value, sizeof(value), fmt, val[i*n + j]);
+				else
+					snprintf(value, sizeof(value), "null");
+				out_printf("%s%s", (j > 0 ? comma_str : spc_str), value);
+			}
+			out_str(" ]");
+		}
+		out_str(" ]");
+	} else if (bo->output->mode == CLINFO_HUMAN) {
+		out_printf("%*s%s\n", indent, "", hname);
+		out_printf("%*s%-10s", indent + 2, "", "src \\ dst");
+		for (j = 0; j < n; ++j) {
+			snprintf(value, sizeof(value), "#%" PRIu32, labels[j]);
+			out_printf("  %10s", value);
+		}
+		out_char('\n');
+		for (i = 0; i < n; ++i) {
+			snprintf(value, sizeof(value), "#%" PRIu32, labels[i]);
+			out_printf("%*s%-10s", indent + 2, "", value);
+			for (j = 0; j < n; ++j) {
+				if (valid[i*n + j])
+					snprintf(value, sizeof(value), fmt, val[i*n + j]);
+				else
+					snprintf(value, sizeof(value), "-");
+				out_printf("  %10s", value);
+			}
+			out_char('\n');
+		}
+	} else {
+		char name[128] = "";
+		size_t len = 0;
+		for (i = 0; i < bo->depth; ++i)
+			len += snprintf(name + len, sizeof(name) - len, "%s.", bo->group[i]);
+		for (i = 0; i < n; ++i) {
+			for (j = 0; j < n; ++j) {
+				if (!valid[i*n + j])
+					continue;
+				snprintf(name + len, sizeof(name) - len, "%s.%" PRIu32 ".%" PRIu32,
+					key, labels[i], labels[j]);
+				snprintf(value, sizeof(value), fmt, val[i*n + j]);
+				out_printf("%s" I1_STR "%s\n", bo->pfx, name, value);
+			}
+		}
 	}
-	output->selected_props[output->num_selected_props++] = prop;
 }
 
-void parse_prop(const char *input, struct opt_out *output)
+void benchBandwidth(struct bench_env *env, struct bench_out *bo)
 {
-	/* We normalize the property name by upcasing it and replacing the minus sign (-)
-	 * with the underscore (_). If any other character is found, we consider it an error
-	 */
+	struct bench_bandwidth res;
+	const char *src[ARRAY_SIZE(sources)];
+	cl_int err;
+	cl_uint w;
 
-	size_t len = strlen(input);
-	char *normalized;
-	ALLOC(normalized, len+1, "normalized property name");
-	for (size_t i = 0; i < len; ++i)
-	{
-		char c = input[i];
-		if ( (c == '_') || ( c >= 'A' && c <= 'Z'))
-			normalized[i] = c;
-		else if (c >= 'a' && c <= 'z')
-			normalized[i] = 'A' + (c - 'a');
-		else if (c == '-')
-			normalized[i] = '_';
-		else {
-			fprintf(stderr, "invalid property name substring '%s'\n", input);
-			exit(1);
+	memcpy(src, sources, sizeof(sources));
+	src[ARRAY_SIZE(src) - 1] = bench_all_widths;
+
+	bench_group_begin(bo, "Global memory bandwidth", "bandwidth");
+	err = bench_bandwidth(env, src, ARRAY_SIZE(src), &res);
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+	} else {
+		struct _strbuf sz_str;
+		init_strbuf(&sz_str, "buffer size");
+		strbuf_mem("buffer size", &sz_str, res.buf_sz);
+		bench_value(bo, "Buffer size", "buffer_size", sz_str.buf, "%" PRIuS, res.buf_sz);
+		free_strbuf(&sz_str);
+		for (w = 0; w < BENCH_BW_WIDTHS; ++w) {
+			char hname[48], key[16];
+			snprintf(key, sizeof(key), w ? "float%u" : "float", 1U << w);
+			snprintf(hname, sizeof(hname), "%s (GB/s)", key);
+			if (res.err[w]) {
+				char msg[64];
+				snprintf(msg, sizeof(msg), "<error %" PRId32 ">", res.err[w]);
+				bench_string(bo, hname, key, msg);
+			} else {
+				bench_value(bo, hname, key, NULL, "%.3f", res.gbps[w]);
+			}
 		}
+		bench_value(bo, "Preferred vector width (float)", "preferred_vector_width",
+			NULL, "%" PRIu32, res.preferred_width);
+		bench_value(bo, "Native vector width (float)", "native_vector_width",
+			NULL, "%" PRIu32, res.native_width);
 	}
-
-	add_selected_prop(output, normalized);
+	bench_group_end(bo);
 }
 
-void usage(void)
+/* human-readable power-of-two size, such as 4KiB */
+void bench_size_str(char *str, size_t len, size_t sz)
 {
-	version();
+	size_t sfx = 0;
+	while (sz >= 1024 && !(sz & 1023) && sfx < memsfx_end) {
+		sz >>= 10;
+		++sfx;
+	}
+	snprintf(str, len, "%" PRIuS "%s", sz, memsfx[sfx]);
+}
+
+/* Get the PCI bus address of the device, from whichever of the vendor
+ * properties is supported; returns CL_FALSE if none is */
+cl_bool getDevicePciAddr(cl_device_id dev, cl_device_pci_bus_info_khr *pci)
+{
+	cl_device_topology_amd devtopo;
+	cl_uint bus, slot;
+
+	if (clGetDeviceInfo(dev, CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(*pci), pci, NULL) == CL_SUCCESS)
+		return CL_TRUE;
+
+	if (clGetDeviceInfo(dev, CL_DEVICE_TOPOLOGY_AMD, sizeof(devtopo), &devtopo, NULL) == CL_SUCCESS &&
+		devtopo.raw.type == CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD) {
+		pci->pci_domain = 0;
+		pci->pci_bus = devtopo.pcie.bus;
+		pci->pci_device = devtopo.pcie.device;
+		pci->pci_function = devtopo.pcie.function;
+		return CL_TRUE;
+	}
+
+	if (clGetDeviceInfo(dev, CL_DEVICE_PCI_BUS_ID_NV, sizeof(bus), &bus, NULL) == CL_SUCCESS &&
+		clGetDeviceInfo(dev, CL_DEVICE_PCI_SLOT_ID_NV, sizeof(slot), &slot, NULL) == CL_SUCCESS) {
+		cl_uint domain = 0;
+		/* see device_info_devtopo_nv */
+		if (clGetDeviceInfo(dev, CL_DEVICE_PCI_DOMAIN_ID_NV, sizeof(domain), &domain, NULL) != CL_SUCCESS)
+			domain = 0;
+		pci->pci_domain = domain;
+		pci->pci_bus = bus & 0xff;
+		pci->pci_device = (slot >> 3) & 0xff;
+		pci->pci_function = slot & 7;
+		return CL_TRUE;
+	}
+	return CL_FALSE;
+}
+
+void benchTransfer(struct bench_env *env, struct bench_out *bo, const struct opt_out *output)
+{
+	static const char * const kind_key[] = {
+		"write_pageable", "read_pageable", "write_pinned", "read_pinned" };
+	static const char * const kind_hname[] = {
+		"Host to device, pageable memory", "Device to host, pageable memory",
+		"Host to device, pinned memory", "Device to host, pinned memory" };
+	struct bench_transfer res;
+	struct device_info_ret ret;
+	struct info_loc loc;
+	cl_device_pci_bus_info_khr pci;
+	const int nodes = bench_numa_nodes();
+	int dev_node = -1;
+	int node;
+
+	bench_group_begin(bo, "Host/device transfers", "transfer");
+
+	/* the PCI topology, as shown in the device properties */
+	INIT_RET(ret, "transfer topology");
+	reset_loc(&loc, __func__);
+	loc.plat = env->plat;
+	loc.dev = env->dev;
+	RESET_LOC_PARAM(loc, dev, CL_DEVICE_PCI_BUS_INFO_KHR);
+	device_info_devtopo_khr(&ret, &loc, NULL, output);
+	if (ret.err) {
+		reset_strbuf(&ret.str);
+		reset_strbuf(&ret.err_str);
+		RESET_LOC_PARAM(loc, dev, CL_DEVICE_TOPOLOGY_AMD);
+		device_info_devtopo_amd(&ret, &loc, NULL, output);
+	}
+	if (ret.err) {
+		reset_strbuf(&ret.str);
+		reset_strbuf(&ret.err_str);
+		RESET_LOC_PARAM(loc, dev, CL_DEVICE_PCI_BUS_ID_NV);
+		device_info_devtopo_nv(&ret, &loc, NULL, output);
+	}
+	if (!ret.err && !strncmp(ret.str.buf, "PCI-E", 5)) {
+		bench_string(bo, "PCI topology", "pci_topology", ret.str.buf);
+	} else {
+		bench_string(bo, "PCI topology", "pci_topology", "n/a");
+	}
+	UNINIT_RET(ret);
+	/* the vendor properties have different layouts, so look up the NUMA node
+	 * from the normalized address */
+	if (getDevicePciAddr(env->dev, &pci))
+		dev_node = bench_pci_numa_node(&pci);
+	bench_value(bo, "Device NUMA node", "numa_node", NULL, "%d", dev_node);
+
+	/* run once for each NUMA node, or just once if only one or unknown */
+	for (node = (nodes > 1 ? 0 : -1); node < (nodes > 1 ? nodes : 0); ++node) {
+		struct bench_numa numa;
+		char key[16], hname[64];
+		cl_int err;
+		cl_uint k, i;
+
+		if (node < 0) {
+			snprintf(key, sizeof(key), "host");
+			snprintf(hname, sizeof(hname), "Host memory");
+			numa.bound = CL_FALSE;
+		} else {
+			snprintf(key, sizeof(key), "node%d", node);
+			snprintf(hname, sizeof(hname), "Host memory on NUMA node %d%s", node,
+				node == dev_node ? " (local)" : "");
+			if (!bench_numa_bind(&numa, node))
+				continue;
+		}
+
+		bench_group_begin(bo, hname, key);
+		err = bench_transfer(env, &res);
+		bench_numa_unbind(&numa);
+		if (err) {
+			bench_string(bo, "Error", "error", env->err_str.buf);
+			reset_strbuf(&env->err_str);
+			bench_group_end(bo);
+			continue;
+		}
+		for (k = 0; k < BENCH_XFER_KINDS; ++k) {
+			bench_group_begin(bo, kind_hname[k], kind_key[k]);
+			if (res.err[k]) {
+				char msg[64];
+				snprintf(msg, sizeof(msg), "<error %" PRId32 ">", res.err[k]);
+				bench_string(bo, "Error", "error", msg);
+			} else {
+				char size_str[16], size_hname[32];
+				bench_size_str(size_str, sizeof(size_str), res.size[0]);
+				snprintf(size_hname, sizeof(size_hname), "Latency (%s)", size_str);
+				bench_value(bo, size_hname, "latency_us", " us", "%.3f", res.us[k][0]);
+				for (i = 0; i < res.num_sizes; ++i) {
+					bench_size_str(size_str, sizeof(size_str), res.size[i]);
+					bench_value(bo, size_str, size_str, " GB/s", "%.3f", res.gbps[k][i]);
+				}
+			}
+			bench_group_end(bo);
+		}
+		bench_group_end(bo);
+	}
+	bench_group_end(bo);
+}
+
+void benchLaunchQueue(struct bench_env *env, struct bench_out *bo, cl_command_queue queue,
+	cl_kernel krn, const char *hname, const char *key, const char *family)
+{
+	struct bench_launch res;
+	cl_int err;
+
+	bench_group_begin(bo, hname, key);
+	if (family)
+		bench_string(bo, "Queue family", "family", family);
+	reset_strbuf(&env->err_str);
+	err = bench_launch(env, queue, krn, &res);
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+	} else {
+		bench_value(bo, "Launch latency (median)", "latency_us", " us", "%.3f", res.latency_us);
+		bench_value(bo, "Launch latency (min)", "min_latency_us", " us", "%.3f", res.min_latency_us);
+		bench_value(bo, "Launch latency, host side (median)", "host_latency_us", " us", "%.3f", res.host_latency_us);
+		bench_value(bo, "Sustained launches", "launches_per_s", " per second", "%.0f", res.launches_per_s);
+	}
+	bench_group_end(bo);
+}
+
+void benchLaunch(struct bench_env *env, struct bench_out *bo)
+{
+	const char *src = bench_empty_src;
+	cl_command_queue_properties qprops = 0;
+	cl_queue_family_properties_intel *fams = NULL;
+	size_t fams_sz = 0, f;
+	cl_program prg = NULL;
+	cl_kernel krn = NULL;
+	cl_int err;
+
+	bench_group_begin(bo, "Kernel launch", "launch");
+
+	prg = bench_build(env, &src, 1, NULL, &err);
+	if (!err) {
+		krn = clCreateKernel(prg, "empty", &err);
+		REPORT_ERROR(&env->err_str, err, "create kernel");
+	}
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+		goto out;
+	}
+
+	benchLaunchQueue(env, bo, env->queue, krn, "In-order queue", "in_order", NULL);
+
+	clGetDeviceInfo(env->dev, CL_DEVICE_QUEUE_PROPERTIES, sizeof(qprops), &qprops, NULL);
+	if (qprops & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) {
+		cl_command_queue queue = bench_queue(env,
+			CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE, &err);
+		if (!err) {
+			benchLaunchQueue(env, bo, queue, krn, "Out-of-order queue", "out_of_order", NULL);
+			clReleaseCommandQueue(queue);
+		}
+	}
+
+	/* Intel queue families that can run kernels */
+	if (env->create_queue &&
+		clGetDeviceInfo(env->dev, CL_DEVICE_QUEUE_FAMILY_PROPERTIES_INTEL, 0, NULL, &fams_sz) == CL_SUCCESS &&
+		fams_sz >= sizeof(*fams)) {
+		ALLOC(fams, fams_sz/sizeof(*fams), "queue families");
+		if (clGetDeviceInfo(env->dev, CL_DEVICE_QUEUE_FAMILY_PROPERTIES_INTEL, fams_sz, fams, NULL) != CL_SUCCESS)
+			fams_sz = 0;
+	}
+	for (f = 0; f < fams_sz/sizeof(*fams); ++f) {
+		const cl_queue_family_properties_intel *fam = fams + f;
+		const cl_queue_properties props[] = {
+			CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE,
+			CL_QUEUE_FAMILY_INTEL, f,
+			CL_QUEUE_INDEX_INTEL, 0,
+			0 };
+		char key[32], hname[48];
+		cl_command_queue queue;
+
+		if (fam->capabilities != CL_QUEUE_DEFAULT_CAPABILITIES_INTEL &&
+			!(fam->capabilities & CL_QUEUE_CAPABILITY_KERNEL_INTEL))
+			continue;
+		if (!(fam->properties & CL_QUEUE_PROFILING_ENABLE))
+			continue;
+
+		queue = env->create_queue(env->ctx, env->dev, props, &err);
+		if (err)
+			continue;
+		snprintf(key, sizeof(key), "family%" PRIuS, f);
+		snprintf(hname, sizeof(hname), "Queue family #%" PRIuS, f);
+		benchLaunchQueue(env, bo, queue, krn, hname, key, fam->name);
+		clReleaseCommandQueue(queue);
+	}
+	free(fams);
+
+out:
+	if (krn)
+		clReleaseKernel(krn);
+	if (prg)
+		clReleaseProgram(prg);
+	bench_group_end(bo);
+}
+
+/* Look up the extension function name for platform plat; clGetExtensionFunctionAddressForPlatform
+ * itself is looked up at runtime, since the OpenCL library might predate it */
+void *bench_ext_fn(cl_platform_id plat, const char *name)
+{
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	void *ptrHack = dlsym(DL_MODULE, "clGetExtensionFunctionAddressForPlatform");
+	const bench_get_ext_fn get_ext = *(bench_get_ext_fn*)(&ptrHack);
+	return get_ext ? get_ext(plat, name) : NULL;
+}
+
+void benchSVM(struct bench_env *env, struct bench_out *bo)
+{
+	/* same names as the capabilities of the device properties */
+	static const char * const kind_hname[BENCH_MEM_KINDS] = {
+		"Coarse-grained buffer sharing",
+		"Fine-grained buffer sharing",
+		"Fine-grained system sharing",
+		"Host USM (Intel)",
+		"Device USM (Intel)",
+		"Single-Device USM (Intel)",
+	};
+	static const char * const kind_key[BENCH_MEM_KINDS] = {
+		"svm_coarse_grain_buffer",
+		"svm_fine_grain_buffer",
+		"svm_fine_grain_system",
+		"usm_host",
+		"usm_device",
+		"usm_shared",
+	};
+	static const cl_device_svm_capabilities svm_cap[] = {
+		CL_DEVICE_SVM_COARSE_GRAIN_BUFFER,
+		CL_DEVICE_SVM_FINE_GRAIN_BUFFER,
+		CL_DEVICE_SVM_FINE_GRAIN_SYSTEM,
+	};
+	static const cl_device_info usm_cap_param[] = {
+		CL_DEVICE_HOST_MEM_CAPABILITIES_INTEL,
+		CL_DEVICE_DEVICE_MEM_CAPABILITIES_INTEL,
+		CL_DEVICE_SINGLE_DEVICE_SHARED_MEM_CAPABILITIES_INTEL,
+	};
+	const char *src = bench_touch_src;
+	struct bench_mem_api api;
+	struct bench_mem res;
+	cl_device_svm_capabilities svm_caps = 0;
+	cl_bool supported[BENCH_MEM_KINDS];
+	cl_uint num_supported = 0;
+	cl_program prg = NULL;
+	cl_kernel krn = NULL;
+	cl_int err;
+	int k;
+
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	*(void**)(&api.svm_alloc) = dlsym(DL_MODULE, "clSVMAlloc");
+	*(void**)(&api.svm_free) = dlsym(DL_MODULE, "clSVMFree");
+	*(void**)(&api.svm_map) = dlsym(DL_MODULE, "clEnqueueSVMMap");
+	*(void**)(&api.svm_unmap) = dlsym(DL_MODULE, "clEnqueueSVMUnmap");
+	*(void**)(&api.set_arg_svm) = dlsym(DL_MODULE, "clSetKernelArgSVMPointer");
+	*(void**)(&api.usm_host_alloc) = bench_ext_fn(env->plat, "clHostMemAllocINTEL");
+	*(void**)(&api.usm_device_alloc) = bench_ext_fn(env->plat, "clDeviceMemAllocINTEL");
+	*(void**)(&api.usm_shared_alloc) = bench_ext_fn(env->plat, "clSharedMemAllocINTEL");
+	*(void**)(&api.usm_free) = bench_ext_fn(env->plat, "clMemBlockingFreeINTEL");
+	*(void**)(&api.set_arg_usm) = bench_ext_fn(env->plat, "clSetKernelArgMemPointerINTEL");
+
+	if (api.svm_alloc && api.svm_free && api.svm_map && api.svm_unmap && api.set_arg_svm)
+		clGetDeviceInfo(env->dev, CL_DEVICE_SVM_CAPABILITIES, sizeof(svm_caps), &svm_caps, NULL);
+	for (k = 0; k < BENCH_MEM_KINDS; ++k) {
+		if (!BENCH_MEM_IS_USM(k)) {
+			supported[k] = !!(svm_caps & svm_cap[k]);
+		} else {
+			cl_bitfield usm_caps = 0;
+			supported[k] = CL_FALSE;
+			if (api.usm_host_alloc && api.usm_device_alloc && api.usm_shared_alloc &&
+				api.usm_free && api.set_arg_usm &&
+				clGetDeviceInfo(env->dev, usm_cap_param[k - BENCH_MEM_USM_HOST],
+					sizeof(usm_caps), &usm_caps, NULL) == CL_SUCCESS)
+				supported[k] = !!(usm_caps & CL_UNIFIED_SHARED_MEMORY_ACCESS_INTEL);
+		}
+		num_supported += supported[k];
+	}
+
+	bench_group_begin(bo, "SVM and USM", "svm");
+	if (!num_supported) {
+		bench_string(bo, "Error", "error", "no SVM or USM support");
+		goto out;
+	}
+
+	prg = bench_build(env, &src, 1, NULL, &err);
+	if (!err) {
+		krn = clCreateKernel(prg, "touch", &err);
+		REPORT_ERROR(&env->err_str, err, "create kernel");
+	}
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+		goto out;
+	}
+
+	for (k = 0; k < BENCH_MEM_KINDS; ++k) {
+		if (!supported[k])
+			continue;
+		bench_group_begin(bo, kind_hname[k], kind_key[k]);
+		reset_strbuf(&env->err_str);
+		err = bench_mem(env, &api, (enum bench_mem_kind)k, krn, &res);
+		if (err) {
+			bench_string(bo, "Error", "error", env->err_str.buf);
+		} else {
+			bench_value(bo, "Allocation size", "size", " bytes", "%" PRIuS, res.size);
+			bench_value(bo, "Allocation latency", "alloc_us", " us", "%.3f", res.alloc_us);
+			bench_value(bo, "Release latency", "free_us", " us", "%.3f", res.free_us);
+			if (k != BENCH_MEM_USM_DEVICE)
+				bench_value(bo, "First access from the host", "host_touch_us", " us", "%.3f", res.host_touch_us);
+			bench_value(bo, "First access from the device", "first_touch_us", " us", "%.3f", res.first_touch_us);
+			bench_value(bo, "Kernel access bandwidth", "gbps", " GB/s", "%.2f", res.gbps);
+		}
+		bench_group_end(bo);
+	}
+
+out:
+	if (krn)
+		clReleaseKernel(krn);
+	if (prg)
+		clReleaseProgram(prg);
+	bench_group_end(bo);
+}
+
+/* Build times of the work-group size probe source */
+void benchCompile(struct bench_env *env, struct bench_out *bo)
+{
+	struct bench_compile_api api;
+	struct bench_compile res;
+	char il_version[64] = "";
+	cl_int err;
+
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	*(void**)(&api.compile) = dlsym(DL_MODULE, "clCompileProgram");
+	*(void**)(&api.link) = dlsym(DL_MODULE, "clLinkProgram");
+	*(void**)(&api.create_with_il) = dlsym(DL_MODULE, "clCreateProgramWithIL");
+	if (!api.create_with_il)
+		*(void**)(&api.create_with_il) = bench_ext_fn(env->plat, "clCreateProgramWithILKHR");
+
+	/* only try the IL build for devices that support SPIR-V */
+	clGetDeviceInfo(env->dev, CL_DEVICE_IL_VERSION, sizeof(il_version) - 1, il_version, NULL);
+
+	bench_group_begin(bo, "Program build", "compile");
+	err = bench_compile(env, &api, sources, ARRAY_SIZE(sources), !!strstr(il_version, "SPIR-V"), &res);
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+	} else {
+		bench_value(bo, "Build from new source", "build_ms", " ms", "%.3f", res.build_ms);
+		bench_value(bo, "Build from the same source again", "rebuild_ms", " ms", "%.3f", res.rebuild_ms);
+		bench_value(bo, "Driver program cache speedup", "driver_cache_speedup", "x", "%.2f",
+			res.build_ms/(res.rebuild_ms > 0 ? res.rebuild_ms : 1.0e-6));
+		if (res.has_compile) {
+			bench_value(bo, "Compile from new source", "compile_ms", " ms", "%.3f", res.compile_ms);
+			bench_value(bo, "Link", "link_ms", " ms", "%.3f", res.link_ms);
+		}
+		bench_value(bo, "Program binary size", "binary_size", " bytes", "%" PRIuS, res.binary_size);
+		bench_value(bo, "Build from binary", "binary_ms", " ms", "%.3f", res.binary_ms);
+		bench_value(bo, "Binary speedup", "binary_speedup", "x", "%.2f",
+			res.build_ms/(res.binary_ms > 0 ? res.binary_ms : 1.0e-6));
+		if (res.has_il)
+			bench_value(bo, "Build from IL (empty kernel)", "il_ms", " ms", "%.3f", res.il_ms);
+	}
+	bench_group_end(bo);
+}
+
+/* Peak throughput for half (with cl_khr_fp16), float and double (if supported) */
+void benchFlops(struct bench_env *env, struct bench_out *bo, const struct device_info_checks *chk)
+{
+	struct bench_flops res;
+	cl_bool supported[BENCH_FP_TYPES];
+	cl_uint t;
+
+	supported[BENCH_FP_HALF] = dev_has_half(chk);
+	supported[BENCH_FP_FLOAT] = CL_TRUE;
+	supported[BENCH_FP_DOUBLE] = dev_has_double(chk);
+
+	bench_group_begin(bo, "Peak floating-point throughput", "flops");
+	bench_flops(env, supported, &res);
+	bench_value(bo, "Work-items", "work_items", NULL, "%" PRIuS, res.gws);
+	for (t = 0; t < BENCH_FP_TYPES; ++t) {
+		const char *type = bench_fp_info[t].type;
+		char hname[48], key[24];
+		if (!res.supported[t])
+			continue;
+		snprintf(hname, sizeof(hname), "%s (GFLOP/s)", type);
+		if (res.err[t])
+			bench_string(bo, hname, type, res.err_str[t]);
+		else
+			bench_value(bo, hname, type, NULL, "%.1f", res.gflops[t]);
+		snprintf(hname, sizeof(hname), "Vector width (%s)", type);
+		snprintf(key, sizeof(key), "%s_width", type);
+		bench_value(bo, hname, key, NULL, "%" PRIu32, res.width[t]);
+	}
+	bench_group_end(bo);
+}
+
+/* show a memory size of the current group, with its human-readable form in HUMAN mode */
+void bench_mem_value(struct bench_out *bo, const char *hname, const char *key, cl_ulong sz)
+{
+	struct _strbuf sz_str;
+	init_strbuf(&sz_str, hname);
+	strbuf_mem(hname, &sz_str, sz);
+	bench_value(bo, hname, key, sz_str.buf, "%" PRIu64, sz);
+	free_strbuf(&sz_str);
+}
+
+/* The measured cache levels and local memory bandwidth, next to the values
+ * reported by the device */
+void benchCache(struct bench_env *env, struct bench_out *bo)
+{
+	struct bench_cache_latency lat;
+	struct bench_local_bandwidth lbw;
+	cl_ulong cache_sz = 0, local_sz = 0;
+	cl_uint line = 0;
+	cl_int err;
+	cl_uint i;
+
+	clGetDeviceInfo(env->dev, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(cache_sz), &cache_sz, NULL);
+	clGetDeviceInfo(env->dev, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, sizeof(line), &line, NULL);
+	clGetDeviceInfo(env->dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_sz), &local_sz, NULL);
+
+	bench_group_begin(bo, "Memory hierarchy", "cache");
+
+	err = bench_cache_latency(env, &lat);
+	bench_group_begin(bo, "Pointer-chase latency (ns)", "latency");
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+		reset_strbuf(&env->err_str);
+	} else {
+		bench_value(bo, "Node stride", "stride", NULL, "%" PRIuS, lat.line);
+		for (i = 0; i < lat.num_sizes; ++i) {
+			char key[16];
+			bench_size_str(key, sizeof(key), lat.size[i]);
+			bench_value(bo, key, key, NULL, "%.2f", lat.latency_ns[i]);
+		}
+	}
+	bench_group_end(bo);
+
+	bench_group_begin(bo, "Cache levels", "levels");
+	bench_mem_value(bo, "Reported global memory cache size", "reported_size", cache_sz);
+	bench_value(bo, "Reported global memory cache line size", "reported_line_size",
+		NULL, "%" PRIu32, line);
+	if (!err) {
+		for (i = 0; i < lat.num_levels; ++i) {
+			char hname[48], key[32];
+			snprintf(hname, sizeof(hname), "Measured level %" PRIu32 " size", i + 1);
+			snprintf(key, sizeof(key), "level%" PRIu32 "_size", i + 1);
+			bench_mem_value(bo, hname, key, lat.level[i].size);
+			snprintf(hname, sizeof(hname), "Measured level %" PRIu32 " latency (ns)", i + 1);
+			snprintf(key, sizeof(key), "level%" PRIu32 "_latency", i + 1);
+			bench_value(bo, hname, key, NULL, "%.2f", lat.level[i].latency_ns);
+		}
+	}
+	bench_group_end(bo);
+
+	bench_group_begin(bo, "Local memory bandwidth (GB/s)", "local_bandwidth");
+	bench_mem_value(bo, "Reported local memory size", "reported_size", local_sz);
+	err = bench_local_bandwidth(env, &lbw);
+	if (err) {
+		bench_string(bo, "Error", "error", env->err_str.buf);
+		reset_strbuf(&env->err_str);
+	} else {
+		bench_value(bo, "Work-group size", "work_group_size", NULL, "%" PRIuS, lbw.lws);
+		for (i = 0; i < BENCH_LMEM_STRIDES; ++i) {
+			char hname[32], key[16];
+			snprintf(hname, sizeof(hname), "Stride %u", 1U << i);
+			snprintf(key, sizeof(key), "stride%u", 1U << i);
+			if (lbw.err[i]) {
+				char msg[64];
+				snprintf(msg, sizeof(msg), "<error %" PRId32 ">", lbw.err[i]);
+				bench_string(bo, hname, key, msg);
+			} else {
+				bench_value(bo, hname, key, NULL, "%.3f", lbw.gbps[i]);
+			}
+		}
+	}
+	bench_group_end(bo);
+
+	bench_group_end(bo);
+}
+
+/* Peer-to-peer copies between the given n devices of platform p, as matrices
+ * indexed by source and destination device, for the direct (cl_amd_copy_buffer_p2p)
+ * and host-staged copies */
+void benchP2P(const struct platform_list *plist, cl_uint p, const cl_uint *dev_idx, cl_uint n,
+	struct bench_out *bo, const struct opt_out *output)
+{
+	static const char * const kind_hname[] = { "Direct copy (cl_amd_copy_buffer_p2p)", "Host-staged copy" };
+	static const char * const kind_key[] = { "direct", "host" };
+	const cl_device_id *devs = get_platform_devs(plist, p);
+	struct bench_env *env = NULL;
+	cl_mem *buf = NULL;
+	struct bench_p2p *res = NULL;
+	double *val = NULL;
+	cl_bool *valid = NULL;
+	void *host = NULL;
+	bench_copy_p2p_fn copy_p2p;
+	cl_ulong max_alloc = BENCH_P2P_SZ;
+	size_t sz;
+	cl_uint i, j, k;
+	cl_int err = CL_SUCCESS;
+
+	/* see oclIcdProps for why we go through a pointer-to-pointer */
+	void *ptrHack = bench_ext_fn(plist->platform[p], "clEnqueueCopyBufferP2PAMD");
+	copy_p2p = *(bench_copy_p2p_fn*)(&ptrHack);
+
+	ALLOC(env, n, "P2P benchmark environments");
+	ALLOC(buf, n, "P2P benchmark buffers");
+	ALLOC(res, (size_t)n*n*BENCH_P2P_KINDS, "P2P benchmark results");
+	ALLOC(val, (size_t)n*n, "P2P benchmark values");
+	ALLOC(valid, (size_t)n*n, "P2P benchmark values");
+	memset(env, 0, n*sizeof(*env));
+	memset(buf, 0, n*sizeof(*buf));
+	memset(res, 0, (size_t)n*n*BENCH_P2P_KINDS*sizeof(*res));
+
+	bench_group_begin(bo, "Peer-to-peer copy", "p2p");
+
+	/* one buffer per device, as large as all devices allow */
+	for (i = 0; i < n; ++i) {
+		cl_ulong dev_max_alloc = 0;
+		clGetDeviceInfo(devs[dev_idx[i]], CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+			sizeof(dev_max_alloc), &dev_max_alloc, NULL);
+		if (dev_max_alloc && dev_max_alloc < max_alloc)
+			max_alloc = dev_max_alloc;
+	}
+	sz = (size_t)max_alloc;
+	for (i = 0; i < n && !err; ++i) {
+		set_timing_ctx(p, dev_idx[i], CL_FALSE);
+		err = bench_env_init(env + i, plist->platform[p], devs[dev_idx[i]], bench_create_queue_func());
+		if (!err)
+			buf[i] = bench_buffer(env + i, sz, &err);
+		if (err)
+			bench_string(bo, "Error", "error", env[i].err_str.buf);
+	}
+	set_timing_ctx(p, -1, CL_FALSE);
+	if (err)
+		goto out;
+	host = malloc(sz);
+	if (!host) {
+		bench_string(bo, "Error", "error", "could not allocate the host staging buffer");
+		goto out;
+	}
+	/* first touch */
+	memset(host, 0, sz);
+
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < n; ++j) {
+			struct bench_p2p *r = res + (i*n + j)*BENCH_P2P_KINDS;
+			if (i == j)
+				continue;
+			if (copy_p2p && bench_p2p_peer(env[i].dev, env[j].dev))
+				bench_p2p_pair(env + i, env + j, buf[i], buf[j], sz, copy_p2p, host, r + BENCH_P2P_DIRECT);
+			else
+				r[BENCH_P2P_DIRECT].err = CL_INVALID_DEVICE;
+			bench_p2p_pair(env + i, env + j, buf[i], buf[j], sz, NULL, host, r + BENCH_P2P_HOST);
+		}
+	}
+
+	bench_value(bo, "Copy size", "size", NULL, "%" PRIuS, sz);
+	if (output->mode == CLINFO_HUMAN) {
+		bench_group_begin(bo, "Devices", "devices");
+		for (i = 0; i < n; ++i) {
+			char hname[16], name[256] = "";
+			snprintf(hname, sizeof(hname), "#%" PRIu32, dev_idx[i]);
+			clGetDeviceInfo(env[i].dev, CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+			bench_value(bo, hname, NULL, NULL, "%s", name);
+		}
+		bench_group_end(bo);
+	} else if (output->json) {
+		out_printf("%s\"devices\" : [", (bo->n[bo->depth]++ > 0 ? comma_str : spc_str));
+		for (i = 0; i < n; ++i)
+			out_printf("%s%" PRIu32, (i > 0 ? comma_str : spc_str), dev_idx[i]);
+		out_str(" ]");
+	}
+
+	for (k = 0; k < BENCH_P2P_KINDS; ++k) {
+		bench_group_begin(bo, kind_hname[k], kind_key[k]);
+		for (i = 0; i < n*n; ++i) {
+			valid[i] = (i/n != i%n) && !res[i*BENCH_P2P_KINDS + k].err;
+			val[i] = res[i*BENCH_P2P_KINDS + k].gbps;
+		}
+		bench_matrix(bo, "Bandwidth (GB/s)", "gbps", n, dev_idx, val, valid, "%.2f");
+		for (i = 0; i < n*n; ++i)
+			val[i] = res[i*BENCH_P2P_KINDS + k].latency_us;
+		bench_matrix(bo, "Latency (us)", "latency_us", n, dev_idx, val, valid, "%.2f");
+		bench_group_end(bo);
+	}
+
+out:
+	bench_group_end(bo);
+	free(host);
+	for (i = 0; i < n; ++i) {
+		if (buf[i])
+			clReleaseMemObject(buf[i]);
+		bench_env_release(env + i);
+	}
+	free(valid);
+	free(val);
+	free(res);
+	free(buf);
+	free(env);
+}
+
+/* Run the requested benchmarks on all the selected devices */
+void runBenchmarks(const struct platform_list *plist, const struct opt_out *output)
+{
+	struct bench_out bo;
+	cl_uint *dev_idx = NULL;
+	cl_uint p, d, n = 0;
+	cl_ulong start;
+
+	const bench_create_queue_fn create_queue = bench_create_queue_func();
+
+	bo.output = output;
+	if (output->json)
+		out_str(", \"benchmarks\" : [");
+	else if (output->mode == CLINFO_HUMAN)
+		out_str("\nBenchmarks\n");
+
+	for (p = 0; p < plist->num_platforms; ++p) {
+		const struct platform_data *pdata = plist->pdata + p;
+		const cl_device_id *devs = get_platform_devs(plist, p);
+		cl_uint num_sel = 0;
+		if (!is_selected_platform(output, p))
+			continue;
+		REALLOC(dev_idx, pdata->ndevs ? pdata->ndevs : 1, "selected devices");
+		for (d = 0; d < pdata->ndevs; ++d) {
+			struct bench_env env;
+			char name[256] = "";
+			cl_int err;
+
+			if (!is_selected_device(output, p, d))
+				continue;
+			dev_idx[num_sel++] = d;
+			if (!(output->benchmarks & ~BENCH_PLATFORM_KINDS))
+				continue;
+
+			clGetDeviceInfo(devs[d], CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+			snprintf(bo.pfx, sizeof(bo.pfx), "[%s/%" PRIu32 "]", pdata->sname, d);
+			bo.depth = 0;
+			bo.n[0] = 0;
+			if (output->json) {
+				out_printf("%s{ \"platform\" : %" PRIu32 ", \"device\" : %" PRIu32 ", \"name\" : ",
+					(n > 0 ? comma_str : spc_str), p, d);
+				json_stringify(name);
+				bo.n[0] = 3;
+			} else if (output->mode == CLINFO_HUMAN) {
+				out_printf("%sPlatform #%" PRIu32 ", Device #%" PRIu32 ": %s\n",
+					n > 0 ? "\n" : "", p, d, name);
+			}
+			++n;
+
+			set_timing_ctx(p, d, CL_FALSE);
+			err = bench_env_init(&env, plist->platform[p], devs[d], create_queue);
+			if (err) {
+				bench_group_begin(&bo, "Benchmark setup", "setup");
+				bench_string(&bo, "Error", "error", env.err_str.buf);
+				bench_group_end(&bo);
+			} else {
+				if (output->benchmarks & BENCH_BANDWIDTH) {
+					start = timing_start(output);
+					benchBandwidth(&env, &bo);
+					timing_stop(output, TIMING_PHASE, "benchBandwidth", start);
+				}
+				if (output->benchmarks & BENCH_TRANSFER) {
+					reset_strbuf(&env.err_str);
+					start = timing_start(output);
+					benchTransfer(&env, &bo, output);
+					timing_stop(output, TIMING_PHASE, "benchTransfer", start);
+				}
+				if (output->benchmarks & BENCH_LAUNCH) {
+					reset_strbuf(&env.err_str);
+					start = timing_start(output);
+					benchLaunch(&env, &bo);
+					timing_stop(output, TIMING_PHASE, "benchLaunch", start);
+				}
+				if (output->benchmarks & BENCH_SVM) {
+					reset_strbuf(&env.err_str);
+					start = timing_start(output);
+					benchSVM(&env, &bo);
+					timing_stop(output, TIMING_PHASE, "benchSVM", start);
+				}
+				if (output->benchmarks & BENCH_COMPILE) {
+					reset_strbuf(&env.err_str);
+					start = timing_start(output);
+					benchCompile(&env, &bo);
+					timing_stop(output, TIMING_PHASE, "benchCompile", start);
+				}
+				if (output->benchmarks & BENCH_FLOPS) {
+					struct device_info_checks chk;
+					reset_strbuf(&env.err_str);
+					gatherDeviceChecks(devs[d], plist, p, &chk, output);
+					start = timing_start(output);
+					benchFlops(&env, &bo, &chk);
+					timing_stop(output, TIMING_PHASE, "benchFlops", start);
+				}
+				if (output->benchmarks & BENCH_CACHE) {
+					reset_strbuf(&env.err_str);
+					start = timing_start(output);
+					benchCache(&env, &bo);
+					timing_stop(output, TIMING_PHASE, "benchCache", start);
+				}
+			}
+			bench_env_release(&env);
+			set_timing_ctx(-1, -1, CL_FALSE);
+
+			if (output->json)
+				out_str(" }");
+		}
+
+		/* benchmarks involving several devices of the platform */
+		if ((output->benchmarks & BENCH_P2P) && num_sel > 1) {
+			snprintf(bo.pfx, sizeof(bo.pfx), "[%s]", pdata->sname);
+			bo.depth = 0;
+			bo.n[0] = 0;
+			if (output->json) {
+				out_printf("%s{ \"platform\" : %" PRIu32 ", \"name\" : ",
+					(n > 0 ? comma_str : spc_str), p);
+				json_stringify(pdata->pname);
+				bo.n[0] = 2;
+			} else if (output->mode == CLINFO_HUMAN) {
+				out_printf("%sPlatform #%" PRIu32 ": %s\n",
+					n > 0 ? "\n" : "", p, pdata->pname);
+			}
+			++n;
+
+			start = timing_start(output);
+			benchP2P(plist, p, dev_idx, num_sel, &bo, output);
+			timing_stop(output, TIMING_PHASE, "benchP2P", start);
+
+			if (output->json)
+				out_str(" }");
+		}
+	}
+	free(dev_idx);
+	if (output->json)
+		out_str(" ]");
+	else if (output->mode == CLINFO_HUMAN && output->detailed)
+		out_char('\n');
+}
+
+/* Show the recorded timings, slowest first: as a table on stderr,
+ * or as a "timings" object in JSON mode */
+void showTimings(const struct opt_out *output)
+{
+	static const char * const kind_str[] = { "phases", "properties" };
+	size_t i;
+	int k;
+
+	qsort(timings, num_timings, sizeof(*timings), timings_cmp);
+
+	if (output->json) {
+		out_str(", \"timings\" : {");
+		for (k = TIMING_PHASE; k <= TIMING_PROP; ++k) {
+			cl_uint n = 0;
+			out_printf("%s\"%s\" : [", (k > TIMING_PHASE ? comma_str : spc_str), kind_str[k]);
+			for (i = 0; i < num_timings; ++i) {
+				const struct timing_rec *rec = timings + i;
+				if (rec->kind != (enum timing_kind)k)
+					continue;
+				out_printf("%s{ \"name\" : \"%s\"", (n++ > 0 ? comma_str : spc_str), rec->name);
+				if (rec->p >= 0)
+					out_printf(", \"platform\" : %" PRId32, rec->p);
+				if (rec->d >= 0)
+					out_printf(", \"device\" : %" PRId32 "%s", rec->d,
+						rec->offline ? ", \"offline\" : true" : "");
+				out_printf(", \"ms\" : %.3f }", rec->ns/1.0e6);
+			}
+			out_str(" ]");
+		}
+		out_str(" }");
+		return;
+	}
+
+	fprintf(stderr, "%12s  %-8s  %-8s  %-9s  %s\n", "Time (ms)", "Platform", "Device", "Kind", "Name");
+	for (i = 0; i < num_timings; ++i) {
+		const struct timing_rec *rec = timings + i;
+		char pstr[16] = "-", dstr[24] = "-";
+		if (rec->p >= 0)
+			snprintf(pstr, sizeof(pstr), "%" PRId32, rec->p);
+		if (rec->d >= 0)
+			snprintf(dstr, sizeof(dstr), "%" PRId32 "%s", rec->d, rec->offline ? " (off)" : "");
+		fprintf(stderr, "%12.3f  %-8s  %-8s  %-9s  %s\n", rec->ns/1.0e6,
+			pstr, dstr, rec->kind == TIMING_PHASE ? "phase" : "property", rec->name);
+	}
+}
+
+void version(void)
+{
+	puts("clinfo version 3.0.23.01.25");
+}
+
+void add_selected_device(struct opt_out *output, cl_uint p, cl_uint d)
+{
+	if (p >= output->num_selection_platforms) {
+		REALLOC(output->selected_devices, p + 1, "selected devices");
+		memset(output->selected_devices + output->num_selection_platforms, 0,
+			(p + 1 - output->num_selection_platforms)*sizeof(*output->selected_devices));
+		output->num_selection_platforms = p + 1;
+	}
+	bitmap_set(output->selected_devices + p, d);
+}
+
+/* Parse a PCI bus address in the form [domain:]bus:device.function (hexadecimal) */
+cl_bool parse_pci_addr(const char *str, cl_device_pci_bus_info_khr *pci)
+{
+	unsigned int domain = 0, bus, dev, fn;
+	int n = 0;
+	if (sscanf(str, "%x:%x:%x.%x%n", &domain, &bus, &dev, &fn, &n) != 4 || str[n]) {
+		domain = 0;
+		n = 0;
+		if (sscanf(str, "%x:%x.%x%n", &bus, &dev, &fn, &n) != 3 || str[n])
+			return CL_FALSE;
+	}
+	if (bus > 0xff || dev > 0x1f || fn > 7)
+		return CL_FALSE;
+	pci->pci_domain = domain;
+	pci->pci_bus = bus;
+	pci->pci_device = dev;
+	pci->pci_function = fn;
+	return CL_TRUE;
+}
+
+/* Parse a device UUID as 32 hexadecimal digits, optionally separated by dashes */
+cl_bool parse_uuid(const char *str, cl_uchar *uuid)
+{
+	size_t n = 0;
+	for (; *str; ++str) {
+		const char c = *str;
+		int v;
+		if (c == '-')
+			continue;
+		if (c >= '0' && c <= '9')
+			v = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			v = c - 'A' + 10;
+		else
+			return CL_FALSE;
+		if (n == 2*CL_UUID_SIZE_KHR)
+			return CL_FALSE;
+		if (n % 2)
+			uuid[n/2] |= (cl_uchar)v;
+		else
+			uuid[n/2] = (cl_uchar)(v << 4);
+		++n;
+	}
+	return n == 2*CL_UUID_SIZE_KHR;
+}
+
+void parse_device_spec(const char *str, struct opt_out *output)
+{
+	int p, d, n;
+	if (!str) {
+		fprintf(stderr, "please specify a device in the form P:D where P is the platform number and D the device number, "
+			"or as pci:[domain:]bus:device.function or uuid:UUID\n");
+		exit(1);
+	}
+	if (!strncmp(str, "pci:", 4) || !strncmp(str, "uuid:", 5)) {
+		struct device_id_spec *spec;
+		REALLOC(output->device_id_specs, output->num_device_id_specs + 1, "device identifier specifications");
+		spec = output->device_id_specs + output->num_device_id_specs;
+		memset(spec, 0, sizeof(*spec));
+		spec->str = str;
+		if (str[0] == 'p') {
+			spec->kind = DEVICE_ID_PCI;
+			if (!parse_pci_addr(str + 4, &spec->pci)) {
+				fprintf(stderr, "invalid PCI address '%s'\n", str + 4);
+				exit(1);
+			}
+		} else {
+			spec->kind = DEVICE_ID_UUID;
+			if (!parse_uuid(str + 5, spec->uuid)) {
+				fprintf(stderr, "invalid device UUID '%s'\n", str + 5);
+				exit(1);
+			}
+		}
+		++output->num_device_id_specs;
+		++output->num_selected_devices;
+		return;
+	}
+	n = sscanf(str, "%d:%d", &p, &d);
+	if (n != 2 || p < 0 || d < 0) {
+		fprintf(stderr, "invalid device specification '%s'\n", str);
+		exit(1);
+	}
+	add_selected_device(output, p, d);
+	++output->num_selected_devices;
+}
+
+/* Resolve the device specifications by PCI address or UUID into the bitmaps
+ * of the selected devices, so that the devices can be selected in the same way
+ * as the ones specified by index. The identifiers are only queried here, once,
+ * and only if such specifications were given.
+ */
+void resolveDeviceSelection(struct opt_out *output)
+{
+	cl_platform_id *platform = NULL;
+	cl_device_id *dev = NULL;
+	cl_uint num_platforms = 0, num_devs, alloced_devs = 0, p, d;
+	size_t s;
+	cl_bool need_pci = CL_FALSE, need_uuid = CL_FALSE;
+
+	if (!output->num_device_id_specs)
+		return;
+
+	for (s = 0; s < output->num_device_id_specs; ++s) {
+		if (output->device_id_specs[s].kind == DEVICE_ID_PCI)
+			need_pci = CL_TRUE;
+		else
+			need_uuid = CL_TRUE;
+	}
+
+	if (clGetPlatformIDs(0, NULL, &num_platforms) != CL_SUCCESS)
+		num_platforms = 0;
+	if (num_platforms) {
+		ALLOC(platform, num_platforms, "platform IDs");
+		if (clGetPlatformIDs(num_platforms, platform, NULL) != CL_SUCCESS)
+			num_platforms = 0;
+	}
+
+	for (p = 0; p < num_platforms; ++p) {
+		if (clGetDeviceIDs(platform[p], CL_DEVICE_TYPE_ALL, 0, NULL, &num_devs) != CL_SUCCESS)
+			continue;
+		if (num_devs > alloced_devs) {
+			REALLOC(dev, num_devs, "device IDs");
+			alloced_devs = num_devs;
+		}
+		if (clGetDeviceIDs(platform[p], CL_DEVICE_TYPE_ALL, num_devs, dev, NULL) != CL_SUCCESS)
+			continue;
+
+		for (d = 0; d < num_devs; ++d) {
+			cl_device_pci_bus_info_khr pci;
+			cl_uchar uuid[CL_UUID_SIZE_KHR];
+			const cl_bool has_pci = need_pci && getDevicePciAddr(dev[d], &pci);
+			const cl_bool has_uuid = need_uuid &&
+				clGetDeviceInfo(dev[d], CL_DEVICE_UUID_KHR, sizeof(uuid), uuid, NULL) == CL_SUCCESS;
+
+			for (s = 0; s < output->num_device_id_specs; ++s) {
+				struct device_id_spec *spec = output->device_id_specs + s;
+				const cl_bool match = spec->kind == DEVICE_ID_PCI ?
+					has_pci &&
+					spec->pci.pci_domain == pci.pci_domain &&
+					spec->pci.pci_bus == pci.pci_bus &&
+					spec->pci.pci_device == pci.pci_device &&
+					spec->pci.pci_function == pci.pci_function :
+					has_uuid && !memcmp(spec->uuid, uuid, sizeof(uuid));
+				if (match) {
+					add_selected_device(output, p, d);
+					spec->matched = CL_TRUE;
+				}
+			}
+		}
+	}
+
+	for (s = 0; s < output->num_device_id_specs; ++s)
+		if (!output->device_id_specs[s].matched)
+			fprintf(stderr, "no device matches '%s'\n", output->device_id_specs[s].str);
+
+	free(dev);
+	free(platform);
+}
+
+void parse_jobs(const char *str, struct opt_out *output)
+{
+	char *end = NULL;
+	unsigned long jobs;
+	if (!str) {
+		fprintf(stderr, "please specify the number of concurrent jobs\n");
+		exit(1);
+	}
+	jobs = strtoul(str, &end, 10);
+	if (end == str || *end || jobs == 0 || jobs > UINT32_MAX) {
+		fprintf(stderr, "invalid number of jobs '%s'\n", str);
+		exit(1);
+	}
+	output->jobs = (cl_uint)jobs;
+}
+
+void parse_timeout(const char *str, struct opt_out *output)
+{
+	char *end = NULL;
+	double timeout;
+	if (!str) {
+		fprintf(stderr, "please specify the timeout in seconds\n");
+		exit(1);
+	}
+	timeout = strtod(str, &end);
+	if (end == str || *end || !(timeout > 0) || timeout > 86400) {
+		fprintf(stderr, "invalid timeout '%s'\n", str);
+		exit(1);
+	}
+	output->timeout_ms = (cl_ulong)(timeout*1000 + 0.5);
+	if (!output->timeout_ms)
+		output->timeout_ms = 1;
+}
+
+void parse_watch(const char *str, struct opt_out *output)
+{
+	char *end = NULL;
+	double interval;
+	if (!str) {
+		fprintf(stderr, "please specify the watch interval in seconds\n");
+		exit(1);
+	}
+	interval = strtod(str, &end);
+	if (end == str || *end || !(interval > 0) || interval > 86400) {
+		fprintf(stderr, "invalid watch interval '%s'\n", str);
+		exit(1);
+	}
+	output->watch_interval = interval;
+}
+
+void parse_has_ext(const char *str, struct opt_out *output)
+{
+	/* exit status 1 means the extensions are not supported, so
+	 * use 2 for usage errors, as --diff does */
+	if (!str || !str[strspn(str, ",")]) {
+		fprintf(stderr, "please specify the extensions to check for\n");
+		exit(2);
+	}
+	output->has_ext = str;
+}
+
+/* parse a comma-separated list of benchmark names */
+void parse_bench(const char *str, struct opt_out *output)
+{
+	if (!str) {
+		fprintf(stderr, "please specify the benchmarks to run\n");
+		exit(1);
+	}
+	while (*str) {
+		const size_t len = strcspn(str, ",");
+		size_t i;
+		for (i = 0; i < ARRAY_SIZE(bench_names); ++i) {
+			if (strlen(bench_names[i].name) == len &&
+				!strncmp(str, bench_names[i].name, len))
+				break;
+		}
+		if (i == ARRAY_SIZE(bench_names)) {
+			fprintf(stderr, "unknown benchmark '%.*s'\n", (int)len, str);
+			exit(1);
+		}
+		output->benchmarks |= bench_names[i].kind;
+		str += len;
+		if (*str == ',')
+			++str;
+	}
+}
+
+/* Set the default output options */
+void init_output(struct opt_out *output)
+{
+	output->num_selected_devices = 0;
+	output->selected_devices = NULL;
+	output->num_selection_platforms = 0;
+	output->device_id_specs = NULL;
+	output->num_device_id_specs = 0;
+	output->selected_props = NULL;
+	output->num_selected_props = 0;
+	output->dev_prop_plan = NULL;
+	output->mode = CLINFO_HUMAN;
+	output->cond = COND_PROP_CHECK;
+	output->brief = CL_FALSE;
+	output->detailed = CL_TRUE;
+	output->offline = CL_FALSE;
+	output->null_platform = CL_FALSE;
+	output->json = CL_FALSE;
+	output->check_size = CL_FALSE;
+	output->jobs = 1;
+	output->cache_dir = cache_dir_default(CL_FALSE);
+	output->snapshot = CL_FALSE;
+	output->flush = CL_FALSE;
+	output->timings = CL_FALSE;
+	output->benchmarks = 0;
+	output->sub_devices = CL_FALSE;
+	output->watch_interval = 0;
+	output->cbor = CL_FALSE;
+	output->timeout_ms = 0;
+	output->has_ext = NULL;
+	output->metrics = NULL;
+	output->diff = NULL;
+	output->select = NULL;
+	output->select_env = NULL;
+}
+
+void free_output(struct opt_out *output)
+{
+	cl_uint p;
+	size_t i;
+	/* proper memory management for selected_devices and selected_props,
+	 * and for what is derived from them
+	 */
+	for (p = 0; p < output->num_selection_platforms; ++p)
+		bitmap_free(output->selected_devices + p);
+	free(output->selected_devices);
+	output->selected_devices = NULL;
+	output->num_selection_platforms = 0;
+	free(output->device_id_specs);
+	output->device_id_specs = NULL;
+	output->num_device_id_specs = 0;
+	for (i = 0; i < output->num_selected_props; ++i)
+		free(output->selected_props[i]);
+	free(output->selected_props);
+	output->selected_props = NULL;
+	output->num_selected_props = 0;
+	free(output->dev_prop_plan);
+	output->dev_prop_plan = NULL;
+	free(output->cache_dir);
+	output->cache_dir = NULL;
+}
+
+void add_selected_prop(struct opt_out *output, char *prop)
+{
+	REALLOC(output->selected_props, output->num_selected_props + 1, "selected properties");
+	output->selected_props[output->num_selected_props++] = prop;
+}
+
+void parse_prop(const char *input, struct opt_out *output)
+{
+	/* We normalize the property name by upcasing it and replacing the minus sign (-)
+	 * with the underscore (_). If any other character is found, we consider it an error
+	 */
+
+	size_t len = strlen(input);
+	char *normalized;
+	ALLOC(normalized, len+1, "normalized property name");
+	for (size_t i = 0; i < len; ++i)
+	{
+		char c = input[i];
+		if ( (c == '_') || ( c >= 'A' && c <= 'Z'))
+			normalized[i] = c;
+		else if (c >= 'a' && c <= 'z')
+			normalized[i] = 'A' + (c - 'a');
+		else if (c == '-')
+			normalized[i] = '_';
+		else {
+			fprintf(stderr, "invalid property name substring '%s'\n", input);
+			exit(1);
+		}
+	}
+
+	add_selected_prop(output, normalized);
+}
+
+void usage(void)
+{
+	version();
 	puts("Display properties of all available OpenCL platforms and devices");
 	puts("Usage: clinfo [options ...]\n");
 	puts("Options:");
@@ -4595,36 +7579,1546 @@ void usage(void)
 	puts("\t--human\t\t\thuman-friendly output (default)");
 	puts("\t--raw\t\t\traw output");
 	puts("\t--json\t\t\toutput raw data in JSON format (experimental)");
+	puts("\t--cbor\t\t\toutput typed data in the binary CBOR format");
 	puts("\t--offline\t\talso show offline devices");
 	puts("\t--null-platform\t\talso show the NULL platform devices");
 	puts("\t--list, -l\t\tonly list the platforms and devices by name");
 	puts("\t--prop prop-name\tonly list properties matching the given name");
 	puts("\t--device p:d, -d p:d\tonly show information about device number d from platform number p");
+	puts("\t-d pci:ADDR, -d uuid:ID\tonly show information about the device with the given PCI address or UUID");
+	puts("\t--bench name[,name]\trun the given benchmarks on the devices (bandwidth, transfer, launch, p2p, svm, compile, flops, cache)");
+	puts("\t--has-ext name[,name]\tonly check if the devices support the given extensions, reporting it in the exit status");
+	puts("\t--sub-devices\t\tpartition the devices in all supported ways, and show the resulting sub-devices");
+	puts("\t--timeout SECONDS\tgive up on the platforms and devices whose properties take longer to gather");
+	puts("\t--diff FILE\t\tonly show the differences from the --json output in FILE, reporting them in the exit status");
+	puts("\t--select EXPR\t\tonly print the index (p:d) of the device with the highest score according to EXPR");
+	puts("\t--select-env NAME\tprint the selected device index as NAME=p:d");
+	puts("\t--metrics FILE\t\texport the numeric device properties to FILE (- for stdout) in the OpenMetrics format");
+	puts("\t--watch SECONDS\t\tpoll the dynamic device properties at the given interval, showing the changes");
+	puts("\t--timings\t\treport the time spent on each property and phase");
+	puts("\t--flush\t\t\twrite out each device property as soon as it is available");
+	puts("\t--snapshot\t\tanswer static device properties from the on-disk cache when possible");
+	puts("\t--cache\t\t\tuse the on-disk cache (off by default, implied by --snapshot)");
+	puts("\t--no-cache\t\tdo not use the on-disk cache");
+	puts("\t--jobs N, -j N\t\tgather the properties of up to N platforms or devices concurrently");
 	puts("\t--help, -h, -?\t\tshow usage");
 	puts("\t--version, -v\t\tshow version\n");
 	puts("Defaults to raw mode if invoked with a name that contains the string \"raw\"");
 }
 
+/*
+ * Library API (libclinfo.h)
+ */
+
+struct clinfo_session {
+	struct platform_list plist;
+	struct opt_out output;
+	/* values returned by the last props call, with their strings */
+	struct clinfo_value *values;
+	size_t num_values;
+	size_t alloc_values;
+	struct arena strings;
+};
+
+/* Type of the values retrieved by the given show functions */
+static const struct {
+	void (*show_func)(struct device_info_ret *,
+		const struct info_loc *, const struct device_info_checks *,
+		const struct opt_out *);
+	enum clinfo_value_type type;
+} dinfo_value_types[] = {
+	{ device_info_bool, CLINFO_VALUE_BOOL },
+	{ device_info_int, CLINFO_VALUE_UINT },
+	{ device_info_hex, CLINFO_VALUE_UINT },
+	{ device_info_bits, CLINFO_VALUE_UINT },
+	{ device_info_mem_int, CLINFO_VALUE_UINT },
+	{ device_info_version, CLINFO_VALUE_UINT },
+	{ device_info_cachetype, CLINFO_VALUE_UINT },
+	{ device_info_lmemtype, CLINFO_VALUE_UINT },
+	{ device_info_long, CLINFO_VALUE_ULONG },
+	{ device_info_mem, CLINFO_VALUE_ULONG },
+	{ device_info_time_offset, CLINFO_VALUE_ULONG },
+	{ device_info_sz, CLINFO_VALUE_SIZE },
+	{ device_info_mem_sz, CLINFO_VALUE_SIZE },
+	{ device_info_devtype, CLINFO_VALUE_BITFIELD },
+	{ device_info_atomic_caps, CLINFO_VALUE_BITFIELD },
+	{ device_info_device_enqueue_caps, CLINFO_VALUE_BITFIELD },
+	{ device_info_fpconf, CLINFO_VALUE_BITFIELD },
+	{ device_info_qprop, CLINFO_VALUE_BITFIELD },
+	{ device_info_command_buffer_caps, CLINFO_VALUE_BITFIELD },
+	{ device_info_mutable_dispatch_caps, CLINFO_VALUE_BITFIELD },
+	{ device_info_intel_usm_cap, CLINFO_VALUE_BITFIELD },
+	{ device_info_execap, CLINFO_VALUE_BITFIELD },
+	{ device_info_svm_cap, CLINFO_VALUE_BITFIELD },
+	{ device_info_terminate_capability, CLINFO_VALUE_BITFIELD },
+	{ device_info_terminate_arm, CLINFO_VALUE_BITFIELD },
+	{ device_info_arm_scheduling_controls, CLINFO_VALUE_BITFIELD },
+	{ device_info_intel_features, CLINFO_VALUE_BITFIELD },
+};
+
+static enum clinfo_value_type
+dinfo_value_type(const struct device_info_traits *traits)
+{
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(dinfo_value_types); ++i)
+		if (dinfo_value_types[i].show_func == traits->show_func)
+			return dinfo_value_types[i].type;
+	return CLINFO_VALUE_STRING;
+}
+
+static enum clinfo_value_type
+pinfo_value_type(const struct platform_info_traits *traits)
+{
+	if (traits->show_func == platform_info_ulong)
+		return CLINFO_VALUE_ULONG;
+	if (traits->show_func == platform_info_sz)
+		return CLINFO_VALUE_SIZE;
+	if (traits->show_func == platform_info_version)
+		return CLINFO_VALUE_UINT;
+	return CLINFO_VALUE_STRING;
+}
+
+static void
+session_clear_values(struct clinfo_session *session)
+{
+	arena_reset(&session->strings);
+	session->num_values = 0;
+}
+
+/* Append a value to the session values, copying its string representation */
+static struct clinfo_value *
+session_add_value(struct clinfo_session *session, const char *name, cl_uint param,
+	cl_int err, enum clinfo_value_type type, const struct _strbuf *str)
+{
+	struct clinfo_value *val;
+	size_t len = strlen(str->buf);
+	char *copy;
+
+	if (session->num_values == session->alloc_values) {
+		session->alloc_values = session->alloc_values ? 2*session->alloc_values : 64;
+		REALLOC(session->values, session->alloc_values, "library values");
+	}
+	ARENA_ALLOC(&session->strings, copy, len + 1, "library value string");
+	memcpy(copy, str->buf, len + 1);
+
+	val = session->values + session->num_values++;
+	memset(val, 0, sizeof(*val));
+	val->name = name;
+	val->param = param;
+	val->err = err;
+	val->type = type;
+	val->str = copy;
+	return val;
+}
+
+struct clinfo_session *
+clinfo_open(cl_int *err_ret)
+{
+	struct clinfo_session *session;
+	cl_device_id *devs;
+	cl_int err;
+	cl_uint p;
+
+	ALLOC(session, 1, "library session");
+	memset(session, 0, sizeof(*session));
+	init_plist(&session->plist);
+
+	/* gather quietly, with the values represented as in RAW mode */
+	init_output(&session->output);
+	session->output.mode = CLINFO_RAW;
+	session->output.detailed = CL_FALSE;
+	free(session->output.cache_dir);
+	session->output.cache_dir = NULL;
+
+	if (!line_pfx)
+		ALLOC(line_pfx, 1, "line prefix");
+	line_pfx[0] = '\0';
+	mutex_init(&wg_probe_lock);
+	cond_init(&wg_probe_built);
+
+	err = clGetPlatformIDs(0, NULL, &session->plist.num_platforms);
+	if (err == CL_PLATFORM_NOT_FOUND_KHR) {
+		session->plist.num_platforms = 0;
+		err = CL_SUCCESS;
+	}
+	if (!err && session->plist.num_platforms) {
+		alloc_plist(&session->plist, &session->output);
+		err = clGetPlatformIDs(session->plist.num_platforms, session->plist.platform, NULL);
+	}
+	if (err) {
+		if (err_ret)
+			*err_ret = err;
+		clinfo_close(session);
+		return NULL;
+	}
+
+	for (p = 0; p < session->plist.num_platforms; ++p) {
+		gatherPlatformInfo(&session->plist, p, &devs, &session->output);
+		mergePlatformInfo(&session->plist, p, devs);
+	}
+
+	if (err_ret)
+		*err_ret = CL_SUCCESS;
+	return session;
+}
+
+void
+clinfo_close(struct clinfo_session *session)
+{
+	if (!session)
+		return;
+	free(session->values);
+	arena_free(&session->strings);
+	arena_free(&scratch);
+	release_wg_probes();
+	cond_destroy(&wg_probe_built);
+	mutex_destroy(&wg_probe_lock);
+	free_plist(&session->plist);
+	free_output(&session->output);
+	free(line_pfx);
+	line_pfx = NULL;
+	free(session);
+}
+
+cl_uint
+clinfo_num_platforms(const struct clinfo_session *session)
+{
+	return session->plist.num_platforms;
+}
+
+cl_platform_id
+clinfo_platform(const struct clinfo_session *session, cl_uint p)
+{
+	return p < session->plist.num_platforms ? session->plist.platform[p] : NULL;
+}
+
+cl_uint
+clinfo_num_devices(const struct clinfo_session *session, cl_uint p)
+{
+	return p < session->plist.num_platforms ? session->plist.pdata[p].ndevs : 0;
+}
+
+cl_device_id
+clinfo_device(const struct clinfo_session *session, cl_uint p, cl_uint d)
+{
+	return d < clinfo_num_devices(session, p) ? get_platform_dev(&session->plist, p, d) : NULL;
+}
+
+size_t
+clinfo_platform_props(struct clinfo_session *session, cl_uint p,
+	const struct clinfo_value **values)
+{
+	const struct platform_info_checks *pinfo_checks;
+	struct platform_info_ret ret;
+	struct info_loc loc;
+
+	session_clear_values(session);
+	*values = session->values;
+	if (p >= session->plist.num_platforms)
+		return 0;
+
+	pinfo_checks = session->plist.platform_checks + p;
+	INIT_RET(ret, "platform");
+	reset_loc(&loc, __func__);
+	loc.plat = session->plist.platform[p];
+
+	for (loc.line = 0; loc.line < ARRAY_SIZE(pinfo_traits); ++loc.line) {
+		const struct platform_info_traits *traits = pinfo_traits + loc.line;
+		struct clinfo_value *val;
+
+		if (traits->check_func && !traits->check_func(pinfo_checks))
+			continue;
+
+		loc.sname = loc.pname = traits->sname;
+		loc.param.plat = traits->param;
+		cur_sfx = empty_str;
+
+		reset_strbuf(&ret.str);
+		reset_strbuf(&ret.err_str);
+		traits->show_func(&ret, &loc, pinfo_checks, &session->output);
+
+		val = session_add_value(session, traits->sname, traits->param, ret.err,
+			pinfo_value_type(traits), RET_BUF(ret));
+		if (!ret.err) {
+			val->value.u64 = ret.value.u64;
+			if (val->type == CLINFO_VALUE_UINT)
+				val->value.u32 = ret.value.u32;
+			else if (val->type == CLINFO_VALUE_SIZE)
+				val->value.s = ret.value.s;
+		}
+	}
+	UNINIT_RET(ret);
+
+	*values = session->values;
+	return session->num_values;
+}
+
+size_t
+clinfo_device_props(struct clinfo_session *session, cl_uint p, cl_uint d,
+	const struct clinfo_value **values)
+{
+	const cl_device_id dev = clinfo_device(session, p, d);
+	struct device_info_checks chk;
+	struct device_info_ret ret;
+	struct info_loc loc;
+	char *extensions = NULL;
+
+	session_clear_values(session);
+	*values = session->values;
+	if (!dev)
+		return 0;
+
+	memset(&chk, 0, sizeof(chk));
+	chk.pinfo_checks = session->plist.platform_checks + p;
+	chk.dev_version = 10;
+
+	arena_reset(&scratch);
+	INIT_RET_SCRATCH(ret, "device");
+	reset_loc(&loc, __func__);
+	loc.plat = session->plist.platform[p];
+	loc.dev = dev;
+
+	/* the same walk as printDeviceInfo in RAW mode, checking the conditions */
+	for (loc.line = 0; loc.line < ARRAY_SIZE(dinfo_traits); ++loc.line) {
+		const struct device_info_traits *traits = dinfo_traits + loc.line;
+		struct clinfo_value *val;
+
+		if (traits->param == CL_FALSE || !(traits->output_mode & CLINFO_RAW))
+			continue;
+		if (traits->check_func && !traits->check_func(&chk))
+			continue;
+
+		loc.sname = loc.pname = traits->sname;
+		loc.param.dev = traits->param;
+		cur_sfx = empty_str;
+
+		reset_strbuf(&ret.str);
+		reset_strbuf(&ret.err_str);
+		ret.needs_escaping = CL_FALSE;
+		traits->show_func(&ret, &loc, &chk, &session->output);
+
+		val = session_add_value(session, traits->sname, traits->param, ret.err,
+			dinfo_value_type(traits), RET_BUF(ret));
+		if (ret.err)
+			continue;
+
+		switch (val->type) {
+		case CLINFO_VALUE_BOOL:
+			val->value.b = ret.value.b;
+			break;
+		case CLINFO_VALUE_UINT:
+			val->value.u32 = ret.value.u32;
+			break;
+		case CLINFO_VALUE_SIZE:
+			val->value.s = ret.value.s;
+			break;
+		case CLINFO_VALUE_ULONG:
+		case CLINFO_VALUE_BITFIELD:
+			val->value.u64 = ret.value.u64;
+			break;
+		default:
+			break;
+		}
+
+		if (traits->param == CL_DEVICE_EXTENSIONS) {
+			/* padded with spaces, as expected by identify_device_extensions */
+			const size_t len = strlen(ret.str.buf);
+			SCRATCH_ALLOC(extensions, len + 3, "extensions");
+			extensions[0] = ' ';
+			memcpy(extensions + 1, ret.str.buf, len);
+			extensions[len + 1] = ' ';
+			extensions[len + 2] = '\0';
+		}
+		updateDeviceChecks(traits->param, &ret, extensions, &chk);
+	}
+	UNINIT_RET(ret);
+
+	*values = session->values;
+	return session->num_values;
+}
+
+const struct clinfo_value *
+clinfo_find(const struct clinfo_value *values, size_t num_values, const char *name)
+{
+	size_t i;
+	for (i = 0; i < num_values; ++i)
+		if (!strcmp(values[i].name, name))
+			return values + i;
+	return NULL;
+}
+
+/* Binary output (--cbor), built on the library API. The document is a map with:
+ *   "names": the symbolic names of the properties, each appearing only once;
+ *   "platforms": for each selected platform, a map with "props" (the platform properties)
+ *     and "devices" (the properties of each selected device);
+ * the properties are maps keyed by the index of the property name in "names".
+ * Numeric values are written as unsigned integers, booleans as booleans, and anything else
+ * as a string (as in RAW mode); a property that could not be retrieved is written as an array
+ * holding the (negative) error code and the error description.
+ */
+
+/* property names used in the document, in order of first use */
+struct cbor_names {
+	const char **name;
+	size_t count;
+	size_t alloc;
+};
+
+static size_t cbor_name_index(struct cbor_names *names, const char *name)
+{
+	size_t i;
+	for (i = 0; i < names->count; ++i)
+		if (names->name[i] == name || !strcmp(names->name[i], name))
+			return i;
+	if (names->count == names->alloc) {
+		names->alloc = names->alloc ? 2*names->alloc : 256;
+		REALLOC(names->name, names->alloc, "CBOR names");
+	}
+	names->name[names->count] = name;
+	return names->count++;
+}
+
+static void cbor_props(struct _strbuf *doc, struct cbor_names *names,
+	const struct clinfo_value *val, size_t num_values, const struct opt_out *output)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < num_values; ++i)
+		count += is_selected_prop(output, val[i].name);
+	cbor_map(doc, count);
+
+	for (i = 0; i < num_values; ++i) {
+		if (!is_selected_prop(output, val[i].name))
+			continue;
+		cbor_uint(doc, cbor_name_index(names, val[i].name));
+		if (val[i].err) {
+			cbor_array(doc, 2);
+			cbor_int(doc, val[i].err);
+			cbor_text(doc, val[i].str);
+			continue;
+		}
+		switch (val[i].type) {
+		case CLINFO_VALUE_BOOL:
+			cbor_bool(doc, val[i].value.b);
+			break;
+		case CLINFO_VALUE_UINT:
+			cbor_uint(doc, val[i].value.u32);
+			break;
+		case CLINFO_VALUE_ULONG:
+			cbor_uint(doc, val[i].value.u64);
+			break;
+		case CLINFO_VALUE_SIZE:
+			cbor_uint(doc, val[i].value.s);
+			break;
+		case CLINFO_VALUE_BITFIELD:
+			cbor_uint(doc, val[i].value.bits);
+			break;
+		default:
+			cbor_text(doc, val[i].str);
+			break;
+		}
+	}
+}
+
+void showCBOR(const struct opt_out *output)
+{
+	struct clinfo_session *session;
+	struct cbor_names names;
+	struct _strbuf doc, head;
+	const struct clinfo_value *val;
+	size_t num_values, i;
+	cl_uint num_platforms, p, d, count;
+	cl_int err;
+
+	session = clinfo_open(&err);
+	CHECK_ERROR(err, "platform IDs");
+	num_platforms = clinfo_num_platforms(session);
+
+	memset(&names, 0, sizeof(names));
+	init_strbuf(&doc, "CBOR document");
+	init_strbuf(&head, "CBOR names");
+
+	for (p = 0, count = 0; p < num_platforms; ++p)
+		count += is_selected_platform(output, p);
+	cbor_text(&doc, "platforms");
+	cbor_array(&doc, count);
+
+	for (p = 0; p < num_platforms; ++p) {
+		if (!is_selected_platform(output, p))
+			continue;
+		cbor_map(&doc, 2);
+		cbor_text(&doc, "props");
+		num_values = clinfo_platform_props(session, p, &val);
+		cbor_props(&doc, &names, val, num_values, output);
+
+		for (d = 0, count = 0; d < clinfo_num_devices(session, p); ++d)
+			count += is_selected_device(output, p, d);
+		cbor_text(&doc, "devices");
+		cbor_array(&doc, count);
+		for (d = 0; d < clinfo_num_devices(session, p); ++d) {
+			if (!is_selected_device(output, p, d))
+				continue;
+			num_values = clinfo_device_props(session, p, d, &val);
+			cbor_props(&doc, &names, val, num_values, output);
+		}
+	}
+
+	/* the names table comes first, so that it can be read as the document is parsed */
+	cbor_map(&head, 2);
+	cbor_text(&head, "names");
+	cbor_array(&head, names.count);
+	for (i = 0; i < names.count; ++i)
+		cbor_text(&head, names.name[i]);
+
+#ifdef _MSC_VER
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	out_str_len(head.buf, head.end);
+	out_str_len(doc.buf, doc.end);
+
+	free(names.name);
+	free_strbuf(&head);
+	free_strbuf(&doc);
+	clinfo_close(session);
+}
+
+/*
+ * Metrics mode (--metrics): the numeric device properties, as OpenMetrics gauges
+ */
+
+/* A numeric device property exported in metrics mode */
+struct metric_rec {
+	cl_uint p;
+	cl_uint d;
+	cl_device_id dev;
+	const struct device_info_checks *chk;
+	const struct device_info_traits *traits;
+	const char *labels; /* of the device, shared by all of its records */
+	cl_bool dynamic; /* queried again for each export, rather than only once */
+	cl_int err;
+	cl_ulong value[2];
+	cl_uint num_values;
+};
+
+/* Append the string to str, escaped as an OpenMetrics label value */
+void metrics_escape(struct _strbuf *str, const char *val)
+{
+	for (; *val; ++val) {
+		switch (*val) {
+		case '\\': strbuf_append_str_len(__func__, str, "\\\\", 2); break;
+		case '"': strbuf_append_str_len(__func__, str, "\\\"", 2); break;
+		case '\n': strbuf_append_str_len(__func__, str, "\\n", 2); break;
+		default: strbuf_append_str_len(__func__, str, val, 1); break;
+		}
+	}
+}
+
+/* Metric name for a property: CL_DEVICE_MAX_COMPUTE_UNITS becomes clinfo_device_max_compute_units */
+void metrics_name(struct _strbuf *str, const char *sname)
+{
+	if (!strncmp(sname, "CL_", 3))
+		sname += 3;
+	strbuf_append_str_len(__func__, str, "clinfo_", 7);
+	for (; *sname; ++sname) {
+		const char c = (char)tolower((unsigned char)*sname);
+		strbuf_append_str_len(__func__, str, &c, 1);
+	}
+}
+
+/* HELP text for a property: its display name; the indented ones (such as the
+ * vector widths, shown as "char", "short", etc) are qualified by the heading they
+ * are shown under, and by the symbolic name, which tells them apart */
+void metrics_help(struct _strbuf *str, const struct device_info_traits *traits)
+{
+	const size_t indent = strspn(traits->pname, " ");
+	const struct device_info_traits *head = traits;
+
+	if (!indent) {
+		strbuf_append_str(__func__, str, traits->pname);
+		return;
+	}
+	while (head > dinfo_traits && strspn(head->pname, " ") >= indent)
+		--head;
+	if (strspn(head->pname, " ") < indent)
+		strbuf_append(__func__, str, "%s: ", skip_leading_ws(head->pname));
+	strbuf_append(__func__, str, "%s (%s)", traits->pname + indent, traits->sname);
+}
+
+/* Whether the property can be exported as a gauge, and with how many values */
+cl_uint metrics_num_values(const struct device_info_traits *traits)
+{
+	if (traits->show_func == device_info_free_mem_amd)
+		return 2;
+	switch (dinfo_value_type(traits)) {
+	case CLINFO_VALUE_BOOL:
+	case CLINFO_VALUE_UINT:
+	case CLINFO_VALUE_ULONG:
+	case CLINFO_VALUE_SIZE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Whether the device info trait at the given line is exported */
+cl_bool is_metrics_trait(size_t line, const struct opt_out *output)
+{
+	const struct device_info_traits *traits = dinfo_traits + line;
+	return traits->param != CL_FALSE && (traits->output_mode & CLINFO_RAW) &&
+		metrics_num_values(traits) &&
+		!(output->dev_prop_plan && output->dev_prop_plan[line] != PROP_SELECTED);
+}
+
+/* Query the property of the record, taking the number(s) from the value union */
+void metrics_query(struct metric_rec *rec, const struct platform_list *plist,
+	struct device_info_ret *ret, const struct opt_out *output)
+{
+	const struct device_info_traits *traits = rec->traits;
+	struct info_loc loc;
+
+	reset_loc(&loc, __func__);
+	loc.line = traits - dinfo_traits;
+	loc.plat = plist->platform[rec->p];
+	loc.dev = rec->dev;
+	loc.sname = loc.pname = traits->sname;
+	loc.param.dev = traits->param;
+	cur_sfx = empty_str;
+
+	reset_strbuf(&ret->str);
+	reset_strbuf(&ret->err_str);
+	ret->needs_escaping = CL_FALSE;
+	traits->show_func(ret, &loc, rec->chk, output);
+
+	rec->err = ret->err;
+	if (ret->err)
+		return;
+	if (rec->num_values == 2) {
+		rec->value[0] = ret->value.u64v2.s[0];
+		rec->value[1] = ret->value.u64v2.s[1];
+		return;
+	}
+	switch (dinfo_value_type(traits)) {
+	case CLINFO_VALUE_BOOL:
+		rec->value[0] = ret->value.b;
+		break;
+	case CLINFO_VALUE_UINT:
+		rec->value[0] = ret->value.u32;
+		break;
+	case CLINFO_VALUE_SIZE:
+		rec->value[0] = ret->value.s;
+		break;
+	default:
+		rec->value[0] = ret->value.u64;
+		break;
+	}
+}
+
+/* Labels identifying the device: platform symbolic name, device index and PCI address (if known) */
+char *metrics_labels(const struct platform_list *plist, cl_uint p, cl_uint d, cl_device_id dev)
+{
+	struct _strbuf str;
+	cl_device_pci_bus_info_khr pci;
+	char *labels;
+
+	init_strbuf(&str, "metric labels");
+	strbuf_append_str(__func__, &str, "platform=\"");
+	metrics_escape(&str, plist->pdata[p].sname);
+	strbuf_append(__func__, &str, "\",device=\"%" PRIu32 "\"", d);
+	if (getDevicePciAddr(dev, &pci))
+		strbuf_append(__func__, &str, ",pci=\"%04x:%02x:%02x.%u\"",
+			pci.pci_domain, pci.pci_bus, pci.pci_device, pci.pci_function);
+
+	ALLOC(labels, str.end + 1, "metric labels");
+	memcpy(labels, str.buf, str.end + 1);
+	free_strbuf(&str);
+	return labels;
+}
+
+/* Write out the document to the metrics path, atomically unless it's standard output */
+void metrics_write(const struct _strbuf *doc, const char *path)
+{
+	struct _strbuf tmp;
+	FILE *f;
+
+	if (!strcmp(path, "-")) {
+		fwrite(doc->buf, 1, doc->end, stdout);
+		fflush(stdout);
+		return;
+	}
+
+	init_strbuf(&tmp, "metrics temporary path");
+	strbuf_append(__func__, &tmp, "%s.tmp", path);
+	f = fopen(tmp.buf, "wb");
+	if (!f || fwrite(doc->buf, 1, doc->end, f) != doc->end) {
+		fprintf(stderr, "failed to write metrics to '%s': %s\n", tmp.buf, strerror(errno));
+		if (f)
+			fclose(f);
+		exit(1);
+	}
+	fclose(f);
+#ifdef _WIN32
+	/* rename does not replace existing files on Windows */
+	remove(path);
+#endif
+	if (rename(tmp.buf, path)) {
+		fprintf(stderr, "failed to write metrics to '%s': %s\n", path, strerror(errno));
+		exit(1);
+	}
+	free_strbuf(&tmp);
+}
+
+/* Metrics mode: export the numeric properties of the selected devices to output->metrics
+ * in the OpenMetrics text format. The static properties are only queried once; with
+ * a watch interval, the devices are kept open and the metrics are written out again
+ * every interval, only querying the dynamic properties; otherwise they are written out
+ * once.
+ */
+void exportMetrics(struct platform_list *plist, cl_uint num_platforms, const struct opt_out *output)
+{
+	struct device_info_checks *chk = NULL;
+	struct metric_rec *rec = NULL;
+	char **labels = NULL;
+	size_t num_recs = 0, alloc_recs = 0, r;
+	struct device_info_ret ret;
+	struct _strbuf doc, name, help;
+	cl_ulong next;
+	const cl_ulong interval = (cl_ulong)(output->watch_interval*1.0e9);
+	cl_uint p, d, dev_idx;
+	size_t line, other;
+
+	gatherPlatformsQuietly(plist, num_platforms, output);
+
+	ALLOC(chk, plist->ndevs_total ? plist->ndevs_total : 1, "metrics device checks");
+	ALLOC(labels, plist->ndevs_total ? plist->ndevs_total : 1, "metrics device labels");
+	for (p = 0, dev_idx = 0; p < num_platforms; ++p) {
+		if (!is_selected_platform(output, p))
+			continue;
+		for (d = 0; d < plist->pdata[p].ndevs; ++d, ++dev_idx) {
+			const cl_device_id dev = get_platform_dev(plist, p, d);
+			if (!is_selected_device(output, p, d))
+				continue;
+			gatherDeviceChecks(dev, plist, p, chk + dev_idx, output);
+			labels[dev_idx] = metrics_labels(plist, p, d, dev);
+		}
+	}
+
+	/* the records of each metric must be contiguous: for each property name,
+	 * take for each device the first of its traits that applies */
+	INIT_RET(ret, "metrics");
+	for (line = 0; line < ARRAY_SIZE(dinfo_traits); ++line) {
+		const struct device_info_traits *traits = dinfo_traits + line;
+		if (!is_metrics_trait(line, output))
+			continue;
+		for (other = 0; other < line; ++other)
+			if (is_metrics_trait(other, output) && !strcmp(dinfo_traits[other].sname, traits->sname))
+				break;
+		if (other < line)
+			continue;
+
+		for (p = 0, dev_idx = 0; p < num_platforms; ++p) {
+			if (!is_selected_platform(output, p))
+				continue;
+			for (d = 0; d < plist->pdata[p].ndevs; ++d, ++dev_idx) {
+				const struct device_info_traits *t = traits;
+				if (!is_selected_device(output, p, d))
+					continue;
+				for (; t < dinfo_traits + ARRAY_SIZE(dinfo_traits); ++t)
+					if (is_metrics_trait(t - dinfo_traits, output) &&
+						!strcmp(t->sname, traits->sname) &&
+						(!t->check_func || t->check_func(chk + dev_idx)))
+						break;
+				if (t == dinfo_traits + ARRAY_SIZE(dinfo_traits))
+					continue;
+
+				if (num_recs == alloc_recs) {
+					alloc_recs = alloc_recs ? 2*alloc_recs : 64;
+					REALLOC(rec, alloc_recs, "metrics");
+				}
+				memset(rec + num_recs, 0, sizeof(*rec));
+				rec[num_recs].p = p;
+				rec[num_recs].d = d;
+				rec[num_recs].dev = get_platform_dev(plist, p, d);
+				rec[num_recs].chk = chk + dev_idx;
+				rec[num_recs].traits = t;
+				rec[num_recs].labels = labels[dev_idx];
+				rec[num_recs].dynamic = is_dynamic_dev_info(t->param);
+				rec[num_recs].num_values = metrics_num_values(t);
+				/* the static properties are only queried now, and dropped if not available */
+				metrics_query(rec + num_recs, plist, &ret, output);
+				if (!rec[num_recs].dynamic && rec[num_recs].err)
+					continue;
+				++num_recs;
+			}
+		}
+	}
+
+	init_strbuf(&doc, "metrics");
+	init_strbuf(&name, "metric name");
+	init_strbuf(&help, "metric help");
+	next = timer_ns();
+	for (;;) {
+		arena_reset(&scratch);
+		reset_strbuf(&doc);
+		for (r = 0; r < num_recs; ++r) {
+			struct metric_rec *mr = rec + r;
+			if (!r || strcmp(rec[r-1].traits->sname, mr->traits->sname)) {
+				reset_strbuf(&name);
+				metrics_name(&name, mr->traits->sname);
+				reset_strbuf(&help);
+				metrics_help(&help, mr->traits);
+				strbuf_append(__func__, &doc, "# TYPE %s gauge\n# HELP %s %s\n",
+					name.buf, name.buf, help.buf);
+			}
+			if (mr->dynamic)
+				metrics_query(mr, plist, &ret, output);
+			if (mr->err)
+				continue;
+			if (mr->num_values == 2) {
+				strbuf_append(__func__, &doc, "%s{%s,kind=\"total\"} %" PRIu64 "\n",
+					name.buf, mr->labels, mr->value[0]);
+				strbuf_append(__func__, &doc, "%s{%s,kind=\"largest_block\"} %" PRIu64 "\n",
+					name.buf, mr->labels, mr->value[1]);
+			} else {
+				strbuf_append(__func__, &doc, "%s{%s} %" PRIu64 "\n",
+					name.buf, mr->labels, mr->value[0]);
+			}
+		}
+		strbuf_append_str(__func__, &doc, "# EOF\n");
+		metrics_write(&doc, output->metrics);
+
+		if (!interval)
+			break;
+
+		timer_wait_next(&next, interval);
+	}
+
+	free_strbuf(&help);
+	free_strbuf(&name);
+	free_strbuf(&doc);
+	UNINIT_RET(ret);
+	for (dev_idx = 0; dev_idx < plist->ndevs_total; ++dev_idx)
+		free(labels[dev_idx]);
+	free(labels);
+	free(rec);
+	free(chk);
+}
+
+/* Diff mode: the baseline document (from a previous --json run), with the
+ * entities (platforms, devices, ICD loader) and their properties indexed by key,
+ * which is the label of the entity (e.g. 0:1 for the second device of the first
+ * platform), followed by a space and the property name for properties.
+ */
+struct diff_entry {
+	const char *key; /* NULL for an empty slot */
+	const struct json_node *node; /* entity object, or property value */
+	cl_bool seen; /* also present in the current document */
+};
+
+struct diff_baseline {
+	struct arena arena; /* owner of the documents and of the keys */
+	const struct json_node *root;
+	struct diff_entry *entry; /* open addressing, with linear probing */
+	size_t mask; /* number of slots minus one, the number of slots being a power of two */
+	size_t num;
+	/* names of the properties that are expected to change from run to run,
+	 * and are therefore not compared */
+	const char *skip[ARRAY_SIZE(dev_dynamic_info)];
+	size_t num_skip;
+};
+
+/* Slot where the entry for key is or would be */
+struct diff_entry *diff_slot(const struct diff_baseline *base, const char *key)
+{
+	size_t i = ext_hash(key, strlen(key)) & base->mask;
+	while (base->entry[i].key && strcmp(base->entry[i].key, key))
+		i = (i + 1) & base->mask;
+	return base->entry + i;
+}
+
+void diff_insert(struct diff_baseline *base, const char *key, const struct json_node *node)
+{
+	struct diff_entry *slot;
+
+	/* keep the table at most half full */
+	if (2*(base->num + 1) > base->mask + 1) {
+		struct diff_entry *old = base->entry;
+		const size_t old_slots = base->mask + 1;
+		size_t i;
+
+		base->mask = 2*old_slots - 1;
+		ALLOC(base->entry, base->mask + 1, "diff index");
+		memset(base->entry, 0, (base->mask + 1)*sizeof(*base->entry));
+		for (i = 0; i < old_slots; ++i)
+			if (old[i].key)
+				*diff_slot(base, old[i].key) = old[i];
+		free(old);
+	}
+
+	slot = diff_slot(base, key);
+	if (slot->key)
+		return; /* duplicate, keep the first */
+	ARENA_ALLOC(&base->arena, slot->key, strlen(key) + 1, "diff key");
+	memcpy((char *)slot->key, key, strlen(key) + 1);
+	slot->node = node;
+	slot->seen = CL_FALSE;
+	++base->num;
+}
+
+cl_bool diff_skip_prop(const struct diff_baseline *base, const char *name)
+{
+	size_t i;
+	for (i = 0; i < base->num_skip; ++i)
+		if (!strcmp(base->skip[i], name))
+			return CL_TRUE;
+	return CL_FALSE;
+}
+
+/* Call fn for each entity in the document, with its label and kind */
+typedef void (*diff_entity_fn)(struct diff_baseline *base, const char *label,
+	const char *kind, const struct json_node *obj);
+
+void diff_walk(struct diff_baseline *base, const struct json_node *root, diff_entity_fn fn)
+{
+	const struct json_node *node, *devs, *dev;
+	char label[64];
+	cl_uint p, d, offline;
+
+	for (node = json_children(json_get(root, "platforms")), p = 0; node; node = node->next, ++p) {
+		snprintf(label, sizeof(label), "%" PRIu32, p);
+		fn(base, label, "platform", node);
+	}
+	for (devs = json_children(json_get(root, "devices")), p = 0; devs; devs = devs->next, ++p) {
+		for (offline = 0; offline < 2; ++offline) {
+			dev = json_children(json_get(devs, offline ? "offline" : "online"));
+			for (d = 0; dev; dev = dev->next, ++d) {
+				snprintf(label, sizeof(label), "%" PRIu32 ":%" PRIu32 "%s", p, d, offline ? " offline" : "");
+				fn(base, label, offline ? "offline device" : "device", dev);
+			}
+		}
+	}
+	node = json_get(root, "icd_loader");
+	if (node)
+		fn(base, "icd_loader", "ICD loader", node);
+}
+
+void diff_index_entity(struct diff_baseline *base, const char *label,
+	const char *UNUSED(kind), const struct json_node *obj)
+{
+	const struct json_node *prop;
+	struct _strbuf key;
+
+	diff_insert(base, label, obj);
+	init_strbuf(&key, "diff key");
+	for (prop = json_children(obj); prop; prop = prop->next) {
+		if (!prop->key || diff_skip_prop(base, prop->key))
+			continue;
+		reset_strbuf(&key);
+		strbuf_append(__func__, &key, "%s %s", label, prop->key);
+		diff_insert(base, key.buf, prop);
+	}
+	free_strbuf(&key);
+}
+
+/* Load and index the baseline; exits with status 2 (trouble, as for diff(1)) on failure */
+void diff_load(struct diff_baseline *base, const char *path)
+{
+	struct _strbuf text;
+	const char *error;
+	FILE *f;
+	size_t t, got;
+	const cl_device_info *dyn;
+
+	memset(base, 0, sizeof(*base));
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "failed to open the baseline '%s': %s\n", path, strerror(errno));
+		exit(2);
+	}
+	init_strbuf(&text, "baseline");
+	do {
+		realloc_strbuf(&text, text.end + 65536 + 1, "baseline");
+		got = fread(text.buf + text.end, 1, text.sz - text.end - 1, f);
+		text.end += got;
+	} while (got > 0);
+	text.buf[text.end] = '\0';
+	if (ferror(f)) {
+		fprintf(stderr, "failed to read the baseline '%s': %s\n", path, strerror(errno));
+		exit(2);
+	}
+	fclose(f);
+
+	base->root = json_parse(text.buf, text.end, &base->arena, &error);
+	free_strbuf(&text);
+	if (!base->root || base->root->type != JSON_OBJECT) {
+		fprintf(stderr, "failed to parse the baseline '%s': %s\n", path,
+			error ? error : "not a JSON object");
+		exit(2);
+	}
+
+	/* CL_DEVICE_AVAILABLE is dynamic too, but a device going away is worth reporting */
+	for (dyn = dev_dynamic_info; *dyn != CL_FALSE; ++dyn) {
+		if (*dyn == CL_DEVICE_AVAILABLE)
+			continue;
+		for (t = 0; t < ARRAY_SIZE(dinfo_traits); ++t) {
+			if (dinfo_traits[t].param == *dyn) {
+				base->skip[base->num_skip++] = dinfo_traits[t].sname;
+				break;
+			}
+		}
+	}
+
+	base->mask = 1023;
+	ALLOC(base->entry, base->mask + 1, "diff index");
+	memset(base->entry, 0, (base->mask + 1)*sizeof(*base->entry));
+	diff_walk(base, base->root, diff_index_entity);
+}
+
+void diff_free(struct diff_baseline *base)
+{
+	free(base->entry);
+	base->entry = NULL;
+	arena_free(&base->arena);
+}
+
+/* State of the comparison, shared by the diff_walk callbacks */
+static struct _strbuf diff_old, diff_new, diff_key;
+static cl_bool diff_changed;
+
+/* Print the name of the entity, if it has one */
+void diff_entity_name(const struct json_node *obj)
+{
+	const struct json_node *name = json_get(obj, "CL_DEVICE_NAME");
+	if (!name)
+		name = json_get(obj, "CL_PLATFORM_NAME");
+	if (name) {
+		reset_strbuf(&diff_new);
+		json_write(&diff_new, name);
+		out_printf(" %s", diff_new.buf);
+	}
+}
+
+/* Compare an entity of the current document with the baseline one with the same label */
+void diff_compare_entity(struct diff_baseline *base, const char *label,
+	const char *kind, const struct json_node *obj)
+{
+	struct diff_entry *entity = diff_slot(base, label);
+	struct diff_entry *entry;
+	const struct json_node *prop;
+
+	if (!entity->key) {
+		out_printf("+ %s %s", label, kind);
+		diff_entity_name(obj);
+		out_char('\n');
+		diff_changed = CL_TRUE;
+		return;
+	}
+	entity->seen = CL_TRUE;
+
+	for (prop = json_children(obj); prop; prop = prop->next) {
+		if (!prop->key || diff_skip_prop(base, prop->key))
+			continue;
+		reset_strbuf(&diff_key);
+		strbuf_append(__func__, &diff_key, "%s %s", label, prop->key);
+		entry = diff_slot(base, diff_key.buf);
+
+		reset_strbuf(&diff_new);
+		json_write(&diff_new, prop);
+		if (!entry->key) {
+			out_printf("+ %s %s\n", diff_key.buf, diff_new.buf);
+			diff_changed = CL_TRUE;
+			continue;
+		}
+		entry->seen = CL_TRUE;
+		reset_strbuf(&diff_old);
+		json_write(&diff_old, entry->node);
+		if (strcmp(diff_old.buf, diff_new.buf)) {
+			out_printf("~ %s %s -> %s\n", diff_key.buf, diff_old.buf, diff_new.buf);
+			diff_changed = CL_TRUE;
+		}
+	}
+
+	/* properties no longer reported */
+	for (prop = json_children(entity->node); prop; prop = prop->next) {
+		if (!prop->key || diff_skip_prop(base, prop->key))
+			continue;
+		reset_strbuf(&diff_key);
+		strbuf_append(__func__, &diff_key, "%s %s", label, prop->key);
+		entry = diff_slot(base, diff_key.buf);
+		if (entry->seen || entry->node != prop)
+			continue;
+		entry->seen = CL_TRUE;
+		reset_strbuf(&diff_old);
+		json_write(&diff_old, prop);
+		out_printf("- %s %s\n", diff_key.buf, diff_old.buf);
+		diff_changed = CL_TRUE;
+	}
+}
+
+/* Report the baseline entities missing from the current document */
+void diff_removed_entity(struct diff_baseline *base, const char *label,
+	const char *kind, const struct json_node *obj)
+{
+	struct diff_entry *entity = diff_slot(base, label);
+	if (entity->seen || entity->node != obj)
+		return;
+	out_printf("- %s %s", label, kind);
+	diff_entity_name(obj);
+	out_char('\n');
+	diff_changed = CL_TRUE;
+}
+
+/* Compare the output document, in JSON format, with the baseline, and replace it
+ * with the report of the differences: one line per changed (~), added (+) or
+ * removed (-) property, or added or removed platform or device.
+ * Returns the exit status, as for diff(1): 0 if nothing changed, 1 otherwise,
+ * 2 in case of trouble.
+ */
+int diff_report(struct diff_baseline *base)
+{
+	const char *error;
+	const struct json_node *root = json_parse(out_doc.buf, out_doc.end, &base->arena, &error);
+
+	reset_strbuf(&out_doc);
+	if (!root) {
+		fprintf(stderr, "failed to parse the current output: %s\n", error);
+		return 2;
+	}
+
+	init_strbuf(&diff_old, "diff value");
+	init_strbuf(&diff_new, "diff value");
+	init_strbuf(&diff_key, "diff key");
+	diff_changed = CL_FALSE;
+
+	diff_walk(base, root, diff_compare_entity);
+	diff_walk(base, base->root, diff_removed_entity);
+
+	free_strbuf(&diff_old);
+	free_strbuf(&diff_new);
+	free_strbuf(&diff_key);
+	return diff_changed ? 1 : 0;
+}
+
+/*
+ * Select mode (--select): pick the device with the highest score,
+ * computed from its properties by the given expression
+ */
+
+enum select_op {
+	SEL_NUM, SEL_VAR,
+	SEL_NEG, SEL_NOT,
+	SEL_MUL, SEL_DIV, SEL_ADD, SEL_SUB, SEL_BITAND,
+	SEL_LT, SEL_LE, SEL_GT, SEL_GE, SEL_EQ, SEL_NE,
+	SEL_AND, SEL_OR
+};
+
+struct select_node {
+	enum select_op op;
+	double num; /* SEL_NUM */
+	size_t var; /* SEL_VAR: index into the variables */
+	size_t lhs, rhs; /* operands (lhs only for the unary operators), as node indices */
+};
+
+/* Variables referenced by the expression: numeric device properties or measurements */
+#define SELECT_BANDWIDTH ((size_t)-1)
+
+struct select_var {
+	char *name;
+	size_t line; /* of the first device info trait with this name, or SELECT_BANDWIDTH */
+	double value;
+	cl_bool valid; /* the value of the current device could be obtained */
+};
+
+/* Whether the property can be used in the expression: the numeric ones
+ * exported as metrics, and the bitfields (such as CL_DEVICE_TYPE) */
+cl_bool select_is_numeric(const struct device_info_traits *traits)
+{
+	return metrics_num_values(traits) || dinfo_value_type(traits) == CLINFO_VALUE_BITFIELD;
+}
+
+struct select_expr {
+	const char *text;
+	const char *cur; /* parsing position */
+	struct select_node *node;
+	size_t num_nodes;
+	struct select_var *var;
+	size_t num_vars;
+	size_t root;
+};
+
+void select_error(const struct select_expr *expr, const char *msg)
+{
+	fprintf(stderr, "invalid --select expression '%s': %s at offset %u\n",
+		expr->text, msg, (unsigned)(expr->cur - expr->text));
+	exit(1);
+}
+
+size_t select_add_node(struct select_expr *expr, enum select_op op, size_t lhs, size_t rhs)
+{
+	struct select_node *node;
+	REALLOC(expr->node, expr->num_nodes + 1, "select expression");
+	node = expr->node + expr->num_nodes;
+	memset(node, 0, sizeof(*node));
+	node->op = op;
+	node->lhs = lhs;
+	node->rhs = rhs;
+	return expr->num_nodes++;
+}
+
+void select_skip_ws(struct select_expr *expr)
+{
+	while (isspace((unsigned char)*expr->cur))
+		++expr->cur;
+}
+
+/* Match the operator tok at the current position, consuming it */
+cl_bool select_accept(struct select_expr *expr, const char *tok)
+{
+	const size_t len = strlen(tok);
+	select_skip_ws(expr);
+	if (strncmp(expr->cur, tok, len))
+		return CL_FALSE;
+	/* don't take the & of && or the | of ||, or the < of <= */
+	if (len == 1 && (tok[0] == '&' || tok[0] == '|') && expr->cur[1] == tok[0])
+		return CL_FALSE;
+	if (len == 1 && (tok[0] == '<' || tok[0] == '>' || tok[0] == '!') && expr->cur[1] == '=')
+		return CL_FALSE;
+	expr->cur += len;
+	return CL_TRUE;
+}
+
+/* Resolve an identifier: a device type constant, a numeric device property, or bandwidth */
+size_t select_ident(struct select_expr *expr, const char *start, size_t len)
+{
+	char *name;
+	size_t i, line;
+
+	ALLOC(name, len + 1, "select variable");
+	for (i = 0; i < len; ++i)
+		name[i] = (char)toupper((unsigned char)start[i]);
+	name[len] = '\0';
+
+	for (i = 1; i < devtype_count; ++i) {
+		if (!strcmp(name, device_type_raw_str[i])) {
+			const size_t n = select_add_node(expr, SEL_NUM, 0, 0);
+			expr->node[n].num = (double)devtype[i];
+			free(name);
+			return n;
+		}
+	}
+
+	for (i = 0; i < expr->num_vars; ++i)
+		if (!strcmp(expr->var[i].name, name))
+			break;
+	if (i == expr->num_vars) {
+		if (!strcmp(name, "BANDWIDTH")) {
+			line = SELECT_BANDWIDTH;
+		} else {
+			for (line = 0; line < ARRAY_SIZE(dinfo_traits); ++line)
+				if (dinfo_traits[line].param != CL_FALSE &&
+					!strcmp(dinfo_traits[line].sname, name) &&
+					select_is_numeric(dinfo_traits + line))
+					break;
+			if (line == ARRAY_SIZE(dinfo_traits)) {
+				free(name);
+				select_error(expr, "not a numeric device property");
+			}
+		}
+		REALLOC(expr->var, expr->num_vars + 1, "select variables");
+		expr->var[i].name = name;
+		expr->var[i].line = line;
+		++expr->num_vars;
+	} else {
+		free(name);
+	}
+
+	line = select_add_node(expr, SEL_VAR, 0, 0);
+	expr->node[line].var = i;
+	return line;
+}
+
+size_t select_parse_or(struct select_expr *expr);
+
+size_t select_parse_unary(struct select_expr *expr)
+{
+	size_t n;
+
+	select_skip_ws(expr);
+	if (select_accept(expr, "-"))
+		return select_add_node(expr, SEL_NEG, select_parse_unary(expr), 0);
+	if (select_accept(expr, "!"))
+		return select_add_node(expr, SEL_NOT, select_parse_unary(expr), 0);
+	if (select_accept(expr, "(")) {
+		n = select_parse_or(expr);
+		if (!select_accept(expr, ")"))
+			select_error(expr, "expected ')'");
+		return n;
+	}
+	if (isdigit((unsigned char)*expr->cur) || *expr->cur == '.') {
+		char *end;
+		const double num = strtod(expr->cur, &end);
+		if (end == expr->cur)
+			select_error(expr, "invalid number");
+		expr->cur = end;
+		n = select_add_node(expr, SEL_NUM, 0, 0);
+		expr->node[n].num = num;
+		return n;
+	}
+	if (isalpha((unsigned char)*expr->cur) || *expr->cur == '_') {
+		const char *start = expr->cur;
+		while (isalnum((unsigned char)*expr->cur) || *expr->cur == '_')
+			++expr->cur;
+		return select_ident(expr, start, expr->cur - start);
+	}
+	select_error(expr, *expr->cur ? "unexpected character" : "unexpected end");
+	return 0;
+}
+
+/* Binary operators, from the loosest to the tightest binding;
+ * unlike C, & binds tighter than the comparisons, so that
+ * CL_DEVICE_TYPE & CL_DEVICE_TYPE_GPU == CL_DEVICE_TYPE_GPU works as expected */
+static const struct select_binop {
+	const char *tok;
+	enum select_op op;
+	int level;
+} select_binops[] = {
+	{ "||", SEL_OR, 0 },
+	{ "&&", SEL_AND, 1 },
+	{ "==", SEL_EQ, 2 }, { "!=", SEL_NE, 2 },
+	{ "<=", SEL_LE, 3 }, { ">=", SEL_GE, 3 }, { "<", SEL_LT, 3 }, { ">", SEL_GT, 3 },
+	{ "&", SEL_BITAND, 4 },
+	{ "+", SEL_ADD, 5 }, { "-", SEL_SUB, 5 },
+	{ "*", SEL_MUL, 6 }, { "/", SEL_DIV, 6 },
+};
+#define SELECT_LEVELS 7
+
+size_t select_parse_level(struct select_expr *expr, int level)
+{
+	size_t lhs, i;
+
+	if (level == SELECT_LEVELS)
+		return select_parse_unary(expr);
+
+	lhs = select_parse_level(expr, level + 1);
+	for (;;) {
+		for (i = 0; i < ARRAY_SIZE(select_binops); ++i)
+			if (select_binops[i].level == level && select_accept(expr, select_binops[i].tok))
+				break;
+		if (i == ARRAY_SIZE(select_binops))
+			return lhs;
+		lhs = select_add_node(expr, select_binops[i].op, lhs, select_parse_level(expr, level + 1));
+	}
+}
+
+size_t select_parse_or(struct select_expr *expr)
+{
+	return select_parse_level(expr, 0);
+}
+
+/* Parse the expression, and select the properties it references,
+ * so that only those (and their dependencies) get queried */
+void parse_select(struct select_expr *expr, struct opt_out *output)
+{
+	size_t i;
+
+	memset(expr, 0, sizeof(*expr));
+	expr->text = output->select;
+	expr->cur = expr->text;
+	expr->root = select_parse_or(expr);
+	select_skip_ws(expr);
+	if (*expr->cur)
+		select_error(expr, "unexpected character");
+
+	for (i = 0; i < expr->num_vars; ++i) {
+		char *prop;
+		if (expr->var[i].line == SELECT_BANDWIDTH)
+			continue;
+		ALLOC(prop, strlen(expr->var[i].name) + 1, "selected property");
+		strcpy(prop, expr->var[i].name);
+		add_selected_prop(output, prop);
+	}
+}
+
+void free_select(struct select_expr *expr)
+{
+	size_t i;
+	for (i = 0; i < expr->num_vars; ++i)
+		free(expr->var[i].name);
+	free(expr->var);
+	free(expr->node);
+}
+
+/* Value of the node; invalid if any of the variables it uses is */
+double select_eval(const struct select_expr *expr, size_t n, cl_bool *valid)
+{
+	const struct select_node *node = expr->node + n;
+	double lhs, rhs = 0;
+
+	switch (node->op) {
+	case SEL_NUM:
+		return node->num;
+	case SEL_VAR:
+		if (!expr->var[node->var].valid)
+			*valid = CL_FALSE;
+		return expr->var[node->var].value;
+	case SEL_NEG:
+		return -select_eval(expr, node->lhs, valid);
+	case SEL_NOT:
+		return !select_eval(expr, node->lhs, valid);
+	default:
+		break;
+	}
+
+	lhs = select_eval(expr, node->lhs, valid);
+	rhs = select_eval(expr, node->rhs, valid);
+	switch (node->op) {
+	case SEL_MUL: return lhs*rhs;
+	case SEL_DIV:
+		if (rhs == 0)
+			*valid = CL_FALSE;
+		return rhs ? lhs/rhs : 0;
+	case SEL_ADD: return lhs + rhs;
+	case SEL_SUB: return lhs - rhs;
+	case SEL_BITAND: return (double)((cl_ulong)lhs & (cl_ulong)rhs);
+	case SEL_LT: return lhs < rhs;
+	case SEL_LE: return lhs <= rhs;
+	case SEL_GT: return lhs > rhs;
+	case SEL_GE: return lhs >= rhs;
+	case SEL_EQ: return lhs == rhs;
+	case SEL_NE: return lhs != rhs;
+	case SEL_AND: return lhs && rhs;
+	case SEL_OR: return lhs || rhs;
+	default: return 0;
+	}
+}
+
+/* Best global memory bandwidth of the device (in GB/s) over all vector widths, 0 on failure */
+double select_bandwidth(const struct platform_list *plist, cl_uint p, cl_device_id dev)
+{
+	struct bench_env env;
+	struct bench_bandwidth res;
+	const char *src[ARRAY_SIZE(sources)];
+	double best = 0;
+	cl_uint w;
+
+	memcpy(src, sources, sizeof(sources));
+	src[ARRAY_SIZE(src) - 1] = bench_all_widths;
+
+	if (!bench_env_init(&env, plist->platform[p], dev, bench_create_queue_func()) &&
+		!bench_bandwidth(&env, src, ARRAY_SIZE(src), &res)) {
+		for (w = 0; w < BENCH_BW_WIDTHS; ++w)
+			if (!res.err[w] && res.gbps[w] > best)
+				best = res.gbps[w];
+	}
+	bench_env_release(&env);
+	return best;
+}
+
+/* Score the selected devices and print the index of the best one, as p:d
+ * (after output->select_env and = if set); the devices for which some of the
+ * referenced values are not available are not considered.
+ * Returns the exit status: 0 if a device was chosen, 1 otherwise
+ */
+int selectDevice(struct platform_list *plist, cl_uint num_platforms,
+	struct select_expr *expr, const struct opt_out *output)
+{
+	struct device_info_checks chk;
+	struct device_info_ret ret;
+	struct metric_rec rec;
+	cl_bool found = CL_FALSE;
+	double best = 0;
+	cl_uint p, d, best_p = 0, best_d = 0;
+	size_t i;
+
+	gatherPlatformsQuietly(plist, num_platforms, output);
+
+	INIT_RET(ret, "select");
+	for (p = 0; p < num_platforms; ++p) {
+		if (!is_selected_platform(output, p))
+			continue;
+		for (d = 0; d < plist->pdata[p].ndevs; ++d) {
+			const cl_device_id dev = get_platform_dev(plist, p, d);
+			cl_bool valid = CL_TRUE;
+			double score;
+
+			if (!is_selected_device(output, p, d))
+				continue;
+			arena_reset(&scratch);
+			gatherDeviceChecks(dev, plist, p, &chk, output);
+
+			for (i = 0; i < expr->num_vars; ++i) {
+				struct select_var *var = expr->var + i;
+				const struct device_info_traits *t;
+
+				var->valid = CL_FALSE;
+				var->value = 0;
+				if (var->line == SELECT_BANDWIDTH) {
+					var->value = select_bandwidth(plist, p, dev);
+					var->valid = var->value > 0;
+					continue;
+				}
+				/* the first of the traits with the name that applies to the device */
+				for (t = dinfo_traits + var->line; t < dinfo_traits + ARRAY_SIZE(dinfo_traits); ++t)
+					if (!strcmp(t->sname, var->name) && select_is_numeric(t) &&
+						(!t->check_func || t->check_func(&chk)))
+						break;
+				if (t == dinfo_traits + ARRAY_SIZE(dinfo_traits))
+					continue;
+
+				memset(&rec, 0, sizeof(rec));
+				rec.p = p;
+				rec.d = d;
+				rec.dev = dev;
+				rec.chk = &chk;
+				rec.traits = t;
+				rec.num_values = metrics_num_values(t) == 2 ? 2 : 1;
+				metrics_query(&rec, plist, &ret, output);
+				if (!rec.err) {
+					/* for the free memory, the total */
+					var->value = (double)rec.value[0];
+					var->valid = CL_TRUE;
+				}
+			}
+
+			score = select_eval(expr, expr->root, &valid);
+			if (valid && (!found || score > best)) {
+				found = CL_TRUE;
+				best = score;
+				best_p = p;
+				best_d = d;
+			}
+		}
+	}
+	UNINIT_RET(ret);
+
+	if (!found) {
+		fprintf(stderr, "no device could be scored by '%s'\n", expr->text);
+		return 1;
+	}
+	if (output->select_env)
+		out_printf("%s=", output->select_env);
+	out_printf("%" PRIu32 ":%" PRIu32 "\n", best_p, best_d);
+	return 0;
+}
+
+#ifndef CLINFO_LIBRARY
 int main(int argc, char *argv[])
 {
 	cl_uint p;
 	cl_int err;
 	int a = 0;
+	int status = 0;
+	cl_ulong phase_start;
+	cl_bool use_cache = CL_FALSE, no_cache = CL_FALSE;
 
 	struct opt_out output;
+	struct diff_baseline baseline;
+	struct select_expr select_expr;
 
 	struct platform_list plist;
 	init_plist(&plist);
 
-	output.num_selected_devices = 0;
-	output.num_selected_props = 0;
-	output.mode = CLINFO_HUMAN;
-	output.cond = COND_PROP_CHECK;
-	output.brief = CL_FALSE;
-	output.offline = CL_FALSE;
-	output.null_platform = CL_FALSE;
-	output.json = CL_FALSE;
-	output.check_size = CL_FALSE;
+	init_output(&output);
 
 	/* if there's a 'raw' in the program name, switch to raw output mode */
 	if (strstr(argv[0], "raw"))
@@ -4646,6 +9140,68 @@ int main(int argc, char *argv[])
 			output.null_platform = CL_TRUE;
 		else if (!strcmp(argv[a], "--json"))
 			output.json = CL_TRUE;
+		else if (!strcmp(argv[a], "--cbor"))
+			output.cbor = CL_TRUE;
+		else if (!strcmp(argv[a], "--bench")) {
+			++a;
+			parse_bench(argv[a], &output);
+		}
+		else if (!strcmp(argv[a], "--sub-devices"))
+			output.sub_devices = CL_TRUE;
+		else if (!strcmp(argv[a], "--timeout")) {
+			++a;
+			parse_timeout(argv[a], &output);
+		}
+		else if (!strcmp(argv[a], "--has-ext")) {
+			++a;
+			parse_has_ext(argv[a], &output);
+		}
+		else if (!strcmp(argv[a], "--metrics")) {
+			++a;
+			if (!argv[a]) {
+				fprintf(stderr, "please specify the file to export the metrics to, or - for the standard output\n");
+				exit(1);
+			}
+			output.metrics = argv[a];
+		}
+		else if (!strcmp(argv[a], "--diff")) {
+			++a;
+			if (!argv[a]) {
+				fprintf(stderr, "please specify the baseline to compare with\n");
+				exit(2);
+			}
+			output.diff = argv[a];
+		}
+		else if (!strcmp(argv[a], "--select")) {
+			++a;
+			if (!argv[a]) {
+				fprintf(stderr, "please specify the expression to score the devices by\n");
+				exit(1);
+			}
+			output.select = argv[a];
+		}
+		else if (!strcmp(argv[a], "--select-env")) {
+			++a;
+			if (!argv[a]) {
+				fprintf(stderr, "please specify the name of the environment variable\n");
+				exit(1);
+			}
+			output.select_env = argv[a];
+		}
+		else if (!strcmp(argv[a], "--watch")) {
+			++a;
+			parse_watch(argv[a], &output);
+		}
+		else if (!strcmp(argv[a], "--timings"))
+			output.timings = CL_TRUE;
+		else if (!strcmp(argv[a], "--flush"))
+			output.flush = CL_TRUE;
+		else if (!strcmp(argv[a], "--snapshot"))
+			output.snapshot = CL_TRUE;
+		else if (!strcmp(argv[a], "--cache"))
+			use_cache = CL_TRUE;
+		else if (!strcmp(argv[a], "--no-cache"))
+			no_cache = CL_TRUE;
 		else if (!strcmp(argv[a], "-l") || !strcmp(argv[a], "--list"))
 			output.brief = CL_TRUE;
 		else if (!strcmp(argv[a], "-d") || !strcmp(argv[a], "--device")) {
@@ -4653,6 +9209,11 @@ int main(int argc, char *argv[])
 			parse_device_spec(argv[a], &output);
 		} else if (!strncmp(argv[a], "-d", 2)) {
 			parse_device_spec(argv[a] + 2, &output);
+		} else if (!strcmp(argv[a], "-j") || !strcmp(argv[a], "--jobs")) {
+			++a;
+			parse_jobs(argv[a], &output);
+		} else if (!strncmp(argv[a], "-j", 2)) {
+			parse_jobs(argv[a] + 2, &output);
 		} else if (!strcmp(argv[a], "--prop")) {
 			++a;
 			parse_prop(argv[a], &output);
@@ -4668,37 +9229,148 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "ignoring unknown command-line parameter %s\n", argv[a]);
 		}
 	}
+	/* The on-disk cache is only used when requested (--snapshot needs it),
+	 * or when CLINFO_CACHE_DIR points to it */
+	if (no_cache) {
+		free(output.cache_dir);
+		output.cache_dir = NULL;
+	} else if (!output.cache_dir && (use_cache || output.snapshot)) {
+		output.cache_dir = cache_dir_default(CL_TRUE);
+	}
+	/* The diff is computed over the whole JSON output */
+	if (output.diff) {
+		if (output.num_selected_devices || output.num_selected_props || output.brief ||
+			output.cbor || output.has_ext || output.metrics || output.watch_interval || output.select) {
+			fprintf(stderr, "--diff compares the whole output, and cannot be combined with "
+				"-d, --prop, --list, --cbor, --has-ext, --metrics, --select or --watch\n");
+			exit(2);
+		}
+		output.json = CL_TRUE;
+		output.flush = CL_FALSE;
+	}
+
 	/* If a property was specified, we only print in RAW mode.
 	 * Likewise, JSON format assumes RAW
 	 */
+	if (output.select_env && !output.select) {
+		fprintf(stderr, "--select-env needs --select\n");
+		exit(1);
+	}
+	if (output.select)
+		parse_select(&select_expr, &output);
+
 	if (output.num_selected_props || output.json)
 		output.mode = CLINFO_RAW;
-	output.detailed = !output.brief && !output.num_selected_devices && !output.num_selected_props;
+	output.detailed = !output.brief && !output.num_selected_devices && !output.num_selected_props &&
+		!output.watch_interval && !output.has_ext && !output.metrics && !output.select;
+	planDeviceInfo(&output);
+	resolveDeviceSelection(&output);
+
+	/* load the baseline before querying anything, to bail out early if it's unusable */
+	if (output.diff)
+		diff_load(&baseline, output.diff);
+
+	/* collect all the output, and write it out at the end (or in large chunks) */
+	init_strbuf(&out_doc, "output");
+	out_buf = &out_doc;
+	out_held = !!output.diff;
+	atexit(out_flush);
+
+	if (output.timings)
+		timings_init();
+
+	if (output.cbor) {
+		showCBOR(&output);
+		out_flush();
+		out_buf = NULL;
+		free_strbuf(&out_doc);
+		free_output(&output);
+		return 0;
+	}
 
+	phase_start = timing_start(&output);
 	err = clGetPlatformIDs(0, NULL, &plist.num_platforms);
 	if (err != CL_PLATFORM_NOT_FOUND_KHR)
 		CHECK_ERROR(err, "number of platforms");
 
 	if (output.detailed && !output.json)
-		printf(I0_STR "%" PRIu32 "\n",
+		out_printf(I0_STR "%" PRIu32 "\n",
 			(output.mode == CLINFO_HUMAN ?
 			 "Number of platforms" : "#PLATFORMS"),
 			plist.num_platforms);
 
 	cl_uint alloced_platforms = 0;
+	struct platform_job *platform_job = NULL;
 	if (plist.num_platforms) {
 		alloced_platforms = alloc_plist(&plist, &output);
 		err = clGetPlatformIDs(plist.num_platforms, plist.platform, NULL);
 		CHECK_ERROR(err, "platform IDs");
 	}
+	timing_stop(&output, TIMING_PHASE, "clGetPlatformIDs", phase_start);
 
 	ALLOC(line_pfx, 1, "line prefix");
+	mutex_init(&wg_probe_lock);
+	cond_init(&wg_probe_built);
+
+	if (output.metrics) {
+		exportMetrics(&plist, alloced_platforms, &output); /* only returns without a watch interval */
+		arena_free(&scratch);
+		release_wg_probes();
+		cond_destroy(&wg_probe_built);
+		mutex_destroy(&wg_probe_lock);
+		free_plist(&plist);
+		free(line_pfx);
+		line_pfx = NULL;
+		out_buf = NULL;
+		free_strbuf(&out_doc);
+		free_output(&output);
+		return 0;
+	}
+
+	if (output.select) {
+		status = selectDevice(&plist, alloced_platforms, &select_expr, &output);
+		free_select(&select_expr);
+		arena_free(&scratch);
+		/* as on the other exit paths, in case the queries built any probe */
+		release_wg_probes();
+		cond_destroy(&wg_probe_built);
+		mutex_destroy(&wg_probe_lock);
+		free_plist(&plist);
+		free(line_pfx);
+		line_pfx = NULL;
+		out_flush();
+		out_buf = NULL;
+		free_strbuf(&out_doc);
+		free_output(&output);
+		return status;
+	}
+
+	if (output.watch_interval > 0)
+		watchDevices(&plist, alloced_platforms, &output); /* does not return */
+
+	if (output.has_ext) {
+		status = checkDeviceExtensions(&plist, &output);
+		arena_free(&scratch);
+		cond_destroy(&wg_probe_built);
+		mutex_destroy(&wg_probe_lock);
+		free_plist(&plist);
+		free(line_pfx);
+		line_pfx = NULL;
+		out_buf = NULL;
+		free_strbuf(&out_doc);
+		free_output(&output);
+		return status;
+	}
 
 	/* Open the JSON object and the JSON platforms list */
 	if (output.json)
-		fputs("{ \"platforms\" : [", stdout);
+		out_str("{ \"platforms\" : [");
+
+	if ((output.jobs > 1 && alloced_platforms > 1) || (output.timeout_ms && alloced_platforms > 0))
+		platform_job = gatherPlatformsConcurrently(&plist, alloced_platforms, &output);
 
 	for (p = 0; p < alloced_platforms; ++p) {
+		cl_device_id *devs = NULL;
 		// skip non-selected platforms altogether
 		if (!(is_selected_platform(&output, p))) {
 			/* Update the dev_offset, otherwise the wrong devices will be picked
@@ -4713,43 +9385,112 @@ int main(int argc, char *argv[])
 
 		/* Open a JSON object for this platform */
 		if (output.json)
-			printf("%s%s", (p > 0 ? comma_str : spc_str),
+			out_printf("%s%s", (p > 0 ? comma_str : spc_str),
 				(output.brief ? "" : "{"));
 
-		gatherPlatformInfo(&plist, p, &output);
+		if (platform_job && platform_job[p].timed_out) {
+			/* report the platform as having no devices, named by the error */
+			struct _strbuf str;
+			init_strbuf(&str, "platform timeout");
+			report_timeout(&str, "gatherPlatformInfo", &output);
+			if (output.json)
+				out_printf(output.brief ? "\"%s\"" : " \"error\" : \"%s\"", str.buf);
+			else if (output.detailed)
+				out_printf("%s" I1_STR "%s\n", line_pfx,
+					(output.mode == CLINFO_HUMAN ? "Platform Name" : "CL_PLATFORM_NAME"), str.buf);
+			ALLOC(plist.pdata[p].pname, str.end + 1, "platform name copy");
+			memcpy(plist.pdata[p].pname, str.buf, str.end + 1);
+			ALLOC(plist.pdata[p].sname, SNAME_MAX+1, "platform symbolic name");
+			snprintf(plist.pdata[p].sname, SNAME_MAX, "P%" PRIu32 "", p);
+			plist.pdata[p].ndevs = 0;
+			plist.platform_checks[p].plat_version = 10;
+			free_strbuf(&str);
+		} else if (platform_job) {
+			out_str(platform_job[p].out.buf);
+			free_strbuf(&platform_job[p].out);
+			devs = platform_job[p].devs;
+			plist.pdata[p] = platform_job[p].pdata;
+			plist.platform_checks[p] = platform_job[p].pinfo_checks;
+		} else {
+			gatherPlatformInfo(&plist, p, &devs, &output);
+		}
+		mergePlatformInfo(&plist, p, devs);
 
 		/* Close JSON object for this platform */
 		if (output.json && !output.brief)
-			fputs(" }", stdout);
+			out_str(" }");
 		else if (output.detailed)
-			puts("");
+			out_char('\n');
+		out_checkpoint();
 	}
 
+	/* the data of the platforms that timed out is still in use */
+	if (!abandoned_jobs)
+		free(platform_job);
+
 	/* Close JSON platforms list, open JSON devices list */
 	if (alloced_platforms) {
 		if (output.json)
-			fputs(" ], \"devices\" : [", stdout);
+			out_str(" ], \"devices\" : [");
 
 		showDevices(&plist, &output);
 	}
 
 	/* Close JSON devices list */
 	if (output.json)
-		fputs(" ]", stdout);
+		out_str(" ]");
+
+	if (output.benchmarks && alloced_platforms) {
+		out_checkpoint();
+		runBenchmarks(&plist, &output);
+	}
 
 	if (output.num_selected_props || (output.detailed && !output.num_selected_devices)) {
+		out_checkpoint();
 		if (output.mode != CLINFO_RAW && plist.num_platforms)
 			checkNullBehavior(&plist, &output);
+		phase_start = timing_start(&output);
 		oclIcdProps(&plist, &output);
+		timing_stop(&output, TIMING_PHASE, "oclIcdProps", phase_start);
 	}
 
+	if (output.timings && output.json)
+		showTimings(&output);
+
 	/* Close the JSON object */
 	if (output.json)
-		fputs(" }", stdout);
+		out_str(" }");
+
+	/* replace the output with the differences from the baseline */
+	if (output.diff) {
+		status = diff_report(&baseline);
+		diff_free(&baseline);
+		out_held = CL_FALSE;
+	}
+
+	out_flush();
+	out_buf = NULL;
+	free_strbuf(&out_doc);
+
+	/* abandoned jobs may still be using the shared data, so leave it to the OS */
+	if (abandoned_jobs) {
+		fflush(stdout);
+		return status;
+	}
 
+	if (output.timings) {
+		if (!output.json)
+			showTimings(&output);
+		timings_free();
+	}
 
+	release_wg_probes();
+	cond_destroy(&wg_probe_built);
+	mutex_destroy(&wg_probe_lock);
+	arena_free(&scratch);
 	free_plist(&plist);
 	free(line_pfx);
 	free_output(&output);
-	return 0;
+	return status;
 }
+#endif
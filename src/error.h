@@ -38,13 +38,13 @@ cl_int
 report_ocl_error_loc(struct _strbuf *str, cl_int err, const char *fmt,
 	const struct info_loc *loc)
 {
-	static char full_fmt[1024];
+	char full_fmt[1024];
 	if (err != CL_SUCCESS) {
 		snprintf(full_fmt, 1024, "<%s:%" PRIuS ": %s : error %d>",
 			loc->function, loc->line, fmt, err);
 		snprintf(str->buf, str->sz, full_fmt, loc->sname);
 	}
-	return err != CL_SUCCESS;
+	return err;
 }
 
 void
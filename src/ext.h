@@ -33,6 +33,8 @@
 #include <OpenCL/opencl.h>
 #else
 #define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+/* clCreateCommandQueue is used by the benchmarks, since it works everywhere */
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <CL/cl.h>
 #endif
 
@@ -128,6 +130,11 @@
 typedef cl_bitfield         cl_device_svm_capabilities;
 #endif
 
+/* SVM allocation flags, only needed by the benchmarks */
+#ifndef CL_MEM_SVM_FINE_GRAIN_BUFFER
+#define CL_MEM_SVM_FINE_GRAIN_BUFFER                (1 << 10)
+#endif
+
 #ifndef CL_VERSION_2_1
 #define CL_PLATFORM_HOST_TIMER_RESOLUTION		0x0905
 #define CL_DEVICE_IL_VERSION				0x105B
@@ -387,6 +394,8 @@ typedef cl_ulong  cl_device_partition_property_ext;
 #define CL_DEVICE_CROSS_DEVICE_SHARED_MEM_CAPABILITIES_INTEL	0x4193
 #define CL_DEVICE_SHARED_SYSTEM_MEM_CAPABILITIES_INTEL		0x4194
 
+#define CL_UNIFIED_SHARED_MEMORY_ACCESS_INTEL			(1 << 0)
+
 /* cl_qcom_ext_host_ptr */
 #define CL_DEVICE_EXT_MEM_PADDING_IN_BYTES_QCOM		0x40A0
 #define CL_DEVICE_PAGE_SIZE_QCOM			0x40A1
@@ -435,6 +444,12 @@ typedef struct _cl_queue_family_properties_intel {
     char name[CL_QUEUE_FAMILY_MAX_NAME_SIZE_INTEL];
 } cl_queue_family_properties_intel;
 
+#define CL_QUEUE_FAMILY_INTEL				0x418C
+#define CL_QUEUE_INDEX_INTEL				0x418D
+
+#define CL_QUEUE_DEFAULT_CAPABILITIES_INTEL		0
+#define CL_QUEUE_CAPABILITY_KERNEL_INTEL		(1 << 26)
+
 /* cl_arm_job_slot_selection */
 #define CL_DEVICE_JOB_SLOTS_ARM				0x41E0
 
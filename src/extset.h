@@ -0,0 +1,112 @@
+/* Set of the extensions supported by a platform or device: the space-separated
+ * extensions string is tokenized once into a hash table, so that checking
+ * for an extension doesn't need a scan of the whole string, and only matches
+ * whole extension names
+ */
+
+#ifndef EXTSET_H
+#define EXTSET_H
+
+#include <ctype.h>
+#include <string.h>
+
+#include "ext.h"
+#include "memory.h"
+#include "arena.h"
+
+struct ext_set_entry {
+	const char *name; /* into the extensions string, not NUL-terminated */
+	size_t len;
+};
+
+struct ext_set {
+	struct ext_set_entry *entry; /* open addressing, with linear probing */
+	size_t mask; /* number of slots minus one, the number of slots being a power of two */
+	size_t num;
+	struct arena *arena; /* owner of the table, NULL for the heap */
+};
+
+/* FNV-1a */
+static inline size_t ext_hash(const char *name, size_t len)
+{
+	size_t hash = 2166136261U;
+	while (len--) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* Find the slot where the extension name (of length len) is or would be */
+static inline struct ext_set_entry *ext_set_slot(const struct ext_set *set, const char *name, size_t len)
+{
+	size_t i = ext_hash(name, len) & set->mask;
+	while (set->entry[i].name &&
+		!(set->entry[i].len == len && !memcmp(set->entry[i].name, name, len)))
+		i = (i + 1) & set->mask;
+	return set->entry + i;
+}
+
+/* Build the set for the given extensions string, which must outlive the set;
+ * the table is allocated from arena, or on the heap if arena is NULL */
+static inline void ext_set_init(struct ext_set *set, const char *extensions, struct arena *arena)
+{
+	const char *cur = extensions;
+	size_t words = 0, slots = 16;
+
+	/* count the words to size the table, keeping it at most half full */
+	while (*cur) {
+		while (isspace((unsigned char)*cur)) ++cur;
+		if (!*cur) break;
+		++words;
+		while (*cur && !isspace((unsigned char)*cur)) ++cur;
+	}
+	while (slots < 2*words)
+		slots *= 2;
+
+	set->mask = slots - 1;
+	set->num = 0;
+	set->arena = arena;
+	if (arena)
+		ARENA_ALLOC(arena, set->entry, slots, "extension set");
+	else
+		ALLOC(set->entry, slots, "extension set");
+
+	cur = extensions;
+	while (*cur) {
+		const char *start;
+		struct ext_set_entry *slot;
+
+		while (isspace((unsigned char)*cur)) ++cur;
+		if (!*cur) break;
+		start = cur;
+		while (*cur && !isspace((unsigned char)*cur)) ++cur;
+
+		slot = ext_set_slot(set, start, cur - start);
+		if (!slot->name) {
+			slot->name = start;
+			slot->len = cur - start;
+			++set->num;
+		}
+	}
+}
+
+static inline void ext_set_free(struct ext_set *set)
+{
+	if (!set->arena)
+		free(set->entry);
+	set->entry = NULL;
+	set->num = 0;
+}
+
+static inline cl_bool ext_set_has_len(const struct ext_set *set, const char *name, size_t len)
+{
+	return !!ext_set_slot(set, name, len)->name;
+}
+
+static inline cl_bool ext_set_has(const struct ext_set *set, const char *name)
+{
+	return ext_set_has_len(set, name, strlen(name));
+}
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef INFO_LOC_H
 #define INFO_LOC_H
 
+#include <stdint.h>
+
 #include "ext.h"
+#include "threads.h"
 
 struct info_loc {
 	const char *function;
@@ -27,6 +30,21 @@ static inline void reset_loc(struct info_loc *loc, const char *func)
 	loc->param.plat = 0;
 }
 
+/* Buffer size hints for the properties whose size is not known in advance
+ * (strings and arrays): the size found for a property is used as the
+ * initial buffer size when fetching the same property for the next
+ * platform or device, so that the driver is usually only called once.
+ * Hints are looked up by (a hash of) the address of the symbolic name of the
+ * property, and collisions only affect performance.
+ */
+#define NUM_SIZE_HINTS 256
+THREAD_LOCAL size_t size_hints[NUM_SIZE_HINTS];
+
+static inline size_t *loc_size_hint(const struct info_loc *loc)
+{
+	return size_hints + ((uintptr_t)loc->sname >> 3) % NUM_SIZE_HINTS;
+}
+
 #define RESET_LOC_PARAM(_loc, _dev, _param) do { \
 	_loc.param._dev = _param; \
 	_loc.sname = #_param; \
@@ -81,6 +81,13 @@ struct icdl_info_ret
 	init_strbuf(&ret.err_str, msg " info error values"); \
 } while (0)
 
+/* As above, with the buffers in the scratch arena (see arena.h),
+ * for use while gathering the properties of a device */
+#define INIT_RET_SCRATCH(ret, msg) do { \
+	init_strbuf_arena(&ret.str, &scratch, msg " info string values"); \
+	init_strbuf_arena(&ret.err_str, &scratch, msg " info error values"); \
+} while (0)
+
 #define UNINIT_RET(ret) do { \
 	free_strbuf(&ret.str); \
 	free_strbuf(&ret.err_str); \
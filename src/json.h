@@ -0,0 +1,385 @@
+/* Minimal JSON parser, for the --diff baseline: the document is parsed
+ * into a tree of nodes allocated from an arena, which can be written back
+ * in a canonical (minified) form for comparison.
+ *
+ * Since clinfo itself only escapes \ and " in its JSON strings, raw control
+ * characters are accepted inside strings.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <string.h>
+
+#include "ext.h"
+#include "arena.h"
+#include "strbuf.h"
+
+/* nesting depth above which the document is rejected */
+#define JSON_MAX_DEPTH 64
+
+enum json_type {
+	JSON_NULL,
+	JSON_FALSE,
+	JSON_TRUE,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+struct json_node {
+	enum json_type type;
+	const char *key; /* member name, for the members of an object */
+	const char *str; /* contents of a string, or text of a number */
+	struct json_node *child; /* first element or member */
+	struct json_node *next; /* next sibling */
+};
+
+struct json_parser {
+	const char *cur, *end;
+	struct arena *arena;
+	const char *error; /* description of the first error, NULL if none */
+};
+
+static inline void json_skip_ws(struct json_parser *ps)
+{
+	while (ps->cur < ps->end &&
+		(*ps->cur == ' ' || *ps->cur == '\t' || *ps->cur == '\n' || *ps->cur == '\r'))
+		++ps->cur;
+}
+
+static inline cl_bool json_fail(struct json_parser *ps, const char *error)
+{
+	if (!ps->error)
+		ps->error = error;
+	return CL_FALSE;
+}
+
+static inline int json_hex(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/* read the four hex digits of a \u escape */
+static inline cl_bool json_read_u16(struct json_parser *ps, cl_uint *val)
+{
+	int i;
+	*val = 0;
+	if (ps->end - ps->cur < 4)
+		return json_fail(ps, "truncated \\u escape");
+	for (i = 0; i < 4; ++i) {
+		const int h = json_hex(*ps->cur++);
+		if (h < 0)
+			return json_fail(ps, "invalid \\u escape");
+		*val = *val << 4 | (cl_uint)h;
+	}
+	return CL_TRUE;
+}
+
+/* parse a string, cur being past the opening quote; the unescaped contents
+ * are never longer than the escaped ones, so they fit in a buffer of that size */
+static inline const char *json_parse_str(struct json_parser *ps)
+{
+	const char *close = ps->cur;
+	char *ret, *dst;
+
+	while (close < ps->end && *close != '"')
+		close += (*close == '\\' ? 2 : 1);
+	if (close >= ps->end) {
+		json_fail(ps, "unterminated string");
+		return NULL;
+	}
+
+	ARENA_ALLOC(ps->arena, ret, close - ps->cur + 1, "JSON string");
+	dst = ret;
+	while (ps->cur < close) {
+		char c = *ps->cur++;
+		cl_uint cp;
+		if (c != '\\') {
+			*dst++ = c;
+			continue;
+		}
+		c = *ps->cur++;
+		switch (c) {
+		case '"': case '\\': case '/': *dst++ = c; continue;
+		case 'b': *dst++ = '\b'; continue;
+		case 'f': *dst++ = '\f'; continue;
+		case 'n': *dst++ = '\n'; continue;
+		case 'r': *dst++ = '\r'; continue;
+		case 't': *dst++ = '\t'; continue;
+		case 'u': break;
+		default:
+			json_fail(ps, "invalid escape");
+			return NULL;
+		}
+		if (!json_read_u16(ps, &cp))
+			return NULL;
+		/* a surrogate pair is 12 bytes escaped, 4 in UTF-8 */
+		if (cp >= 0xd800 && cp < 0xdc00 && close - ps->cur >= 6 &&
+			ps->cur[0] == '\\' && ps->cur[1] == 'u') {
+			cl_uint lo;
+			ps->cur += 2;
+			if (!json_read_u16(ps, &lo))
+				return NULL;
+			if (lo < 0xdc00 || lo >= 0xe000) {
+				json_fail(ps, "invalid surrogate pair");
+				return NULL;
+			}
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+		}
+		/* UTF-8 encoding */
+		if (cp < 0x80) {
+			*dst++ = (char)cp;
+		} else if (cp < 0x800) {
+			*dst++ = (char)(0xc0 | cp >> 6);
+			*dst++ = (char)(0x80 | (cp & 0x3f));
+		} else if (cp < 0x10000) {
+			*dst++ = (char)(0xe0 | cp >> 12);
+			*dst++ = (char)(0x80 | (cp >> 6 & 0x3f));
+			*dst++ = (char)(0x80 | (cp & 0x3f));
+		} else {
+			*dst++ = (char)(0xf0 | cp >> 18);
+			*dst++ = (char)(0x80 | (cp >> 12 & 0x3f));
+			*dst++ = (char)(0x80 | (cp >> 6 & 0x3f));
+			*dst++ = (char)(0x80 | (cp & 0x3f));
+		}
+	}
+	*dst = '\0';
+	ps->cur = close + 1;
+	return ret;
+}
+
+/* parse a literal (true, false, null) */
+static inline cl_bool json_parse_lit(struct json_parser *ps, const char *lit)
+{
+	const size_t len = strlen(lit);
+	if ((size_t)(ps->end - ps->cur) < len || memcmp(ps->cur, lit, len))
+		return json_fail(ps, "invalid literal");
+	ps->cur += len;
+	return CL_TRUE;
+}
+
+/* parse a number, keeping its text */
+static inline const char *json_parse_num(struct json_parser *ps)
+{
+	const char *start = ps->cur;
+	char *ret;
+
+	if (ps->cur < ps->end && *ps->cur == '-')
+		++ps->cur;
+	while (ps->cur < ps->end && (
+		(*ps->cur >= '0' && *ps->cur <= '9') ||
+		*ps->cur == '.' || *ps->cur == 'e' || *ps->cur == 'E' ||
+		*ps->cur == '+' || *ps->cur == '-'))
+		++ps->cur;
+	if (ps->cur == start || (ps->cur == start + 1 && *start == '-')) {
+		json_fail(ps, "invalid value");
+		return NULL;
+	}
+
+	ARENA_ALLOC(ps->arena, ret, ps->cur - start + 1, "JSON number");
+	memcpy(ret, start, ps->cur - start);
+	ret[ps->cur - start] = '\0';
+	return ret;
+}
+
+static inline struct json_node *json_parse_value(struct json_parser *ps, int depth)
+{
+	struct json_node *node, **tail;
+	char close;
+
+	json_skip_ws(ps);
+	if (ps->cur >= ps->end) {
+		json_fail(ps, "unexpected end of document");
+		return NULL;
+	}
+	if (depth > JSON_MAX_DEPTH) {
+		json_fail(ps, "nesting too deep");
+		return NULL;
+	}
+
+	ARENA_ALLOC(ps->arena, node, 1, "JSON node");
+	memset(node, 0, sizeof(*node));
+
+	switch (*ps->cur) {
+	case '"':
+		++ps->cur;
+		node->type = JSON_STRING;
+		node->str = json_parse_str(ps);
+		return node->str ? node : NULL;
+	case 't':
+		node->type = JSON_TRUE;
+		return json_parse_lit(ps, "true") ? node : NULL;
+	case 'f':
+		node->type = JSON_FALSE;
+		return json_parse_lit(ps, "false") ? node : NULL;
+	case 'n':
+		node->type = JSON_NULL;
+		return json_parse_lit(ps, "null") ? node : NULL;
+	case '[':
+		node->type = JSON_ARRAY;
+		close = ']';
+		break;
+	case '{':
+		node->type = JSON_OBJECT;
+		close = '}';
+		break;
+	default:
+		node->type = JSON_NUMBER;
+		node->str = json_parse_num(ps);
+		return node->str ? node : NULL;
+	}
+
+	/* array or object */
+	++ps->cur;
+	tail = &node->child;
+	json_skip_ws(ps);
+	if (ps->cur < ps->end && *ps->cur == close) {
+		++ps->cur;
+		return node;
+	}
+	for (;;) {
+		const char *key = NULL;
+		struct json_node *elem;
+
+		if (node->type == JSON_OBJECT) {
+			json_skip_ws(ps);
+			if (ps->cur >= ps->end || *ps->cur != '"') {
+				json_fail(ps, "expected member name");
+				return NULL;
+			}
+			++ps->cur;
+			key = json_parse_str(ps);
+			if (!key)
+				return NULL;
+			json_skip_ws(ps);
+			if (ps->cur >= ps->end || *ps->cur != ':') {
+				json_fail(ps, "expected ':'");
+				return NULL;
+			}
+			++ps->cur;
+		}
+
+		elem = json_parse_value(ps, depth + 1);
+		if (!elem)
+			return NULL;
+		elem->key = key;
+		*tail = elem;
+		tail = &elem->next;
+
+		json_skip_ws(ps);
+		if (ps->cur < ps->end && *ps->cur == ',') {
+			++ps->cur;
+			continue;
+		}
+		if (ps->cur < ps->end && *ps->cur == close) {
+			++ps->cur;
+			return node;
+		}
+		json_fail(ps, node->type == JSON_OBJECT ? "expected ',' or '}'" : "expected ',' or ']'");
+		return NULL;
+	}
+}
+
+/* Parse the len bytes of text into a tree allocated from arena;
+ * on failure NULL is returned, and *error describes the problem */
+static inline struct json_node *json_parse(const char *text, size_t len,
+	struct arena *arena, const char **error)
+{
+	struct json_parser ps;
+	struct json_node *root;
+
+	ps.cur = text;
+	ps.end = text + len;
+	ps.arena = arena;
+	ps.error = NULL;
+
+	root = json_parse_value(&ps, 0);
+	if (root) {
+		json_skip_ws(&ps);
+		if (ps.cur < ps.end)
+			root = NULL, json_fail(&ps, "trailing data after the document");
+	}
+	*error = ps.error;
+	return root;
+}
+
+/* First element or member of an array or object, NULL if empty (or if node is neither) */
+static inline const struct json_node *json_children(const struct json_node *node)
+{
+	return node && (node->type == JSON_ARRAY || node->type == JSON_OBJECT) ? node->child : NULL;
+}
+
+/* Member of an object with the given name, NULL if missing (or if node is not an object) */
+static inline const struct json_node *json_get(const struct json_node *node, const char *key)
+{
+	const struct json_node *child;
+	if (!node || node->type != JSON_OBJECT)
+		return NULL;
+	for (child = node->child; child; child = child->next)
+		if (!strcmp(child->key, key))
+			return child;
+	return NULL;
+}
+
+static inline void json_write_str(struct _strbuf *str, const char *s)
+{
+	strbuf_append_str_len("JSON", str, "\"", 1);
+	for (;;) {
+		/* copy runs of characters that need no escaping in one go */
+		size_t run = 0;
+		while (s[run] && s[run] != '"' && s[run] != '\\' && (unsigned char)s[run] >= 0x20)
+			++run;
+		if (run)
+			strbuf_append_str_len("JSON", str, s, run);
+		s += run;
+		if (!*s)
+			break;
+		switch (*s) {
+		case '"': strbuf_append_str("JSON", str, "\\\""); break;
+		case '\\': strbuf_append_str("JSON", str, "\\\\"); break;
+		case '\n': strbuf_append_str("JSON", str, "\\n"); break;
+		case '\r': strbuf_append_str("JSON", str, "\\r"); break;
+		case '\t': strbuf_append_str("JSON", str, "\\t"); break;
+		default: strbuf_append("JSON", str, "\\u%04x", (unsigned char)*s); break;
+		}
+		++s;
+	}
+	strbuf_append_str_len("JSON", str, "\"", 1);
+}
+
+/* Append the canonical form of node to str: no whitespace, strings
+ * escaped the same way regardless of how they were escaped originally,
+ * so that equal values have equal canonical forms */
+static inline void json_write(struct _strbuf *str, const struct json_node *node)
+{
+	const struct json_node *child;
+
+	switch (node->type) {
+	case JSON_NULL: strbuf_append_str("JSON", str, "null"); return;
+	case JSON_FALSE: strbuf_append_str("JSON", str, "false"); return;
+	case JSON_TRUE: strbuf_append_str("JSON", str, "true"); return;
+	case JSON_NUMBER: strbuf_append_str("JSON", str, node->str); return;
+	case JSON_STRING: json_write_str(str, node->str); return;
+	case JSON_ARRAY:
+	case JSON_OBJECT:
+		strbuf_append_str_len("JSON", str, node->type == JSON_ARRAY ? "[" : "{", 1);
+		for (child = node->child; child; child = child->next) {
+			if (child != node->child)
+				strbuf_append_str_len("JSON", str, ",", 1);
+			if (child->key) {
+				json_write_str(str, child->key);
+				strbuf_append_str_len("JSON", str, ":", 1);
+			}
+			json_write(str, child);
+		}
+		strbuf_append_str_len("JSON", str, node->type == JSON_ARRAY ? "]" : "}", 1);
+		return;
+	}
+}
+
+#endif
@@ -0,0 +1,98 @@
+/* libclinfo: in-process access to the platform and device information
+ * gathered by clinfo, without spawning the program and parsing its output.
+ *
+ * A session enumerates the platforms and devices once, and keeps them
+ * alive until it is closed, so that repeated queries (e.g. polling
+ * the dynamic device properties such as the free memory or temperature)
+ * skip the ICD initialization entirely.
+ *
+ * The library is the clinfo gathering code itself, built from the same
+ * source as the program, and returns the values as they are gathered for
+ * the RAW output mode; the output modes of the program are not implemented
+ * on top of this API. Only the clinfo_* functions are exported.
+ *
+ * The library shares global state with the clinfo gathering code,
+ * so at most one session should be open at any time, and it should
+ * only be used by one thread at a time.
+ */
+
+#ifndef LIBCLINFO_H
+#define LIBCLINFO_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/* Symbols exported by the shared library, which is built with hidden visibility */
+#ifndef CLINFO_API
+# if defined CLINFO_LIBRARY && defined __GNUC__
+#  define CLINFO_API __attribute__((visibility("default")))
+# else
+#  define CLINFO_API
+# endif
+#endif
+
+/* Kind of value held by a struct clinfo_value */
+enum clinfo_value_type {
+	CLINFO_VALUE_STRING, /* only the string representation is meaningful */
+	CLINFO_VALUE_BOOL, /* value.b */
+	CLINFO_VALUE_UINT, /* value.u32 */
+	CLINFO_VALUE_ULONG, /* value.u64 */
+	CLINFO_VALUE_SIZE, /* value.s */
+	CLINFO_VALUE_BITFIELD /* value.bits */
+};
+
+/* A platform or device property */
+struct clinfo_value {
+	/* symbolic name of the property, e.g. "CL_DEVICE_NAME" */
+	const char *name;
+	/* CL_PLATFORM_* or CL_DEVICE_* */
+	cl_uint param;
+	/* error retrieving the property, CL_SUCCESS if none */
+	cl_int err;
+	enum clinfo_value_type type;
+	/* the actual value, when err is CL_SUCCESS and type is not CLINFO_VALUE_STRING */
+	union {
+		cl_bool b;
+		cl_uint u32;
+		cl_ulong u64;
+		size_t s;
+		cl_bitfield bits;
+	} value;
+	/* representation of the value as in clinfo --raw, or the description of the error */
+	const char *str;
+};
+
+struct clinfo_session;
+
+/* Enumerate the platforms and their devices; returns NULL on failure,
+ * and in that case, if err is not NULL, the OpenCL error is stored in *err */
+CLINFO_API struct clinfo_session *clinfo_open(cl_int *err);
+
+/* Release all the resources associated with the session */
+CLINFO_API void clinfo_close(struct clinfo_session *session);
+
+CLINFO_API cl_uint clinfo_num_platforms(const struct clinfo_session *session);
+CLINFO_API cl_platform_id clinfo_platform(const struct clinfo_session *session, cl_uint p);
+CLINFO_API cl_uint clinfo_num_devices(const struct clinfo_session *session, cl_uint p);
+CLINFO_API cl_device_id clinfo_device(const struct clinfo_session *session, cl_uint p, cl_uint d);
+
+/* Retrieve all the properties supported by platform p, or by device d of platform p;
+ * *values is set to an array owned by the session, whose contents remain valid
+ * until the next call to these functions or to clinfo_close. Returns the number of values,
+ * or 0 if p or d are out of range.
+ */
+CLINFO_API size_t clinfo_platform_props(struct clinfo_session *session, cl_uint p,
+	const struct clinfo_value **values);
+CLINFO_API size_t clinfo_device_props(struct clinfo_session *session, cl_uint p, cl_uint d,
+	const struct clinfo_value **values);
+
+/* Find the property with the given symbolic name among the values; returns NULL if missing */
+CLINFO_API const struct clinfo_value *clinfo_find(const struct clinfo_value *values, size_t num_values,
+	const char *name);
+
+#endif
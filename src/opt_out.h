@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "ext.h"
+#include "bitmap.h"
 
 enum output_modes {
 	CLINFO_HUMAN = 1, /* more human readable */
@@ -19,22 +20,53 @@ enum cond_prop_modes {
 	COND_PROP_SHOW = 2 /* try, print an error if invalid */
 };
 
+/* Devices specified by an identifier that is independent from the enumeration order */
+enum device_id_kind {
+	DEVICE_ID_PCI, /* PCI bus address, from any of the PCI topology properties */
+	DEVICE_ID_UUID /* CL_DEVICE_UUID_KHR */
+};
+
+struct device_id_spec {
+	enum device_id_kind kind;
+	cl_device_pci_bus_info_khr pci;
+	cl_uchar uuid[CL_UUID_SIZE_KHR];
+	const char *str; /* as given on the command line */
+	cl_bool matched;
+};
+
+/* How a device property should be handled when only specific properties
+ * were selected */
+enum prop_plan {
+	PROP_SKIP = 0, /* not selected, nothing depends on it */
+	PROP_DEPENDENCY = 1, /* not selected, but needed by the conditions of others */
+	PROP_SELECTED = 2 /* selected, to be shown */
+};
+
 /* Output options */
 struct opt_out {
 	enum output_modes mode;
 	enum cond_prop_modes cond;
 
-/* Specify that we should only print information about specific devices */
-/* TODO proper memory management */
-#define MAX_SELECTED_DEVICES 256
-	cl_uint2 selected_devices[MAX_SELECTED_DEVICES];
-	size_t num_selected_devices;
-
-/* Specify that we should only print information about a specific property */
-/* TODO proper memory management */
-#define MAX_SELECTED_PROPS 256
-	const char *selected_props[MAX_SELECTED_PROPS];
+/* Specify that we should only print information about specific devices:
+ * the device specifications are resolved into a bitmap of the selected devices
+ * of each platform, the ones by index as they are parsed, the ones by
+ * PCI address or UUID once the devices are known (see resolveDeviceSelection)
+ */
+	size_t num_selected_devices; /* number of device specifications */
+	struct bitmap *selected_devices; /* one for each of the first num_selection_platforms */
+	cl_uint num_selection_platforms;
+	struct device_id_spec *device_id_specs;
+	size_t num_device_id_specs;
+
+/* Specify that we should only print information about specific properties,
+ * given as (normalized) substrings of their names */
+	char **selected_props;
 	size_t num_selected_props;
+/* Execution plan for the device properties, resolved from the selected_props
+ * once at startup: one enum prop_plan entry per device info trait,
+ * or NULL if no property was selected
+ */
+	unsigned char *dev_prop_plan;
 
 /* Specify if we should only be listing the platform and devices;
  * can be done in both human and raw mode, and only the platform
@@ -50,30 +82,73 @@ struct opt_out {
 /* JSON output for RAW */
 	cl_bool json;
 
+/* Binary CBOR output, with typed values and interned property names */
+	cl_bool cbor;
+
 /* clGetDeviceInfo returns CL_INVALID_VALUE both for unknown properties
  * and when the destination variable is too small. Set the following to CL_TRUE
  * to check which one is the case
  */
 	cl_bool check_size;
+
+/* Number of devices whose properties can be gathered concurrently */
+	cl_uint jobs;
+
+/* Deadline for gathering the information of each platform and device (in ms), 0 for none */
+	cl_ulong timeout_ms;
+
+/* Benchmarks to run on the selected devices (bitmask of enum bench_kind) */
+	cl_uint benchmarks;
+
+/* Only check that the devices support all the extensions in this comma-separated list,
+ * reporting the result in the exit status; NULL for the normal output */
+	const char *has_ext;
+
+/* Export the numeric device properties in the OpenMetrics text format to this file
+ * ("-" for standard output), again every watch_interval seconds if set; NULL for the normal output */
+	const char *metrics;
+
+/* Compare the JSON output with this baseline (from a previous --json run),
+ * only reporting the differences, and whether there are any in the exit status;
+ * NULL for the normal output */
+	const char *diff;
+
+/* Only print the index (p:d) of the selected device with the highest score
+ * according to this expression, after select_env and = if set; NULL for the normal output */
+	const char *select;
+	const char *select_env;
+
+/* Partition the devices with clCreateSubDevices, and show the resulting sub-devices */
+	cl_bool sub_devices;
+
+/* Poll the dynamic device properties every watch_interval seconds, 0 to disable */
+	double watch_interval;
+
+/* Record and report the time spent on each property and phase */
+	cl_bool timings;
+
+/* Write out the output after each device, rather than collecting it
+ * and writing it out in large chunks */
+	cl_bool flush;
+
+/* Directory for the on-disk cache, NULL if disabled */
+	char *cache_dir;
+
+/* Answer the static device properties from the snapshot of a previous run
+ * stored in the on-disk cache, if the device and driver did not change */
+	cl_bool snapshot;
 };
 
 static inline cl_bool is_selected_platform(const struct opt_out *output, cl_uint p) {
 	if (output->num_selected_devices == 0) return CL_TRUE;
 
-	for (cl_uint i = 0; i < output->num_selected_devices; ++i) {
-		if (p == output->selected_devices[i].s[0]) return CL_TRUE;
-	}
-	return CL_FALSE;
+	return p < output->num_selection_platforms && output->selected_devices[p].count > 0;
 }
 
 static inline cl_bool is_selected_device(const struct opt_out *output, cl_uint p, cl_uint d) {
 	if (output->num_selected_devices == 0) return CL_TRUE;
 
-	for (cl_uint i = 0; i < output->num_selected_devices; ++i) {
-		const cl_uint2 cmp = output->selected_devices[i];
-		if (p == cmp.s[0] && d == cmp.s[1]) return CL_TRUE;
-	}
-	return CL_FALSE;
+	return p < output->num_selection_platforms && bitmap_test(output->selected_devices + p, d);
 }
 
 static inline cl_bool is_selected_prop(const struct opt_out *output, const char *prop) {
@@ -1,5 +1,6 @@
 /* multi-purpose string _strbuf, will be initialized to be
- * at least 1024 bytes long.
+ * at least 1024 bytes long, and grows geometrically. The storage
+ * is either on the heap, or in an arena (see init_strbuf_arena).
  */
 
 #ifndef STRBUF_H
@@ -11,19 +12,28 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include "memory.h"
+#include "arena.h"
 #include "fmtmacros.h"
+#include "threads.h"
 
 struct _strbuf
 {
 	char *buf;
 	size_t sz; /* allocated size */
 	size_t end; /* offset to terminating null byte */
+	struct arena *arena; /* owner of the storage, NULL for the heap */
 };
 
 static inline void realloc_strbuf(struct _strbuf *str, size_t nusz, const char* what)
 {
 	if (nusz > str->sz) {
-		REALLOC(str->buf, nusz, what);
+		/* at least double the size, since most buffers are built piecewise */
+		if (nusz < 2*str->sz)
+			nusz = 2*str->sz;
+		if (str->arena)
+			str->buf = arena_realloc(str->arena, str->buf, str->sz, nusz, what);
+		else
+			REALLOC(str->buf, nusz, what);
 		str->sz = nusz;
 	}
 }
@@ -34,18 +44,27 @@ static inline void reset_strbuf(struct _strbuf *str)
 	if (str->buf) str->buf[0] = '\0';
 }
 
-static inline void init_strbuf(struct _strbuf *str, const char *what)
+static inline void init_strbuf_arena(struct _strbuf *str, struct arena *arena, const char *what)
 {
 	str->sz = 0;
 	str->buf = NULL;
+	str->arena = arena;
 	realloc_strbuf(str, 1024, what);
 	reset_strbuf(str);
 }
 
+static inline void init_strbuf(struct _strbuf *str, const char *what)
+{
+	init_strbuf_arena(str, NULL, what);
+}
+
+/* the storage of arena-backed buffers is only released with the arena */
 static inline void free_strbuf(struct _strbuf *str)
 {
-	free(str->buf);
+	if (!str->arena)
+		free(str->buf);
 	str->buf = NULL;
+	str->sz = 0;
 	reset_strbuf(str);
 }
 
@@ -95,29 +114,46 @@ static inline void strbuf_append_str(const char *what, struct _strbuf *str, cons
 	strbuf_append_str_len(what, str, to_append, strlen(to_append));
 }
 
+/* Fetch a string property. The current buffer is tried first, and the size
+ * of the property is only queried if it turns out to be too small (which
+ * also covers the error case).
+ * NOTE: if the driver reports a size larger than the buffer, the
+ * string was truncated even if the call was successful
+ */
 #define GET_STRING(str, err, cmd, param, param_str, ...) do { \
-	size_t nusz; \
-	err = cmd(__VA_ARGS__, param, 0, NULL, &nusz); \
-	if (REPORT_ERROR(str, err, "get " param_str " size")) break; \
-	realloc_strbuf(str, nusz, #param); \
-	err = cmd(__VA_ARGS__, param, (str)->sz, (str)->buf, NULL); \
-	if (REPORT_ERROR(str, err, "get " param_str)) break; \
+	size_t nusz = 0; \
+	err = cmd(__VA_ARGS__, param, (str)->sz, (str)->buf, &nusz); \
+	if (err != CL_SUCCESS || nusz > (str)->sz) { \
+		err = cmd(__VA_ARGS__, param, 0, NULL, &nusz); \
+		if (REPORT_ERROR(str, err, "get " param_str " size")) break; \
+		realloc_strbuf(str, nusz, #param); \
+		err = cmd(__VA_ARGS__, param, (str)->sz, (str)->buf, NULL); \
+		if (REPORT_ERROR(str, err, "get " param_str)) break; \
+	} \
 	(str)->end = nusz; \
 } while (0)
 
+/* As above, for a property described by an info_loc, growing the buffer
+ * beforehand to the size hint for the property */
 #define GET_STRING_LOC(ret, loc, cmd, ...) do { \
-	size_t nusz; \
-	ret->err = REPORT_ERROR_LOC(ret, \
-		cmd(__VA_ARGS__, 0, NULL, &nusz), \
-		loc, "get %s size"); \
-	if (!ret->err) { \
-		realloc_strbuf(&ret->str, nusz, loc->sname); \
+	size_t *hint = loc_size_hint(loc); \
+	size_t nusz = 0; \
+	realloc_strbuf(&ret->str, *hint, loc->sname); \
+	ret->err = cmd(__VA_ARGS__, ret->str.sz, ret->str.buf, &nusz); \
+	if (ret->err != CL_SUCCESS || nusz > ret->str.sz) { \
 		ret->err = REPORT_ERROR_LOC(ret, \
-			cmd(__VA_ARGS__, ret->str.sz, ret->str.buf, NULL), \
-			loc, "get %s"); \
+			cmd(__VA_ARGS__, 0, NULL, &nusz), \
+			loc, "get %s size"); \
+		if (!ret->err) { \
+			realloc_strbuf(&ret->str, nusz, loc->sname); \
+			ret->err = REPORT_ERROR_LOC(ret, \
+				cmd(__VA_ARGS__, ret->str.sz, ret->str.buf, NULL), \
+				loc, "get %s"); \
+		} \
 	} \
 	if (!ret->err) { \
 		ret->str.end = nusz; \
+		*hint = nusz; \
 	} \
 } while (0)
 
@@ -132,11 +168,12 @@ static inline const char* skip_leading_ws(const char *str)
 /* Separators: we want to be able to prepend separators as needed to _strbuf,
  * which we do only if halfway through the buffer. The callers should first
  * call a 'set_separator' and then use add_separator(&offset) to add it, where szval
- * is an offset inside the buffer, which will be incremented as needed
+ * is an offset inside the buffer, which will be incremented as needed.
+ * The separator is per-thread, since devices may be processed concurrently.
  */
 
-const char *sep;
-size_t sepsz;
+THREAD_LOCAL const char *sep;
+THREAD_LOCAL size_t sepsz;
 
 void set_separator(const char* _sep)
 {
@@ -0,0 +1,304 @@
+/* Minimal portable threading support: a thread-local storage qualifier
+ * and a simple pool that runs a batch of independent jobs concurrently,
+ * optionally giving up on the jobs that do not complete by a deadline
+ */
+
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+
+#ifdef _MSC_VER
+# include <windows.h>
+# define THREAD_LOCAL __declspec(thread)
+typedef HANDLE thread_handle;
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+# define THREAD_FUNC DWORD WINAPI
+# define THREAD_RETURN 0
+# define mutex_init(m) InitializeCriticalSection(m)
+# define mutex_destroy(m) DeleteCriticalSection(m)
+# define mutex_lock(m) EnterCriticalSection(m)
+# define mutex_unlock(m) LeaveCriticalSection(m)
+# define cond_init(c) InitializeConditionVariable(c)
+# define cond_destroy(c) ((void)(c))
+# define cond_broadcast(c) WakeAllConditionVariable(c)
+# define cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+# define thread_detach(t) CloseHandle(t)
+#else
+# include <pthread.h>
+# include <sys/time.h>
+# define THREAD_LOCAL __thread
+typedef pthread_t thread_handle;
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+# define THREAD_FUNC void *
+# define THREAD_RETURN NULL
+# define mutex_init(m) pthread_mutex_init(m, NULL)
+# define mutex_destroy(m) pthread_mutex_destroy(m)
+# define mutex_lock(m) pthread_mutex_lock(m)
+# define mutex_unlock(m) pthread_mutex_unlock(m)
+# define cond_init(c) pthread_cond_init(c, NULL)
+# define cond_destroy(c) pthread_cond_destroy(c)
+# define cond_broadcast(c) pthread_cond_broadcast(c)
+# define cond_wait(c, m) pthread_cond_wait(c, m)
+# define thread_detach(t) pthread_detach(t)
+#endif
+
+/* wall-clock time in milliseconds, from an arbitrary origin */
+static inline unsigned long long thread_now_ms(void)
+{
+#ifdef _MSC_VER
+	return GetTickCount64();
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec*1000U + tv.tv_usec/1000U;
+#endif
+}
+
+/* wait on c (with m locked) until signaled, or for at most ms milliseconds */
+static inline void cond_wait_ms(thread_cond *c, thread_mutex *m, unsigned long long ms)
+{
+#ifdef _MSC_VER
+	SleepConditionVariableCS(c, m, (DWORD)ms);
+#else
+	struct timeval tv;
+	struct timespec ts;
+	gettimeofday(&tv, NULL);
+	ms += tv.tv_usec/1000U;
+	ts.tv_sec = tv.tv_sec + (time_t)(ms/1000U);
+	ts.tv_nsec = (long)(ms%1000U)*1000000L + (long)(tv.tv_usec%1000U)*1000L;
+	pthread_cond_timedwait(c, m, &ts);
+#endif
+}
+
+typedef void (*job_func)(void *job);
+
+/* State shared by all the workers of a pool: each worker picks the next
+ * job to run from the jobs array, until all jobs have been taken
+ */
+struct job_pool {
+	job_func func;
+	char *jobs;
+	size_t job_sz;
+	size_t num_jobs;
+	size_t next;
+	thread_mutex lock;
+};
+
+THREAD_FUNC job_worker(void *arg)
+{
+	struct job_pool *pool = arg;
+	for (;;) {
+		size_t j;
+		mutex_lock(&pool->lock);
+		j = pool->next++;
+		mutex_unlock(&pool->lock);
+		if (j >= pool->num_jobs)
+			break;
+		pool->func(pool->jobs + j*pool->job_sz);
+	}
+	return THREAD_RETURN;
+}
+
+/* Run func on each of the num_jobs elements of size job_sz in jobs,
+ * using up to num_threads concurrent threads, and wait for all of them
+ * to complete. With a single thread (or a single job) everything is run
+ * sequentially in the calling thread; the same happens if no thread can be
+ * started.
+ */
+void run_jobs(job_func func, void *jobs, size_t job_sz, size_t num_jobs, size_t num_threads)
+{
+	struct job_pool pool;
+	thread_handle *thread = NULL;
+	size_t t, started = 0;
+
+	pool.func = func;
+	pool.jobs = jobs;
+	pool.job_sz = job_sz;
+	pool.num_jobs = num_jobs;
+	pool.next = 0;
+
+	if (num_threads > num_jobs)
+		num_threads = num_jobs;
+
+	if (num_threads < 2) {
+		for (t = 0; t < num_jobs; ++t)
+			func(pool.jobs + t*job_sz);
+		return;
+	}
+
+	/* the calling thread is one of the num_threads */
+	mutex_init(&pool.lock);
+	ALLOC(thread, num_threads - 1, "worker threads");
+	for (t = 0; t < num_threads - 1; ++t) {
+#ifdef _MSC_VER
+		thread[started] = CreateThread(NULL, 0, job_worker, &pool, 0, NULL);
+		if (thread[started] == NULL)
+			break;
+#else
+		if (pthread_create(thread + started, NULL, job_worker, &pool))
+			break;
+#endif
+		++started;
+	}
+	/* the calling thread always helps out, which also guarantees
+	 * progress if we failed to start any worker */
+	job_worker(&pool);
+	for (t = 0; t < started; ++t) {
+#ifdef _MSC_VER
+		WaitForSingleObject(thread[t], INFINITE);
+		CloseHandle(thread[t]);
+#else
+		pthread_join(thread[t], NULL);
+#endif
+	}
+	free(thread);
+	mutex_destroy(&pool.lock);
+}
+
+/* State shared by the caller of run_jobs_deadline and the job threads; since timed out
+ * threads are abandoned, it is freed by whoever is the last to leave */
+struct deadline_pool {
+	job_func func;
+	char *jobs;
+	size_t job_sz;
+	unsigned char *done; /* per job */
+	size_t refs; /* the caller and the running threads */
+	thread_mutex lock;
+	thread_cond cond;
+};
+
+struct deadline_arg {
+	struct deadline_pool *pool;
+	size_t j;
+};
+
+static void deadline_pool_release(struct deadline_pool *pool)
+{
+	size_t refs;
+	mutex_lock(&pool->lock);
+	refs = --pool->refs;
+	mutex_unlock(&pool->lock);
+	if (refs)
+		return;
+	cond_destroy(&pool->cond);
+	mutex_destroy(&pool->lock);
+	free(pool->done);
+	free(pool);
+}
+
+THREAD_FUNC deadline_worker(void *arg)
+{
+	struct deadline_arg *a = arg;
+	struct deadline_pool *pool = a->pool;
+	const size_t j = a->j;
+	free(a);
+	pool->func(pool->jobs + j*pool->job_sz);
+	mutex_lock(&pool->lock);
+	pool->done[j] = 1;
+	cond_broadcast(&pool->cond);
+	mutex_unlock(&pool->lock);
+	deadline_pool_release(pool);
+	return THREAD_RETURN;
+}
+
+/* Run func on each of the num_jobs elements of size job_sz in jobs, like run_jobs,
+ * but stop waiting for a job timeout_ms milliseconds after it was started, and mark it
+ * in the timed_out array. Each job runs on its own thread, with up to num_threads
+ * running at a time (not counting the abandoned ones). The thread of a job that timed
+ * out is left running, so the caller must never touch (or free) the data of that job
+ * afterwards. Returns the number of jobs that timed out.
+ */
+size_t run_jobs_deadline(job_func func, void *jobs, size_t job_sz, size_t num_jobs,
+	size_t num_threads, unsigned long long timeout_ms, unsigned char *timed_out)
+{
+	struct deadline_pool *pool;
+	unsigned long long *started_at = NULL;
+	unsigned char *running = NULL;
+	size_t next = 0, num_running = 0, resolved = 0, num_timed_out = 0, j;
+
+	memset(timed_out, 0, num_jobs);
+	ALLOC(pool, 1, "deadline pool");
+	ALLOC(pool->done, num_jobs, "deadline pool jobs");
+	ALLOC(started_at, num_jobs, "deadline pool start times");
+	ALLOC(running, num_jobs, "deadline pool running jobs");
+	pool->func = func;
+	pool->jobs = jobs;
+	pool->job_sz = job_sz;
+	pool->refs = 1;
+	mutex_init(&pool->lock);
+	cond_init(&pool->cond);
+	if (num_threads < 1)
+		num_threads = 1;
+
+	mutex_lock(&pool->lock);
+	while (resolved < num_jobs) {
+		unsigned long long now, wait_ms = timeout_ms;
+		thread_handle thread;
+		struct deadline_arg *arg;
+		int ok;
+
+		while (next < num_jobs && num_running < num_threads) {
+			ALLOC(arg, 1, "deadline job");
+			arg->pool = pool;
+			arg->j = next;
+			++pool->refs;
+#ifdef _MSC_VER
+			thread = CreateThread(NULL, 0, deadline_worker, arg, 0, NULL);
+			ok = thread != NULL;
+#else
+			ok = !pthread_create(&thread, NULL, deadline_worker, arg);
+#endif
+			if (!ok) {
+				/* no deadline if no thread can be started */
+				--pool->refs;
+				free(arg);
+				mutex_unlock(&pool->lock);
+				func(pool->jobs + next*job_sz);
+				mutex_lock(&pool->lock);
+				++resolved;
+				++next;
+				continue;
+			}
+			thread_detach(thread);
+			running[next] = 1;
+			started_at[next] = thread_now_ms();
+			++num_running;
+			++next;
+		}
+
+		now = thread_now_ms();
+		for (j = 0; j < next; ++j) {
+			if (!running[j])
+				continue;
+			if (pool->done[j] || now - started_at[j] >= timeout_ms) {
+				if (!pool->done[j]) {
+					timed_out[j] = 1;
+					++num_timed_out;
+				}
+				running[j] = 0;
+				--num_running;
+				++resolved;
+			} else if (started_at[j] + timeout_ms - now < wait_ms) {
+				wait_ms = started_at[j] + timeout_ms - now;
+			}
+		}
+		/* wait for a job to finish, or for the earliest deadline */
+		if (num_running && (next == num_jobs || num_running == num_threads))
+			cond_wait_ms(&pool->cond, &pool->lock, wait_ms);
+	}
+	mutex_unlock(&pool->lock);
+
+	free(running);
+	free(started_at);
+	deadline_pool_release(pool);
+	return num_timed_out;
+}
+
+#endif
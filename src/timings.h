@@ -0,0 +1,156 @@
+/* Timing instrumentation (--timings): the wall time spent on each
+ * platform and device property, and on the major phases of the run,
+ * is recorded so that slow driver queries can be identified
+ */
+
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef _MSC_VER
+# include <sys/time.h>
+#endif
+
+#include "ext.h"
+#include "memory.h"
+#include "opt_out.h"
+#include "threads.h"
+
+enum timing_kind {
+	TIMING_PHASE,
+	TIMING_PROP
+};
+
+struct timing_rec {
+	enum timing_kind kind;
+	const char *name; /* not copied, must be a static string */
+	cl_int p; /* platform index, or -1 if not specific to a platform */
+	cl_int d; /* device index, or -1 if not specific to a device */
+	cl_bool offline; /* d is the index of an offline device */
+	cl_ulong ns;
+};
+
+/* Platform and device the recorded timings refer to, for the current thread */
+struct timing_ctx {
+	cl_int p;
+	cl_int d;
+	cl_bool offline;
+};
+
+THREAD_LOCAL struct timing_ctx timing_ctx = { -1, -1, CL_FALSE };
+
+struct timing_rec *timings;
+size_t num_timings, alloced_timings;
+thread_mutex timings_lock;
+
+static inline void set_timing_ctx(cl_int p, cl_int d, cl_bool offline)
+{
+	timing_ctx.p = p;
+	timing_ctx.d = d;
+	timing_ctx.offline = offline;
+}
+
+/* current time in nanoseconds, from an arbitrary origin */
+static inline cl_ulong timer_ns(void)
+{
+#if defined _MSC_VER
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (cl_ulong)(count.QuadPart*(1.0e9/freq.QuadPart));
+#elif defined CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (cl_ulong)ts.tv_sec*1000000000U + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (cl_ulong)tv.tv_sec*1000000000U + (cl_ulong)tv.tv_usec*1000U;
+#endif
+}
+
+/* sleep for (at least) the given number of nanoseconds */
+static inline void timer_sleep_ns(cl_ulong ns)
+{
+#if defined _MSC_VER
+	Sleep((DWORD)(ns/1000000));
+#else
+	struct timespec ts;
+	ts.tv_sec = (time_t)(ns/1000000000U);
+	ts.tv_nsec = (long)(ns%1000000000U);
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+#endif
+}
+
+/* Wait for the next tick of a schedule with the given period, *next being
+ * the previous one: the schedule is kept regardless of how long the work
+ * between the ticks took, and restarted from now if the tick has already passed */
+static inline void timer_wait_next(cl_ulong *next, cl_ulong period)
+{
+	const cl_ulong now = timer_ns();
+	*next += period;
+	if (now < *next)
+		timer_sleep_ns(*next - now);
+	else
+		*next = now;
+}
+
+void timings_add(enum timing_kind kind, const char *name, cl_ulong ns)
+{
+	struct timing_rec *rec;
+	mutex_lock(&timings_lock);
+	if (num_timings == alloced_timings) {
+		alloced_timings = alloced_timings ? 2*alloced_timings : 256;
+		REALLOC(timings, alloced_timings, "timings");
+	}
+	rec = timings + num_timings++;
+	rec->kind = kind;
+	rec->name = name;
+	rec->p = timing_ctx.p;
+	rec->d = timing_ctx.d;
+	rec->offline = timing_ctx.offline;
+	rec->ns = ns;
+	mutex_unlock(&timings_lock);
+}
+
+/* Start and stop timing something: these are no-ops unless --timings was specified */
+static inline cl_ulong timing_start(const struct opt_out *output)
+{
+	return output->timings ? timer_ns() : 0;
+}
+
+static inline void timing_stop(const struct opt_out *output,
+	enum timing_kind kind, const char *name, cl_ulong start)
+{
+	if (output->timings)
+		timings_add(kind, name, timer_ns() - start);
+}
+
+/* sort callback: slowest first */
+int timings_cmp(const void *a, const void *b)
+{
+	const struct timing_rec *ta = a;
+	const struct timing_rec *tb = b;
+	return (ta->ns < tb->ns) - (ta->ns > tb->ns);
+}
+
+void timings_init(void)
+{
+	timings = NULL;
+	num_timings = alloced_timings = 0;
+	mutex_init(&timings_lock);
+}
+
+void timings_free(void)
+{
+	free(timings);
+	timings = NULL;
+	num_timings = alloced_timings = 0;
+	mutex_destroy(&timings_lock);
+}
+
+#endif